@@ -0,0 +1,391 @@
+#include "MKIImage.h"
+#include "MKIHistogram.h"
+#include "MKIImageConstants.h"
+#include "MKIImageFuncs.h"
+#include "MKIMask.h"
+#include "MKIMetrics.h"
+#include "MKIPerceptualHash.h"
+#include "MKITaskGraph.h"
+#include "MKIThreadPool.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+
+/*
+	Benchmarks for MKImageLib.
+
+	Every benchmark takes two arguments: the image side length (256 to 8192) and the number of
+	threads in the library's ThreadPool (1 to all hardware threads). items_per_second is pixels/s,
+	bytes_per_second counts pixel data (or file bytes for load/save).
+
+	Write JSON to diff results across releases:
+		bench --benchmark_out=results.json --benchmark_out_format=json
+	Narrow the sweep with a filter, e.g. --benchmark_filter='Mask/SMOOTH_3X3/size:1024/'
+
+	--pin_threads pins the pool's workers node by node (ThreadPool::setPinned). To see the effect of
+	NUMA placement on a single-node machine, split it with the kernel's NUMA emulation (boot with
+	numa=fake=2) and compare runs with and without the flag, and against a run under
+	numactl --membind=1 --cpunodebind=0, where every access is remote.
+*/
+
+namespace {
+	using namespace MKImage;
+	namespace FS = std::filesystem;
+
+	constexpr size_t MIN_SIZE = 256;
+	constexpr size_t MAX_SIZE = 8192;
+
+	// A deterministic test card: diagonal gradient plus a little texture.
+	const Image& sourceImage(size_t size) {
+		static std::map<size_t, std::unique_ptr<Image>> images;
+
+		auto& image = images[size];
+		if (!image) {
+			ImageData data(size, std::vector<short>(size));
+			for (size_t i = 0; i < size; ++i) {
+				for (size_t j = 0; j < size; ++j) {
+					data[i][j] = static_cast<short>(((i + j) * 255 / (2 * size) + (i * 7 + j * 13) % 31) % 256);
+				}
+			}
+			image = std::make_unique<Image>(std::move(data), 255);
+		}
+		return *image;
+	}
+
+	size_t imageSize(const benchmark::State& state) {
+		return static_cast<size_t>(state.range(0));
+	}
+
+	void setThreads(const benchmark::State& state) {
+		ThreadPool::instance().setThreadCount(static_cast<size_t>(state.range(1)));
+	}
+
+	void setCounters(benchmark::State& state, size_t pixels, size_t bytes) {
+		state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * pixels));
+		state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+	}
+
+	// size x threads sweep shared by every benchmark
+	void sweep(benchmark::internal::Benchmark* b) {
+		size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+
+		b->ArgNames({ "size", "threads" });
+		for (size_t size = MIN_SIZE; size <= MAX_SIZE; size *= 2) {
+			for (size_t threads = 1; threads < hardware; threads *= 2) {
+				b->Args({ static_cast<int64_t>(size), static_cast<int64_t>(threads) });
+			}
+			b->Args({ static_cast<int64_t>(size), static_cast<int64_t>(hardware) });
+		}
+		b->UseRealTime();
+		b->Unit(benchmark::kMillisecond);
+	}
+
+	std::string fileName(size_t size, FileType type) {
+		return "bench_" + std::to_string(size) + "_" + type.toString() + ".pgm";
+	}
+
+	/* #################### File I/O #################### */
+
+	void BM_Load(benchmark::State& state, FileType type) {
+		setThreads(state);
+
+		size_t size = imageSize(state);
+		Image image(ImageData(sourceImage(size).data()), 255, type);
+		image.save(fileName(size, type));
+
+		FS::path file = FS::absolute(FS::path(Consts::OUTPUT_FOLDER) / fileName(size, type));
+
+		for (auto _ : state) {
+			Image loaded(file.string());
+			benchmark::DoNotOptimize(loaded.data().data());
+		}
+
+		setCounters(state, size * size, FS::file_size(file));
+	}
+
+	void BM_Save(benchmark::State& state, FileType type) {
+		setThreads(state);
+
+		size_t size = imageSize(state);
+		Image image(ImageData(sourceImage(size).data()), 255, type);
+
+		for (auto _ : state) {
+			image.save(fileName(size, type));
+		}
+
+		setCounters(state, size * size, FS::file_size(FS::path(Consts::OUTPUT_FOLDER) / fileName(size, type)));
+	}
+
+	/* #################### Processing #################### */
+
+	// Runs "operation" on a fresh copy of the source image each iteration; the copy is not timed.
+	void runOnCopy(benchmark::State& state, const std::function<void(Image&)>& operation, size_t outputPixels) {
+		setThreads(state);
+
+		size_t size = imageSize(state);
+		const Image& source = sourceImage(size);
+
+		for (auto _ : state) {
+			state.PauseTiming();
+			Image image(source);
+			state.ResumeTiming();
+
+			operation(image);
+			benchmark::DoNotOptimize(image.data().data());
+		}
+
+		setCounters(state, outputPixels, size * size * sizeof(short));
+	}
+
+	void BM_Scaling(benchmark::State& state, Image::ScalingOps operation) {
+		size_t newSize = imageSize(state) * 3 / 4;
+		runOnCopy(state, [newSize, operation](Image& image) {
+			image.scalingProcessing(newSize, newSize, operation);
+		}, newSize * newSize);
+	}
+
+	void BM_Mask(benchmark::State& state, const Mask* mask) {
+		runOnCopy(state, [mask](Image& image) {
+			image.maskProcessing(*mask);
+		}, imageSize(state) * imageSize(state));
+	}
+
+	void BM_Point(benchmark::State& state, std::function<void(Image&)> operation) {
+		runOnCopy(state, operation, imageSize(state) * imageSize(state));
+	}
+
+	// Whole-image neighbourhood filters other than masks.
+	void BM_Filter(benchmark::State& state, std::function<void(Image&)> operation) {
+		runOnCopy(state, operation, imageSize(state) * imageSize(state));
+	}
+
+	void BM_Frame(benchmark::State& state, Image::FrameOps operation) {
+		Image other(sourceImage(imageSize(state)));
+		runOnCopy(state, [&other, operation](Image& image) {
+			image.frameProcessing(other, operation);
+		}, imageSize(state) * imageSize(state));
+	}
+
+	void BM_Histogram(benchmark::State& state) {
+		setThreads(state);
+
+		size_t size = imageSize(state);
+		const Image& source = sourceImage(size);
+
+		for (auto _ : state) {
+			MKIHistogram histogram(source);
+			benchmark::DoNotOptimize(histogram.data().data());
+		}
+
+		setCounters(state, size * size, size * size * sizeof(short));
+	}
+
+	// Compares the source with a blurred copy, as when checking an approximate path.
+	void BM_Metric(benchmark::State& state, double (*metric)(const Image&, const Image&)) {
+		setThreads(state);
+
+		size_t size = imageSize(state);
+		const Image& source = sourceImage(size);
+		Image blurred(source);
+		blurred.maskProcessing(Mask::GAUSSIAN_BLUR_3X3);
+
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(metric(source, blurred));
+		}
+
+		setCounters(state, size * size, 2 * size * size * sizeof(short));
+	}
+
+	// Distance to the objects of the thresholded test card.
+	void BM_Distance(benchmark::State& state) {
+		setThreads(state);
+
+		size_t size = imageSize(state);
+		Image mask(sourceImage(size));
+		mask.pointProcessing(GS::blackAndWhite, mask.depth());
+
+		for (auto _ : state) {
+			auto map = mask.distanceTransform(Image::DistanceTarget::nonZero);
+			benchmark::DoNotOptimize(map.values.data());
+		}
+
+		setCounters(state, size * size, size * size * sizeof(short));
+	}
+
+	// Both perceptual hashes of the test card, as computed per file by PerceptualHash::hashFiles.
+	void BM_PerceptualHash(benchmark::State& state) {
+		setThreads(state);
+
+		size_t size = imageSize(state);
+		const Image& image = sourceImage(size);
+
+		for (auto _ : state) {
+			benchmark::DoNotOptimize(PerceptualHash::difference(image));
+			benchmark::DoNotOptimize(PerceptualHash::dct(image));
+		}
+
+		setCounters(state, size * size, size * size * sizeof(short));
+	}
+
+	// A fan-out recipe as a TaskGraph: an equalised preview, an edge map and three thumbnails of one image.
+	void BM_TaskGraph(benchmark::State& state) {
+		setThreads(state);
+
+		size_t size = imageSize(state);
+		TaskGraph graph;
+		TaskGraph::NodeId source = graph.input(sourceImage(size));
+		graph.add(graph.scale(source, size / 2, size / 2, Image::ScalingOps::bilinear), [](Image& image) {
+			MKIHistogram histogram(image);
+			histogram.makeEqualized();
+			image.pointProcessing(GS::histogramTransformation, histogram, image.depth());
+		}, "equalize");
+		graph.mask(source, Mask::EDGE_LAPLACIAN_3X3);
+		for (size_t side : { size / 16, size / 8, size / 4 }) {
+			graph.scale(source, side, side, Image::ScalingOps::lanczos2);
+		}
+
+		for (auto _ : state) {
+			graph.run();
+		}
+
+		setCounters(state, size * size, size * size * sizeof(short));
+	}
+}
+
+BENCHMARK_CAPTURE(BM_Load, P2, FileType(FileType::P2))->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Load, P5, FileType(FileType::P5))->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Save, P2, FileType(FileType::P2))->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Save, P5, FileType(FileType::P5))->Apply(sweep);
+
+BENCHMARK_CAPTURE(BM_Scaling, nearestNeighbor, Image::ScalingOps::nearestNeighbor)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Scaling, bilinear, Image::ScalingOps::bilinear)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Scaling, bicubic, Image::ScalingOps::bicubic)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Scaling, lanczos2, Image::ScalingOps::lanczos2)->Apply(sweep);
+
+BENCHMARK_CAPTURE(BM_Mask, SMOOTH_3X3, &Mask::SMOOTH_3X3)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, SMOOTH_5X5, &Mask::SMOOTH_5X5)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, SMOOTH_9X9, &Mask::SMOOTH_9X9)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, BLUR_5X5, &Mask::BLUR_5X5)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, GAUSSIAN_BLUR_3X3, &Mask::GAUSSIAN_BLUR_3X3)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, GAUSSIAN_BLUR_5X5, &Mask::GAUSSIAN_BLUR_5X5)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, HEDGED_LAPLACIAN_3X3, &Mask::HEDGED_LAPLACIAN_3X3)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, HEDGED_LAPLACIAN_5X5, &Mask::HEDGED_LAPLACIAN_5X5)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, GAUSSIAN_HEDGED_LAPLACIAN_5X5, &Mask::GAUSSIAN_HEDGED_LAPLACIAN_5X5)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, EDGE_LAPLACIAN_3X3, &Mask::EDGE_LAPLACIAN_3X3)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, EDGE_LAPLACIAN_5X5, &Mask::EDGE_LAPLACIAN_5X5)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, HARD_EDGE_LAPLACIAN_5X5, &Mask::HARD_EDGE_LAPLACIAN_5X5)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Mask, HARD_EDGE_LAPLACIAN_9X9, &Mask::HARD_EDGE_LAPLACIAN_9X9)->Apply(sweep);
+
+BENCHMARK_CAPTURE(BM_Filter, guided, [](Image& image) {
+	image.guidedProcessing(8, 0.01);
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Filter, bilateralDirect, [](Image& image) {
+	image.bilateralProcessing(1.0, 20.0);
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Filter, bilateralGrid, [](Image& image) {
+	image.bilateralProcessing(8.0, 20.0);
+})->Apply(sweep);
+
+BENCHMARK_CAPTURE(BM_Point, brightness, [](Image& image) {
+	image.pointProcessing(GS::brightness, short(20));
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Point, simpleContrast, [](Image& image) {
+	image.pointProcessing(GS::simpleContrast, short(64), short(192), 0.8, 1.2);
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Point, linearTransformation, [](Image& image) {
+	image.pointProcessing(GS::linearTransformation, image.minValue(), image.maxValue(), short(0), image.depth());
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Point, logarithmicTransformation, [](Image& image) {
+	image.pointProcessing(GS::logarithmicTransformation, Math::logTransC(image.depth()));
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Point, gammaTransformation, [](Image& image) {
+	image.pointProcessing(GS::gammaTransformation, short(1), 0.9);
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Point, exponentialTransformation, [](Image& image) {
+	image.pointProcessing(GS::exponentialTransformation, Math::exponTransA(image.depth()));
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Point, sigmoidTransformation, [](Image& image) {
+	image.pointProcessing(GS::sigmoidTransformation, static_cast<double>(image.depth()), 10.0, 0.5);
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Point, altSigmoidTransformation, [](Image& image) {
+	image.pointProcessing(GS::altSigmoidTransformation, 0.5);
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Point, negative, [](Image& image) {
+	image.pointProcessing(GS::negative, image.depth());
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Point, blackAndWhite, [](Image& image) {
+	image.pointProcessing(GS::blackAndWhite, image.depth());
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Point, histogramTransformation, [](Image& image) {
+	MKIHistogram histogram(image);
+	histogram.makeEqualized();
+	image.pointProcessing(GS::histogramTransformation, histogram, image.depth());
+})->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Point, gammaTransformationLut, [](Image& image) {
+	image.lutProcessing(image.makeLut(GS::gammaTransformation, short(1), 0.9));
+})->Apply(sweep);
+// Brightness followed by the histogram of the result, counted in the same pass.
+BENCHMARK_CAPTURE(BM_Point, brightnessWithHistogram, [](Image& image) {
+	MKIHistogram histogram;
+	image.pointProcessing(histogram, GS::brightness, short(20));
+	benchmark::DoNotOptimize(histogram.average());
+})->Apply(sweep);
+
+BENCHMARK_CAPTURE(BM_Frame, add, Image::FrameOps::add)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Frame, sub, Image::FrameOps::sub)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Frame, mult, Image::FrameOps::mult)->Apply(sweep);
+
+BENCHMARK(BM_Histogram)->Apply(sweep);
+
+BENCHMARK_CAPTURE(BM_Metric, psnr, &Metrics::psnr)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Metric, ssim, &Metrics::ssim)->Apply(sweep);
+BENCHMARK_CAPTURE(BM_Metric, msSsim, &Metrics::msSsim)->Apply(sweep);
+
+BENCHMARK(BM_Distance)->Apply(sweep);
+
+BENCHMARK(BM_PerceptualHash)->Apply(sweep);
+
+BENCHMARK(BM_TaskGraph)->Apply(sweep);
+
+int main(int argc, char** argv) {
+	// Image::save() writes next to the image's source, i.e. ./out for generated images.
+	// Run in a scratch directory, resolving --benchmark_out against the caller's directory first.
+	std::vector<std::string> args(argv, argv + argc);
+	const std::string outFlag = "--benchmark_out=";
+	const std::string pinFlag = "--pin_threads";
+	for (auto& arg : args) {
+		if (arg.compare(0, outFlag.size(), outFlag) == 0) {
+			arg = outFlag + FS::absolute(arg.substr(outFlag.size())).string();
+		}
+	}
+	auto pin = std::find(args.begin(), args.end(), pinFlag);
+	if (pin != args.end()) {
+		args.erase(pin);
+		ThreadPool::instance().setPinned(true);
+	}
+	std::vector<char*> argPointers;
+	for (auto& arg : args) {
+		argPointers.push_back(arg.data());
+	}
+	int argCount = static_cast<int>(argPointers.size());
+
+	FS::path workDir = FS::temp_directory_path() / "mkimage_bench";
+	FS::create_directories(workDir);
+	FS::current_path(workDir);
+
+	benchmark::Initialize(&argCount, argPointers.data());
+	if (benchmark::ReportUnrecognizedArguments(argCount, argPointers.data())) {
+		return 1;
+	}
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+
+	return 0;
+}
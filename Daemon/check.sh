@@ -0,0 +1,58 @@
+#!/bin/sh
+# Smoke check for mkid: jobs that fail are answered with "error" and counted, and the daemon
+# goes on serving. Usage: check.sh MKID MKIC IMAGE
+set -u
+
+mkid=$1
+mkic=$2
+image=$3
+
+work=$(mktemp -d)
+socket=$work/mkid.sock
+daemon=
+trap '[ -n "$daemon" ] && kill $daemon 2>/dev/null; wait $daemon 2>/dev/null; rm -rf "$work"' EXIT
+
+# A path that is not a socket is refused rather than replaced.
+echo keep > "$work/file"
+"$mkid" "$work/file" > "$work/refused.log" 2>&1 &
+refused=$!
+tries=0
+while kill -0 $refused 2>/dev/null && [ $tries -lt 50 ]; do
+    tries=$((tries + 1))
+    sleep 0.1
+done
+if kill -0 $refused 2>/dev/null || [ "$(cat "$work/file")" != keep ]; then
+    kill $refused 2>/dev/null
+    echo "check: mkid replaced a regular file"; exit 1
+fi
+
+"$mkid" "$socket" --workers 1 --threads 2 > "$work/mkid.log" 2>&1 &
+daemon=$!
+
+tries=0
+while [ ! -S "$socket" ]; do
+    tries=$((tries + 1))
+    if [ $tries -gt 100 ] || ! kill -0 $daemon 2>/dev/null; then
+        echo "check: mkid did not start"; cat "$work/mkid.log"; exit 1
+    fi
+    sleep 0.1
+done
+
+# One job the recipe parser rejects and one whose input the worker cannot load.
+if "$mkic" "$socket" job "$image" "$work/rejected.pgm" "mask nosuchmask" 2> "$work/error.txt"; then
+    echo "check: the rejected recipe was answered ok"; exit 1
+fi
+printf 'not an image\n' > "$work/bad.pgm"
+if "$mkic" "$socket" job "$work/bad.pgm" "$work/bad_out.pgm" "mask smooth3" 2> "$work/error.txt"; then
+    echo "check: the unreadable input was answered ok"; exit 1
+fi
+if ! kill -0 $daemon 2>/dev/null; then
+    echo "check: mkid died on a failing job"; cat "$work/mkid.log"; exit 1
+fi
+
+if ! "$mkic" "$socket" job "$image" "$work/out.pgm" "mask smooth3" || [ ! -s "$work/out.pgm" ]; then
+    echo "check: mkid stopped serving after the failing jobs"; exit 1
+fi
+"$mkic" "$socket" stats | grep -q "failed 2" || { echo "check: the failures were not counted"; exit 1; }
+
+echo "check: ok"
@@ -0,0 +1,166 @@
+#include "Latency.h"
+#include "Protocol.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+	namespace FS = std::filesystem;
+	using namespace MKImage::Daemon;
+	using Clock = std::chrono::steady_clock;
+
+	void usage() {
+		std::cerr << "usage: mkic SOCKET stats\n"
+					 "       mkic SOCKET job INPUT OUTPUT RECIPE\n"
+					 "       mkic SOCKET load INPUT OUTPUT_DIR RECIPE [JOBS [CONNECTIONS]]\n";
+	}
+
+	// The daemon does not share our working directory.
+	std::string absolute(const std::string& path) {
+		return FS::absolute(path).lexically_normal().string();
+	}
+
+	int connectOrReport(const std::string& socketPath) {
+		int socket = connectTo(socketPath);
+		if (socket < 0) {
+			std::cerr << "mkic: cannot connect to " << socketPath << ": " << std::strerror(errno) << "\n";
+		}
+		return socket;
+	}
+
+	// Sends "request" and prints the reply. Returns the exit status.
+	int single(const std::string& socketPath, const Message& request) {
+		int socket = connectOrReport(socketPath);
+		if (socket < 0) {
+			return 1;
+		}
+
+		Message response;
+		bool ok = sendMessage(socket, request) && receiveMessage(socket, response) && response.size() == 2;
+		close(socket);
+		if (!ok) {
+			std::cerr << "mkic: no reply\n";
+			return 1;
+		}
+
+		(response[0] == OK ? std::cout : std::cerr) << response[1] << (response[1].empty() || response[1].back() == '\n' ? "" : "\n");
+		return response[0] == OK ? 0 : 1;
+	}
+
+	/*
+		Runs "jobs" jobs over "connections" connections, each sending its next job as soon as the
+		previous one is answered, and reports throughput and the latency seen by the client.
+	*/
+	int load(const std::string& socketPath, const std::string& input, const std::string& outputDirectory,
+			 const std::string& recipe, size_t jobs, size_t connections) {
+		std::error_code ignored;
+		FS::create_directories(outputDirectory, ignored);
+
+		std::string extension = FS::path(input).extension().string();
+		std::atomic<size_t> next{ 0 };
+		std::atomic<size_t> failed{ 0 };
+		std::mutex mutex;
+		std::vector<double> latencies;
+		std::string firstError;
+
+		auto client = [&]() {
+			int socket = connectOrReport(socketPath);
+			if (socket < 0) {
+				return;
+			}
+
+			for (size_t job = next++; job < jobs; job = next++) {
+				std::string output = (FS::path(outputDirectory) / ("job" + std::to_string(job) + extension)).string();
+
+				Clock::time_point sent = Clock::now();
+				Message response;
+				if (!sendMessage(socket, { JOB, input, output, recipe }) || !receiveMessage(socket, response) ||
+					response.size() != 2) {
+					failed++;
+					break;
+				}
+				std::chrono::duration<double, std::milli> latency = Clock::now() - sent;
+
+				std::lock_guard<std::mutex> lock(mutex);
+				latencies.push_back(latency.count());
+				if (response[0] != OK) {
+					failed++;
+					if (firstError.empty()) {
+						firstError = response[1];
+					}
+				}
+			}
+			close(socket);
+		};
+
+		Clock::time_point start = Clock::now();
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < connections; ++i) {
+			threads.emplace_back(client);
+		}
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+
+		std::cout << std::fixed << std::setprecision(2);
+		std::cout << latencies.size() << " jobs over " << connections << " connections in " << elapsed.count()
+				  << " s, " << latencies.size() / elapsed.count() << " jobs/s, " << failed.load() << " failed\n";
+		std::cout << "client latency ms p50 " << percentile(latencies, 0.50) << " p90 " << percentile(latencies, 0.90)
+				  << " p99 " << percentile(latencies, 0.99) << " max " << percentile(latencies, 1.0) << "\n";
+		if (!firstError.empty()) {
+			std::cout << "first error: " << firstError << "\n";
+		}
+
+		std::cout << "\nserver:\n";
+		int status = single(socketPath, { STATS });
+		return failed.load() == 0 ? status : 1;
+	}
+}
+
+/*
+	mkic: a small client for mkid, for scripts and for load testing, e.g.
+
+		mkic /tmp/mkid.sock job img/lena512_PGM.pgm /tmp/out.pgm "scale 1024 1024 bicubic; gamma 0.8"
+		mkic /tmp/mkid.sock load img/lena512_PGM.pgm /tmp/out "guided 4 0.01" 500 8
+*/
+int main(int argc, char* argv[]) {
+	if (argc < 3) {
+		usage();
+		return 2;
+	}
+
+	std::string socketPath = argv[1];
+	std::string command = argv[2];
+
+	if (command == STATS && argc == 3) {
+		return single(socketPath, { STATS });
+	}
+	if (command == JOB && argc == 6) {
+		return single(socketPath, { JOB, absolute(argv[3]), absolute(argv[4]), argv[5] });
+	}
+	if (command == "load" && argc >= 6 && argc <= 8) {
+		size_t jobs = argc > 6 ? std::strtoul(argv[6], nullptr, 10) : 100;
+		size_t connections = argc > 7 ? std::strtoul(argv[7], nullptr, 10) : 4;
+		if (jobs == 0 || connections == 0) {
+			usage();
+			return 2;
+		}
+		return load(socketPath, absolute(argv[3]), absolute(argv[4]), argv[5], jobs, connections);
+	}
+
+	usage();
+	return 2;
+}
@@ -0,0 +1,130 @@
+#include "Protocol.h"
+#include "Server.h"
+
+#include "MKIBufferPool.h"
+#include "MKIResultCache.h"
+#include "MKIThreadPool.h"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace {
+	std::atomic<bool> stopRequested{ false };
+
+	void requestStop(int) {
+		stopRequested.store(true);
+	}
+
+	void usage() {
+		std::cerr << "usage: mkid SOCKET [--workers N] [--queue N] [--threads N] [--pool-mb N]"
+					 " [--cache-mb N] [--cache-dir DIR]\n";
+	}
+
+	bool parseCount(const char* text, size_t& value) {
+		char* end = nullptr;
+		errno = 0;
+		unsigned long long parsed = std::strtoull(text, &end, 10);
+		if (errno != 0 || end == text || *end != '\0' || text[0] == '-') {
+			return false;
+		}
+		value = static_cast<size_t>(parsed);
+		return true;
+	}
+}
+
+/*
+	mkid: the image-processing daemon. Serves jobs (see Protocol.h) on a Unix domain socket until
+	SIGINT or SIGTERM, keeping the library's pools, plans and caches warm between jobs.
+*/
+int main(int argc, char* argv[]) {
+	using namespace MKImage;
+
+	if (argc < 2) {
+		usage();
+		return 2;
+	}
+
+	std::string socketPath = argv[1];
+	Daemon::Server::Options options;
+	size_t threads = 0;
+	size_t poolMb = BufferPool::DEFAULT_CAPACITY >> 20;
+	size_t cacheMb = 0;
+	std::string cacheDirectory;
+
+	for (int i = 2; i < argc; ++i) {
+		std::string flag = argv[i];
+		if (i + 1 >= argc) {
+			usage();
+			return 2;
+		}
+		const char* value = argv[++i];
+
+		bool ok = true;
+		if (flag == "--workers") {
+			ok = parseCount(value, options.workers) && options.workers > 0;
+		}
+		else if (flag == "--queue") {
+			ok = parseCount(value, options.queueCapacity) && options.queueCapacity > 0;
+		}
+		else if (flag == "--threads") {
+			ok = parseCount(value, threads);
+		}
+		else if (flag == "--pool-mb") {
+			ok = parseCount(value, poolMb);
+		}
+		else if (flag == "--cache-mb") {
+			ok = parseCount(value, cacheMb);
+		}
+		else if (flag == "--cache-dir") {
+			cacheDirectory = value;
+		}
+		else {
+			ok = false;
+		}
+
+		if (!ok) {
+			std::cerr << "mkid: bad option " << flag << " " << value << "\n";
+			usage();
+			return 2;
+		}
+	}
+
+	// Set up before the first job, so even the first one finds the pools at their final size.
+	ThreadPool::instance().setThreadCount(threads);
+	BufferPool::instance().setCapacity(poolMb << 20);
+	ResultCache::instance().setCapacity(cacheMb << 20);
+	ResultCache::instance().setDirectory(cacheDirectory);
+
+	struct sigaction action;
+	std::memset(&action, 0, sizeof(action));
+	action.sa_handler = requestStop;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	int listenSocket = Daemon::listenOn(socketPath, 64);
+	if (listenSocket < 0) {
+		std::cerr << "mkid: cannot listen on " << socketPath << ": " << std::strerror(errno) << "\n";
+		return 1;
+	}
+
+	std::cout << "mkid: listening on " << socketPath << " with " << options.workers << " workers, queue of "
+			  << options.queueCapacity << ", " << ThreadPool::instance().threadCount() << " threads" << std::endl;
+
+	{
+		Daemon::Server server(listenSocket, options);
+		server.run(stopRequested);
+	}
+
+	close(listenSocket);
+	unlink(socketPath.c_str());
+	std::cout << "mkid: stopped" << std::endl;
+	return 0;
+}
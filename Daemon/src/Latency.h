@@ -0,0 +1,47 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace MKImage {
+	namespace Daemon {
+		// The "fraction" (0..1) percentile of "values", nearest rank. 0 for no values.
+		inline double percentile(std::vector<double> values, double fraction) {
+			if (values.empty()) {
+				return 0.0;
+			}
+			size_t rank = static_cast<size_t>(fraction * static_cast<double>(values.size() - 1) + 0.5);
+			std::nth_element(values.begin(), values.begin() + rank, values.end());
+			return values[rank];
+		}
+
+		/*
+			The most recent "capacity" latencies (milliseconds), so the percentiles of a long-running
+			daemon describe the current load rather than its whole lifetime. Not thread-safe.
+		*/
+		class LatencyWindow {
+		public:
+			explicit LatencyWindow(size_t capacity)
+				: m_Values{}, m_Next{ 0 }, m_Capacity{ capacity == 0 ? 1 : capacity } {
+			}
+
+			void add(double milliseconds) {
+				if (m_Values.size() < m_Capacity) {
+					m_Values.push_back(milliseconds);
+				}
+				else {
+					m_Values[m_Next] = milliseconds;
+				}
+				m_Next = (m_Next + 1) % m_Capacity;
+			}
+
+			const std::vector<double>& values() const { return m_Values; }
+
+		private:
+			std::vector<double> m_Values;
+			size_t m_Next;
+			size_t m_Capacity;
+		};
+	}
+}
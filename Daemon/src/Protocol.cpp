@@ -0,0 +1,166 @@
+#include "Protocol.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace MKImage {
+	namespace Daemon {
+		namespace {
+			bool sendAll(int socket, const char* data, size_t bytes) {
+				while (bytes > 0) {
+					// MSG_NOSIGNAL: a client that hung up is an error here, not a SIGPIPE.
+					ssize_t sent = ::send(socket, data, bytes, MSG_NOSIGNAL);
+					if (sent < 0) {
+						if (errno == EINTR) {
+							continue;
+						}
+						return false;
+					}
+					data += sent;
+					bytes -= static_cast<size_t>(sent);
+				}
+				return true;
+			}
+
+			bool receiveAll(int socket, char* data, size_t bytes) {
+				while (bytes > 0) {
+					ssize_t received = ::recv(socket, data, bytes, 0);
+					if (received < 0 && errno == EINTR) {
+						continue;
+					}
+					if (received <= 0) {
+						return false;
+					}
+					data += received;
+					bytes -= static_cast<size_t>(received);
+				}
+				return true;
+			}
+
+			void putLength(std::string& out, size_t value) {
+				for (int shift = 0; shift < 32; shift += 8) {
+					out.push_back(static_cast<char>((value >> shift) & 0xff));
+				}
+			}
+
+			bool receiveLength(int socket, size_t& value) {
+				std::array<unsigned char, 4> bytes;
+				if (!receiveAll(socket, reinterpret_cast<char*>(bytes.data()), bytes.size())) {
+					return false;
+				}
+				value = static_cast<size_t>(static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8
+											| static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24);
+				return true;
+			}
+
+			bool socketAddress(const std::string& path, sockaddr_un& address) {
+				std::memset(&address, 0, sizeof(address));
+				address.sun_family = AF_UNIX;
+				if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+					errno = ENAMETOOLONG;
+					return false;
+				}
+				std::memcpy(address.sun_path, path.c_str(), path.size());
+				return true;
+			}
+		}
+
+		bool sendMessage(int socket, const Message& message) {
+			if (message.size() > MAX_FIELDS) {
+				return false;
+			}
+
+			// One buffer and one send, so small requests and replies go out as a single packet.
+			std::string bytes;
+			putLength(bytes, message.size());
+			for (const auto& field : message) {
+				if (field.size() > MAX_FIELD_BYTES) {
+					return false;
+				}
+				putLength(bytes, field.size());
+				bytes += field;
+			}
+			return sendAll(socket, bytes.data(), bytes.size());
+		}
+
+		bool receiveMessage(int socket, Message& message) {
+			message.clear();
+
+			size_t fields = 0;
+			if (!receiveLength(socket, fields) || fields > MAX_FIELDS) {
+				return false;
+			}
+
+			message.resize(fields);
+			for (auto& field : message) {
+				size_t bytes = 0;
+				if (!receiveLength(socket, bytes) || bytes > MAX_FIELD_BYTES) {
+					return false;
+				}
+				field.resize(bytes);
+				if (!receiveAll(socket, field.data(), bytes)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		int listenOn(const std::string& path, int backlog) {
+			sockaddr_un address;
+			if (!socketAddress(path, address)) {
+				return -1;
+			}
+
+			int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (socket < 0) {
+				return -1;
+			}
+
+			// Only a stale socket is replaced; anything else at "path" is left alone.
+			struct stat status;
+			if (::lstat(path.c_str(), &status) == 0) {
+				if (!S_ISSOCK(status.st_mode)) {
+					::close(socket);
+					errno = EEXIST;
+					return -1;
+				}
+				::unlink(path.c_str());
+			}
+			if (::bind(socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 ||
+				::listen(socket, backlog) < 0) {
+				int error = errno;
+				::close(socket);
+				errno = error;
+				return -1;
+			}
+			return socket;
+		}
+
+		int connectTo(const std::string& path) {
+			sockaddr_un address;
+			if (!socketAddress(path, address)) {
+				return -1;
+			}
+
+			int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (socket < 0) {
+				return -1;
+			}
+
+			if (::connect(socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+				int error = errno;
+				::close(socket);
+				errno = error;
+				return -1;
+			}
+			return socket;
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace MKImage {
+	namespace Daemon {
+		/*
+			Wire format shared by the daemon (mkid) and its client (mkic).
+
+			A message is a list of byte strings: a little-endian uint32 field count, then each field
+			as a little-endian uint32 length followed by its bytes. Requests are
+
+				"job", input path, output path, recipe	-> "ok" | "error", message
+				"stats"									-> "ok", report
+
+			and a connection can carry any number of requests, each answered before the next is read.
+			Paths must be absolute, since the daemon's working directory is not the client's.
+		*/
+		using Message = std::vector<std::string>;
+
+		// Larger messages are rejected, so a bad peer cannot make the other side allocate at will.
+		constexpr size_t MAX_FIELDS = 16;
+		constexpr size_t MAX_FIELD_BYTES = size_t(1) << 20;
+
+		constexpr char JOB[] = "job";
+		constexpr char STATS[] = "stats";
+		constexpr char OK[] = "ok";
+		constexpr char ERROR[] = "error";
+
+		// False if the peer has gone or the message is malformed.
+		bool sendMessage(int socket, const Message& message);
+		bool receiveMessage(int socket, Message& message);
+
+		// A listening socket bound to "path" (a stale socket file is replaced, any other
+		// file is not), or -1 with errno set.
+		int listenOn(const std::string& path, int backlog);
+		// A socket connected to the daemon at "path", or -1 with errno set.
+		int connectTo(const std::string& path);
+	}
+}
@@ -0,0 +1,303 @@
+#include "Recipe.h"
+
+#include "MKIMultiImage.h"
+#include "MKIHistogram.h"
+#include "MKIImageFuncs.h"
+
+#include <sstream>
+#include <unordered_map>
+
+namespace MKImage {
+	namespace Daemon {
+		namespace {
+			using Step = std::function<void(MultiImage&)>;
+			using Tokens = std::vector<std::string>;
+
+			// Bounds on sizes taken from a request, so a stray digit cannot ask for terabytes.
+			constexpr size_t MAX_SIDE = size_t(1) << 16;
+			constexpr size_t MAX_RADIUS = 1024;
+
+			const std::unordered_map<std::string, const Mask*> MASKS = {
+				{ "smooth3", &Mask::SMOOTH_3X3 },
+				{ "smooth5", &Mask::SMOOTH_5X5 },
+				{ "smooth9", &Mask::SMOOTH_9X9 },
+				{ "blur5", &Mask::BLUR_5X5 },
+				{ "gaussian3", &Mask::GAUSSIAN_BLUR_3X3 },
+				{ "gaussian5", &Mask::GAUSSIAN_BLUR_5X5 },
+				{ "hedged3", &Mask::HEDGED_LAPLACIAN_3X3 },
+				{ "hedged5", &Mask::HEDGED_LAPLACIAN_5X5 },
+				{ "gaussianHedged5", &Mask::GAUSSIAN_HEDGED_LAPLACIAN_5X5 },
+				{ "laplacian3", &Mask::EDGE_LAPLACIAN_3X3 },
+				{ "laplacian5", &Mask::EDGE_LAPLACIAN_5X5 },
+				{ "hardLaplacian5", &Mask::HARD_EDGE_LAPLACIAN_5X5 },
+				{ "hardLaplacian9", &Mask::HARD_EDGE_LAPLACIAN_9X9 },
+			};
+
+			const std::unordered_map<std::string, const StructuringElement*> ELEMENTS = {
+				{ "square3", &StructuringElement::SQUARE_3X3 },
+				{ "square5", &StructuringElement::SQUARE_5X5 },
+				{ "cross3", &StructuringElement::CROSS_3X3 },
+				{ "cross5", &StructuringElement::CROSS_5X5 },
+				{ "disk5", &StructuringElement::DISK_5X5 },
+				{ "disk7", &StructuringElement::DISK_7X7 },
+			};
+
+			const std::unordered_map<std::string, Image::ScalingOps> SCALING = {
+				{ "nearest", Image::ScalingOps::nearestNeighbor },
+				{ "bilinear", Image::ScalingOps::bilinear },
+				{ "bicubic", Image::ScalingOps::bicubic },
+				{ "lanczos2", Image::ScalingOps::lanczos2 },
+			};
+
+			const std::unordered_map<std::string, Image::MorphOps> MORPHOLOGY = {
+				{ "erode", Image::MorphOps::erode },
+				{ "dilate", Image::MorphOps::dilate },
+				{ "open", Image::MorphOps::open },
+				{ "close", Image::MorphOps::close },
+				{ "tophat", Image::MorphOps::topHat },
+				{ "blackhat", Image::MorphOps::blackHat },
+			};
+
+			const std::unordered_map<std::string, Image::GeometricOps> GEOMETRY = {
+				{ "rotate90", Image::GeometricOps::rotate90 },
+				{ "rotate180", Image::GeometricOps::rotate180 },
+				{ "rotate270", Image::GeometricOps::rotate270 },
+				{ "fliph", Image::GeometricOps::flipHorizontal },
+				{ "flipv", Image::GeometricOps::flipVertical },
+				{ "transpose", Image::GeometricOps::transpose },
+			};
+
+			// The whole token as a T, or false.
+			template<typename T>
+			bool number(const std::string& token, T& value) {
+				std::istringstream in(token);
+				in >> value;
+				return !in.fail() && in.eof();
+			}
+
+			// For operations that only exist on Image (or need each channel's own levels).
+			Step perChannel(std::function<void(Image&)> f) {
+				return [f](MultiImage& image) {
+					for (size_t c = 0; c < image.channels(); ++c) {
+						f(image.channel(c));
+					}
+				};
+			}
+
+			bool makeStep(const Tokens& tokens, Step& step, std::string& error) {
+				const std::string& name = tokens[0];
+				size_t arguments = tokens.size() - 1;
+
+				auto expect = [&](size_t count) {
+					if (arguments != count) {
+						error = name + " takes " + std::to_string(count) + " argument" + (count == 1 ? "" : "s");
+						return false;
+					}
+					return true;
+				};
+				auto bad = [&](const std::string& token) {
+					error = name + ": bad argument \"" + token + "\"";
+					return false;
+				};
+
+				if (name == "scale") {
+					size_t width = 0;
+					size_t height = 0;
+					Image::ScalingOps operation = Image::ScalingOps::bilinear;
+					if (arguments != 2 && arguments != 3) {
+						error = "scale takes a width, a height and optionally an interpolation";
+						return false;
+					}
+					if (!number(tokens[1], width) || width == 0 || width > MAX_SIDE) {
+						return bad(tokens[1]);
+					}
+					if (!number(tokens[2], height) || height == 0 || height > MAX_SIDE) {
+						return bad(tokens[2]);
+					}
+					if (arguments == 3) {
+						auto found = SCALING.find(tokens[3]);
+						if (found == SCALING.end()) {
+							return bad(tokens[3]);
+						}
+						operation = found->second;
+					}
+					step = [=](MultiImage& image) { image.scalingProcessing(width, height, operation); };
+				}
+				else if (name == "mask") {
+					if (!expect(1)) {
+						return false;
+					}
+					auto found = MASKS.find(tokens[1]);
+					if (found == MASKS.end()) {
+						return bad(tokens[1]);
+					}
+					const Mask* mask = found->second;
+					step = [mask](MultiImage& image) { image.maskProcessing(*mask); };
+				}
+				else if (name == "brightness") {
+					short delta = 0;
+					if (!expect(1)) {
+						return false;
+					}
+					if (!number(tokens[1], delta)) {
+						return bad(tokens[1]);
+					}
+					step = [delta](MultiImage& image) { image.pointProcessing(GS::brightness, delta); };
+				}
+				else if (name == "stretch") {
+					if (!expect(0)) {
+						return false;
+					}
+					step = perChannel([](Image& channel) {
+						channel.pointProcessing(GS::linearTransformation, channel.minValue(), channel.maxValue(), short(0), channel.depth());
+					});
+				}
+				else if (name == "gamma") {
+					double gamma = 0.0;
+					if (!expect(1)) {
+						return false;
+					}
+					if (!number(tokens[1], gamma) || gamma <= 0.0) {
+						return bad(tokens[1]);
+					}
+					step = [gamma](MultiImage& image) { image.pointProcessing(GS::gammaTransformation, short(1), gamma); };
+				}
+				else if (name == "log") {
+					if (!expect(0)) {
+						return false;
+					}
+					step = perChannel([](Image& channel) {
+						channel.pointProcessing(GS::logarithmicTransformation, Math::logTransC(channel.depth()));
+					});
+				}
+				else if (name == "exp") {
+					if (!expect(0)) {
+						return false;
+					}
+					step = perChannel([](Image& channel) {
+						channel.pointProcessing(GS::exponentialTransformation, Math::exponTransA(channel.depth()));
+					});
+				}
+				else if (name == "negative" || name == "threshold") {
+					if (!expect(0)) {
+						return false;
+					}
+					auto f = name == "negative" ? GS::negative : GS::blackAndWhite;
+					step = perChannel([f](Image& channel) { channel.pointProcessing(f, channel.depth()); });
+				}
+				else if (name == "equalize") {
+					if (!expect(0)) {
+						return false;
+					}
+					step = perChannel([](Image& channel) {
+						MKIHistogram histogram(channel);
+						histogram.makeEqualized();
+						channel.pointProcessing(GS::histogramTransformation, histogram, channel.depth());
+					});
+				}
+				else if (name == "guided") {
+					size_t radius = 0;
+					double epsilon = 0.0;
+					if (!expect(2)) {
+						return false;
+					}
+					if (!number(tokens[1], radius) || radius > MAX_RADIUS) {
+						return bad(tokens[1]);
+					}
+					if (!number(tokens[2], epsilon) || epsilon <= 0.0) {
+						return bad(tokens[2]);
+					}
+					step = [=](MultiImage& image) { image.guidedProcessing(radius, epsilon); };
+				}
+				else if (name == "bilateral") {
+					double spatialSigma = 0.0;
+					double rangeSigma = 0.0;
+					if (!expect(2)) {
+						return false;
+					}
+					if (!number(tokens[1], spatialSigma) || spatialSigma <= 0.0 || spatialSigma > MAX_RADIUS) {
+						return bad(tokens[1]);
+					}
+					if (!number(tokens[2], rangeSigma) || rangeSigma <= 0.0) {
+						return bad(tokens[2]);
+					}
+					step = [=](MultiImage& image) { image.bilateralProcessing(spatialSigma, rangeSigma); };
+				}
+				else if (name == "canny") {
+					short low = 0;
+					short high = 0;
+					if (!expect(2)) {
+						return false;
+					}
+					if (!number(tokens[1], low) || low < 0) {
+						return bad(tokens[1]);
+					}
+					if (!number(tokens[2], high) || high < low) {
+						return bad(tokens[2]);
+					}
+					step = perChannel([=](Image& channel) { channel.cannyProcessing(low, high); });
+				}
+				else if (MORPHOLOGY.count(name) != 0) {
+					if (!expect(1)) {
+						return false;
+					}
+					auto found = ELEMENTS.find(tokens[1]);
+					if (found == ELEMENTS.end()) {
+						return bad(tokens[1]);
+					}
+					const StructuringElement* element = found->second;
+					Image::MorphOps operation = MORPHOLOGY.at(name);
+					step = perChannel([=](Image& channel) { channel.morphologyProcessing(*element, operation); });
+				}
+				else if (GEOMETRY.count(name) != 0) {
+					if (!expect(0)) {
+						return false;
+					}
+					Image::GeometricOps operation = GEOMETRY.at(name);
+					step = perChannel([operation](Image& channel) { channel.geometricProcessing(operation); });
+				}
+				else {
+					error = "unknown operation \"" + name + "\"";
+					return false;
+				}
+				return true;
+			}
+		}
+
+		bool Recipe::parse(const std::string& text, Recipe& recipe, std::string& error) {
+			recipe.m_Steps.clear();
+
+			std::string stepText;
+			std::istringstream steps(text);
+			while (std::getline(steps, stepText, ';')) {
+				std::istringstream lines(stepText);
+				std::string line;
+				while (std::getline(lines, line)) {
+					Tokens tokens;
+					std::istringstream words(line);
+					for (std::string word; words >> word;) {
+						tokens.push_back(word);
+					}
+					if (tokens.empty()) {
+						continue;
+					}
+
+					Step step;
+					if (!makeStep(tokens, step, error)) {
+						error = "step " + std::to_string(recipe.m_Steps.size() + 1) + ": " + error;
+						recipe.m_Steps.clear();
+						return false;
+					}
+					recipe.m_Steps.push_back(std::move(step));
+				}
+			}
+			return true;
+		}
+
+		void Recipe::apply(MultiImage& image) const {
+			for (const auto& step : m_Steps) {
+				step(image);
+			}
+		}
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace MKImage {
+	class MultiImage;
+
+	namespace Daemon {
+		/*
+			A processing pipeline given as text: steps separated by ';' or newlines, each an operation
+			name followed by its arguments, e.g. "scale 512 512 bicubic; guided 4 0.01; gamma 0.8".
+
+				scale W H [nearest|bilinear|bicubic|lanczos2]	mask NAME (smooth3, gaussian5, ...)
+				brightness D	stretch		gamma G		log		exp		negative	threshold	equalize
+				guided RADIUS EPSILON		bilateral SPATIAL_SIGMA RANGE_SIGMA		canny LOW HIGH
+				erode|dilate|open|close|tophat|blackhat ELEMENT (square3, cross5, disk7, ...)
+				rotate90|rotate180|rotate270|fliph|flipv|transpose
+
+			The whole recipe is parsed before any image is touched, so a typo is reported at once
+			instead of after a load. Steps apply to every channel.
+		*/
+		class Recipe {
+		public:
+			// Parses "text" into "recipe". On failure returns false and describes the bad step in "error".
+			static bool parse(const std::string& text, Recipe& recipe, std::string& error);
+
+			size_t steps() const { return m_Steps.size(); }
+			void apply(MultiImage& image) const;
+
+		private:
+			std::vector<std::function<void(MultiImage&)>> m_Steps;
+		};
+	}
+}
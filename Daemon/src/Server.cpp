@@ -0,0 +1,270 @@
+#include "Server.h"
+
+#include "MKIBufferPool.h"
+#include "MKIMultiImage.h"
+#include "MKIResultCache.h"
+#include "MKIThreadPool.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <exception>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+
+namespace MKImage {
+	namespace Daemon {
+		namespace FS = std::filesystem;
+
+		namespace {
+			constexpr int ACCEPT_POLL_MS = 250;
+
+			Message reply(const char* status, const std::string& text) {
+				return { status, text };
+			}
+		}
+
+		Server::Server(int listenSocket, const Options& options)
+			: m_ListenSocket{ listenSocket }, m_Options{ options }, m_Started{ Clock::now() },
+			  m_Connections{}, m_Workers{}, m_Queue{}, m_QueueMutex{}, m_QueueNotEmpty{}, m_QueueNotFull{},
+			  m_Closing{ false }, m_StatsMutex{}, m_Latencies{ options.latencyWindow }, m_Jobs{ 0 }, m_Failed{ 0 },
+			  m_QueueWaits{ 0 } {
+
+			if (m_Options.workers == 0) {
+				m_Options.workers = 1;
+			}
+			if (m_Options.queueCapacity == 0) {
+				m_Options.queueCapacity = 1;
+			}
+
+			for (size_t i = 0; i < m_Options.workers; ++i) {
+				m_Workers.emplace_back(&Server::workerLoop, this);
+			}
+		}
+
+		Server::~Server() {
+			{
+				std::lock_guard<std::mutex> lock(m_QueueMutex);
+				m_Closing = true;
+			}
+			m_QueueNotEmpty.notify_all();
+			m_QueueNotFull.notify_all();
+
+			reapConnections(true);
+			for (auto& worker : m_Workers) {
+				worker.join();
+			}
+		}
+
+		void Server::run(const std::atomic<bool>& stop) {
+			pollfd listening{ m_ListenSocket, POLLIN, 0 };
+
+			while (!stop.load()) {
+				reapConnections(false);
+
+				// Polled with a timeout so a stop request is noticed without a connection arriving.
+				int ready = ::poll(&listening, 1, ACCEPT_POLL_MS);
+				if (ready <= 0 || (listening.revents & POLLIN) == 0) {
+					continue;
+				}
+
+				int socket = ::accept(m_ListenSocket, nullptr, nullptr);
+				if (socket < 0) {
+					continue;
+				}
+
+				m_Connections.emplace_back();
+				Connection& connection = m_Connections.back();
+				connection.socket = socket;
+				connection.thread = std::thread(&Server::serve, this, std::ref(connection));
+			}
+
+			// Stop reading new requests; the ones already read still get their replies.
+			for (auto& connection : m_Connections) {
+				::shutdown(connection.socket, SHUT_RD);
+			}
+			reapConnections(true);
+		}
+
+		void Server::serve(Connection& connection) {
+			Message request;
+			while (receiveMessage(connection.socket, request)) {
+				if (!sendMessage(connection.socket, handle(request))) {
+					break;
+				}
+			}
+			connection.done.store(true);
+		}
+
+		Message Server::handle(const Message& request) {
+			Clock::time_point received = Clock::now();
+
+			if (request.size() == 1 && request[0] == STATS) {
+				return reply(OK, report());
+			}
+			if (request.empty() || request[0] != JOB) {
+				return reply(ERROR, "unknown request");
+			}
+			if (request.size() != 4) {
+				return reply(ERROR, "a job takes an input path, an output path and a recipe");
+			}
+
+			auto job = std::make_unique<Job>();
+			job->input = request[1];
+			job->output = request[2];
+
+			// Everything that can be checked without the image is answered straight away.
+			std::string error;
+			std::error_code ignored;
+			FS::path output(job->output);
+			if (!FS::path(job->input).is_absolute() || !output.is_absolute()) {
+				error = "paths must be absolute";
+			}
+			else if (!FS::is_directory(output.parent_path(), ignored)) {
+				error = "no directory " + output.parent_path().string();
+			}
+			else {
+				Recipe::parse(request[3], job->recipe, error);
+			}
+			if (!error.empty()) {
+				record(received, true);
+				return reply(ERROR, error);
+			}
+
+			std::future<Message> result = job->reply.get_future();
+			if (!enqueue(std::move(job))) {
+				record(received, true);
+				return reply(ERROR, "shutting down");
+			}
+
+			Message response = result.get();
+			record(received, response[0] != OK);
+			return response;
+		}
+
+		Message Server::runJob(Job& job) {
+			try {
+				MultiImage image(job.input);
+				if (image.isBadImage()) {
+					return reply(ERROR, "cannot load " + job.input);
+				}
+
+				job.recipe.apply(image);
+
+				// Removed first, so the check below does not mistake an old file for the result.
+				std::error_code ignored;
+				FS::remove(job.output, ignored);
+				image.save(job.output);
+				if (!FS::exists(job.output, ignored)) {
+					return reply(ERROR, "cannot write " + job.output);
+				}
+
+				return reply(OK, std::to_string(image.columns()) + "x" + std::to_string(image.rows()) + " x"
+								 + std::to_string(image.channels()));
+			}
+			catch (const std::exception& e) {
+				return reply(ERROR, e.what());
+			}
+		}
+
+		bool Server::enqueue(std::unique_ptr<Job> job) {
+			std::unique_lock<std::mutex> lock(m_QueueMutex);
+			if (m_Queue.size() >= m_Options.queueCapacity && !m_Closing) {
+				std::lock_guard<std::mutex> statsLock(m_StatsMutex);
+				m_QueueWaits++;
+			}
+			m_QueueNotFull.wait(lock, [this] { return m_Queue.size() < m_Options.queueCapacity || m_Closing; });
+			if (m_Closing) {
+				return false;
+			}
+
+			m_Queue.push_back(std::move(job));
+			lock.unlock();
+			m_QueueNotEmpty.notify_one();
+			return true;
+		}
+
+		void Server::workerLoop() {
+			for (;;) {
+				std::unique_ptr<Job> job;
+				{
+					std::unique_lock<std::mutex> lock(m_QueueMutex);
+					m_QueueNotEmpty.wait(lock, [this] { return !m_Queue.empty() || m_Closing; });
+					if (m_Queue.empty()) {
+						return;
+					}
+					job = std::move(m_Queue.front());
+					m_Queue.pop_front();
+				}
+				m_QueueNotFull.notify_one();
+
+				job->reply.set_value(runJob(*job));
+			}
+		}
+
+		void Server::record(Clock::time_point received, bool failed) {
+			std::chrono::duration<double, std::milli> latency = Clock::now() - received;
+
+			std::lock_guard<std::mutex> lock(m_StatsMutex);
+			m_Jobs++;
+			if (failed) {
+				m_Failed++;
+			}
+			m_Latencies.add(latency.count());
+		}
+
+		std::string Server::report() {
+			size_t queued = 0;
+			{
+				std::lock_guard<std::mutex> lock(m_QueueMutex);
+				queued = m_Queue.size();
+			}
+
+			std::vector<double> latencies;
+			size_t jobs = 0;
+			size_t failed = 0;
+			size_t waits = 0;
+			{
+				std::lock_guard<std::mutex> lock(m_StatsMutex);
+				latencies = m_Latencies.values();
+				jobs = m_Jobs;
+				failed = m_Failed;
+				waits = m_QueueWaits;
+			}
+
+			std::chrono::duration<double> uptime = Clock::now() - m_Started;
+			BufferPool::Stats pool = BufferPool::instance().stats();
+			ResultCache::Stats cache = ResultCache::instance().stats();
+
+			std::ostringstream out;
+			out << std::fixed << std::setprecision(2);
+			out << "uptime " << uptime.count() << " s, " << m_Options.workers << " workers, "
+				<< ThreadPool::instance().threadCount() << " threads\n";
+			out << "jobs " << jobs << ", failed " << failed << "\n";
+			out << "queue " << queued << "/" << m_Options.queueCapacity << ", waits for a free slot " << waits << "\n";
+			out << "latency ms (last " << latencies.size() << ") p50 " << percentile(latencies, 0.50)
+				<< " p90 " << percentile(latencies, 0.90) << " p99 " << percentile(latencies, 0.99)
+				<< " max " << percentile(latencies, 1.0) << "\n";
+			out << "buffer pool hits " << pool.hits << ", misses " << pool.misses << ", dropped " << pool.dropped
+				<< ", pooled " << BufferPool::instance().pooledBytes() / double(1 << 20) << " MiB\n";
+			out << "result cache memory hits " << cache.memoryHits << ", disk hits " << cache.diskHits
+				<< ", misses " << cache.misses << "\n";
+			return out.str();
+		}
+
+		void Server::reapConnections(bool all) {
+			for (auto it = m_Connections.begin(); it != m_Connections.end();) {
+				if (!all && !it->done.load()) {
+					++it;
+					continue;
+				}
+				it->thread.join();
+				// Closed here rather than by the connection thread, so run() never shuts down a reused descriptor.
+				::close(it->socket);
+				it = m_Connections.erase(it);
+			}
+		}
+	}
+}
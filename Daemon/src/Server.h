@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Latency.h"
+#include "Protocol.h"
+#include "Recipe.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace MKImage {
+	namespace Daemon {
+		/*
+			Serves jobs (see Protocol.h) for as long as the process lives, so the library's ThreadPool,
+			BufferPool, FFT plans and ResultCache stay warm from one job to the next.
+
+			Each connection gets a thread that reads requests and waits for their replies; jobs go
+			through a bounded queue to a fixed set of workers, each running one job at a time on the
+			shared ThreadPool. When the queue is full the connection thread blocks before reading the
+			next request, which pushes back on the client through its unanswered request instead of
+			letting memory grow with the backlog.
+
+			Latency is measured from the arrival of a request to its reply, over a window of recent
+			jobs, and reported by the "stats" request.
+		*/
+		class Server {
+		public:
+			struct Options {
+				size_t workers = 2;				// jobs processed at once
+				size_t queueCapacity = 16;		// accepted jobs waiting for a worker
+				size_t latencyWindow = 4096;	// recent jobs the percentiles are taken over
+			};
+
+		public:
+			Server(int listenSocket, const Options& options);
+			~Server();
+
+			Server(const Server&) = delete;
+			Server& operator=(const Server&) = delete;
+
+			// Accepts connections until "stop" is set, then answers the requests already read and returns.
+			void run(const std::atomic<bool>& stop);
+
+		private:
+			using Clock = std::chrono::steady_clock;
+
+			struct Job {
+				std::string input;
+				std::string output;
+				Recipe recipe;
+				std::promise<Message> reply;
+			};
+
+			struct Connection {
+				std::thread thread;
+				int socket = -1;
+				std::atomic<bool> done{ false };
+			};
+
+			void serve(Connection& connection);
+			Message handle(const Message& request);
+			Message runJob(Job& job);
+			// Blocks while the queue is full. False once the server is stopping.
+			bool enqueue(std::unique_ptr<Job> job);
+			void workerLoop();
+			void record(Clock::time_point received, bool failed);
+			std::string report();
+			// Joins and closes finished connections, or all of them.
+			void reapConnections(bool all);
+
+		private:
+			int m_ListenSocket;
+			Options m_Options;
+			Clock::time_point m_Started;
+
+			std::list<Connection> m_Connections;
+			std::vector<std::thread> m_Workers;
+
+			std::deque<std::unique_ptr<Job>> m_Queue;
+			std::mutex m_QueueMutex;
+			std::condition_variable m_QueueNotEmpty;
+			std::condition_variable m_QueueNotFull;
+			bool m_Closing;
+
+			std::mutex m_StatsMutex;
+			LatencyWindow m_Latencies;
+			size_t m_Jobs;
+			size_t m_Failed;
+			size_t m_QueueWaits;		// jobs that found the queue full and had to wait
+		};
+	}
+}
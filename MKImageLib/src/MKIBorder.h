@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+namespace MKImage {
+	namespace Border {
+		/*
+			Mirrors an out of range index back into [0, size) the way Mask treats borders, without
+			repeating the edge pixel: -1 -> 1, size -> size - 2. Indices further out keep folding
+			back and forth, so windows wider than the image stay in range.
+		*/
+		inline size_t mirror(long index, size_t size) {
+			if (size <= 1) {
+				return 0;
+			}
+
+			long period = 2 * (static_cast<long>(size) - 1);
+			long folded = index % period;
+			if (folded < 0) {
+				folded += period;
+			}
+			return static_cast<size_t>(folded < static_cast<long>(size) ? folded : period - folded);
+		}
+	}
+}
@@ -0,0 +1,129 @@
+#include "MKIBufferPool.h"
+
+#include "MKIThreadPool.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace MKImage {
+	namespace {
+		// Below this many pixels a new buffer is cheaper to allocate on one thread than to hand out.
+		constexpr size_t PARALLEL_ALLOCATION_PIXELS = size_t(1) << 16;
+	}
+
+	BufferPool& BufferPool::instance() {
+		// Never destroyed, so images with static storage duration can still release into it at exit.
+		static BufferPool* pool = new BufferPool();
+		return *pool;
+	}
+
+	BufferPool::BufferPool()
+		: m_Entries{}, m_Mutex{}, m_Bytes{ 0 }, m_Capacity{ DEFAULT_CAPACITY }, m_Stats{} {
+	}
+
+	ImageData BufferPool::acquire(size_t rows, size_t columns) {
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			for (auto it = m_Entries.rbegin(); it != m_Entries.rend(); ++it) {
+				if (it->rows == rows && it->columns == columns) {
+					ImageData data = std::move(it->data);
+					m_Entries.erase(std::next(it).base());
+					m_Bytes -= bytes(rows, columns);
+					m_Stats.hits++;
+					return data;
+				}
+			}
+			m_Stats.misses++;
+		}
+
+		if (rows * columns < PARALLEL_ALLOCATION_PIXELS) {
+			return ImageData(rows, std::vector<short>(columns));
+		}
+
+		// Rows are allocated and zeroed by the thread that is home to their band (see ThreadPool), so
+		// their pages are first touched, and on NUMA machines placed, where they will be processed.
+		ImageData data(rows);
+		ThreadPool::instance().parallelFor(0, rows, [&data, columns](size_t rowBegin, size_t rowEnd) {
+			for (size_t i = rowBegin; i < rowEnd; ++i) {
+				data[i] = std::vector<short>(columns);
+			}
+		});
+		return data;
+	}
+
+	void BufferPool::release(ImageData&& data) {
+		ImageData buffer = std::move(data);
+		if (buffer.empty() || buffer[0].empty()) {
+			return;
+		}
+
+		size_t rows = buffer.size();
+		size_t columns = buffer[0].size();
+		for (const auto& row : buffer) {
+			if (row.size() != columns) {
+				return;
+			}
+		}
+
+		// Buffers are freed outside the lock.
+		std::vector<Entry> freed;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			if (bytes(rows, columns) > m_Capacity) {
+				m_Stats.dropped++;
+				return;
+			}
+
+			m_Entries.push_back({ rows, columns, std::move(buffer) });
+			m_Bytes += bytes(rows, columns);
+			evict(m_Capacity, freed);
+		}
+	}
+
+	void BufferPool::setCapacity(size_t bytes) {
+		std::vector<Entry> freed;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Capacity = bytes;
+			evict(m_Capacity, freed);
+		}
+	}
+
+	size_t BufferPool::capacity() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Capacity;
+	}
+
+	size_t BufferPool::pooledBytes() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Bytes;
+	}
+
+	void BufferPool::trim(size_t bytes) {
+		std::vector<Entry> freed;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			evict(bytes, freed);
+		}
+	}
+
+	BufferPool::Stats BufferPool::stats() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Stats;
+	}
+
+	void BufferPool::evict(size_t limit, std::vector<Entry>& freed) {
+		size_t count = 0;
+		while (m_Bytes > limit && count < m_Entries.size()) {
+			m_Bytes -= bytes(m_Entries[count].rows, m_Entries[count].columns);
+			m_Stats.dropped++;
+			++count;
+		}
+		if (count != 0) {
+			std::move(m_Entries.begin(), m_Entries.begin() + count, std::back_inserter(freed));
+			m_Entries.erase(m_Entries.begin(), m_Entries.begin() + count);
+		}
+	}
+}
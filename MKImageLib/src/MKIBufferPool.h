@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <cstddef>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	/*
+		A process-wide cache of released pixel buffers, keyed by size (rows x columns).
+
+		Image bodies and the scratch buffers of processing calls are taken from here and handed back
+		when they are no longer needed, so a batch of equally sized images reaches a steady state in
+		which no pixel storage is allocated or freed. Each buffer keeps its row vectors, so reuse saves
+		rows + 1 allocations.
+
+		Pooled memory is bounded by capacity(); the least recently released buffers are freed first.
+
+		Large new buffers are allocated band by band on the ThreadPool, so on NUMA machines each band
+		lives on the node of the thread that processes it. Rows are separate allocations, which rules
+		out explicit huge pages; transparent huge pages for the malloc heaps the rows come from can be
+		turned on for the process with GLIBC_TUNABLES=glibc.malloc.hugetlb=1 (glibc 2.35 or later).
+	*/
+	class BufferPool {
+	public:
+		struct Stats {
+			size_t hits = 0;		// acquire() served from the pool
+			size_t misses = 0;		// acquire() that had to allocate
+			size_t dropped = 0;		// release() freed straight away because of the capacity
+		};
+
+	public:
+		static BufferPool& instance();
+
+		BufferPool(const BufferPool&) = delete;
+		BufferPool& operator=(const BufferPool&) = delete;
+
+		/*
+			A rows x columns buffer. A reused buffer keeps its old contents, so callers must write
+			every pixel (new buffers are zeroed).
+		*/
+		ImageData acquire(size_t rows, size_t columns);
+		// Hands a buffer back for reuse. Empty or ragged buffers are simply freed.
+		void release(ImageData&& data);
+
+		// Upper bound on the bytes kept in the pool. Lowering it trims straight away.
+		void setCapacity(size_t bytes);
+		size_t capacity() const;
+		size_t pooledBytes() const;
+		// Frees pooled buffers until at most "bytes" remain.
+		void trim(size_t bytes = 0);
+
+		Stats stats() const;
+
+		// Default capacity: 256 MiB, about four 8K x 8K images.
+		static constexpr size_t DEFAULT_CAPACITY = size_t(256) << 20;
+
+	private:
+		struct Entry {
+			size_t rows;
+			size_t columns;
+			ImageData data;
+		};
+
+		BufferPool();
+
+		static size_t bytes(size_t rows, size_t columns) { return rows * columns * sizeof(short); }
+		// Frees least recently released buffers until m_Bytes <= limit. Caller holds the lock.
+		void evict(size_t limit, std::vector<Entry>& freed);
+
+	private:
+		// Least recently released first. A vector so that steady-state release/acquire never allocates.
+		std::vector<Entry> m_Entries;
+		mutable std::mutex m_Mutex;
+		size_t m_Bytes;
+		size_t m_Capacity;
+		Stats m_Stats;
+	};
+}
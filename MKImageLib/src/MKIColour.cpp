@@ -0,0 +1,58 @@
+#include "MKIColour.h"
+
+#include "MKIThreadPool.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace MKImage {
+	namespace Colour {
+		namespace {
+			constexpr int RED_WEIGHT = 77;
+			constexpr int GREEN_WEIGHT = 150;
+			constexpr int BLUE_WEIGHT = 29;
+			constexpr int ROUNDING = 128;
+			constexpr int SHIFT = 8;
+
+			void lumaRow(const short* red, const short* green, const short* blue, short* out, size_t columns) {
+				size_t j = 0;
+#ifdef __SSE2__
+				/*
+					Samples can use the full 15 bits, so the products need 32 bits: interleave (R, G) and
+					(B, 1) and let madd multiply and add each pair into one 32-bit lane.
+				*/
+				const __m128i redGreen = _mm_set1_epi32((GREEN_WEIGHT << 16) | RED_WEIGHT);
+				const __m128i blueRound = _mm_set1_epi32((ROUNDING << 16) | BLUE_WEIGHT);
+				const __m128i one = _mm_set1_epi16(1);
+
+				for (; j + 8 <= columns; j += 8) {
+					__m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(red + j));
+					__m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(green + j));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blue + j));
+
+					__m128i low = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), redGreen),
+												_mm_madd_epi16(_mm_unpacklo_epi16(b, one), blueRound));
+					__m128i high = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), redGreen),
+												 _mm_madd_epi16(_mm_unpackhi_epi16(b, one), blueRound));
+
+					__m128i luma = _mm_packs_epi32(_mm_srai_epi32(low, SHIFT), _mm_srai_epi32(high, SHIFT));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + j), luma);
+				}
+#endif
+				for (; j < columns; ++j) {
+					out[j] = static_cast<short>((RED_WEIGHT * red[j] + GREEN_WEIGHT * green[j] + BLUE_WEIGHT * blue[j] +
+												 ROUNDING) >> SHIFT);
+				}
+			}
+		}
+
+		void rgbToLuma(const ImageData& red, const ImageData& green, const ImageData& blue, ImageData& out) {
+			ThreadPool::instance().parallelFor(0, out.size(), [&](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					lumaRow(red[i].data(), green[i].data(), blue[i].data(), out[i].data(), out[i].size());
+				}
+			});
+		}
+	}
+}
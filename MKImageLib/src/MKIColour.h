@@ -0,0 +1,17 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	namespace Colour {
+		/*
+			Rec. 601 luma, Y = (77 R + 150 G + 29 B + 128) / 256, from three planes of equal size
+			into "out" (already that size). Rows are converted in parallel, 8 pixels at a time with
+			SSE2 where available; the weights sum to 256 so Y never exceeds the largest input.
+		*/
+		void rgbToLuma(const ImageData& red, const ImageData& green, const ImageData& blue, ImageData& out);
+	}
+}
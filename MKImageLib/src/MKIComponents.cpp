@@ -0,0 +1,281 @@
+#include "MKIComponents.h"
+
+#include "MKIThreadPool.h"
+#include "MKIUnionFind.h"
+
+#include <algorithm>
+
+namespace MKImage {
+	namespace Components {
+		namespace {
+			// Tile edge; a power of two so local pixel positions split with shifts.
+			constexpr size_t TILE_SHIFT = 7;
+			constexpr size_t TILE = size_t(1) << TILE_SHIFT;
+
+			// The part of a component inside one tile, with its measurements.
+			struct Piece {
+				uint32_t root = 0;		// global index of the piece's first pixel
+				size_t area = 0;
+				size_t top = 0;
+				size_t left = 0;
+				size_t bottom = 0;
+				size_t right = 0;
+				uint64_t rowSum = 0;
+				uint64_t columnSum = 0;
+			};
+
+			uint32_t localFind(std::vector<uint32_t>& parent, uint32_t i) {
+				while (parent[i] != i) {
+					parent[i] = parent[parent[i]];
+					i = parent[i];
+				}
+				return i;
+			}
+
+			void localUnite(std::vector<uint32_t>& parent, uint32_t a, uint32_t b) {
+				a = localFind(parent, a);
+				b = localFind(parent, b);
+				if (a != b) {
+					parent[std::max(a, b)] = std::min(a, b);
+				}
+			}
+
+			/*
+				Labels one tile with a union-find over local pixel positions (row * TILE + column), links
+				every pixel to its tile-local root in "sets" and measures each piece.
+			*/
+			void labelTile(const uint8_t* mask, size_t columns, const Region& tile, bool eight, UnionFind& sets,
+						   std::vector<Piece>& pieces) {
+				thread_local std::vector<uint32_t> parent(TILE * TILE);
+				thread_local std::vector<uint32_t> slot(TILE * TILE);
+
+				for (size_t i = 0; i < tile.height; ++i) {
+					const uint8_t* row = mask + (tile.row + i) * columns + tile.column;
+					const uint8_t* up = i > 0 ? row - columns : nullptr;
+
+					for (size_t j = 0; j < tile.width; ++j) {
+						if (!row[j]) {
+							continue;
+						}
+
+						uint32_t local = static_cast<uint32_t>((i << TILE_SHIFT) + j);
+						parent[local] = local;
+
+						if (j > 0 && row[j - 1]) {
+							localUnite(parent, local, local - 1);
+						}
+						if (i > 0) {
+							uint32_t above = local - static_cast<uint32_t>(TILE);
+							if (up[j]) {
+								localUnite(parent, local, above);
+							}
+							if (eight && j > 0 && up[j - 1]) {
+								localUnite(parent, local, above - 1);
+							}
+							if (eight && j + 1 < tile.width && up[j + 1]) {
+								localUnite(parent, local, above + 1);
+							}
+						}
+					}
+				}
+
+				// Roots are the first pixel of their piece, so they are met before the rest of it.
+				for (size_t i = 0; i < tile.height; ++i) {
+					const uint8_t* row = mask + (tile.row + i) * columns + tile.column;
+
+					for (size_t j = 0; j < tile.width; ++j) {
+						if (!row[j]) {
+							continue;
+						}
+
+						uint32_t local = static_cast<uint32_t>((i << TILE_SHIFT) + j);
+						uint32_t root = localFind(parent, local);
+						size_t rootRow = tile.row + (root >> TILE_SHIFT);
+						size_t rootColumn = tile.column + (root & (TILE - 1));
+						uint32_t globalRoot = static_cast<uint32_t>(rootRow * columns + rootColumn);
+
+						if (root == local) {
+							slot[local] = static_cast<uint32_t>(pieces.size());
+							Piece piece;
+							piece.root = globalRoot;
+							piece.top = piece.bottom = tile.row + i;
+							piece.left = piece.right = tile.column + j;
+							pieces.push_back(piece);
+						}
+
+						Piece& piece = pieces[slot[root]];
+						size_t r = tile.row + i;
+						size_t c = tile.column + j;
+						++piece.area;
+						piece.top = std::min(piece.top, r);
+						piece.bottom = std::max(piece.bottom, r);
+						piece.left = std::min(piece.left, c);
+						piece.right = std::max(piece.right, c);
+						piece.rowSum += r;
+						piece.columnSum += c;
+
+						sets.link(static_cast<uint32_t>(r * columns + c), globalRoot);
+					}
+				}
+			}
+
+			// Joins pieces that touch across tile borders.
+			void mergeBorders(const uint8_t* mask, size_t rows, size_t columns, bool eight, UnionFind& sets) {
+				auto join = [&](size_t a, size_t b) {
+					if (mask[a] && mask[b]) {
+						sets.unite(static_cast<uint32_t>(a), static_cast<uint32_t>(b));
+					}
+				};
+
+				for (size_t i = TILE; i < rows; i += TILE) {
+					for (size_t j = 0; j < columns; ++j) {
+						size_t index = i * columns + j;
+						join(index, index - columns);
+						if (eight && j > 0) {
+							join(index, index - columns - 1);
+						}
+						if (eight && j + 1 < columns) {
+							join(index, index - columns + 1);
+						}
+					}
+				}
+
+				for (size_t j = TILE; j < columns; j += TILE) {
+					for (size_t i = 0; i < rows; ++i) {
+						size_t index = i * columns + j;
+						join(index, index - 1);
+						if (eight && i > 0) {
+							join(index, index - columns - 1);
+							join(index - 1, index - columns);
+						}
+					}
+				}
+			}
+		}
+
+		Labels label(const ImageData& in, Connectivity connectivity) {
+			size_t rows = in.size();
+			size_t columns = rows == 0 ? 0 : in[0].size();
+			std::vector<uint8_t> mask(rows * columns);
+
+			ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					const short* src = in[i].data();
+					uint8_t* dst = mask.data() + i * columns;
+					for (size_t j = 0; j < columns; ++j) {
+						dst[j] = src[j] != 0;
+					}
+				}
+			});
+
+			return label(mask, rows, columns, connectivity);
+		}
+
+		Labels label(const std::vector<uint8_t>& mask, size_t rows, size_t columns, Connectivity connectivity) {
+			Labels result;
+			result.rows = rows;
+			result.columns = columns;
+			result.labels.assign(rows * columns, 0);
+			if (rows == 0 || columns == 0) {
+				return result;
+			}
+
+			bool eight = connectivity == Connectivity::eight;
+			size_t tilesAcross = (columns + TILE - 1) / TILE;
+			size_t tilesDown = (rows + TILE - 1) / TILE;
+			size_t tiles = tilesAcross * tilesDown;
+
+			UnionFind sets(rows * columns);
+			std::vector<std::vector<Piece>> pieces(tiles);
+
+			ThreadPool& pool = ThreadPool::instance();
+			pool.parallelForBands(0, tiles, tiles, [&](size_t tileBegin, size_t tileEnd) {
+				for (size_t t = tileBegin; t < tileEnd; ++t) {
+					Region tile{ (t % tilesAcross) * TILE, (t / tilesAcross) * TILE, TILE, TILE };
+					labelTile(mask.data(), columns, tile.clipped(rows, columns), eight, sets, pieces[t]);
+				}
+			});
+
+			mergeBorders(mask.data(), rows, columns, eight, sets);
+
+			/*
+				Number the components in raster order of their roots (the smallest index of each set):
+				count roots per band, then give each band its first label.
+			*/
+			size_t bands = std::min(rows, pool.threadCount());
+			std::vector<uint32_t> firstLabel(bands + 1, 0);
+			auto bandRows = [rows, bands](size_t band) { return rows * band / bands; };
+
+			pool.parallelForBands(0, bands, bands, [&](size_t bandBegin, size_t bandEnd) {
+				for (size_t band = bandBegin; band < bandEnd; ++band) {
+					uint32_t roots = 0;
+					for (size_t index = bandRows(band) * columns; index < bandRows(band + 1) * columns; ++index) {
+						roots += mask[index] && sets.root(static_cast<uint32_t>(index)) == index;
+					}
+					firstLabel[band + 1] = roots;
+				}
+			});
+			for (size_t band = 0; band < bands; ++band) {
+				firstLabel[band + 1] += firstLabel[band];
+			}
+
+			pool.parallelForBands(0, bands, bands, [&](size_t bandBegin, size_t bandEnd) {
+				for (size_t band = bandBegin; band < bandEnd; ++band) {
+					uint32_t next = firstLabel[band] + 1;
+					for (size_t index = bandRows(band) * columns; index < bandRows(band + 1) * columns; ++index) {
+						if (mask[index] && sets.root(static_cast<uint32_t>(index)) == index) {
+							result.labels[index] = next++;
+						}
+					}
+				}
+			});
+
+			// Roots are labelled, so every other pixel can take its root's label; only non-roots are written.
+			pool.parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+				for (size_t index = rowBegin * columns; index < rowEnd * columns; ++index) {
+					if (mask[index]) {
+						uint32_t root = sets.root(static_cast<uint32_t>(index));
+						if (root != index) {
+							result.labels[index] = result.labels[root];
+						}
+					}
+				}
+			});
+
+			// Add up the pieces of every component.
+			size_t count = firstLabel[bands];
+			std::vector<Piece> totals(count);
+			std::vector<uint8_t> seen(count, 0);
+			for (const auto& tilePieces : pieces) {
+				for (const auto& piece : tilePieces) {
+					size_t k = result.labels[piece.root] - 1;
+					Piece& total = totals[k];
+					if (!seen[k]) {
+						total = piece;
+						seen[k] = 1;
+						continue;
+					}
+					total.area += piece.area;
+					total.top = std::min(total.top, piece.top);
+					total.bottom = std::max(total.bottom, piece.bottom);
+					total.left = std::min(total.left, piece.left);
+					total.right = std::max(total.right, piece.right);
+					total.rowSum += piece.rowSum;
+					total.columnSum += piece.columnSum;
+				}
+			}
+
+			result.blobs.resize(count);
+			for (size_t k = 0; k < count; ++k) {
+				const Piece& total = totals[k];
+				Blob& blob = result.blobs[k];
+				blob.area = total.area;
+				blob.bounds = { total.left, total.top, total.right - total.left + 1, total.bottom - total.top + 1 };
+				blob.centroidRow = static_cast<double>(total.rowSum) / total.area;
+				blob.centroidColumn = static_cast<double>(total.columnSum) / total.area;
+			}
+
+			return result;
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "MKIRegion.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	namespace Components {
+		enum class Connectivity { four = 4, eight = 8 };
+
+		// Measurements of one connected component.
+		struct Blob {
+			size_t area = 0;
+			Region bounds;
+			double centroidRow = 0;
+			double centroidColumn = 0;
+		};
+
+		struct Labels {
+			size_t rows = 0;
+			size_t columns = 0;
+			// Row-major, 0 for background and k for the pixels of blobs[k - 1]. Blobs are numbered in
+			// raster order of their first pixel.
+			std::vector<uint32_t> labels;
+			std::vector<Blob> blobs;
+
+			size_t count() const { return blobs.size(); }
+			uint32_t at(size_t row, size_t column) const { return labels[row * columns + column]; }
+		};
+
+		/*
+			Labels the connected components of the non-zero pixels of "in", e.g. after GS::blackAndWhite.
+
+			The image is cut into square tiles that are labelled in parallel with a union-find over
+			pixel indices; each tile accumulates the area, bounding box and coordinate sums of its
+			pieces in the same pass. Tile borders are then merged on one thread, the components are
+			numbered, and the pieces' measurements are added up per component.
+		*/
+		Labels label(const ImageData& in, Connectivity connectivity);
+		// Same, for a row-major mask of rows x columns where non-zero bytes are foreground.
+		Labels label(const std::vector<uint8_t>& mask, size_t rows, size_t columns, Connectivity connectivity);
+	}
+}
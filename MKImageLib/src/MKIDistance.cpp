@@ -0,0 +1,150 @@
+#include "MKIDistance.h"
+
+#include "MKIThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace MKImage {
+	namespace Distance {
+		namespace {
+			/*
+				Vertical distance from every pixel to the nearest target pixel in its column, row-major
+				into "g". Columns without a target pixel hold "rows", which no real distance reaches.
+			*/
+			void columnPass(const ImageData& in, bool zero, std::vector<uint32_t>& g) {
+				size_t rows = in.size();
+				size_t columns = in[0].size();
+				const uint32_t none = static_cast<uint32_t>(rows);
+
+				// Column bands, swept row by row so every access is a contiguous run.
+				ThreadPool::instance().parallelFor(0, columns, [&](size_t columnBegin, size_t columnEnd) {
+					for (size_t i = 0; i < rows; ++i) {
+						const short* src = in[i].data();
+						uint32_t* dst = g.data() + i * columns;
+						const uint32_t* above = i > 0 ? dst - columns : nullptr;
+						for (size_t j = columnBegin; j < columnEnd; ++j) {
+							uint32_t carried = above ? std::min(above[j] + 1, none) : none;
+							dst[j] = (src[j] == 0) == zero ? 0 : carried;
+						}
+					}
+
+					for (size_t i = rows - 1; i-- > 0;) {
+						uint32_t* dst = g.data() + i * columns;
+						const uint32_t* below = dst + columns;
+						for (size_t j = columnBegin; j < columnEnd; ++j) {
+							dst[j] = std::min(dst[j], below[j] + 1);
+						}
+					}
+				});
+			}
+
+			/*
+				Lower envelope of the parabolas (x - u)^2 + g(u)^2 of every row, written through
+				"convert" (which takes the squared distance) into "out". "out" may alias "g".
+			*/
+			template <typename T, typename Convert>
+			void rowPass(const std::vector<uint32_t>& g, size_t rows, size_t columns, T* out, T none, Convert convert) {
+				const uint32_t noColumnTarget = static_cast<uint32_t>(rows);
+
+				ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+					std::vector<uint32_t> f(columns);
+					// Envelope: parabola "sites[k]" is the lowest from column "starts[k]" on.
+					std::vector<int64_t> sites(columns);
+					std::vector<int64_t> starts(columns);
+
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						std::copy(g.begin() + i * columns, g.begin() + (i + 1) * columns, f.begin());
+						T* dst = out + i * columns;
+
+						auto height = [&f](int64_t x, int64_t u) {
+							int64_t dx = x - u;
+							int64_t dy = f[u];
+							return dx * dx + dy * dy;
+						};
+						// First column from which parabola u is below parabola v (v < u).
+						auto separation = [&f](int64_t v, int64_t u) {
+							int64_t fv = f[v];
+							int64_t fu = f[u];
+							return (u * u - v * v + fu * fu - fv * fv) / (2 * (u - v));
+						};
+
+						ptrdiff_t k = -1;
+						for (size_t column = 0; column < columns; ++column) {
+							if (f[column] == noColumnTarget) {
+								continue;
+							}
+
+							int64_t u = static_cast<int64_t>(column);
+							while (k >= 0 && height(starts[k], sites[k]) > height(starts[k], u)) {
+								--k;
+							}
+							if (k < 0) {
+								k = 0;
+								sites[0] = u;
+								starts[0] = 0;
+							} else {
+								int64_t start = 1 + separation(sites[k], u);
+								if (start < static_cast<int64_t>(columns)) {
+									++k;
+									sites[k] = u;
+									starts[k] = start;
+								}
+							}
+						}
+
+						if (k < 0) {
+							std::fill(dst, dst + columns, none);
+							continue;
+						}
+
+						for (size_t column = columns; column-- > 0;) {
+							int64_t x = static_cast<int64_t>(column);
+							dst[column] = convert(height(x, sites[k]));
+							if (x == starts[k]) {
+								--k;
+							}
+						}
+					}
+				});
+			}
+
+			bool empty(const ImageData& in) {
+				return in.empty() || in[0].empty();
+			}
+		}
+
+		Map<uint32_t> squared(const ImageData& in, Target target) {
+			Map<uint32_t> map;
+			if (empty(in)) {
+				return map;
+			}
+
+			map.rows = in.size();
+			map.columns = in[0].size();
+			map.values.resize(map.rows * map.columns);
+
+			columnPass(in, target == Target::zero, map.values);
+			rowPass(map.values, map.rows, map.columns, map.values.data(), NONE_SQUARED,
+					[](int64_t d) { return static_cast<uint32_t>(d); });
+			return map;
+		}
+
+		Map<float> euclidean(const ImageData& in, Target target) {
+			Map<float> map;
+			if (empty(in)) {
+				return map;
+			}
+
+			map.rows = in.size();
+			map.columns = in[0].size();
+			map.values.resize(map.rows * map.columns);
+
+			std::vector<uint32_t> g(map.rows * map.columns);
+			columnPass(in, target == Target::zero, g);
+			rowPass(g, map.rows, map.columns, map.values.data(), NONE,
+					[](int64_t d) { return static_cast<float>(std::sqrt(static_cast<double>(d))); });
+			return map;
+		}
+	}
+}
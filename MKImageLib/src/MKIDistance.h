@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	namespace Distance {
+		// The pixels distances are measured to.
+		enum class Target { zero, nonZero };
+
+		// Distance of pixels with no target pixel in the image (the target set is empty).
+		constexpr uint32_t NONE_SQUARED = std::numeric_limits<uint32_t>::max();
+		constexpr float NONE = std::numeric_limits<float>::infinity();
+
+		template <typename T>
+		struct Map {
+			size_t rows = 0;
+			size_t columns = 0;
+			std::vector<T> values;		// row-major
+
+			T at(size_t row, size_t column) const { return values[row * columns + column]; }
+		};
+
+		/*
+			Exact Euclidean distance from every pixel to the nearest target pixel, 0 on target pixels.
+			With Target::zero, the pixels of a black-and-white mask get their distance to the
+			background; with Target::nonZero, background pixels get their distance to the objects.
+
+			Separable lower-envelope transform (Meijster et al., as in Felzenszwalb & Huttenlocher):
+			a column pass finds the vertical distance to the nearest target pixel, then a row pass
+			takes the lower envelope of the parabolas (x - u)^2 + g(u)^2 in integers. Both passes are
+			linear in the pixel count and run on the ThreadPool, the column pass as sweeps along rows
+			over a band of columns.
+		*/
+		Map<uint32_t> squared(const ImageData& in, Target target);
+		// Same, as the square root of the squared distances.
+		Map<float> euclidean(const ImageData& in, Target target);
+	}
+}
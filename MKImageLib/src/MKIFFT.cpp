@@ -0,0 +1,234 @@
+#include "MKIFFT.h"
+
+#include "MKIBorder.h"
+#include "MKIThreadPool.h"
+#include "MKITrace.h"
+
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+namespace MKImage {
+	namespace FFT {
+		namespace {
+			// std::complex operator* checks for NaN/inf; these values are always finite.
+			inline Complex multiply(const Complex& a, const Complex& b) {
+				return Complex(a.real() * b.real() - a.imag() * b.imag(),
+							   a.real() * b.imag() + a.imag() * b.real());
+			}
+
+			size_t nextPowerOfTwo(size_t value) {
+				size_t power = 1;
+				while (power < value) {
+					power <<= 1;
+				}
+				return power;
+			}
+		}
+
+		Plan::Plan(size_t size)
+			: m_Size{ size }, m_BitReverse(size), m_Twiddles(size / 2) {
+
+			size_t bits = 0;
+			while ((size_t(1) << bits) < size) {
+				++bits;
+			}
+
+			for (size_t i = 0; i < size; ++i) {
+				uint32_t reversed = 0;
+				for (size_t b = 0; b < bits; ++b) {
+					if (i & (size_t(1) << b)) {
+						reversed |= 1u << (bits - 1 - b);
+					}
+				}
+				m_BitReverse[i] = reversed;
+			}
+
+			for (size_t k = 0; k < size / 2; ++k) {
+				double angle = -2.0 * M_PI * static_cast<double>(k) / static_cast<double>(size);
+				m_Twiddles[k] = Complex(std::cos(angle), std::sin(angle));
+			}
+		}
+
+		void Plan::transform(Complex* data, bool inverse) const {
+			for (size_t i = 0; i < m_Size; ++i) {
+				size_t j = m_BitReverse[i];
+				if (i < j) {
+					std::swap(data[i], data[j]);
+				}
+			}
+
+			for (size_t length = 2; length <= m_Size; length <<= 1) {
+				size_t half = length / 2;
+				size_t step = m_Size / length;
+
+				for (size_t i = 0; i < m_Size; i += length) {
+					for (size_t k = 0; k < half; ++k) {
+						Complex w = m_Twiddles[k * step];
+						if (inverse) {
+							w = std::conj(w);
+						}
+
+						Complex u = data[i + k];
+						Complex v = multiply(data[i + k + half], w);
+						data[i + k] = u + v;
+						data[i + k + half] = u - v;
+					}
+				}
+			}
+		}
+
+		void Plan::transform2D(Complex* data, bool inverse, std::vector<Complex>& column) const {
+			for (size_t r = 0; r < m_Size; ++r) {
+				transform(data + r * m_Size, inverse);
+			}
+
+			column.resize(m_Size);
+			for (size_t c = 0; c < m_Size; ++c) {
+				for (size_t r = 0; r < m_Size; ++r) {
+					column[r] = data[r * m_Size + c];
+				}
+				transform(column.data(), inverse);
+				for (size_t r = 0; r < m_Size; ++r) {
+					data[r * m_Size + c] = column[r];
+				}
+			}
+		}
+
+		const Plan& plan(size_t size) {
+			static std::map<size_t, std::unique_ptr<Plan>> plans;
+			static std::mutex plansMutex;
+
+			std::lock_guard<std::mutex> lock(plansMutex);
+			auto& cached = plans[size];
+			if (!cached) {
+				cached = std::make_unique<Plan>(size);
+			}
+			return *cached;
+		}
+
+		void convolve(const ImageData& in, ImageData& out, const Mask& mask) {
+			size_t rows = in.size();
+			size_t columns = in.at(0).size();
+			size_t maskRows = mask.rows();
+			size_t maskColumns = mask.columns();
+
+			// The mirrored image is conceptually padded so every output is a "valid" correlation sum.
+			size_t paddedRows = rows + maskRows - 1;
+			size_t paddedColumns = columns + maskColumns - 1;
+
+			/*
+				Tiles must be at least twice the kernel so that tiles two apart never write to the same
+				output pixels; that lets the four (row parity, column parity) classes run in parallel.
+			*/
+			size_t maskSize = std::max(maskRows, maskColumns);
+			size_t size = std::min(nextPowerOfTwo(std::max<size_t>(4 * maskSize, 32)),
+								   nextPowerOfTwo(std::max(paddedRows, paddedColumns) + maskSize));
+			const Plan& fft = plan(size);
+
+			size_t blockRows = size - maskRows + 1;
+			size_t blockColumns = size - maskColumns + 1;
+			size_t tileRows = (paddedRows + blockRows - 1) / blockRows;
+			size_t tileColumns = (paddedColumns + blockColumns - 1) / blockColumns;
+
+			Trace::Scope trace("fftConvolve", "fft");
+			trace.addPixels(rows * columns);
+			trace.addTiles(tileRows * tileColumns);
+
+			// Spectrum of the flipped kernel, so the convolution computes Mask's correlation.
+			std::vector<Complex> kernel(size * size);
+			for (size_t i = 0; i < maskRows; ++i) {
+				for (size_t j = 0; j < maskColumns; ++j) {
+					kernel[i * size + j] = mask.value(maskRows - 1 - i, maskColumns - 1 - j);
+				}
+			}
+			{
+				std::vector<Complex> column;
+				fft.transform2D(kernel.data(), false, column);
+			}
+
+			std::vector<double> sums(rows * columns, 0.0);
+			double scale = 1.0 / static_cast<double>(size * size);
+
+			for (size_t phase = 0; phase < 4; ++phase) {
+				std::vector<std::pair<size_t, size_t>> tiles;
+				for (size_t p = phase / 2; p < tileRows; p += 2) {
+					for (size_t q = phase % 2; q < tileColumns; q += 2) {
+						tiles.emplace_back(p, q);
+					}
+				}
+
+				size_t pairs = (tiles.size() + 1) / 2;
+				ThreadPool::instance().parallelFor(0, pairs, [&](size_t pairBegin, size_t pairEnd) {
+					std::vector<Complex> buffer(size * size);
+					std::vector<Complex> column;
+
+					for (size_t pair = pairBegin; pair < pairEnd; ++pair) {
+						size_t count = std::min<size_t>(2, tiles.size() - 2 * pair);
+						std::fill(buffer.begin(), buffer.end(), Complex());
+
+						// First tile goes in the real part, second in the imaginary part.
+						for (size_t t = 0; t < count; ++t) {
+							size_t rowOrigin = tiles[2 * pair + t].first * blockRows;
+							size_t columnOrigin = tiles[2 * pair + t].second * blockColumns;
+							size_t rowEnd = std::min(paddedRows, rowOrigin + blockRows);
+							size_t columnEnd = std::min(paddedColumns, columnOrigin + blockColumns);
+
+							for (size_t u = rowOrigin; u < rowEnd; ++u) {
+								const std::vector<short>& source = in[Border::mirror(static_cast<long>(u) - static_cast<long>(mask.rowOffset()), rows)];
+								Complex* dst = &buffer[(u - rowOrigin) * size];
+								for (size_t v = columnOrigin; v < columnEnd; ++v) {
+									short pixel = source[Border::mirror(static_cast<long>(v) - static_cast<long>(mask.columnOffset()), columns)];
+									if (t == 0) {
+										dst[v - columnOrigin].real(pixel);
+									} else {
+										dst[v - columnOrigin].imag(pixel);
+									}
+								}
+							}
+						}
+
+						fft.transform2D(buffer.data(), false, column);
+						for (size_t k = 0; k < buffer.size(); ++k) {
+							buffer[k] = multiply(buffer[k], kernel[k]);
+						}
+						fft.transform2D(buffer.data(), true, column);
+
+						for (size_t t = 0; t < count; ++t) {
+							long rowOrigin = static_cast<long>(tiles[2 * pair + t].first * blockRows) - static_cast<long>(maskRows - 1);
+							long columnOrigin = static_cast<long>(tiles[2 * pair + t].second * blockColumns) - static_cast<long>(maskColumns - 1);
+
+							for (size_t a = 0; a < size; ++a) {
+								long x = rowOrigin + static_cast<long>(a);
+								if (x < 0 || x >= static_cast<long>(rows)) {
+									continue;
+								}
+								size_t b = static_cast<size_t>(std::max(0L, -columnOrigin));
+								for (; b < size; ++b) {
+									long y = columnOrigin + static_cast<long>(b);
+									if (y >= static_cast<long>(columns)) {
+										break;
+									}
+									const Complex& value = buffer[a * size + b];
+									sums[x * columns + y] += (t == 0 ? value.real() : value.imag()) * scale;
+								}
+							}
+						}
+					}
+				});
+			}
+
+			long long weight = mask.weight();
+			ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					for (size_t j = 0; j < columns; ++j) {
+						long long sum = std::llround(sums[i * columns + j]);
+						out[i][j] = static_cast<short>(sum / weight);
+					}
+				}
+			});
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "MKIMask.h"
+
+#include <vector>
+#include <complex>
+#include <cstdint>
+#include <cstddef>
+
+namespace MKImage {
+	namespace FFT {
+		using Complex = std::complex<double>;
+
+		/*
+			Precomputed bit-reversal order and twiddle factors for a radix-2 transform of one size.
+			Plans are immutable once built, so one plan can be shared by every thread.
+		*/
+		class Plan {
+		public:
+			explicit Plan(size_t size);
+
+			size_t size() const { return m_Size; }
+
+			// In-place 1D transform. The inverse is not scaled by 1 / size.
+			void transform(Complex* data, bool inverse) const;
+			/*
+				In-place 2D transform of a size x size row-major block. The inverse is not scaled.
+
+				column = scratch buffer, resized as needed
+			*/
+			void transform2D(Complex* data, bool inverse, std::vector<Complex>& column) const;
+
+		private:
+			size_t m_Size;
+			std::vector<uint32_t> m_BitReverse;
+			std::vector<Complex> m_Twiddles;
+		};
+
+		// Returns the cached plan for "size" (a power of two), building it on first use.
+		const Plan& plan(size_t size);
+
+		/*
+			Applies "mask" exactly like Mask::apply at every pixel (mirrored borders, integer sum divided
+			by the mask weight), using tiled overlap-add FFT convolution. Pairs of tiles share one complex
+			transform (one in the real part, one in the imaginary part) and tiles are processed in
+			parallel. Sums are rounded back to integers, so the result matches the direct path exactly.
+
+			in = source image, out = destination (same size as in), mask rows/columns smaller than the image
+		*/
+		void convolve(const ImageData& in, ImageData& out, const Mask& mask);
+	}
+}
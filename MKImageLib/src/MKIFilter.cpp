@@ -0,0 +1,407 @@
+#include "MKIFilter.h"
+
+#include "MKIBorder.h"
+#include "MKIImageConstants.h"
+#include "MKIThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+namespace MKImage {
+	namespace Filter {
+		namespace {
+			// Row bands per thread for the window passes, so bands of uneven cost still balance.
+			constexpr size_t BANDS_PER_THREAD = 4;
+			// Cells of margin around the bilateral grid for its 5-tap blur.
+			constexpr size_t GRID_PAD = 2;
+			// Grid rows per band of the bilateral grid, which bounds a band's memory.
+			constexpr size_t GRID_BAND_ROWS = 16;
+
+			short toPixel(double value, short depth) {
+				return static_cast<short>(std::clamp(std::lround(value), 0L, static_cast<long>(depth)));
+			}
+
+			/*
+				Sums of K quantities over a sliding window: column sums over the window rows, and their
+				prefix sums along the row for the window columns.
+			*/
+			template <typename T, size_t K>
+			class WindowSums {
+			public:
+				explicit WindowSums(size_t columns)
+					: m_Columns(columns), m_ColumnSums(K * columns, T(0)), m_Prefix(K * (columns + 1), T(0)) {}
+
+				T* column(size_t k) { return m_ColumnSums.data() + k * m_Columns; }
+
+				// Call after changing the column sums, before sum().
+				void update() {
+					for (size_t k = 0; k < K; ++k) {
+						const T* src = column(k);
+						T* prefix = m_Prefix.data() + k * (m_Columns + 1);
+						for (size_t j = 0; j < m_Columns; ++j) {
+							prefix[j + 1] = prefix[j] + src[j];
+						}
+					}
+				}
+
+				// Sum of quantity k over the window columns [left, right).
+				T sum(size_t k, size_t left, size_t right) const {
+					const T* prefix = m_Prefix.data() + k * (m_Columns + 1);
+					return prefix[right] - prefix[left];
+				}
+
+			private:
+				size_t m_Columns;
+				std::vector<T> m_ColumnSums;
+				std::vector<T> m_Prefix;
+			};
+
+			/*
+				Calls row(i, window) for rows [rowBegin, rowEnd) in order, with "window" holding the sums
+				over rows [i - radius, i + radius] (cut at the border); add(window, row, sign) adds or
+				removes one row of quantities.
+			*/
+			template <typename T, size_t K, typename Add, typename Row>
+			void slideRows(size_t rows, size_t columns, size_t radius, size_t rowBegin, size_t rowEnd, Add add, Row row) {
+				WindowSums<T, K> window(columns);
+
+				size_t top = rowBegin - std::min(rowBegin, radius);
+				size_t bottom = std::min(rows, rowBegin + radius + 1);
+				for (size_t k = top; k < bottom; ++k) {
+					add(window, k, T(1));
+				}
+
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					window.update();
+					row(i, window, bottom - top);
+
+					if (bottom < rows) {
+						add(window, bottom++, T(1));
+					}
+					if (i >= radius) {
+						add(window, top++, T(-1));
+					}
+				}
+			}
+
+			/*
+				Guided filter, first pass: per window, the coefficients of out = a * guide + b.
+				Integer sums are exact, so sliding them never drifts.
+			*/
+			void coefficients(const ImageData& in, const ImageData& guide, size_t radius, double epsilon,
+							  std::vector<float>& a, std::vector<float>& b) {
+				size_t rows = in.size();
+				size_t columns = in[0].size();
+				bool self = &in == &guide;
+				enum { I, P, II, IP };
+
+				auto add = [&](WindowSums<int64_t, 4>& window, size_t row, int64_t sign) {
+					const short* g = guide[row].data();
+					const short* p = in[row].data();
+					int64_t* sumI = window.column(I);
+					int64_t* sumII = window.column(II);
+					for (size_t j = 0; j < columns; ++j) {
+						sumI[j] += sign * g[j];
+						sumII[j] += sign * g[j] * g[j];
+					}
+					if (!self) {
+						int64_t* sumP = window.column(P);
+						int64_t* sumIP = window.column(IP);
+						for (size_t j = 0; j < columns; ++j) {
+							sumP[j] += sign * p[j];
+							sumIP[j] += sign * g[j] * p[j];
+						}
+					}
+				};
+
+				ThreadPool& pool = ThreadPool::instance();
+				size_t bands = std::min(rows, pool.threadCount() * BANDS_PER_THREAD);
+
+				pool.parallelForBands(0, rows, bands, [&](size_t rowBegin, size_t rowEnd) {
+					slideRows<int64_t, 4>(rows, columns, radius, rowBegin, rowEnd, add,
+										  [&](size_t i, const WindowSums<int64_t, 4>& window, size_t windowRows) {
+						float* rowA = a.data() + i * columns;
+						float* rowB = b.data() + i * columns;
+						for (size_t j = 0; j < columns; ++j) {
+							size_t left = j - std::min(j, radius);
+							size_t right = std::min(columns, j + radius + 1);
+							double n = static_cast<double>(windowRows * (right - left));
+
+							double meanI = window.sum(I, left, right) / n;
+							double meanII = window.sum(II, left, right) / n;
+							double meanP = self ? meanI : window.sum(P, left, right) / n;
+							double meanIP = self ? meanII : window.sum(IP, left, right) / n;
+
+							double variance = meanII - meanI * meanI;
+							double covariance = meanIP - meanI * meanP;
+							double slope = covariance / (variance + epsilon);
+							rowA[j] = static_cast<float>(slope);
+							rowB[j] = static_cast<float>(meanP - slope * meanI);
+						}
+					});
+				});
+			}
+
+			// Guided filter, second pass: averages the coefficients of every window covering a pixel.
+			void applyCoefficients(const ImageData& guide, size_t radius, const std::vector<float>& a,
+								   const std::vector<float>& b, ImageData& out, short depth) {
+				size_t rows = guide.size();
+				size_t columns = guide[0].size();
+
+				auto add = [&](WindowSums<double, 2>& window, size_t row, double sign) {
+					const float* rowA = a.data() + row * columns;
+					const float* rowB = b.data() + row * columns;
+					double* sumA = window.column(0);
+					double* sumB = window.column(1);
+					for (size_t j = 0; j < columns; ++j) {
+						sumA[j] += sign * rowA[j];
+						sumB[j] += sign * rowB[j];
+					}
+				};
+
+				ThreadPool& pool = ThreadPool::instance();
+				size_t bands = std::min(rows, pool.threadCount() * BANDS_PER_THREAD);
+
+				pool.parallelForBands(0, rows, bands, [&](size_t rowBegin, size_t rowEnd) {
+					slideRows<double, 2>(rows, columns, radius, rowBegin, rowEnd, add,
+										 [&](size_t i, const WindowSums<double, 2>& window, size_t windowRows) {
+						const short* g = guide[i].data();
+						short* dst = out[i].data();
+						for (size_t j = 0; j < columns; ++j) {
+							size_t left = j - std::min(j, radius);
+							size_t right = std::min(columns, j + radius + 1);
+							double n = static_cast<double>(windowRows * (right - left));
+							dst[j] = toPixel(window.sum(0, left, right) / n * g[j] + window.sum(1, left, right) / n, depth);
+						}
+					});
+				});
+			}
+
+			// Bilateral filter summed over the whole window, for small spatial sigmas.
+			void bilateralDirect(const ImageData& in, ImageData& out, double spatialSigma, double rangeSigma, short depth) {
+				size_t rows = in.size();
+				size_t columns = in[0].size();
+				size_t radius = static_cast<size_t>(std::ceil(2 * spatialSigma));
+				size_t side = 2 * radius + 1;
+
+				std::vector<float> spatial(side * side);
+				for (size_t u = 0; u < side; ++u) {
+					for (size_t v = 0; v < side; ++v) {
+						double dy = static_cast<double>(u) - radius;
+						double dx = static_cast<double>(v) - radius;
+						spatial[u * side + v] = static_cast<float>(std::exp(-(dx * dx + dy * dy) / (2 * spatialSigma * spatialSigma)));
+					}
+				}
+
+				// Range weight of every possible absolute difference.
+				std::vector<float> range(static_cast<size_t>(depth) + 1);
+				for (size_t d = 0; d < range.size(); ++d) {
+					double difference = static_cast<double>(d);
+					range[d] = static_cast<float>(std::exp(-difference * difference / (2 * rangeSigma * rangeSigma)));
+				}
+
+				// Source column of every window column, mirrored at the borders.
+				std::vector<size_t> source(columns + 2 * radius);
+				for (size_t j = 0; j < source.size(); ++j) {
+					source[j] = Border::mirror(static_cast<long>(j) - static_cast<long>(radius), columns);
+				}
+
+				ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+					std::vector<const short*> window(side);
+
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						for (size_t u = 0; u < side; ++u) {
+							window[u] = in[Border::mirror(static_cast<long>(i + u) - static_cast<long>(radius), rows)].data();
+						}
+
+						const short* centre = in[i].data();
+						short* dst = out[i].data();
+						for (size_t j = 0; j < columns; ++j) {
+							const size_t* columnsOf = source.data() + j;
+							float sum = 0;
+							float weights = 0;
+							for (size_t u = 0; u < side; ++u) {
+								const short* src = window[u];
+								const float* taps = spatial.data() + u * side;
+								for (size_t v = 0; v < side; ++v) {
+									short value = src[columnsOf[v]];
+									size_t difference = std::min<size_t>(std::abs(value - centre[j]), depth);
+									float weight = taps[v] * range[difference];
+									sum += weight * value;
+									weights += weight;
+								}
+							}
+							dst[j] = toPixel(sum / weights, depth);
+						}
+					}
+				});
+			}
+
+			// A bilateral grid cell: weighted sum of intensities and sum of weights.
+			struct Cell {
+				float sum = 0;
+				float weight = 0;
+			};
+
+			// out[k] = in[k - 2 * stride] + 4 in[k - stride] + 6 in[k] + 4 in[k + stride] + in[k + 2 * stride]
+			void blur(const Cell* in, Cell* out, size_t count, size_t stride) {
+				for (size_t k = 0; k < count; ++k) {
+					const Cell& m2 = in[k - 2 * stride];
+					const Cell& m1 = in[k - stride];
+					const Cell& c = in[k];
+					const Cell& p1 = in[k + stride];
+					const Cell& p2 = in[k + 2 * stride];
+					out[k].sum = m2.sum + 4 * m1.sum + 6 * c.sum + 4 * p1.sum + p2.sum;
+					out[k].weight = m2.weight + 4 * m1.weight + 6 * c.weight + 4 * p1.weight + p2.weight;
+				}
+			}
+
+			/*
+				Bilateral grid. Grid coordinates are (row / spatialSigma, column / spatialSigma,
+				value / rangeSigma); pixels go to their nearest cell, the grid is blurred with a 5-tap
+				binomial (std. deviation of one cell) along each axis and read back trilinearly.
+			*/
+			void bilateralGrid(const ImageData& in, ImageData& out, double spatialSigma, double rangeSigma, short depth) {
+				size_t rows = in.size();
+				size_t columns = in[0].size();
+				float toCell = static_cast<float>(1 / spatialSigma);
+				float toLevel = static_cast<float>(1 / rangeSigma);
+
+				// Grid positions of the rows and columns, computed once so splatting and slicing agree.
+				std::vector<float> rowPosition(rows);
+				std::vector<float> columnPosition(columns);
+				for (size_t i = 0; i < rows; ++i) {
+					rowPosition[i] = i * toCell;
+				}
+				for (size_t j = 0; j < columns; ++j) {
+					columnPosition[j] = j * toCell;
+				}
+
+				// Cells of the unpadded grid; slicing reads one cell past the last position.
+				size_t gridRows = static_cast<size_t>(rowPosition[rows - 1]) + 1;
+				size_t gridColumns = static_cast<size_t>(std::lround(columnPosition[columns - 1])) + 1;
+				size_t gridLevels = static_cast<size_t>(std::lround(depth * toLevel)) + 1;
+				size_t width = gridColumns + 1 + 2 * GRID_PAD;
+				size_t levels = gridLevels + 1 + 2 * GRID_PAD;
+				size_t rowCells = width * levels;
+
+				ThreadPool& pool = ThreadPool::instance();
+				size_t bands = std::max(pool.threadCount(), (gridRows + GRID_BAND_ROWS - 1) / GRID_BAND_ROWS);
+
+				// Each band slices grid rows [gridBegin, gridEnd), from its own grid of those rows plus margins.
+				pool.parallelForBands(0, gridRows, bands, [&](size_t gridBegin, size_t gridEnd) {
+					size_t height = gridEnd - gridBegin + 1 + 2 * GRID_PAD;
+					std::vector<Cell> grid(height * rowCells);
+					std::vector<Cell> blurred(height * rowCells);
+					auto local = [gridBegin](float position) { return position - gridBegin + GRID_PAD; };
+
+					// Splat the pixels whose nearest grid row lies in the band or its margins.
+					long lowest = static_cast<long>(gridBegin) - static_cast<long>(GRID_PAD);
+					long highest = static_cast<long>(gridEnd + GRID_PAD);
+					for (size_t i = 0; i < rows; ++i) {
+						long gridRow = std::lround(rowPosition[i]);
+						if (gridRow < lowest || gridRow > highest) {
+							continue;
+						}
+
+						Cell* row = grid.data() + static_cast<size_t>(gridRow - lowest) * rowCells;
+						const short* src = in[i].data();
+						for (size_t j = 0; j < columns; ++j) {
+							size_t column = static_cast<size_t>(std::lround(columnPosition[j])) + GRID_PAD;
+							size_t level = static_cast<size_t>(std::lround(src[j] * toLevel)) + GRID_PAD;
+							Cell& cell = row[column * levels + level];
+							cell.sum += src[j];
+							cell.weight += 1;
+						}
+					}
+
+					// Blur rows, then columns, then levels, only where slicing reads.
+					size_t firstRow = GRID_PAD;
+					size_t lastRow = height - GRID_PAD;
+					for (size_t y = firstRow; y < lastRow; ++y) {
+						blur(grid.data() + y * rowCells, blurred.data() + y * rowCells, rowCells, rowCells);
+					}
+					for (size_t y = firstRow; y < lastRow; ++y) {
+						size_t first = y * rowCells + GRID_PAD * levels;
+						blur(blurred.data() + first, grid.data() + first, (width - 2 * GRID_PAD) * levels, levels);
+					}
+					for (size_t y = firstRow; y < lastRow; ++y) {
+						for (size_t x = GRID_PAD; x < width - GRID_PAD; ++x) {
+							size_t first = y * rowCells + x * levels + GRID_PAD;
+							blur(grid.data() + first, blurred.data() + first, levels - 2 * GRID_PAD, 1);
+						}
+					}
+
+					// Slice the pixel rows whose grid position falls in the band.
+					for (size_t i = 0; i < rows; ++i) {
+						size_t gridRow = static_cast<size_t>(rowPosition[i]);
+						if (gridRow < gridBegin || gridRow >= gridEnd) {
+							continue;
+						}
+
+						float y = local(rowPosition[i]);
+						size_t y0 = static_cast<size_t>(y);
+						float fy = y - y0;
+						const short* src = in[i].data();
+						short* dst = out[i].data();
+
+						for (size_t j = 0; j < columns; ++j) {
+							float x = columnPosition[j] + GRID_PAD;
+							float z = src[j] * toLevel + GRID_PAD;
+							size_t x0 = static_cast<size_t>(x);
+							size_t z0 = static_cast<size_t>(z);
+							float fx = x - x0;
+							float fz = z - z0;
+
+							float sum = 0;
+							float weight = 0;
+							for (size_t dy = 0; dy < 2; ++dy) {
+								float wy = dy ? fy : 1 - fy;
+								for (size_t dx = 0; dx < 2; ++dx) {
+									float wxy = wy * (dx ? fx : 1 - fx);
+									const Cell* cells = blurred.data() + (y0 + dy) * rowCells + (x0 + dx) * levels + z0;
+									float w0 = wxy * (1 - fz);
+									float w1 = wxy * fz;
+									sum += w0 * cells[0].sum + w1 * cells[1].sum;
+									weight += w0 * cells[0].weight + w1 * cells[1].weight;
+								}
+							}
+							dst[j] = weight > 0 ? toPixel(sum / weight, depth) : src[j];
+						}
+					}
+				});
+			}
+		}
+
+		void guided(const ImageData& in, const ImageData& guide, ImageData& out, size_t radius, double epsilon, short depth) {
+			if (in.empty() || in[0].empty()) {
+				return;
+			}
+
+			size_t pixels = in.size() * in[0].size();
+			std::vector<float> a(pixels);
+			std::vector<float> b(pixels);
+			double scale = static_cast<double>(depth);
+
+			coefficients(in, guide, radius, epsilon * scale * scale, a, b);
+			applyCoefficients(guide, radius, a, b, out, depth);
+		}
+
+		void bilateral(const ImageData& in, ImageData& out, double spatialSigma, double rangeSigma, short depth) {
+			if (in.empty() || in[0].empty()) {
+				return;
+			}
+
+			spatialSigma = std::max(spatialSigma, 0.1);
+			rangeSigma = std::max(rangeSigma, 0.1);
+
+			if (spatialSigma < Consts::BILATERAL_GRID_SIGMA) {
+				bilateralDirect(in, out, spatialSigma, rangeSigma, depth);
+			} else {
+				bilateralGrid(in, out, spatialSigma, rangeSigma, depth);
+			}
+		}
+	}
+}
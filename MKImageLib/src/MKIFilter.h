@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	// Edge-preserving smoothing.
+	namespace Filter {
+		/*
+			Guided filter (He et al.): "out" is locally a linear function of "guide" that best fits
+			"in" over (2 * radius + 1)^2 windows, so edges of the guide survive while flat areas are
+			averaged. Pass the image as its own guide for plain edge-preserving smoothing.
+
+			epsilon = regularisation relative to the squared depth, e.g. 0.01 smooths edges with
+			contrast below about 0.1 * depth. Windows are cut at the image border.
+
+			Window sums come from sliding column sums (exact integer sums in the first pass), so the
+			cost per pixel does not depend on the radius. Both passes run on the ThreadPool in row
+			bands.
+		*/
+		void guided(const ImageData& in, const ImageData& guide, ImageData& out, size_t radius, double epsilon, short depth);
+
+		/*
+			Bilateral filter: a Gaussian of std. deviation spatialSigma (pixels) whose weights fall
+			off with the intensity difference as a Gaussian of std. deviation rangeSigma (grey levels).
+
+			Below Consts::BILATERAL_GRID_SIGMA the window is summed directly, with the range weights
+			taken from a table indexed by the difference. Larger filters use a bilateral grid (Paris &
+			Durand): pixels are accumulated into cells of spatialSigma x spatialSigma pixels by
+			rangeSigma levels, the grid is blurred and the result is read back with trilinear
+			interpolation. The grid is built band by band (with a margin for the blur), so its memory
+			stays bounded and bands run in parallel.
+		*/
+		void bilateral(const ImageData& in, ImageData& out, double spatialSigma, double rangeSigma, short depth);
+	}
+}
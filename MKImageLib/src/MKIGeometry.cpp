@@ -0,0 +1,234 @@
+#include "MKIGeometry.h"
+
+#include "MKIThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace MKImage {
+	namespace Geometry {
+		namespace {
+			constexpr size_t TILE = 8;
+			// Cache block: 64 x 64 shorts in and out fits comfortably in L1 alongside the row pointers.
+			constexpr size_t BLOCK = 64;
+
+			/*
+				Copies the 8x8 tile at (row, column) of "in" to its transposed position in "out".
+				reverseRows / reverseColumns mirror the source rows / columns on the way,
+				which turns the transpose into a rotation or a transverse.
+			*/
+			void transposeTile(const ImageData& in, ImageData& out, size_t row, size_t column,
+							   bool reverseRows, bool reverseColumns) {
+				size_t rows = in.size();
+				size_t columns = in[0].size();
+				size_t outColumn = reverseRows ? rows - TILE - row : row;
+
+#ifdef __SSE2__
+				__m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[row + 0].data() + column));
+				__m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[row + 1].data() + column));
+				__m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[row + 2].data() + column));
+				__m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[row + 3].data() + column));
+				__m128i r4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[row + 4].data() + column));
+				__m128i r5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[row + 5].data() + column));
+				__m128i r6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[row + 6].data() + column));
+				__m128i r7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in[row + 7].data() + column));
+
+				__m128i t0 = _mm_unpacklo_epi16(r0, r1);
+				__m128i t1 = _mm_unpackhi_epi16(r0, r1);
+				__m128i t2 = _mm_unpacklo_epi16(r2, r3);
+				__m128i t3 = _mm_unpackhi_epi16(r2, r3);
+				__m128i t4 = _mm_unpacklo_epi16(r4, r5);
+				__m128i t5 = _mm_unpackhi_epi16(r4, r5);
+				__m128i t6 = _mm_unpacklo_epi16(r6, r7);
+				__m128i t7 = _mm_unpackhi_epi16(r6, r7);
+
+				__m128i u0 = _mm_unpacklo_epi32(t0, t2);
+				__m128i u1 = _mm_unpackhi_epi32(t0, t2);
+				__m128i u2 = _mm_unpacklo_epi32(t1, t3);
+				__m128i u3 = _mm_unpackhi_epi32(t1, t3);
+				__m128i u4 = _mm_unpacklo_epi32(t4, t6);
+				__m128i u5 = _mm_unpackhi_epi32(t4, t6);
+				__m128i u6 = _mm_unpacklo_epi32(t5, t7);
+				__m128i u7 = _mm_unpackhi_epi32(t5, t7);
+
+				__m128i transposed[TILE] = {
+					_mm_unpacklo_epi64(u0, u4), _mm_unpackhi_epi64(u0, u4),
+					_mm_unpacklo_epi64(u1, u5), _mm_unpackhi_epi64(u1, u5),
+					_mm_unpacklo_epi64(u2, u6), _mm_unpackhi_epi64(u2, u6),
+					_mm_unpacklo_epi64(u3, u7), _mm_unpackhi_epi64(u3, u7)
+				};
+
+				for (size_t k = 0; k < TILE; ++k) {
+					__m128i value = transposed[k];
+					if (reverseRows) {
+						value = _mm_shufflelo_epi16(value, 0x1B);
+						value = _mm_shufflehi_epi16(value, 0x1B);
+						value = _mm_shuffle_epi32(value, 0x4E);
+					}
+					size_t outRow = reverseColumns ? columns - 1 - (column + k) : column + k;
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out[outRow].data() + outColumn), value);
+				}
+#else
+				for (size_t k = 0; k < TILE; ++k) {
+					size_t outRow = reverseColumns ? columns - 1 - (column + k) : column + k;
+					short* dst = out[outRow].data() + outColumn;
+					for (size_t r = 0; r < TILE; ++r) {
+						dst[reverseRows ? TILE - 1 - r : r] = in[row + r][column + k];
+					}
+				}
+#endif
+			}
+
+			void transposePixel(const ImageData& in, ImageData& out, size_t row, size_t column,
+								bool reverseRows, bool reverseColumns) {
+				size_t outRow = reverseColumns ? in[0].size() - 1 - column : column;
+				size_t outColumn = reverseRows ? in.size() - 1 - row : row;
+				out[outRow][outColumn] = in[row][column];
+			}
+
+			void transposeBlocked(const ImageData& in, ImageData& out, bool reverseRows, bool reverseColumns) {
+				size_t rows = in.size();
+				size_t columns = in[0].size();
+				size_t blockColumns = (columns + BLOCK - 1) / BLOCK;
+
+				// Each thread owns a range of source column blocks, i.e. a range of destination rows.
+				ThreadPool::instance().parallelFor(0, blockColumns, [&](size_t blockBegin, size_t blockEnd) {
+					for (size_t bj = blockBegin; bj < blockEnd; ++bj) {
+						size_t columnBegin = bj * BLOCK;
+						size_t columnEnd = std::min(columns, columnBegin + BLOCK);
+
+						for (size_t rowBegin = 0; rowBegin < rows; rowBegin += BLOCK) {
+							size_t rowEnd = std::min(rows, rowBegin + BLOCK);
+
+							size_t i = rowBegin;
+							for (; i + TILE <= rowEnd; i += TILE) {
+								size_t j = columnBegin;
+								for (; j + TILE <= columnEnd; j += TILE) {
+									transposeTile(in, out, i, j, reverseRows, reverseColumns);
+								}
+								for (size_t r = i; r < i + TILE; ++r) {
+									for (size_t c = j; c < columnEnd; ++c) {
+										transposePixel(in, out, r, c, reverseRows, reverseColumns);
+									}
+								}
+							}
+							for (; i < rowEnd; ++i) {
+								for (size_t c = columnBegin; c < columnEnd; ++c) {
+									transposePixel(in, out, i, c, reverseRows, reverseColumns);
+								}
+							}
+						}
+					}
+				});
+			}
+		}
+
+		bool swapsDimensions(Operations operation) {
+			return operation == Operations::rotate90 || operation == Operations::rotate270 ||
+				operation == Operations::transpose || operation == Operations::transverse;
+		}
+
+		void apply(const ImageData& in, ImageData& out, Operations operation) {
+			size_t rows = in.size();
+
+			switch (operation) {
+			case Operations::transpose:
+				transposeBlocked(in, out, false, false);
+				return;
+			case Operations::rotate90:
+				transposeBlocked(in, out, true, false);
+				return;
+			case Operations::rotate270:
+				transposeBlocked(in, out, false, true);
+				return;
+			case Operations::transverse:
+				transposeBlocked(in, out, true, true);
+				return;
+			default:
+				break;
+			}
+
+			ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					switch (operation) {
+					case Operations::rotate180:
+						std::reverse_copy(in[i].begin(), in[i].end(), out[rows - 1 - i].begin());
+						break;
+					case Operations::flipHorizontal:
+						std::reverse_copy(in[i].begin(), in[i].end(), out[i].begin());
+						break;
+					case Operations::flipVertical:
+						std::copy(in[i].begin(), in[i].end(), out[rows - 1 - i].begin());
+						break;
+					default:
+						std::copy(in[i].begin(), in[i].end(), out[i].begin());
+						break;
+					}
+				}
+			});
+		}
+
+		AffineTransform AffineTransform::translation(double columns, double rows) {
+			AffineTransform t;
+			t.tx = columns;
+			t.ty = rows;
+			return t;
+		}
+
+		AffineTransform AffineTransform::scaling(double columnScale, double rowScale) {
+			AffineTransform t;
+			t.a = columnScale;
+			t.d = rowScale;
+			return t;
+		}
+
+		AffineTransform AffineTransform::rotation(double degrees, double centerColumn, double centerRow) {
+			double radians = degrees * M_PI / 180.0;
+			AffineTransform t;
+			t.a = std::cos(radians);
+			t.b = -std::sin(radians);
+			t.c = std::sin(radians);
+			t.d = std::cos(radians);
+			return translation(centerColumn, centerRow) * t * translation(-centerColumn, -centerRow);
+		}
+
+		AffineTransform AffineTransform::shear(double columnShear, double rowShear) {
+			AffineTransform t;
+			t.b = columnShear;
+			t.c = rowShear;
+			return t;
+		}
+
+		AffineTransform AffineTransform::inverted() const {
+			double determinant = a * d - b * c;
+			AffineTransform t;
+			if (determinant == 0.0) {
+				t.a = t.b = t.c = t.d = 0.0;
+				return t;
+			}
+
+			t.a = d / determinant;
+			t.b = -b / determinant;
+			t.c = -c / determinant;
+			t.d = a / determinant;
+			t.tx = -(t.a * tx + t.b * ty);
+			t.ty = -(t.c * tx + t.d * ty);
+			return t;
+		}
+
+		AffineTransform AffineTransform::operator*(const AffineTransform& rhs) const {
+			AffineTransform t;
+			t.a = a * rhs.a + b * rhs.c;
+			t.b = a * rhs.b + b * rhs.d;
+			t.c = c * rhs.a + d * rhs.c;
+			t.d = c * rhs.b + d * rhs.d;
+			t.tx = a * rhs.tx + b * rhs.ty + tx;
+			t.ty = c * rhs.tx + d * rhs.ty + ty;
+			return t;
+		}
+	}
+}
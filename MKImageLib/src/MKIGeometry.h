@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	namespace Geometry {
+		enum class Operations { unknown = 0, rotate90, rotate180, rotate270, flipHorizontal, flipVertical, transpose, transverse };
+
+		// True when the operation swaps the width and height of the image.
+		bool swapsDimensions(Operations operation);
+
+		/*
+			Rotations by multiples of 90 degrees (clockwise), flips and transposes.
+			Transposing operations work on cache-sized blocks split into 8x8 tiles that are
+			transposed in SSE2 registers where available.
+
+			in = source image, out = destination already sized for the result
+		*/
+		void apply(const ImageData& in, ImageData& out, Operations operation);
+
+		/*
+			2D affine transform mapping a source (column, row) to a destination (column, row):
+
+				column' = a * column + b * row + tx
+				row'    = c * column + d * row + ty
+		*/
+		struct AffineTransform {
+			double a = 1.0, b = 0.0, tx = 0.0;
+			double c = 0.0, d = 1.0, ty = 0.0;
+
+			static AffineTransform translation(double columns, double rows);
+			static AffineTransform scaling(double columnScale, double rowScale);
+			// Clockwise rotation in degrees (rows grow downwards) about (centerColumn, centerRow).
+			static AffineTransform rotation(double degrees, double centerColumn, double centerRow);
+			static AffineTransform shear(double columnShear, double rowShear);
+
+			AffineTransform inverted() const;
+
+			// Composition: (lhs * rhs) applies rhs first, then lhs.
+			AffineTransform operator*(const AffineTransform& rhs) const;
+		};
+	}
+}
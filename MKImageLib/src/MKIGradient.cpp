@@ -0,0 +1,215 @@
+#include "MKIGradient.h"
+
+#include "MKIBorder.h"
+#include "MKIThreadPool.h"
+#include "MKIUnionFind.h"
+
+#include <cmath>
+#include <cstdlib>
+
+namespace MKImage {
+	namespace Gradient {
+		namespace {
+			enum State : uint8_t { none = 0, weak, strong };
+
+			uint8_t quantise(long long gx, long long gy) {
+				long long ax = std::llabs(gx);
+				long long ay = std::llabs(gy);
+
+				// tan(22.5 deg) ~= 0.414, tan(67.5 deg) ~= 2.414
+				if (ay * 1000 <= ax * 414) {
+					return horizontal;
+				}
+				if (ay * 414 >= ax * 1000) {
+					return vertical;
+				}
+				return ((gx < 0) == (gy < 0)) ? diagonalDown : diagonalUp;
+			}
+		}
+
+		void compute(const ImageData& in, Field& field, Operations operation) {
+			size_t rows = in.size();
+			size_t columns = in.at(0).size();
+
+			field.rows = rows;
+			field.columns = columns;
+			field.magnitude.resize(rows * columns);
+			field.direction.resize(rows * columns);
+
+			// Smoothing weights of the separable kernel; the derivative is always [-1 0 1].
+			int outer = operation == Operations::scharr ? 3 : 1;
+			int inner = operation == Operations::scharr ? 10 : 2;
+
+			ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+				std::vector<int> smooth(columns), deriv(columns);
+
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					const short* above = in[Border::mirror(static_cast<long>(i) - 1, rows)].data();
+					const short* row = in[i].data();
+					const short* below = in[Border::mirror(static_cast<long>(i) + 1, rows)].data();
+
+					// Vertical half of both kernels for the whole row.
+					for (size_t j = 0; j < columns; ++j) {
+						smooth[j] = outer * above[j] + inner * row[j] + outer * below[j];
+						deriv[j] = below[j] - above[j];
+					}
+
+					float* magnitude = &field.magnitude[i * columns];
+					uint8_t* direction = &field.direction[i * columns];
+
+					// Horizontal half, fused with magnitude and orientation.
+					auto pixel = [&](size_t j, size_t left, size_t right) {
+						long long gx = smooth[right] - smooth[left];
+						long long gy = outer * deriv[left] + inner * deriv[j] + outer * deriv[right];
+
+						magnitude[j] = std::sqrt(static_cast<float>(gx * gx + gy * gy));
+						direction[j] = quantise(gx, gy);
+					};
+
+					pixel(0, Border::mirror(-1, columns), Border::mirror(1, columns));
+					for (size_t j = 1; j + 1 < columns; ++j) {
+						pixel(j, j - 1, j + 1);
+					}
+					if (columns > 1) {
+						pixel(columns - 1, Border::mirror(columns - 2, columns), Border::mirror(columns, columns));
+					}
+				}
+			});
+		}
+
+		void canny(const ImageData& in, ImageData& out, float lowThreshold, float highThreshold,
+				   Operations operation, short depth) {
+			Field field;
+			compute(in, field, operation);
+
+			size_t rows = field.rows;
+			size_t columns = field.columns;
+			std::vector<uint8_t> state(rows * columns);
+
+			// Non-maximum suppression and double threshold.
+			ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+				auto magnitudeAt = [&](long i, long j) -> float {
+					if (i < 0 || j < 0 || i >= static_cast<long>(rows) || j >= static_cast<long>(columns)) {
+						return 0.0f;
+					}
+					return field.magnitude[i * columns + j];
+				};
+
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					for (size_t j = 0; j < columns; ++j) {
+						size_t index = i * columns + j;
+						float m = field.magnitude[index];
+						if (m < lowThreshold) {
+							continue;
+						}
+
+						long y = static_cast<long>(i);
+						long x = static_cast<long>(j);
+						float before, after;
+						switch (field.direction[index]) {
+						case horizontal:
+							before = magnitudeAt(y, x - 1);
+							after = magnitudeAt(y, x + 1);
+							break;
+						case diagonalDown:
+							before = magnitudeAt(y - 1, x - 1);
+							after = magnitudeAt(y + 1, x + 1);
+							break;
+						case vertical:
+							before = magnitudeAt(y - 1, x);
+							after = magnitudeAt(y + 1, x);
+							break;
+						default:
+							before = magnitudeAt(y - 1, x + 1);
+							after = magnitudeAt(y + 1, x - 1);
+							break;
+						}
+
+						// Ties keep only the first pixel so plateaus stay one pixel thick.
+						if (m > before && m >= after) {
+							state[index] = m >= highThreshold ? strong : weak;
+						}
+					}
+				}
+			});
+
+			// Hysteresis: label weak/strong components per band, then merge across band borders.
+			UnionFind sets(rows * columns);
+			std::vector<uint8_t> hasStrong(rows * columns);
+			std::vector<uint8_t> bandStart(rows);
+
+			ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+				bandStart[rowBegin] = 1;
+
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					for (size_t j = 0; j < columns; ++j) {
+						uint32_t index = static_cast<uint32_t>(i * columns + j);
+						if (state[index] == none) {
+							continue;
+						}
+
+						if (j > 0 && state[index - 1] != none) {
+							sets.unite(index, index - 1);
+						}
+						if (i > rowBegin) {
+							uint32_t up = index - static_cast<uint32_t>(columns);
+							if (j > 0 && state[up - 1] != none) {
+								sets.unite(index, up - 1);
+							}
+							if (state[up] != none) {
+								sets.unite(index, up);
+							}
+							if (j + 1 < columns && state[up + 1] != none) {
+								sets.unite(index, up + 1);
+							}
+						}
+					}
+				}
+
+				// Roots of this band's sets are inside the band, so these writes do not overlap other bands.
+				for (size_t index = rowBegin * columns; index < rowEnd * columns; ++index) {
+					if (state[index] == strong) {
+						hasStrong[sets.find(static_cast<uint32_t>(index))] = 1;
+					}
+				}
+			});
+
+			for (size_t i = 1; i < rows; ++i) {
+				if (!bandStart[i]) {
+					continue;
+				}
+
+				for (size_t j = 0; j < columns; ++j) {
+					uint32_t index = static_cast<uint32_t>(i * columns + j);
+					if (state[index] == none) {
+						continue;
+					}
+
+					uint32_t up = index - static_cast<uint32_t>(columns);
+					for (long k = -1; k <= 1; ++k) {
+						long column = static_cast<long>(j) + k;
+						if (column < 0 || column >= static_cast<long>(columns) || state[up + k] == none) {
+							continue;
+						}
+
+						uint32_t a = sets.find(index);
+						uint32_t b = sets.find(static_cast<uint32_t>(up + k));
+						if (a != b) {
+							hasStrong[sets.unite(a, b)] = hasStrong[a] | hasStrong[b];
+						}
+					}
+				}
+			}
+
+			ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					for (size_t j = 0; j < columns; ++j) {
+						uint32_t index = static_cast<uint32_t>(i * columns + j);
+						bool edge = state[index] != none && hasStrong[sets.root(index)];
+						out[i][j] = edge ? depth : 0;
+					}
+				}
+			});
+		}
+	}
+}
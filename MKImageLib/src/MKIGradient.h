@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	namespace Gradient {
+		enum class Operations { unknown = 0, sobel, scharr };
+
+		// Gradient orientation quantised to the four neighbour axes used by non-maximum suppression.
+		enum Direction : uint8_t { horizontal = 0, diagonalDown, vertical, diagonalUp };
+
+		/*
+			Gradient magnitude (L2) and quantised orientation of every pixel, stored row-major.
+			"horizontal" means the gradient points along the x axis, i.e. the edge is vertical.
+		*/
+		struct Field {
+			size_t rows = 0;
+			size_t columns = 0;
+			std::vector<float> magnitude;
+			std::vector<uint8_t> direction;
+
+			float magnitudeAt(size_t row, size_t column) const { return magnitude[row * columns + column]; }
+			uint8_t directionAt(size_t row, size_t column) const { return direction[row * columns + column]; }
+		};
+
+		/*
+			Computes Gx and Gy with a separable 3x3 Sobel or Scharr kernel and turns them into magnitude and
+			orientation in the same pass over the image. Borders are mirrored like Mask.
+		*/
+		void compute(const ImageData& in, Field& field, Operations operation);
+
+		/*
+			Canny edge detection: gradient, non-maximum suppression along the quantised orientation,
+			then hysteresis. Weak pixels (>= lowThreshold) survive only when their 8-connected
+			component contains a strong pixel (>= highThreshold); components are found with a
+			banded parallel union-find. Edges are written as "depth", everything else as 0.
+		*/
+		void canny(const ImageData& in, ImageData& out, float lowThreshold, float highThreshold,
+				   Operations operation, short depth);
+	}
+}
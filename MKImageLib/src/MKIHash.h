@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace MKImage {
+	namespace Hash {
+		namespace Detail {
+			constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+			constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+			constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+			constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+			constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+			inline uint64_t rotate(uint64_t value, int bits) {
+				return (value << bits) | (value >> (64 - bits));
+			}
+
+			inline uint64_t read64(const unsigned char* p) {
+				uint64_t value;
+				std::memcpy(&value, p, sizeof(value));
+				return value;
+			}
+
+			inline uint32_t read32(const unsigned char* p) {
+				uint32_t value;
+				std::memcpy(&value, p, sizeof(value));
+				return value;
+			}
+
+			inline uint64_t round(uint64_t accumulator, uint64_t input) {
+				accumulator += input * PRIME2;
+				return rotate(accumulator, 31) * PRIME1;
+			}
+
+			inline uint64_t merge(uint64_t accumulator, uint64_t lane) {
+				accumulator ^= round(0, lane);
+				return accumulator * PRIME1 + PRIME4;
+			}
+		}
+
+		/*
+			XXH64 of "bytes" bytes at "data" (the reference algorithm, on the machine's byte order):
+			four independent lanes over 32-byte stripes, so it runs at memory speed.
+		*/
+		inline uint64_t xxh64(const void* data, size_t bytes, uint64_t seed = 0) {
+			using namespace Detail;
+
+			const unsigned char* p = static_cast<const unsigned char*>(data);
+			const unsigned char* end = p + bytes;
+			uint64_t hash;
+
+			if (bytes >= 32) {
+				uint64_t v1 = seed + PRIME1 + PRIME2;
+				uint64_t v2 = seed + PRIME2;
+				uint64_t v3 = seed;
+				uint64_t v4 = seed - PRIME1;
+				for (; p + 32 <= end; p += 32) {
+					v1 = round(v1, read64(p));
+					v2 = round(v2, read64(p + 8));
+					v3 = round(v3, read64(p + 16));
+					v4 = round(v4, read64(p + 24));
+				}
+				hash = rotate(v1, 1) + rotate(v2, 7) + rotate(v3, 12) + rotate(v4, 18);
+				hash = merge(hash, v1);
+				hash = merge(hash, v2);
+				hash = merge(hash, v3);
+				hash = merge(hash, v4);
+			} else {
+				hash = seed + PRIME5;
+			}
+
+			hash += static_cast<uint64_t>(bytes);
+
+			for (; p + 8 <= end; p += 8) {
+				hash ^= round(0, read64(p));
+				hash = rotate(hash, 27) * PRIME1 + PRIME4;
+			}
+			if (p + 4 <= end) {
+				hash ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+				hash = rotate(hash, 23) * PRIME2 + PRIME3;
+				p += 4;
+			}
+			for (; p < end; ++p) {
+				hash ^= (*p) * PRIME5;
+				hash = rotate(hash, 11) * PRIME1;
+			}
+
+			hash ^= hash >> 33;
+			hash *= PRIME2;
+			hash ^= hash >> 29;
+			hash *= PRIME3;
+			hash ^= hash >> 32;
+			return hash;
+		}
+	}
+}
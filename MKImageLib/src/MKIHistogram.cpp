@@ -21,17 +21,49 @@ namespace MKImage {
 		calcVar();
 	}
 
+	MKIHistogram::MKIHistogram(const Image& image, const Region& region) :
+		m_Data{}, m_EQData{}, m_Avg{-1.0}, m_Var{-1.0} {
+		make(image, region);
+		calcAvg();
+		calcVar();
+	}
+
+	MKIHistogram::MKIHistogram(const ImageView& view) :
+		MKIHistogram{ view.parent(), view.region() } {
+	}
+
+	MKIHistogram::MKIHistogram(const std::vector<size_t>& counts, size_t pixels) :
+		m_Data(counts.size(), 0.0), m_EQData{}, m_Avg{-1.0}, m_Var{-1.0} {
+		if (pixels > 0) {
+			for (size_t i = 0; i < counts.size(); ++i) {
+				m_Data[i] = static_cast<double>(counts[i]) / pixels;
+			}
+		}
+		calcAvg();
+		calcVar();
+	}
+
 	void MKIHistogram::make(const Image& image) {
+		make(image, image.region());
+	}
+
+	void MKIHistogram::make(const Image& image, const Region& region) {
+		Region area = region.clipped(image.rows(), image.columns());
+
 		m_Data.resize(image.depth() + 1);
 
-		for (const auto& i : image.data()) {
-			for (const auto& j : i) {
-				++m_Data.at(j);
+		for (size_t i = area.row; i < area.row + area.height; ++i) {
+			const short* row = image.data()[i].data() + area.column;
+			for (size_t j = 0; j < area.width; ++j) {
+				++m_Data.at(row[j]);
 			}
 		}
 
-		for (auto& i : m_Data) {
-			i = i / (image.rows() * image.columns());
+		// A region outside the image leaves every bin at zero.
+		if (area.pixels() > 0) {
+			for (auto& i : m_Data) {
+				i = i / area.pixels();
+			}
 		}
 	}
 
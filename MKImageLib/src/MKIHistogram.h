@@ -14,11 +14,19 @@ namespace MKImage {
 	public:
 		MKIHistogram();
 		MKIHistogram(const Image& image);
+		// Histogram of the pixels inside "region" only.
+		MKIHistogram(const Image& image, const Region& region);
+		MKIHistogram(const ImageView& view);
+		// From pixel counts per level, e.g. gathered by Image::pointProcessing() while it ran.
+		MKIHistogram(const std::vector<size_t>& counts, size_t pixels);
 
 		const std::vector<double> data() const { return m_Data; }
 		const std::vector<double> eqData() const { return m_EQData; }
+		double average() const { return m_Avg; }
+		double variance() const { return m_Var; }
 
 		void make(const Image& image);
+		void make(const Image& image, const Region& region);
 		void calcAvg();
 		void calcVar();
 
@@ -1,17 +1,26 @@
 #include "MKIImage.h"
 
 #include "MKIImageConstants.h"
+#include "MKIThreadPool.h"
+#include "MKIFFT.h"
+#include "MKITrace.h"
+#include "MKIBufferPool.h"
+#include "MKIPnm.h"
+#include "MKITiles.h"
+#include "MKIHistogram.h"
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <cmath>
+#include <algorithm>
+#include <limits>
 
 namespace MKImage {
 	
 	Image::Image() 
 		: m_File{}, m_FileType{}, m_Rows{ 0 }, m_Columns{ 0 },
-		m_Depth{ -1 }, m_MinLevel{ 255 }, m_MaxLevel{ 0 }, m_Body(),
+		m_Depth{ -1 }, m_MinLevel{ 255 }, m_MaxLevel{ 0 }, m_Storage(),
 		m_MinMaxMutex{}, m_BadImage{ true } {
 	}
 
@@ -21,20 +30,48 @@ namespace MKImage {
 		load(file);
 	}
 
+	Image::Image(ImageData data, short depth, FileType type)
+		: Image{} {
+
+		m_FileType = type;
+		m_Rows = data.size();
+		m_Columns = data.empty() ? 0 : data.at(0).size();
+		m_Depth = depth;
+		m_BadImage = data.empty();
+
+		// Scanned from the widest range, not the defaults, so levels outside 0..255 are found too.
+		m_MinLevel = m_Rows * m_Columns == 0 ? 0 : std::numeric_limits<short>::max();
+		m_MaxLevel = m_Rows * m_Columns == 0 ? 0 : std::numeric_limits<short>::min();
+		for (const auto& i : data) {
+			for (auto j : i) {
+				if (j < m_MinLevel)
+					m_MinLevel = j;
+				if (j > m_MaxLevel)
+					m_MaxLevel = j;
+			}
+		}
+
+		m_Storage.reset(std::move(data));
+	}
+
 	Image::Image(const Image& other) 
 		: m_File{ other.m_File }, m_FileType{ other.m_FileType },
 		m_Rows{ other.m_Rows }, m_Columns{ other.m_Columns }, m_Depth{ other.m_Depth }, m_MinLevel{ other.m_MinLevel },
-		m_MaxLevel{ other.m_MaxLevel }, m_Body(other.m_Body), m_MinMaxMutex{}, m_BadImage{ other.m_BadImage } {
+		m_MaxLevel{ other.m_MaxLevel }, m_Storage(other.m_Storage), m_MinMaxMutex{}, m_BadImage{ other.m_BadImage } {
 	}
 
-	Image::Image(const Image&& other) 
+	Image::Image(Image&& other) 
 		: m_File{ std::move(other.m_File) }, m_FileType{ std::move(other.m_FileType) },
 		m_Rows{ other.m_Rows }, m_Columns{ other.m_Columns }, m_Depth{ other.m_Depth }, m_MinLevel{ other.m_MinLevel },
-		m_MaxLevel{ other.m_MaxLevel }, m_Body(std::move(other.m_Body)), m_MinMaxMutex{}, m_BadImage{ other.m_BadImage } {
+		m_MaxLevel{ other.m_MaxLevel }, m_Storage(std::move(other.m_Storage)), m_MinMaxMutex{}, m_BadImage{ other.m_BadImage } {
 
 	}
 
-	Image& Image::operator=(Image& rhs) {
+	Image& Image::operator=(const Image& rhs) {
+		if (this == &rhs) {
+			return *this;
+		}
+
 		m_File = rhs.m_File;
 		m_FileType = rhs.m_FileType;
 		m_Rows = rhs.m_Rows;
@@ -42,8 +79,10 @@ namespace MKImage {
 		m_Depth = rhs.m_Depth;
 		m_MinLevel = rhs.m_MinLevel;
 		m_MaxLevel = rhs.m_MaxLevel;
-		m_Body = rhs.m_Body;
+		m_Storage = rhs.m_Storage;
 		m_BadImage = rhs.m_BadImage;
+
+		return *this;
 	}
 
 	void Image::protectRange(short& val) {
@@ -63,49 +102,54 @@ namespace MKImage {
 	}
 
 	void Image::load(const std::string& file) {
-		m_File.assign(FS::current_path());
-		m_File /= file;
-		if (!FS::exists(m_File)) {
-			m_File.assign(FS::current_path());
-			m_File /= Consts::INPUT_FOLDER;
-			m_File /= file;
-		}
-		if (!FS::exists(m_File)) {
+		Trace::Scope trace("load", "io");
+
+		m_File = Pnm::findInput(file);
+
+		std::vector<char> buffer;
+		Pnm::Header header;
+		if (!FS::exists(m_File) || !Pnm::readFile(m_File.string(), buffer) ||
+			!Pnm::parseHeader(buffer.data(), buffer.size(), header)) {
 			std::cout << "Image failed to load";
 			m_BadImage = true;
 			return;
 		}
-		
-		readHeader(m_File.generic_string());
-
-		if (m_FileType == "P5") {
-			loadBin(m_File);
-		}
-		else {
-			loadText(m_File);
+		if (Pnm::isColour(header.type)) {
+			std::cout << "Image failed to load: colour images load with MultiImage";
+			m_BadImage = true;
+			return;
 		}
-		m_BadImage = false;
-		std::cout<< '\n' << file << " opened successful.\n";
+
+		decode(buffer, header);
+
+		trace.addPixels(m_Rows * m_Columns);
+		trace.addBytes(buffer.size());
 	}
 
 	void Image::save(const std::string& file, const std::string& comment) {
-		Path outFile{ m_File.parent_path() };
-		outFile /= Consts::OUTPUT_FOLDER;
-		
-		if (!FS::exists(outFile)) {
-			FS::create_directory(outFile);
-		}
+		save(file, comment, region());
+	}
+
+	void Image::save(const std::string& file, const std::string& comment, const Region& region) {
+		Trace::Scope trace("save", "io");
+
+		Region area = region.clipped(m_Rows, m_Columns);
 
-		outFile /= file;
+		Path outFile = Pnm::outputPath(m_File, file);
 
-		if (m_FileType == FileType::P4 || m_FileType == FileType::P5 || m_FileType == FileType::P6) {
-			saveBin(outFile, comment);
+		if (Pnm::isBinary(m_FileType)) {
+			saveBin(outFile, comment, area);
 		}
 		else {
-			saveText(outFile, comment);
+			saveText(outFile, comment, area);
 		}
 
-		std::cout << '\n' << file << " saved successfully.\n";
+		trace.addPixels(area.pixels());
+		std::error_code error;
+		uintmax_t written = FS::file_size(outFile, error);
+		if (!error) {
+			trace.addBytes(written);
+		}
 	}
 
 	void Image::saveCopy(const std::string& comment) {
@@ -122,320 +166,664 @@ namespace MKImage {
 		save(outName, comment);
 	}
 
-	void Image::maskProcessing(const Mask& mask) {
-		auto funcStart = std::chrono::high_resolution_clock::now();
-		std::cout << "\nMasking started.\n";
+	void Image::saveTiled(const std::string& file, size_t tileSize) {
+		Trace::Scope trace("saveTiled", "io");
 
-		ImageData::iterator mid = m_Body.begin() + (std::distance(m_Body.begin(), m_Body.end()) / 2);
-		ImageData::iterator oneQuarter = m_Body.begin() + (std::distance(m_Body.begin(), mid) / 2);
-		ImageData::iterator threeQuarter = mid + (std::distance(mid, m_Body.end()) / 2);
+		Path outFile = Pnm::outputPath(m_File, file);
 
-		ImageData temp(m_Body.size(), std::vector<short>(m_Body.at(0).size()));
+		std::vector<unsigned char> bytes;
+		Tiles::encode(data(), region(), m_Depth, tileSize, bytes);
 
-		Image::MaskProcessFunct mpFirst(*this, temp, m_Body.begin(), oneQuarter);
-		Image::MaskProcessFunct mpSecond(*this, temp, oneQuarter, mid);
-		Image::MaskProcessFunct mpThird(*this, temp, mid, threeQuarter);
-		Image::MaskProcessFunct mpFourth(*this, temp, threeQuarter, m_Body.end());
+		std::ofstream out(outFile, std::ios::binary);
+		if (out.is_open()) {
+			out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+		}
 
-		std::thread mpThreadOne(mpFirst, mask);
-		std::thread mpThreadTwo(mpSecond, mask);
-		std::thread mpThreadThree(mpThird, mask);
-		std::thread mpThreadFour(mpFourth, mask);
+		trace.addPixels(m_Rows * m_Columns);
+		trace.addBytes(bytes.size());
+	}
+
+	void Image::loadTiled(const std::string& file) {
+		loadTiled(file, { 0, 0, std::numeric_limits<size_t>::max(), std::numeric_limits<size_t>::max() });
+	}
 
-		mpThreadOne.join();
-		mpThreadTwo.join();
-		mpThreadThree.join();
-		mpThreadFour.join();
+	void Image::loadTiled(const std::string& file, const Region& region) {
+		Trace::Scope trace("loadTiled", "io");
 
-		m_Body = std::move(temp);
-		
-		auto funcEnd = std::chrono::high_resolution_clock::now();
-		std::chrono::duration<double> funcRuntime = funcEnd - funcStart;
-		std::cout << "Masking finished in " << funcRuntime.count() << " seconds.\n";
+		m_File = Pnm::findInput(file);
+
+		Tiles::Header header;
+		ImageData body;
+		short min = 0;
+		short max = 0;
+		if (!Tiles::decode(m_File.string(), region, header, body, min, max)) {
+			std::cout << "Image failed to load";
+			BufferPool::instance().release(std::move(body));
+			m_BadImage = true;
+			return;
+		}
+
+		m_FileType = FileType::P5;
+		m_Rows = body.size();
+		m_Columns = body.empty() ? 0 : body[0].size();
+		m_Depth = header.depth;
+		m_MinLevel = min;
+		m_MaxLevel = max;
+		m_BadImage = false;
+		replaceBody(std::move(body));
+
+		trace.addPixels(m_Rows * m_Columns);
 	}
 
-	void Image::scalingProcessing(size_t newWidth, size_t newHeight, ScalingOps operation) {
-		auto funcStart = std::chrono::high_resolution_clock::now();
-		std::cout << "\nScaling with " << ScalingProcessFunct::opsToString.at(operation) << ".\n";
+	ImageView Image::crop(const Region& region) {
+		return ImageView(*this, region.clipped(m_Rows, m_Columns));
+	}
 
-		ImageData temp(newHeight, std::vector<short>(newWidth));
+	void Image::storeHistogram(MKIHistogram& histogram, const std::vector<size_t>& counts, size_t pixels) const {
+		histogram = MKIHistogram(counts, pixels);
+	}
 
-		// Dynamic threading
-		size_t numThreads = std::thread::hardware_concurrency();
+	void Image::replaceBody(ImageData&& data) {
+		m_Storage.reset(std::move(data));
+	}
 
-		if (numThreads > 4) {
-			numThreads -= 2;
-		}
-		
-		std::vector<ImageData::iterator> inters(numThreads + 1);
-		inters.at(0) = temp.begin();
-		inters.at(numThreads) = temp.end();
-		double threadRatio = 1.0 / (numThreads);
-		size_t interDif = (threadRatio * std::distance(temp.begin(), temp.end()));
-		for (int i = 1; i < numThreads; ++i) {
-			inters.at(i) = inters.at(i - 1) + interDif;
+	void Image::cachedProcessing(ResultCache::Key key, const std::function<void()>& compute) {
+		ResultCache& cache = ResultCache::instance();
+		if (!cache.enabled()) {
+			compute();
+			return;
 		}
 
-		std::vector<Image::ScalingProcessFunct> spfs;
-		spfs.reserve(numThreads);
-		for (int i = 0; i < numThreads; ++i) {
-			//Image::ScalingProcessFunct tempSPF(*this, temp, inters.at(i), inters.at(i + 1), operation);
-			spfs.emplace_back(*this, temp, inters.at(i), inters.at(i + 1), operation);
+		key.add(*this);
+
+		ResultCache::Entry entry;
+		if (cache.lookup(key, entry)) {
+			const ImageData& pixels = entry.pixels.read();
+			m_Rows = pixels.size();
+			m_Columns = pixels.empty() ? 0 : pixels[0].size();
+			m_MinLevel = entry.min;
+			m_MaxLevel = entry.max;
+			m_Storage = std::move(entry.pixels);
+			return;
 		}
 
-		double widthRatio = columns() / static_cast<double>(newWidth);
-		double heightRatio = rows() / static_cast<double>(newHeight);
+		compute();
+		cache.store(key, { m_Storage, m_Depth, m_MinLevel, m_MaxLevel });
+	}
 
-		std::vector<std::thread> threads;
-		for (int i = 0 ; i < numThreads; ++i) {
-			threads.emplace_back(spfs.at(i), widthRatio, heightRatio);
-		}
+	void Image::storeFiltered(ImageData&& data) {
+		ThreadPool::instance().parallelFor(0, data.size(), [this, &data](size_t rowBegin, size_t rowEnd) {
+			int min = m_Depth;
+			int max = 0;
+
+			for (size_t i = rowBegin; i < rowEnd; ++i) {
+				for (auto val : data[i]) {
+					if (val < min)
+						min = val;
+					if (val > max)
+						max = val;
+				}
+			}
 
-		for (auto& thread : threads) {
-			thread.join();
-		}
-		// End dynamic threading
+			updateMinMax(min);
+			updateMinMax(max);
+		});
 
-		// ImageData::iterator mid = temp.begin() + (std::distance(temp.begin(), temp.end()) / 2);
-		// ImageData::iterator oneQuarter = temp.begin() + (std::distance(temp.begin(), mid) / 2);
-		// ImageData::iterator threeQuarter = mid + (std::distance(mid, temp.end()) / 2);
+		replaceBody(std::move(data));
+	}
 
-		// Image::ScalingProcessFunct ipFirst(*this, temp, temp.begin(), oneQuarter, operation);
-		// Image::ScalingProcessFunct ipSecond(*this, temp, oneQuarter, mid, operation);
-		// Image::ScalingProcessFunct ipThird(*this, temp, mid, threeQuarter, operation);
-		// Image::ScalingProcessFunct ipFourth(*this, temp, threeQuarter, temp.end(), operation);
+	void Image::storeRegion(const Region& region, ImageData&& data) {
+		if (region.covers(m_Rows, m_Columns)) {
+			replaceBody(std::move(data));
+			return;
+		}
 
-		// double widthRatio = columns() / static_cast<double>(newWidth);
-		// double heightRatio = rows() / static_cast<double>(newHeight);
+		ImageData& body = m_Storage.write();
+		ThreadPool::instance().parallelFor(0, region.height, [&body, &region, &data](size_t rowBegin, size_t rowEnd) {
+			for (size_t i = rowBegin; i < rowEnd; ++i) {
+				std::copy(data[i].begin(), data[i].end(), body[region.row + i].begin() + region.column);
+			}
+		});
+		BufferPool::instance().release(std::move(data));
+	}
 
-		// std::thread ipThreadOne(ipFirst, widthRatio, heightRatio);
-		// std::thread ipThreadTwo(ipSecond, widthRatio, heightRatio);
-		// std::thread ipThreadThree(ipThird, widthRatio, heightRatio);
-		// std::thread ipThreadFour(ipFourth, widthRatio, heightRatio);
+	void Image::lutProcessing(const std::vector<short>& lut) {
+		cachedProcessing(ResultCache::Key("lut").add(lut), [this, &lut] { lutProcessing(lut, region()); });
+	}
 
-		// ipThreadOne.join();
-		// ipThreadTwo.join();
-		// ipThreadThree.join();
-		// ipThreadFour.join();
+	void Image::lutProcessing(const std::vector<short>& lut, const Region& region) {
+		pointProcessing(region, [&lut](short val) { return lut[std::min<size_t>(val, lut.size() - 1)]; });
+	}
 
-		m_Body = std::move(temp);
+	void Image::lutProcessing(const std::vector<short>& lut, MKIHistogram& histogram) {
+		lutProcessing(lut, region(), histogram);
+	}
 
-		m_Columns = newWidth;
-		m_Rows = newHeight;
+	void Image::lutProcessing(const std::vector<short>& lut, const Region& region, MKIHistogram& histogram) {
+		pointProcessing(region, histogram, [&lut](short val) { return lut[std::min<size_t>(val, lut.size() - 1)]; });
+	}
+
+	void Image::maskProcessing(const Mask& mask) {
+		ResultCache::Key key("mask");
+		if (ResultCache::instance().enabled()) {
+			key.add(mask.rows()).add(mask.columns()).add(mask.weight());
+			for (size_t i = 0; i < mask.rows(); ++i) {
+				for (size_t j = 0; j < mask.columns(); ++j) {
+					key.add(mask.value(i, j));
+				}
+			}
+		}
 
-		auto funcEnd = std::chrono::high_resolution_clock::now();
-		std::chrono::duration<double> funcRuntime = funcEnd - funcStart;
-		std::cout << "Scaling finished in " << funcRuntime.count() << " seconds.\n";
+		cachedProcessing(key, [this, &mask] { maskProcessing(mask, region()); });
 	}
 
-	void Image::frameProcessing(Image& otherImage, FrameOps op) {
-		auto funcStart = std::chrono::high_resolution_clock::now();
-		std::cout << "\nFrame processing started.\n";
+	void Image::maskProcessing(const Mask& mask, const Region& region) {
+		Region area = region.clipped(m_Rows, m_Columns);
+		if (area.empty()) {
+			return;
+		}
+
+		Trace::Scope trace("maskProcessing");
+		trace.addPixels(area.pixels());
 
-		ImageData::iterator mid = m_Body.begin() + (std::distance(m_Body.begin(), m_Body.end()) / 2);
-		ImageData::iterator oneQuarter = m_Body.begin() + (std::distance(m_Body.begin(), mid) / 2);
-		ImageData::iterator threeQuarter = mid + (std::distance(mid, m_Body.end()) / 2);
+		ImageData temp = BufferPool::instance().acquire(area.height, area.width);
 
-		ImageData temp(m_Body.size(), std::vector<short>(m_Body.at(0).size()));
+		if (mask.rows() * mask.columns() > Consts::FFT_MASK_AREA) {
+			// Large kernels: FFT convolution gives the same sums without rows * columns MACs per pixel.
+			if (area.covers(m_Rows, m_Columns)) {
+				FFT::convolve(data(), temp, mask);
+			}
+			else {
+				/*
+					Convolve the region plus a margin of real neighbours. Where the margin is cut short
+					it is cut at the image border, so mirroring there matches the whole-image result.
+				*/
+				size_t top = area.row - std::min(area.row, mask.rowOffset());
+				size_t left = area.column - std::min(area.column, mask.columnOffset());
+				size_t bottom = std::min(m_Rows, area.row + area.height + mask.rows());
+				size_t right = std::min(m_Columns, area.column + area.width + mask.columns());
+
+				ImageData source = BufferPool::instance().acquire(bottom - top, right - left);
+				for (size_t i = top; i < bottom; ++i) {
+					std::copy(data()[i].begin() + left, data()[i].begin() + right, source[i - top].begin());
+				}
 
-		Image::FrameProcessFunct fpFirst(*this, otherImage, temp, m_Body.begin(), oneQuarter, op);
-		Image::FrameProcessFunct fpSecond(*this, otherImage, temp, oneQuarter, mid, op);
-		Image::FrameProcessFunct fpThird(*this, otherImage, temp, mid, threeQuarter, op);
-		Image::FrameProcessFunct fpFourth(*this, otherImage, temp, threeQuarter, m_Body.end(), op);
+				ImageData result = BufferPool::instance().acquire(source.size(), right - left);
+				FFT::convolve(source, result, mask);
 
-		std::thread fpThreadOne(fpFirst);
-		std::thread fpThreadTwo(fpSecond);
-		std::thread fpThreadThree(fpThird);
-		std::thread fpThreadFour(fpFourth);
+				for (size_t i = 0; i < area.height; ++i) {
+					auto first = result[area.row - top + i].begin() + (area.column - left);
+					std::copy(first, first + area.width, temp[i].begin());
+				}
 
-		fpThreadOne.join();
-		fpThreadTwo.join();
-		fpThreadThree.join();
-		fpThreadFour.join();
+				BufferPool::instance().release(std::move(source));
+				BufferPool::instance().release(std::move(result));
+			}
 
-		m_Body = std::move(temp);
+			ThreadPool::instance().parallelFor(0, temp.size(), [this, &temp](size_t rowBegin, size_t rowEnd) {
+				int min = m_Depth;
+				int max = 0;
 
-		auto funcEnd = std::chrono::high_resolution_clock::now();
-		std::chrono::duration<double> funcRuntime = funcEnd - funcStart;
-		std::cout << "Frame processing finished in " << funcRuntime.count() << " seconds.\n";
-	}
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					for (auto& val : temp[i]) {
+						protectRange(val);
 
-	/* #################### Private methods #################### */
+						if (val < min)
+							min = val;
+						if (val > max)
+							max = val;
+					}
+				}
 
-	void Image::readHeader(const Path& file) {
-		std::ifstream in(file);
-		if (in.is_open()) {
-			in >> m_FileType;
-			removeComment(in);
-			in >> m_Columns;
-			in >> m_Rows;
-			in >> m_Depth;
+				updateMinMax(min);
+				updateMinMax(max);
+			});
+		}
+		else {
+			ThreadPool::instance().parallelFor(area.row, area.row + area.height,
+											   [this, &temp, &area, &mask](size_t rowBegin, size_t rowEnd) {
+				Image::MaskProcessFunct mp(*this, temp, area, rowBegin, rowEnd);
+				mp(mask);
+			});
 		}
+
+		storeRegion(area, std::move(temp));
 	}
 
-	void Image::removeComment(std::ifstream& in) const {
-		char next;
-		in.get(next);
+	void Image::guidedProcessing(size_t radius, double epsilon) {
+		guidedProcessing(*this, radius, epsilon);
+	}
 
-		while (next == '\n' || next == '#') {
-			if (next == '#')
-				in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-			in.get(next);
+	void Image::guidedProcessing(const Image& guide, size_t radius, double epsilon) {
+		if (guide.rows() != m_Rows || guide.columns() != m_Columns) {
+			return;
 		}
-		in.unget();
+
+		Trace::Scope trace("guidedProcessing");
+		trace.addPixels(m_Rows * m_Columns);
+
+		ImageData temp = BufferPool::instance().acquire(m_Rows, m_Columns);
+		Filter::guided(data(), guide.data(), temp, radius, epsilon, m_Depth);
+		storeFiltered(std::move(temp));
 	}
 
-	void Image::skipHeader(std::ifstream& in) const {
-		in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-		removeComment(in);
+	void Image::bilateralProcessing(double spatialSigma, double rangeSigma) {
+		Trace::Scope trace("bilateralProcessing");
+		trace.addPixels(m_Rows * m_Columns);
+
+		ImageData temp = BufferPool::instance().acquire(m_Rows, m_Columns);
+		Filter::bilateral(data(), temp, spatialSigma, rangeSigma, m_Depth);
+		storeFiltered(std::move(temp));
+	}
 
-		std::string buffer;
-		std::getline(in, buffer);
+	void Image::morphologyProcessing(const StructuringElement& element, MorphOps operation) {
+		Trace::Scope trace("morphologyProcessing");
+		trace.addPixels(m_Rows * m_Columns);
 
-		std::stringstream ss(buffer);
+		bool binary = Morphology::isBinary(data(), m_Depth);
+		short depth = m_Depth;
 
-		int count = 0;
-		while (!ss.eof()) {
-			int i;
-			ss >> i;
-			++count;
+		auto erode = [&element, binary, depth](const ImageData& in, ImageData& out) {
+			if (binary) {
+				Morphology::erodeBinary(in, out, element, depth);
+			} else {
+				Morphology::erode(in, out, element);
+			}
+		};
+		auto dilate = [&element, binary, depth](const ImageData& in, ImageData& out) {
+			if (binary) {
+				Morphology::dilateBinary(in, out, element, depth);
+			} else {
+				Morphology::dilate(in, out, element);
+			}
+		};
+
+		ImageData temp = BufferPool::instance().acquire(m_Rows, m_Columns);
+
+		switch (operation) {
+		case MorphOps::erode:
+			erode(data(), temp);
+			break;
+		case MorphOps::dilate:
+			dilate(data(), temp);
+			break;
+		case MorphOps::open:
+		case MorphOps::topHat: {
+			ImageData eroded = BufferPool::instance().acquire(m_Rows, m_Columns);
+			erode(data(), eroded);
+			dilate(eroded, temp);
+			BufferPool::instance().release(std::move(eroded));
+			break;
 		}
-
-		if (count < 3) {
-			std::getline(in, buffer);
+		case MorphOps::close:
+		case MorphOps::blackHat: {
+			ImageData dilated = BufferPool::instance().acquire(m_Rows, m_Columns);
+			dilate(data(), dilated);
+			erode(dilated, temp);
+			BufferPool::instance().release(std::move(dilated));
+			break;
 		}
+		case MorphOps::unknown:
+			for (size_t i = 0; i < m_Rows; ++i) {
+				std::copy(data()[i].begin(), data()[i].end(), temp[i].begin());
+			}
+			break;
+		}
+
+		ThreadPool::instance().parallelFor(0, temp.size(), [this, &temp, operation](size_t rowBegin, size_t rowEnd) {
+			int min = m_Depth;
+			int max = 0;
+
+			for (size_t i = rowBegin; i < rowEnd; ++i) {
+				for (size_t j = 0; j < temp[i].size(); ++j) {
+					short& val = temp[i][j];
+
+					if (operation == MorphOps::topHat) {
+						val = data()[i][j] - val;
+					} else if (operation == MorphOps::blackHat) {
+						val = val - data()[i][j];
+					}
+
+					if (val < min)
+						min = val;
+					if (val > max)
+						max = val;
+				}
+			}
+
+			updateMinMax(min);
+			updateMinMax(max);
+		});
+
+		replaceBody(std::move(temp));
 	}
 
-	void Image::loadBin(const Path& file) {
-		std::ifstream in;
+	Gradient::Field Image::gradient(GradientOps operation) const {
+		Gradient::Field field;
+		Gradient::compute(data(), field, operation);
+		return field;
+	}
+
+	void Image::gradientProcessing(GradientOps operation) {
+		Trace::Scope trace("gradientProcessing");
+		trace.addPixels(m_Rows * m_Columns);
+
+		Gradient::Field field = gradient(operation);
+
+		ImageData temp = BufferPool::instance().acquire(m_Rows, m_Columns);
 
-		in.open(file, std::ios::binary);
+		ThreadPool::instance().parallelFor(0, temp.size(), [this, &temp, &field](size_t rowBegin, size_t rowEnd) {
+			int min = m_Depth;
+			int max = 0;
 
-		if (in.is_open()) {
-			skipHeader(in);
+			for (size_t i = rowBegin; i < rowEnd; ++i) {
+				for (size_t j = 0; j < temp[i].size(); ++j) {
+					float magnitude = std::min(field.magnitudeAt(i, j), static_cast<float>(m_Depth));
+					short val = static_cast<short>(std::lround(magnitude));
 
-			m_Body = ImageData(m_Rows, std::vector<short>(m_Columns));
+					temp[i][j] = val;
 
-			//short tempPixValue = 0;
-			for (int i = 0; i < m_Rows; ++i) {
-				for (int j = 0; j < m_Columns; ++j) {
-					in.read(reinterpret_cast<char*>(&m_Body.at(i).at(j)), sizeof(int8_t));
-					//m_Body.at(i).at(j) = tempPixValue;
-					updateMinMax(m_Body.at(i).at(j));
+					if (val < min)
+						min = val;
+					if (val > max)
+						max = val;
 				}
 			}
+
+			updateMinMax(min);
+			updateMinMax(max);
+		});
+
+		replaceBody(std::move(temp));
+	}
+
+	void Image::cannyProcessing(short lowThreshold, short highThreshold, GradientOps operation) {
+		Trace::Scope trace("cannyProcessing");
+		trace.addPixels(m_Rows * m_Columns);
+
+		ImageData temp = BufferPool::instance().acquire(m_Rows, m_Columns);
+
+		Gradient::canny(data(), temp, lowThreshold, highThreshold, operation, m_Depth);
+
+		replaceBody(std::move(temp));
+		updateMinMax(0);
+		updateMinMax(m_Depth);
+	}
+
+	Match::Result Image::matchTemplate(const Image& templ, size_t count) const {
+		Trace::Scope trace("matchTemplate");
+		trace.addPixels(m_Rows * m_Columns);
+
+		return Match::match(data(), templ.data(), count);
+	}
+
+	Components::Labels Image::components(Connectivity connectivity) const {
+		Trace::Scope trace("components");
+		trace.addPixels(m_Rows * m_Columns);
+
+		return Components::label(data(), connectivity);
+	}
+
+	Distance::Map<float> Image::distanceTransform(DistanceTarget target) const {
+		Trace::Scope trace("distanceTransform");
+		trace.addPixels(m_Rows * m_Columns);
+
+		return Distance::euclidean(data(), target);
+	}
+
+	Distance::Map<uint32_t> Image::squaredDistanceTransform(DistanceTarget target) const {
+		Trace::Scope trace("squaredDistanceTransform");
+		trace.addPixels(m_Rows * m_Columns);
+
+		return Distance::squared(data(), target);
+	}
+
+	void Image::scalingProcessing(size_t newWidth, size_t newHeight, ScalingOps operation) {
+		ResultCache::Key key("scaling");
+		key.add(newWidth).add(newHeight).add(operation);
+
+		cachedProcessing(key, [this, newWidth, newHeight, operation] {
+			Trace::Scope trace("scalingProcessing");
+			trace.addPixels(newWidth * newHeight);
+
+			ImageData temp = BufferPool::instance().acquire(newHeight, newWidth);
+
+			double widthRatio = columns() / static_cast<double>(newWidth);
+			double heightRatio = rows() / static_cast<double>(newHeight);
+
+			ThreadPool::instance().parallelFor(0, temp.size(), [&](size_t rowBegin, size_t rowEnd) {
+				Image::ScalingProcessFunct spf(*this, temp, temp.begin() + rowBegin, temp.begin() + rowEnd, operation);
+				spf(widthRatio, heightRatio);
+			});
+
+			replaceBody(std::move(temp));
+
+			m_Columns = newWidth;
+			m_Rows = newHeight;
+		});
+	}
+
+	void Image::geometricProcessing(GeometricOps operation) {
+		Trace::Scope trace("geometricProcessing");
+		trace.addPixels(m_Rows * m_Columns);
+
+		bool swap = Geometry::swapsDimensions(operation);
+		size_t newRows = swap ? m_Columns : m_Rows;
+		size_t newColumns = swap ? m_Rows : m_Columns;
+
+		ImageData temp = BufferPool::instance().acquire(newRows, newColumns);
+
+		Geometry::apply(data(), temp, operation);
+
+		replaceBody(std::move(temp));
+
+		m_Columns = newColumns;
+		m_Rows = newRows;
+	}
+
+	void Image::affineProcessing(const AffineTransform& transform, size_t newWidth, size_t newHeight, ScalingOps operation) {
+		Trace::Scope trace("affineProcessing");
+		trace.addPixels(newWidth * newHeight);
+
+		ImageData temp = BufferPool::instance().acquire(newHeight, newWidth);
+		AffineTransform inverse = transform.inverted();
+
+		ThreadPool::instance().parallelFor(0, temp.size(), [this, &temp, &inverse, operation](size_t rowBegin, size_t rowEnd) {
+			Image::ScalingProcessFunct spf(*this, temp, temp.begin() + rowBegin, temp.begin() + rowEnd, operation);
+			spf(inverse);
+		});
+
+		replaceBody(std::move(temp));
+
+		m_Columns = newWidth;
+		m_Rows = newHeight;
+	}
+
+	void Image::frameProcessing(Image& otherImage, FrameOps op) {
+		ResultCache::Key key("frame");
+		if (ResultCache::instance().enabled()) {
+			key.add(op).add(otherImage);
 		}
+
+		cachedProcessing(key, [this, &otherImage, op] { frameProcessing(otherImage, op, region()); });
 	}
 
-	void Image::loadText(const Path& file) {
-		std::ifstream in;
+	void Image::frameProcessing(Image& otherImage, FrameOps op, const Region& region) {
+		frameProcessing(otherImage, op, region, region);
+	}
 
-		in.open(file);
+	void Image::frameProcessing(Image& otherImage, FrameOps op, const Region& region, const Region& otherRegion) {
+		Region area = region.clipped(m_Rows, m_Columns);
+		Region otherArea = otherRegion.clipped(otherImage.rows(), otherImage.columns());
+		area.width = otherArea.width = std::min(area.width, otherArea.width);
+		area.height = otherArea.height = std::min(area.height, otherArea.height);
+		if (area.empty()) {
+			return;
+		}
 
-		if (in.is_open()) {
-			skipHeader(in);
+		Trace::Scope trace("frameProcessing");
+		trace.addPixels(area.pixels());
 
-			m_Body = ImageData(m_Rows, std::vector<short>(m_Columns));
+		ImageData temp = BufferPool::instance().acquire(area.height, area.width);
 
-			//short tempPixValue = 0;
-			for (int i = 0; i < m_Rows; ++i) {
-				for (int j = 0; j < m_Columns; ++j) {
-					in >> m_Body.at(i).at(j);
-					//m_Body.at(i).at(j) = tempPixValue;
-					updateMinMax(m_Body.at(i).at(j));
-				}
+		ThreadPool::instance().parallelFor(area.row, area.row + area.height,
+										   [&](size_t rowBegin, size_t rowEnd) {
+			Image::FrameProcessFunct fp(*this, otherImage, temp, area, otherArea, rowBegin, rowEnd, op);
+			fp();
+		});
+
+		storeRegion(area, std::move(temp));
+	}
+
+	/* #################### Private methods #################### */
+
+	void Image::decode(const std::vector<char>& buffer, const Pnm::Header& header) {
+		m_FileType = header.type;
+		m_Columns = header.columns;
+		m_Rows = header.rows;
+		m_Depth = Pnm::depth(header);
+
+		if (Pnm::isBinary(m_FileType)) {
+			m_BadImage = !loadBin(buffer, header);
+		}
+		else {
+			m_BadImage = !loadText(buffer, header);
+		}
+	}
+
+	bool Image::loadBin(const std::vector<char>& buffer, const Pnm::Header& header) {
+		replaceBody(BufferPool::instance().acquire(m_Rows, m_Columns));
+		ImageData& body = m_Storage.write();
+
+		const unsigned char* payload = reinterpret_cast<const unsigned char*>(buffer.data()) + header.length;
+		size_t size = buffer.size() - header.length;
+
+		if (Pnm::isBitmap(m_FileType)) {
+			if (!Pnm::unpackBits(payload, size, body)) {
+				return false;
 			}
+			m_MinLevel = 0;
+			m_MaxLevel = 1;
+			return true;
+		}
+
+		// Assigned rather than merged: the levels of whatever was loaded before do not apply.
+		return Pnm::readSamples(payload, size, header.maxValue, { &body }, m_MinLevel, m_MaxLevel);
+	}
+
+	bool Image::loadText(const std::vector<char>& buffer, const Pnm::Header& header) {
+		replaceBody(BufferPool::instance().acquire(m_Rows, m_Columns));
+		ImageData& body = m_Storage.write();
+
+		bool bitmap = Pnm::isBitmap(m_FileType);
+		short min = 0;
+		short max = 0;
+		Pnm::parseText(buffer.data() + header.length, buffer.data() + buffer.size(), body, min, max, bitmap);
+
+		if (bitmap) {
+			// P1 stores 1 for black; flip to gray levels with 1 = white.
+			ThreadPool::instance().parallelFor(0, m_Rows, [&body](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					for (auto& val : body[i]) {
+						val = val == 0 ? 1 : 0;
+					}
+				}
+			});
+			min = 0;
+			max = 1;
 		}
+
+		m_MinLevel = min;
+		m_MaxLevel = max;
+		return true;
 	}
 
- 	void Image::saveBin(const Path& file, const std::string& comment) {
+	void Image::saveBin(const Path& file, const std::string& comment, const Region& region) {
 		std::ofstream out;
 
 		out.open(file, std::ios::binary);
 
 		if (out.is_open()) {
-			out << m_FileType << '\n';
-			if (comment.length() > 0) {
-				out << comment << '\n';
-			}
-			out << m_Columns << ' ' << m_Rows << '\n';
-			out << m_Depth << '\n';
+			std::vector<unsigned char> payload;
 
-			for (auto& i : m_Body) {
-				for (auto& j : i) {
-					out.write(reinterpret_cast<char*>(&j), sizeof(uint8_t));
-				}
+			if (Pnm::isBitmap(m_FileType)) {
+				Pnm::packBits(data(), region, m_Depth, payload);
+			}
+			else if (Pnm::isColour(m_FileType)) {
+				// A gray image saved as colour: every channel gets the same value.
+				Pnm::writeSamples({ &data(), &data(), &data() }, region, m_Depth, payload);
 			}
+			else {
+				Pnm::writeSamples({ &data() }, region, m_Depth, payload);
+			}
+
+			out << Pnm::makeHeader(m_FileType, region.width, region.height, m_Depth, comment);
+			out.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
 		}
 	}
 
-	void Image::saveText(const Path& file, const std::string& comment) {
+	void Image::saveText(const Path& file, const std::string& comment, const Region& region) {
 		std::ofstream out;
 
 		out.open(file);
 
 		if (out.is_open()) {
-			out << m_FileType << '\n';
-			if (comment.length() > 0) {
-				out << comment << '\n';
-			}
-			out << m_Columns << ' ' << m_Rows << '\n';
-			out << m_Depth << '\n';
+			std::string text = Pnm::makeHeader(m_FileType, region.width, region.height, m_Depth, comment);
 
-			for (auto& i : m_Body) {
-				for (auto& j : i) {
-					out << j << ' ';
-				}
-				out << '\n';
+			if (Pnm::isColour(m_FileType)) {
+				Pnm::writeText({ &data(), &data(), &data() }, region, false, m_Depth, text);
 			}
+			else {
+				Pnm::writeText({ &data() }, region, Pnm::isBitmap(m_FileType), m_Depth, text);
+			}
+
+			out << text;
 		}
 	}
 
 	/* #################### Functors #################### */
 
-	Image::PointProcessFunct::PointProcessFunct(Image & image, ImageData & out,
-														  ImageData::iterator begin, ImageData::iterator end)
-		: m_Image(image), m_Out(out), m_Begin(begin), m_End(end) {
+	Image::PointProcessFunct::PointProcessFunct(Image& image, ImageData& out, const Region& region,
+												const Region& outRegion, size_t rowBegin, size_t rowEnd, size_t* counts)
+		: m_Image(image), m_Out(out), m_Region(region), m_OutRegion(outRegion), m_RowBegin(rowBegin), m_RowEnd(rowEnd),
+		m_Counts(counts) {
 	}
 
-	Image::MaskProcessFunct::MaskProcessFunct(Image & image, ImageData & out, ImageData::iterator begin,
-														ImageData::iterator end)
-		: m_Image(image), m_Out(out), m_Begin(begin), m_End(end) {
+	Image::MaskProcessFunct::MaskProcessFunct(Image& image, ImageData& out, const Region& region,
+											  size_t rowBegin, size_t rowEnd)
+		: m_Image(image), m_Out(out), m_Region(region), m_RowBegin(rowBegin), m_RowEnd(rowEnd) {
 	}
 
 	void Image::MaskProcessFunct::operator()(const Mask & mask) {
 		int min = m_Image.depth();
 		int max = 0;
 
-		size_t countI = m_Begin - m_Image.data().begin();
-		size_t countJ;
-		for (m_Begin; m_Begin != m_End; ++m_Begin) {
-			countJ = 0;
-			for (auto j : *m_Begin) {
-				short val = mask(m_Image.data(), countI, countJ);
+		for (size_t i = m_RowBegin; i < m_RowEnd; ++i) {
+			short* dest = m_Out[i - m_Region.row].data();
+
+			for (size_t j = 0; j < m_Region.width; ++j) {
+				short val = mask(m_Image.data(), i, m_Region.column + j);
 
 				m_Image.protectRange(val);
 
-				m_Out.at(countI).at(countJ) = val;
+				dest[j] = val;
 
 				if (val < min)
 					min = val;
 				if (val > max)
 					max = val;
-
-				++countJ;
 			}
-			++countI;
 		}
 
 		m_Image.updateMinMax(min);
 		m_Image.updateMinMax(max);
 	}
 
-	Image::FrameProcessFunct::FrameProcessFunct(Image& image, Image& otherImage,
-														  ImageData& out, ImageData::iterator begin,
-														  ImageData::iterator end, Image::FrameProcessFunct::Operations operation)
-		: m_Image(image), m_OtherImage(otherImage), m_Out(out), m_Begin(begin), m_End(end), m_Operation(operation) {
+	Image::FrameProcessFunct::FrameProcessFunct(Image& image, Image& otherImage, ImageData& out,
+												const Region& region, const Region& otherRegion,
+												size_t rowBegin, size_t rowEnd, Image::FrameProcessFunct::Operations operation)
+		: m_Image(image), m_OtherImage(otherImage), m_Out(out), m_Region(region), m_OtherRegion(otherRegion),
+		m_RowBegin(rowBegin), m_RowEnd(rowEnd), m_Operation(operation) {
 	}
 
 	void Image::FrameProcessFunct::operator()() {
@@ -444,25 +832,23 @@ namespace MKImage {
 
 		auto ops = operation();
 
-		size_t countI = m_Begin - m_Image.data().begin();
-		size_t countJ;
-		for (m_Begin; m_Begin != m_End; ++m_Begin) {
-			countJ = 0;
-			for (auto j : *m_Begin) {
-				short val = ops(j, m_OtherImage.data().at(countI).at(countJ));
+		for (size_t i = m_RowBegin; i < m_RowEnd; ++i) {
+			const short* source = m_Image.data()[i].data() + m_Region.column;
+			const short* other = m_OtherImage.data()[m_OtherRegion.row + (i - m_Region.row)].data() + m_OtherRegion.column;
+			short* dest = m_Out[i - m_Region.row].data();
+
+			for (size_t j = 0; j < m_Region.width; ++j) {
+				short val = ops(source[j], other[j]);
 
 				m_Image.protectRange(val);
 
-				m_Out.at(countI).at(countJ) = val;
+				dest[j] = val;
 
 				if (val < min)
 					min = val;
 				if (val > max)
 					max = val;
-
-				++countJ;
 			}
-			++countI;
 		}
 
 		m_Image.updateMinMax(min);
@@ -516,13 +902,15 @@ namespace MKImage {
 		int max = 0;
 
 		auto ops = operation();
+		float ratioWidth = static_cast<float>(widthRatio);
+		float ratioHeight = static_cast<float>(heightRatio);
 
 		size_t rowCount = m_Begin - m_Out.begin();
 		size_t colCount;
 
 		for (m_Begin; m_Begin != m_End; ++m_Begin) {
 			for (colCount = 0; colCount < m_Out.at(rowCount).size(); ++colCount) {
-				short val = ops(colCount, rowCount, widthRatio, heightRatio);
+				short val = ops(colCount * ratioWidth, rowCount * ratioHeight);
 
 				m_Image.protectRange(val);
 
@@ -541,20 +929,59 @@ namespace MKImage {
 		m_Image.updateMinMax(max);
 	}
 
-	std::function<short(size_t, size_t, float, float)> Image::ScalingProcessFunct::operation() {
+	void Image::ScalingProcessFunct::operator()(const Geometry::AffineTransform& inverse) {
+		int min = m_Image.depth();
+		int max = 0;
+
+		auto ops = operation();
+		double columnLimit = static_cast<double>(m_Image.columns());
+		double rowLimit = static_cast<double>(m_Image.rows());
+
+		size_t rowCount = m_Begin - m_Out.begin();
+		size_t colCount;
+
+		for (m_Begin; m_Begin != m_End; ++m_Begin) {
+			double columnSource = inverse.b * rowCount + inverse.tx;
+			double rowSource = inverse.d * rowCount + inverse.ty;
+
+			for (colCount = 0; colCount < m_Out.at(rowCount).size(); ++colCount) {
+				short val = 0;
+
+				if (columnSource >= 0.0 && rowSource >= 0.0 && columnSource < columnLimit && rowSource < rowLimit) {
+					val = ops(static_cast<float>(columnSource), static_cast<float>(rowSource));
+					m_Image.protectRange(val);
+				}
+
+				m_Out.at(rowCount).at(colCount) = val;
+
+				if (val < min) {
+					min = val;
+				}
+				if (val > max) {
+					max = val;
+				}
+
+				columnSource += inverse.a;
+				rowSource += inverse.c;
+			}
+			++rowCount;
+		}
+		m_Image.updateMinMax(min);
+		m_Image.updateMinMax(max);
+	}
+
+	std::function<short(float, float)> Image::ScalingProcessFunct::operation() {
 		switch (m_Operation) {
 		case Operations::nearestNeighbor:
-			return [&m_Image = m_Image, &m_Out = m_Out](size_t column, size_t row, float ratioWidth, float ratioHeight) -> short {
-				float columnIndex = column * ratioWidth;
-				float rowIndex = row * ratioHeight;
+			return [&m_Image = m_Image](float columnIndex, float rowIndex) -> short {
 				short val;
 				val = m_Image.data().at(std::floor(rowIndex)).at(std::floor(columnIndex));
 				return val;
 			};
 		case Operations::bilinear:
-			return [this](size_t column, size_t row, float ratioWidth, float ratioHeight) -> short {
-				float columnFloat = column * ratioWidth - 0.5f;
-				float rowFloat = row * ratioHeight - 0.5f;
+			return [this](float columnSource, float rowSource) -> short {
+				float columnFloat = columnSource - 0.5f;
+				float rowFloat = rowSource - 0.5f;
 				size_t columnIndex = static_cast<size_t>(columnFloat);
 				size_t rowIndex = static_cast<size_t>(rowFloat);
 				float columnDiff = columnFloat - columnIndex;
@@ -574,9 +1001,9 @@ namespace MKImage {
 				return val;
 			};
 		case Operations::bicubic:
-			return [this](size_t column, size_t row, float ratioWidth, float ratioHeight) -> short {
-				float columnFloat = column * ratioWidth - 0.5f;
-				float rowFloat = row * ratioHeight - 0.5f;
+			return [this](float columnSource, float rowSource) -> short {
+				float columnFloat = columnSource - 0.5f;
+				float rowFloat = rowSource - 0.5f;
 				size_t columnIndex = static_cast<size_t>(columnFloat);
 				size_t rowIndex = static_cast<size_t>(rowFloat);
 				float columnDiff = columnFloat - std::floor(columnFloat);
@@ -612,9 +1039,7 @@ namespace MKImage {
 				return static_cast<short>(val);
 			};
 		case Operations::lanczos2:
-			return [this](size_t column, size_t row, float ratioWidth, float ratioHeight) -> short {
-				float columnFloat = column * ratioWidth;
-				float rowFloat = row * ratioHeight;
+			return [this](float columnFloat, float rowFloat) -> short {
 				size_t columnIndex = static_cast<size_t>(columnFloat);
 				size_t rowIndex = static_cast<size_t>(rowFloat);
 
@@ -647,7 +1072,7 @@ namespace MKImage {
 				return static_cast<short>(val);
 			};
 		case Operations::unkown:
-			return [](size_t, size_t, float, float) -> short {
+			return [](float, float) -> short {
 				return short();
 			};
 		}
@@ -692,4 +1117,21 @@ namespace MKImage {
 
 		return val;
 	}
-}
\ No newline at end of file
+
+	/* #################### ImageView #################### */
+
+	ImageView::ImageView(Image& parent, const Region& region)
+		: m_Parent(&parent), m_Region(region) {
+	}
+
+	ImageView ImageView::crop(const Region& region) const {
+		Region inner = region.clipped(m_Region.height, m_Region.width);
+		inner.column += m_Region.column;
+		inner.row += m_Region.row;
+		return ImageView(*m_Parent, inner);
+	}
+
+	void ImageView::frameProcessing(const ImageView& other, Image::FrameOps operation) {
+		m_Parent->frameProcessing(other.parent(), operation, m_Region, other.region());
+	}
+}
@@ -1,40 +1,70 @@
 #pragma once
 
 #include "MKIFileType.h"
+#include "MKIImageConstants.h"
 #include "MKIMask.h"
+#include "MKIMorphology.h"
+#include "MKIGradient.h"
+#include "MKIGeometry.h"
+#include "MKIMatch.h"
+#include "MKIComponents.h"
+#include "MKIDistance.h"
+#include "MKIFilter.h"
+#include "MKIRegion.h"
+#include "MKIThreadPool.h"
+#include "MKITrace.h"
+#include "MKIBufferPool.h"
+#include "MKIImageStorage.h"
+#include "MKIResultCache.h"
+#include "MKIPnm.h"
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <thread>
 #include <mutex>
 #include <filesystem>
-#include <chrono>
 #include <type_traits>
 #include <functional>
 #include <unordered_map>
 
 namespace MKImage {
 	using ImageData = std::vector<std::vector<short>>;
+	class MKIHistogram;
 	using Path = std::filesystem::path;
 	namespace FS = std::filesystem;
 
+	class ImageView;
+
 	/* Data representing an image */
 	class Image {
+		friend class MultiImage;
+
 	public:
 		Image();
 		explicit Image(const std::string& file);
+		// Wraps pixel data produced elsewhere, e.g. generated or decoded by another module.
+		Image(ImageData data, short depth, FileType type = FileType::P5);
 		~Image() {}
+		// Shares the pixels of "other"; they are copied only when one of the images is first changed.
 		Image(const Image& other);
-		Image(const Image&& other);
-		Image& operator=(Image& rhs);
+		Image(Image&& other);
+		Image& operator=(const Image& rhs);
 
 		size_t rows() const { return m_Rows; }
 		size_t columns() const { return m_Columns; }
 		short depth() const { return m_Depth; }
 		short minValue() const { return m_MinLevel; }
 		short maxValue() const { return m_MaxLevel; }
-		const ImageData& data() const { return m_Body; }
+		const ImageData& data() const { return m_Storage.read(); }
 		bool isBadImage() const { return m_BadImage; }
+		// Hash of the size and pixels (see ImageStorage::hash), e.g. to key caches of derived data.
+		uint64_t contentHash() const { return m_Storage.hash(); }
+		FileType fileType() const { return m_FileType; }
+		// The region covering the whole image.
+		Region region() const { return { 0, 0, m_Columns, m_Rows }; }
+		// A view of part of the image. No pixels are copied and edits through the view change this image.
+		ImageView crop(const Region& region);
 
 		// Ensures the pixel "val" is not greater than the depth or less than 0
 		void protectRange(short& val);
@@ -43,8 +73,18 @@ namespace MKImage {
 
 		void load(const std::string& file);
 		void save(const std::string& file, const std::string& comment = "");
+		// Saves only "region" as a standalone image.
+		void save(const std::string& file, const std::string& comment, const Region& region);
 		// Appends _COPY to the end of filename
 		void saveCopy(const std::string& comment = "");
+		/*
+			Saves to the output folder in the compressed tiled container (see Tiles) instead of PNM.
+			Much smaller than P5 for typical images, and parts of it can be loaded on their own.
+		*/
+		void saveTiled(const std::string& file, size_t tileSize = Consts::TILE_SIZE);
+		void loadTiled(const std::string& file);
+		// Loads only "region" of a tiled file, decoding just the tiles it touches; the image becomes that region.
+		void loadTiled(const std::string& file, const Region& region);
 
 		/*
 			Applies a function to every pixel of the image.
@@ -65,20 +105,129 @@ namespace MKImage {
 		template<typename Func, typename ...Args>
 		void pointProcessing(Func f, Args... values);
 
+		/*
+			Applies a function to every pixel inside "region", leaving the rest of the image untouched.
+			Uses concurency.
+
+			Works in place, updating the min/max levels in the same pass, so no second frame is needed.
+			Only when the pixels are shared with another image (see ImageStorage) and the whole image
+			is processed are the results written to a new buffer instead, which avoids copying first.
+		*/
+		template<typename Func, typename ...Args>
+		void pointProcessing(const Region& region, Func f, Args... values);
+
+		/*
+			Point processing that also fills "histogram" (with its mean and variance) from the processed
+			pixels, counted in the same pass: every band counts into its own partial histogram and the
+			partials are summed at the end. A stage that needs the statistics of the result, e.g. a
+			stretch or equalisation, can then skip building an MKIHistogram from the whole image.
+		*/
+		template<typename Func, typename ...Args>
+		void pointProcessing(MKIHistogram& histogram, Func f, Args... values);
+		template<typename Func, typename ...Args>
+		void pointProcessing(const Region& region, MKIHistogram& histogram, Func f, Args... values);
+
+		// f(level, values...) for every level from 0 to the depth, clipped to the depth, for lutProcessing().
+		template<typename Func, typename ...Args>
+		std::vector<short> makeLut(Func f, Args... values) const;
+		/*
+			Replaces every pixel "val" with lut[val]. Transformations that are costly per pixel (log,
+			gamma, sigmoid) then run once per grey level in makeLut(). Runs like pointProcessing().
+		*/
+		void lutProcessing(const std::vector<short>& lut);
+		void lutProcessing(const std::vector<short>& lut, const Region& region);
+		void lutProcessing(const std::vector<short>& lut, MKIHistogram& histogram);
+		void lutProcessing(const std::vector<short>& lut, const Region& region, MKIHistogram& histogram);
+
 		void maskProcessing(const Mask& mask);
+		// Masks only the pixels inside "region"; neighbours outside the region are still read.
+		void maskProcessing(const Mask& mask, const Region& region);
+
+		/*
+			Edge-preserving smoothing with a guided filter (see Filter::guided), guided by the image
+			itself or by an equally sized "guide" (another image is left unchanged).
+
+			radius = window radius in pixels, epsilon = regularisation relative to the squared depth
+		*/
+		void guidedProcessing(size_t radius, double epsilon);
+		void guidedProcessing(const Image& guide, size_t radius, double epsilon);
+		/*
+			Edge-preserving smoothing with a bilateral filter (see Filter::bilateral).
+
+			spatialSigma = std. deviation in pixels, rangeSigma = std. deviation in grey levels
+		*/
+		void bilateralProcessing(double spatialSigma, double rangeSigma);
+
+		using MorphOps = Morphology::Operations;
+		/*
+			Applies a morphological operation with the given structuring element.
+			Images containing only 0 and depth (e.g. after GS::blackAndWhite) use the bit-packed binary path.
+		*/
+		void morphologyProcessing(const StructuringElement& element, MorphOps operation);
+
+		using GradientOps = Gradient::Operations;
+		// Gradient magnitude and quantised orientation of the image, which is left unchanged.
+		Gradient::Field gradient(GradientOps operation) const;
+		// Replaces the image with its gradient magnitude, clipped to the image depth.
+		void gradientProcessing(GradientOps operation);
+		/*
+			Replaces the image with a Canny edge map (edges = depth, background = 0).
+
+			lowThreshold, highThreshold = hysteresis thresholds on the raw gradient magnitude
+		*/
+		void cannyProcessing(short lowThreshold, short highThreshold, GradientOps operation = GradientOps::sobel);
+
+		/*
+			Finds "templ" in the image by normalised cross-correlation (see Match::match). The image is
+			left unchanged; the result holds the score map and the "count" best non-overlapping matches.
+		*/
+		Match::Result matchTemplate(const Image& templ, size_t count = 1) const;
+
+		using Connectivity = Components::Connectivity;
+		/*
+			Labels the connected components of the non-zero pixels, with the area, bounding box and
+			centroid of each. Threshold first, e.g. with GS::blackAndWhite (GS::negative for dark objects).
+		*/
+		Components::Labels components(Connectivity connectivity = Connectivity::eight) const;
+
+		using DistanceTarget = Distance::Target;
+		/*
+			Exact Euclidean distance from every pixel to the nearest "target" pixel (see
+			Distance::euclidean), e.g. DistanceTarget::zero on a GS::blackAndWhite mask for the
+			distance of object pixels to the background.
+		*/
+		Distance::Map<float> distanceTransform(DistanceTarget target) const;
+		// Same, as squared integer distances.
+		Distance::Map<uint32_t> squaredDistanceTransform(DistanceTarget target) const;
 	private:
 		/* #################### Private methods #################### */
 
-		void readHeader(const Path& file);
-		void removeComment(std::ifstream& in) const;
-		void skipHeader(std::ifstream& in) const;
-		void loadBin(const Path& file);
-		void loadText(const Path& file);
-		void saveBin(const Path& file, const std::string& comment = "");
-		void saveText(const Path& file, const std::string& comment = "");
+		// Takes type, size and pixels from a whole gray or bitmap file in "buffer".
+		void decode(const std::vector<char>& buffer, const Pnm::Header& header);
+		// Decode the pixels after the header in "buffer". Return false if the file is truncated.
+		bool loadBin(const std::vector<char>& buffer, const Pnm::Header& header);
+		bool loadText(const std::vector<char>& buffer, const Pnm::Header& header);
+		void saveBin(const Path& file, const std::string& comment, const Region& region);
+		void saveText(const Path& file, const std::string& comment, const Region& region);
+		// Writes "data" (sized like "region") back into the image and returns the spare buffer to the pool.
+		void storeRegion(const Region& region, ImageData&& data);
+		// Makes "data" the image body. The old body goes back to the pool unless another image shares it.
+		void replaceBody(ImageData&& data);
+		/*
+			Runs "compute", a whole-image operation described by "key", unless the ResultCache
+			already holds its result for this image, which then becomes the image. Misses are stored.
+		*/
+		void cachedProcessing(ResultCache::Key key, const std::function<void()>& compute);
+		// replaceBody() for a whole-image filter result, widening the min/max to its levels.
+		void storeFiltered(ImageData&& data);
+		// Shared body of the pointProcessing() overloads. "counts" (one bin per level) is filled when given.
+		template<typename Func, typename ...Args>
+		void pointProcess(const Region& region, std::vector<size_t>* counts, Func f, Args... values);
+		// Turns the counts of a processing pass over "pixels" pixels into "histogram".
+		void storeHistogram(MKIHistogram& histogram, const std::vector<size_t>& counts, size_t pixels) const;
 
 	private:
-		ImageData m_Body;
+		ImageStorage m_Storage;
 		Path m_File;
 		std::mutex m_MinMaxMutex;
 		FileType m_FileType;
@@ -90,37 +239,53 @@ namespace MKImage {
 		/* #################### Functors #################### */
 
 		/*
-			A functor which performs point processing on a region of an image.
-			Designed to be used in conjunction with Image::parallelPP() and std::thread
+			A functor which performs point processing on a band of rows of a region.
+			Designed to be used in conjunction with ThreadPool::parallelFor()
+
+			outRegion = where "region" lands in "out": the region itself when out is the image body
+						(in place), or { 0, 0, width, height } for a separate buffer
+			counts = the band's histogram (one bin per level) to count the results into, or null
 		*/
 		class PointProcessFunct {
 		public:
-			PointProcessFunct(Image& image, ImageData& out, ImageData::iterator begin, ImageData::iterator end);
+			PointProcessFunct(Image& image, ImageData& out, const Region& region, const Region& outRegion,
+							  size_t rowBegin, size_t rowEnd, size_t* counts = nullptr);
 
 			template<typename Func, typename ...Args>
 			void operator ()(Func func, Args... values) {
+				if (m_Counts) {
+					process<true>(func, values...);
+				}
+				else {
+					process<false>(func, values...);
+				}
+			}
+
+		private:
+			template<bool Count, typename Func, typename ...Args>
+			void process(Func func, Args... values) {
 				int min = m_Image.depth();
 				int max = 0;
 
-				size_t countI = m_Begin - m_Image.data().begin();
-				size_t countJ;
-				for (m_Begin; m_Begin != m_End; ++m_Begin) {
-					countJ = 0;
-					for (auto j : *m_Begin) {
-						short val = func(j, values...);
+				for (size_t i = m_RowBegin; i < m_RowEnd; ++i) {
+					const short* source = m_Image.data()[i].data() + m_Region.column;
+					short* dest = m_Out[m_OutRegion.row + (i - m_Region.row)].data() + m_OutRegion.column;
+
+					for (size_t j = 0; j < m_Region.width; ++j) {
+						short val = func(source[j], values...);
 
 						m_Image.protectRange(val);
 
-						m_Out.at(countI).at(countJ) = val;
+						dest[j] = val;
+						if constexpr (Count) {
+							++m_Counts[val];
+						}
 
 						if (val < min)
 							min = val;
 						if (val > max)
 							max = val;
-
-						++countJ;
 					}
-					++countI;
 				}
 
 				m_Image.updateMinMax(min);
@@ -130,19 +295,23 @@ namespace MKImage {
 		private:
 			Image& m_Image;
 			ImageData& m_Out;
-			ImageData::iterator m_Begin;
-			ImageData::iterator m_End;
+			Region m_Region;
+			Region m_OutRegion;
+			size_t m_RowBegin;
+			size_t m_RowEnd;
+			size_t* m_Counts;
 		};
 
 		class MaskProcessFunct {
 		public:
-			MaskProcessFunct(Image& image, ImageData& out, ImageData::iterator begin, ImageData::iterator end);
+			MaskProcessFunct(Image& image, ImageData& out, const Region& region, size_t rowBegin, size_t rowEnd);
 			void operator ()(const Mask& mask);
 		private:
 			Image& m_Image;
 			ImageData& m_Out;
-			ImageData::iterator m_Begin;
-			ImageData::iterator m_End;
+			Region m_Region;
+			size_t m_RowBegin;
+			size_t m_RowEnd;
 		};
 
 		class FrameProcessFunct {
@@ -150,8 +319,12 @@ namespace MKImage {
 			enum class Operations { unknown = 0, add, sub, mult };
 
 		public:
-			FrameProcessFunct(Image& image, Image& otherImage, ImageData& out, ImageData::iterator begin,
-							  ImageData::iterator end, Operations operation);
+			/*
+				region = area of "image" to process
+				otherRegion = area of "otherImage" paired with it (same width and height)
+			*/
+			FrameProcessFunct(Image& image, Image& otherImage, ImageData& out, const Region& region,
+							  const Region& otherRegion, size_t rowBegin, size_t rowEnd, Operations operation);
 			void operator()();
 		private:
 			std::function<short(short, short)> operation();
@@ -159,8 +332,10 @@ namespace MKImage {
 			Image& m_Image;
 			Image& m_OtherImage;
 			ImageData& m_Out;
-			ImageData::iterator m_Begin;
-			ImageData::iterator m_End;
+			Region m_Region;
+			Region m_OtherRegion;
+			size_t m_RowBegin;
+			size_t m_RowEnd;
 			Operations m_Operation;
 		};
 
@@ -174,9 +349,15 @@ namespace MKImage {
 			// ScalingProcessFunct& operator=(const ScalingProcessFunct& rhs);
 			// ScalingProcessFunct& operator=(ScalingProcessFunct&& rhs) = default;
 			void operator()(double widthRatio, double heightRatio);
+			/*
+				Samples the source at inverse(column, row) for every output pixel, stepping the source
+				coordinates incrementally along each row. Pixels that map outside the source are 0.
+			*/
+			void operator()(const Geometry::AffineTransform& inverse);
 
 		private:
-			std::function<short(size_t, size_t, float, float)> operation();
+			// Interpolates the source image at a (column, row) position in source coordinates.
+			std::function<short(float, float)> operation();
 
 			short rangeCheckedPixel(size_t column, size_t row);
 			float cubicHermite(float a, float b, float c, float d, float t);
@@ -197,17 +378,62 @@ namespace MKImage {
 		public:
 			using FrameOps = FrameProcessFunct::Operations;
 			void frameProcessing(Image& otherImage, FrameOps operation);
+			// Combines only the pixels inside "region" with the pixels at the same position of otherImage.
+			void frameProcessing(Image& otherImage, FrameOps operation, const Region& region);
+			// Combines "region" of this image with the equally sized "otherRegion" of otherImage.
+			void frameProcessing(Image& otherImage, FrameOps operation, const Region& region, const Region& otherRegion);
 			using ScalingOps = ScalingProcessFunct::Operations;
 			void scalingProcessing(size_t newWidth, size_t newHeight, ScalingOps operation);
+			using GeometricOps = Geometry::Operations;
+			// Rotates by a multiple of 90 degrees, flips or transposes the image.
+			void geometricProcessing(GeometricOps operation);
+			using AffineTransform = Geometry::AffineTransform;
+			/*
+				Warps the image with an affine transform, interpolating with one of the scaling operations.
+
+				transform = maps source (column, row) to destination (column, row)
+				newWidth, newHeight = size of the destination image
+			*/
+			void affineProcessing(const AffineTransform& transform, size_t newWidth, size_t newHeight, ScalingOps operation);
 	};
 	
 	/* #################### End of Image class definition #################### */
 
+	/*
+		A rectangular window onto an Image. Cropping is O(1): the view keeps a pointer to the parent
+		and addresses the parent's rows directly, so processing through the view edits the parent.
+		Coordinates passed to a view are relative to the view's top-left corner.
+	*/
+	class ImageView {
+	public:
+		ImageView(Image& parent, const Region& region);
+
+		Image& parent() const { return *m_Parent; }
+		const Region& region() const { return m_Region; }
+		size_t rows() const { return m_Region.height; }
+		size_t columns() const { return m_Region.width; }
+		short at(size_t row, size_t column) const { return m_Parent->data()[m_Region.row + row][m_Region.column + column]; }
+
+		// A view of part of this view, "region" is relative to this view.
+		ImageView crop(const Region& region) const;
+
+		template<typename Func, typename ...Args>
+		void pointProcessing(Func f, Args... values) { m_Parent->pointProcessing(m_Region, f, values...); }
+		void maskProcessing(const Mask& mask) { m_Parent->maskProcessing(mask, m_Region); }
+		// Combines this view with an equally sized view, e.g. a region of another image.
+		void frameProcessing(const ImageView& other, Image::FrameOps operation);
+		void save(const std::string& file, const std::string& comment = "") { m_Parent->save(file, comment, m_Region); }
+
+	private:
+		Image* m_Parent;
+		Region m_Region;
+	};
+
 	/* #################### Template method definitions #################### */
 
 	template <typename Func, typename ...Args>
 	void Image::singlePointProcess(Func f, Args... values) {
-		for (auto& i : m_Body) {
+		for (auto& i : m_Storage.write()) {
 			for (auto& j : i) {
 				j = f(j, values...);
 				protectRange(j);
@@ -218,35 +444,90 @@ namespace MKImage {
 
 	template<typename Func, typename ...Args>
 	void Image::pointProcessing(Func f, Args... values) {
-		auto funcStart = std::chrono::high_resolution_clock::now();
-		std::cout << "\nPoint processing started.\n";
+		if (ResultCache::instance().enabled()) {
+			// A pixel function is fully described by its table, which then keys the cache.
+			lutProcessing(makeLut(f, values...));
+			return;
+		}
+		pointProcessing(region(), f, values...);
+	}
 
-		ImageData::iterator mid = m_Body.begin() + (std::distance(m_Body.begin(), m_Body.end()) / 2);
-		ImageData::iterator oneQuarter = m_Body.begin() + (std::distance(m_Body.begin(), mid) / 2);
-		ImageData::iterator threeQuarter = mid + (std::distance(mid, m_Body.end()) / 2);
+	template<typename Func, typename ...Args>
+	void Image::pointProcessing(const Region& region, Func f, Args... values) {
+		pointProcess(region, nullptr, f, values...);
+	}
+
+	template<typename Func, typename ...Args>
+	void Image::pointProcessing(MKIHistogram& histogram, Func f, Args... values) {
+		pointProcessing(region(), histogram, f, values...);
+	}
 
-		ImageData temp(m_Body.size(), std::vector<short>(m_Body.at(0).size()));
+	template<typename Func, typename ...Args>
+	void Image::pointProcessing(const Region& region, MKIHistogram& histogram, Func f, Args... values) {
+		std::vector<size_t> counts(static_cast<size_t>(std::max<short>(m_Depth, 0)) + 1, 0);
+		pointProcess(region, &counts, f, values...);
+		storeHistogram(histogram, counts, region.clipped(m_Rows, m_Columns).pixels());
+	}
 
-		Image::PointProcessFunct ppFirst(*this, temp, m_Body.begin(), oneQuarter);
-		Image::PointProcessFunct ppSecond(*this, temp, oneQuarter, mid);
-		Image::PointProcessFunct ppThird(*this, temp, mid, threeQuarter);
-		Image::PointProcessFunct ppFourth(*this, temp, threeQuarter, m_Body.end());
+	template<typename Func, typename ...Args>
+	std::vector<short> Image::makeLut(Func f, Args... values) const {
+		std::vector<short> lut(static_cast<size_t>(std::max<short>(m_Depth, 0)) + 1);
+		for (size_t level = 0; level < lut.size(); ++level) {
+			short val = f(static_cast<short>(level), values...);
+			lut[level] = std::clamp<short>(val, 0, m_Depth);
+		}
+		return lut;
+	}
 
-		std::thread ppThreadOne(ppFirst, f, values...);
-		std::thread ppThreadTwo(ppSecond, f, values...);
-		std::thread ppThreadThree(ppThird, f, values...);
-		std::thread ppThreadFour(ppFourth, f, values...);
+	template<typename Func, typename ...Args>
+	void Image::pointProcess(const Region& region, std::vector<size_t>* counts, Func f, Args... values) {
+		Region area = region.clipped(m_Rows, m_Columns);
+		if (area.empty()) {
+			return;
+		}
 
-		ppThreadOne.join();
-		ppThreadTwo.join();
-		ppThreadThree.join();
-		ppThreadFour.join();
+		Trace::Scope trace("pointProcessing");
+		trace.addPixels(area.pixels());
+
+		std::mutex countsMutex;
+		auto processBand = [&](ImageData& out, const Region& outRegion, size_t rowBegin, size_t rowEnd) {
+			if (!counts) {
+				Image::PointProcessFunct pp(*this, out, area, outRegion, rowBegin, rowEnd);
+				pp(f, values...);
+				return;
+			}
+
+			// A band never waits on the pool, so one partial histogram per thread is enough.
+			thread_local std::vector<size_t> bandCounts;
+			bandCounts.assign(counts->size(), 0);
+
+			Image::PointProcessFunct pp(*this, out, area, outRegion, rowBegin, rowEnd, bandCounts.data());
+			pp(f, values...);
+
+			std::lock_guard<std::mutex> lock(countsMutex);
+			for (size_t level = 0; level < bandCounts.size(); ++level) {
+				(*counts)[level] += bandCounts[level];
+			}
+		};
+
+		if (m_Storage.shared() && area.covers(m_Rows, m_Columns)) {
+			ImageData temp = BufferPool::instance().acquire(area.height, area.width);
+			Region tempRegion{ 0, 0, area.width, area.height };
+
+			ThreadPool::instance().parallelFor(area.row, area.row + area.height, [&](size_t rowBegin, size_t rowEnd) {
+				processBand(temp, tempRegion, rowBegin, rowEnd);
+			});
+
+			replaceBody(std::move(temp));
+			return;
+		}
 
-		m_Body = std::move(temp);
+		// Each pixel depends only on itself, so bands can overwrite their own rows.
+		ImageData& body = m_Storage.write();
 
-		auto funcEnd = std::chrono::high_resolution_clock::now();
-		std::chrono::duration<double> funcRuntime = funcEnd - funcStart;
-		std::cout << "Point processing finished in " << funcRuntime.count() << " seconds.\n";
+		ThreadPool::instance().parallelFor(area.row, area.row + area.height, [&](size_t rowBegin, size_t rowEnd) {
+			processBand(body, area, rowBegin, rowEnd);
+		});
 	}
 
 	template<typename T, typename>
@@ -1,8 +1,16 @@
 #pragma once
 
+#include <cstddef>
+
 namespace MKImage {
 	namespace Consts {
 		constexpr char INPUT_FOLDER[] = "img";
 		constexpr char OUTPUT_FOLDER[] = "out";
+		// Masks with more elements than this are applied with FFT convolution instead of Mask::apply.
+		constexpr size_t FFT_MASK_AREA = 15 * 15;
+		// Default edge length of the tiles in a tiled (.mkt) file.
+		constexpr size_t TILE_SIZE = 256;
+		// Bilateral filters with at least this spatial sigma use the bilateral grid instead of the full window.
+		constexpr double BILATERAL_GRID_SIGMA = 1.5;
 	}
 }
\ No newline at end of file
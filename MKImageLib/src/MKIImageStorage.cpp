@@ -0,0 +1,183 @@
+#include "MKIImageStorage.h"
+
+#include "MKIBufferPool.h"
+#include "MKIHash.h"
+#include "MKIThreadPool.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace MKImage {
+	namespace {
+		// Spare count blocks, kept so that creating storage does not allocate in steady state.
+		constexpr size_t MAX_SPARE_BLOCKS = 64;
+
+		// Both never destroyed, for the same reason as the BufferPool.
+		std::mutex& spareMutex() {
+			static std::mutex* mutex = new std::mutex();
+			return *mutex;
+		}
+
+		template<typename Block>
+		std::vector<Block*>& spareBlocks() {
+			static std::vector<Block*>* blocks = new std::vector<Block*>();
+			return *blocks;
+		}
+	}
+
+	ImageStorage::ImageStorage(ImageData&& data)
+		: m_Block{ acquireBlock(std::move(data)) } {
+	}
+
+	ImageStorage::ImageStorage(const ImageStorage& other)
+		: m_Block{ other.m_Block } {
+
+		if (m_Block) {
+			m_Block->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	ImageStorage::ImageStorage(ImageStorage&& other) noexcept
+		: m_Block{ other.m_Block } {
+
+		other.m_Block = nullptr;
+	}
+
+	ImageStorage& ImageStorage::operator=(const ImageStorage& rhs) {
+		if (m_Block != rhs.m_Block) {
+			if (rhs.m_Block) {
+				rhs.m_Block->refs.fetch_add(1, std::memory_order_relaxed);
+			}
+			unref(m_Block);
+			m_Block = rhs.m_Block;
+		}
+		return *this;
+	}
+
+	ImageStorage& ImageStorage::operator=(ImageStorage&& rhs) noexcept {
+		if (this != &rhs) {
+			unref(m_Block);
+			m_Block = rhs.m_Block;
+			rhs.m_Block = nullptr;
+		}
+		return *this;
+	}
+
+	ImageStorage::~ImageStorage() {
+		unref(m_Block);
+	}
+
+	const ImageData& ImageStorage::read() const {
+		static const ImageData empty;
+		return m_Block ? m_Block->data : empty;
+	}
+
+	ImageData& ImageStorage::write() {
+		if (!m_Block) {
+			m_Block = acquireBlock(ImageData());
+		}
+		else if (shared()) {
+			const ImageData& source = m_Block->data;
+			size_t rows = source.size();
+			size_t columns = rows == 0 ? 0 : source[0].size();
+
+			Block* copy = acquireBlock(BufferPool::instance().acquire(rows, columns));
+			ThreadPool::instance().parallelFor(0, rows, [&source, copy](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					std::copy(source[i].begin(), source[i].end(), copy->data[i].begin());
+				}
+			});
+
+			unref(m_Block);
+			m_Block = copy;
+		}
+		else {
+			// The caller may change the pixels through the returned reference.
+			m_Block->hashed.store(false, std::memory_order_release);
+		}
+		return m_Block->data;
+	}
+
+	void ImageStorage::reset(ImageData&& data) {
+		if (m_Block && !shared()) {
+			m_Block->hashed.store(false, std::memory_order_release);
+			std::swap(m_Block->data, data);
+			BufferPool::instance().release(std::move(data));
+			return;
+		}
+
+		unref(m_Block);
+		m_Block = acquireBlock(std::move(data));
+	}
+
+	bool ImageStorage::shared() const {
+		return useCount() > 1;
+	}
+
+	size_t ImageStorage::useCount() const {
+		return m_Block ? m_Block->refs.load(std::memory_order_acquire) : 0;
+	}
+
+	uint64_t ImageStorage::hash() const {
+		if (m_Block && m_Block->hashed.load(std::memory_order_acquire)) {
+			return m_Block->hash.load(std::memory_order_relaxed);
+		}
+
+		const ImageData& pixels = read();
+		size_t rows = pixels.size();
+		size_t columns = rows == 0 ? 0 : pixels[0].size();
+
+		std::vector<uint64_t> rowHashes(rows);
+		ThreadPool::instance().parallelFor(0, rows, [&pixels, &rowHashes](size_t rowBegin, size_t rowEnd) {
+			for (size_t i = rowBegin; i < rowEnd; ++i) {
+				rowHashes[i] = Hash::xxh64(pixels[i].data(), pixels[i].size() * sizeof(short), i);
+			}
+		});
+
+		uint64_t result = Hash::xxh64(rowHashes.data(), rowHashes.size() * sizeof(uint64_t), columns);
+		if (m_Block) {
+			m_Block->hash.store(result, std::memory_order_relaxed);
+			m_Block->hashed.store(true, std::memory_order_release);
+		}
+		return result;
+	}
+
+	ImageStorage::Block* ImageStorage::acquireBlock(ImageData&& data) {
+		Block* block = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(spareMutex());
+			auto& spares = spareBlocks<Block>();
+			if (!spares.empty()) {
+				block = spares.back();
+				spares.pop_back();
+			}
+		}
+		if (!block) {
+			block = new Block{};
+		}
+
+		block->refs.store(1, std::memory_order_relaxed);
+		block->hashed.store(false, std::memory_order_relaxed);
+		block->data = std::move(data);
+		return block;
+	}
+
+	void ImageStorage::unref(Block* block) {
+		if (!block || block->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+			return;
+		}
+
+		BufferPool::instance().release(std::move(block->data));
+		block->data = ImageData();
+
+		{
+			std::lock_guard<std::mutex> lock(spareMutex());
+			auto& spares = spareBlocks<Block>();
+			if (spares.size() < MAX_SPARE_BLOCKS) {
+				spares.push_back(block);
+				return;
+			}
+		}
+		delete block;
+	}
+}
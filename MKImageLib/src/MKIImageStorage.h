@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	/*
+		Reference-counted, copy-on-write pixel storage.
+
+		Copying an ImageStorage shares the pixels in O(1). The first write through a handle whose
+		pixels are shared copies them into a buffer of its own, so every other handle keeps seeing the
+		original. The count is atomic: handles to the same pixels can be copied, read and written from
+		different threads, as long as each handle is only used by one thread at a time.
+
+		Pixel buffers come from and go back to the BufferPool, and the small count blocks are recycled
+		as well, so neither sharing nor detaching allocates in steady state.
+	*/
+	class ImageStorage {
+	public:
+		ImageStorage() : m_Block{ nullptr } {}
+		explicit ImageStorage(ImageData&& data);
+		ImageStorage(const ImageStorage& other);
+		ImageStorage(ImageStorage&& other) noexcept;
+		ImageStorage& operator=(const ImageStorage& rhs);
+		ImageStorage& operator=(ImageStorage&& rhs) noexcept;
+		~ImageStorage();
+
+		const ImageData& read() const;
+		// The pixels for writing. Copies them first if another handle shares them.
+		ImageData& write();
+		// Replaces the pixels. The old buffer goes back to the pool unless another handle still uses it.
+		void reset(ImageData&& data);
+
+		bool shared() const;
+		size_t useCount() const;
+
+		/*
+			XXH64-based hash of the size and pixels. Rows are hashed in parallel; the result is the
+			same for any thread count and is remembered until the pixels are next handed out by write()
+			or reset(), so repeated lookups of unchanged (or shared) pixels cost nothing.
+		*/
+		uint64_t hash() const;
+
+	private:
+		struct Block {
+			std::atomic<size_t> refs;
+			ImageData data;
+			mutable std::atomic<bool> hashed;
+			mutable std::atomic<uint64_t> hash;
+		};
+
+		static Block* acquireBlock(ImageData&& data);
+		static void unref(Block* block);
+
+	private:
+		Block* m_Block;
+	};
+}
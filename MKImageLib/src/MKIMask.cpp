@@ -1,19 +1,23 @@
 #include "MKIMask.h"
 
+#include "MKIBorder.h"
+
 #include <exception>
 
 namespace MKImage {
 	Mask::Mask(std::initializer_list<std::initializer_list<short>> values)
-		: m_Mask(values.size()) {
+		: Mask(std::vector<std::vector<short>>(values.begin(), values.end())) {
+	}
 
-		auto initIter = values.begin();
-		for (auto& i : m_Mask) {
-			i = *initIter;
-			++initIter;
-		}
+	Mask::Mask(int weight, std::initializer_list<std::initializer_list<short>> values) 
+		: Mask(weight, std::vector<std::vector<short>>(values.begin(), values.end())) {
+	}
+
+	Mask::Mask(std::vector<std::vector<short>> values)
+		: m_Mask(std::move(values)) {
 
 		m_Weight = 0;
-		for (auto i : m_Mask) {
+		for (auto& i : m_Mask) {
 			for (auto j : i) {
 				m_Weight += j;
 			}
@@ -21,22 +25,22 @@ namespace MKImage {
 
 		if (m_Weight == 0) m_Weight = 1;
 
+		setDimensions();
+	}
+
+	Mask::Mask(int weight, std::vector<std::vector<short>> values)
+		: m_Mask(std::move(values)), m_Weight(weight) {
+
+		setDimensions();
+	}
+
+	void Mask::setDimensions() {
 		m_Rows = m_Mask.size();
 		m_Columns = m_Mask.at(0).size();
 		m_XOffset = m_Rows / 2;
 		m_YOffset = m_Columns / 2;
 	}
 
-	Mask::Mask(int weight, std::initializer_list<std::initializer_list<short>> values) 
-		: m_Mask( values.size()), m_Weight(weight) {
-
-		auto initIter = values.begin();
-		for (auto& i : m_Mask) {
-			i = *initIter;
-			++initIter;
-		}
-	}
-
 	short Mask::apply(const ImageData& image, size_t imageXCord, size_t imageYCord) const {
 		int xOffsetCord = static_cast<int>(imageXCord) - m_XOffset;
 		int yOffsetCord = static_cast<int>(imageYCord) - m_YOffset;
@@ -55,31 +59,11 @@ namespace MKImage {
 	}
 
 	size_t Mask::findBoundedX(const ImageData& image, int offsetX) const {
-		size_t boundedX;
-		if (offsetX < 0) {
-			boundedX = -(offsetX);
-		}
-		else if (offsetX > image.size() - 1) {
-			boundedX = (image.size() - 1) - (offsetX - ((image.size() - 1)));
-		}
-		else {
-			boundedX = offsetX;
-		}
-		return boundedX;
+		return Border::mirror(offsetX, image.size());
 	}
 
 	size_t Mask::findBoundedY(const ImageData& image, int offsetY, size_t boundedX) const {
-		size_t boundedY;
-		if (offsetY < 0) {
-			boundedY = -(offsetY);
-		}
-		else if (offsetY > image.at(boundedX).size() - 1) {
-			boundedY = (image.at(boundedX).size() - 1) - (offsetY - ((image.at(boundedX).size() - 1)));
-		}
-		else {
-			boundedY = offsetY;
-		}
-		return boundedY;
+		return Border::mirror(offsetY, image.at(boundedX).size());
 	}
 
 	const Mask Mask::SMOOTH_3X3{ { 0, 1, 0},
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
 #include <vector>
 #include <initializer_list>
 
@@ -19,6 +20,9 @@ namespace MKImage {
 	public:
 		Mask(std::initializer_list<std::initializer_list<short>> values);
 		Mask(int weight, std::initializer_list<std::initializer_list<short>> values);
+		// For kernels too large to write out, e.g. a measured point spread function.
+		explicit Mask(std::vector<std::vector<short>> values);
+		Mask(int weight, std::vector<std::vector<short>> values);
 		
 		short operator ()(const ImageData& image, size_t imageXCord, size_t imageYCord) const { return apply(image, imageXCord, imageYCord); }
 		short apply(const ImageData& neighborhood) const;
@@ -26,8 +30,14 @@ namespace MKImage {
 
 		size_t rows() const { return m_Rows; }
 		size_t columns() const { return m_Columns; }
+		int weight() const { return m_Weight; }
+		short value(size_t row, size_t column) const { return m_Mask.at(row).at(column); }
+		// Offset of the kernel center from its top-left element.
+		size_t rowOffset() const { return m_XOffset; }
+		size_t columnOffset() const { return m_YOffset; }
 
 	private:
+		void setDimensions();
 		size_t findBoundedX(const ImageData& image, int offsetX) const;
 		size_t findBoundedY(const ImageData& image, int offsetY, size_t smartX) const;
 
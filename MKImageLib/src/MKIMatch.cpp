@@ -0,0 +1,303 @@
+#include "MKIMatch.h"
+
+#include "MKIThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+namespace MKImage {
+	namespace Match {
+		namespace {
+			// The pyramid stops before the template gets smaller than this on its shorter side.
+			constexpr size_t COARSE_SIDE = 12;
+			// Candidates are searched this far around their position carried up from the coarser level.
+			constexpr size_t REFINE_RADIUS = 2;
+			// Output rows per band, which bounds the size of a band's integral images.
+			constexpr size_t BAND_ROWS = 128;
+			// Candidates kept per requested match while refining, so the true match survives coarse noise.
+			constexpr size_t CANDIDATES_PER_MATCH = 8;
+			constexpr size_t MIN_CANDIDATES = 32;
+			// Windows with less relative variance than this are treated as flat.
+			constexpr double FLAT = 1e-9;
+
+			struct Plane {
+				size_t rows = 0;
+				size_t columns = 0;
+				std::vector<float> pixels;
+
+				const float* row(size_t i) const { return pixels.data() + i * columns; }
+				float* row(size_t i) { return pixels.data() + i * columns; }
+			};
+
+			// A template with its mean removed, so the correlation needs no mean of the image window.
+			struct Template {
+				Plane zeroMean;
+				double energy = 0;		// sum of squares of zeroMean
+			};
+
+			Plane toPlane(const ImageData& in) {
+				Plane plane{ in.size(), in.empty() ? 0 : in[0].size(), {} };
+				plane.pixels.resize(plane.rows * plane.columns);
+
+				ThreadPool::instance().parallelFor(0, plane.rows, [&](size_t rowBegin, size_t rowEnd) {
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						std::copy(in[i].begin(), in[i].end(), plane.row(i));
+					}
+				});
+				return plane;
+			}
+
+			// 2x2 average, dropping an odd last row or column.
+			Plane halved(const Plane& in) {
+				Plane out{ in.rows / 2, in.columns / 2, std::vector<float>((in.rows / 2) * (in.columns / 2)) };
+
+				ThreadPool::instance().parallelFor(0, out.rows, [&](size_t rowBegin, size_t rowEnd) {
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						const float* top = in.row(2 * i);
+						const float* bottom = in.row(2 * i + 1);
+						float* dst = out.row(i);
+						for (size_t j = 0; j < out.columns; ++j) {
+							dst[j] = 0.25f * (top[2 * j] + top[2 * j + 1] + bottom[2 * j] + bottom[2 * j + 1]);
+						}
+					}
+				});
+				return out;
+			}
+
+			Template prepare(const Plane& templ) {
+				double mean = 0;
+				for (float value : templ.pixels) {
+					mean += value;
+				}
+				mean /= static_cast<double>(templ.pixels.size());
+
+				Template t{ templ, 0 };
+				for (float& value : t.zeroMean.pixels) {
+					value = static_cast<float>(value - mean);
+					t.energy += static_cast<double>(value) * value;
+				}
+				return t;
+			}
+
+			float normalise(double correlation, double sum, double squares, double pixels, double energy) {
+				double variance = squares - sum * sum / pixels;
+				double denominator = variance * energy;
+				if (variance <= FLAT * (squares + 1) || denominator <= 0) {
+					return 0;
+				}
+				return static_cast<float>(std::clamp(correlation / std::sqrt(denominator), -1.0, 1.0));
+			}
+
+			// Scores of output rows [rowBegin, rowEnd) into "out", one row of "columns" scores each.
+			void scoreBand(const Plane& image, const Template& t, size_t rowBegin, size_t rowEnd, float* out, size_t columns) {
+				const Plane& templ = t.zeroMean;
+				double pixels = static_cast<double>(templ.rows * templ.columns);
+
+				// Integral images of the input rows this band reads: [rowBegin, rowEnd + template rows - 1).
+				size_t rows = rowEnd - rowBegin + templ.rows - 1;
+				size_t stride = image.columns + 1;
+				std::vector<double> sums((rows + 1) * stride, 0.0);
+				std::vector<double> squares((rows + 1) * stride, 0.0);
+				for (size_t i = 0; i < rows; ++i) {
+					const float* src = image.row(rowBegin + i);
+					double rowSum = 0;
+					double rowSquares = 0;
+					for (size_t j = 0; j < image.columns; ++j) {
+						rowSum += src[j];
+						rowSquares += static_cast<double>(src[j]) * src[j];
+						sums[(i + 1) * stride + j + 1] = sums[i * stride + j + 1] + rowSum;
+						squares[(i + 1) * stride + j + 1] = squares[i * stride + j + 1] + rowSquares;
+					}
+				}
+
+				std::vector<float> correlation(columns);
+				for (size_t r = rowBegin; r < rowEnd; ++r) {
+					std::fill(correlation.begin(), correlation.end(), 0.0f);
+
+					// Tap by tap over the whole output row, so the inner loop is a plain vectorisable sweep.
+					for (size_t u = 0; u < templ.rows; ++u) {
+						const float* src = image.row(r + u);
+						const float* taps = templ.row(u);
+						for (size_t v = 0; v < templ.columns; ++v) {
+							float tap = taps[v];
+							const float* shifted = src + v;
+							for (size_t x = 0; x < columns; ++x) {
+								correlation[x] += tap * shifted[x];
+							}
+						}
+					}
+
+					size_t top = (r - rowBegin) * stride;
+					size_t bottom = (r - rowBegin + templ.rows) * stride;
+					float* dst = out + (r - rowBegin) * columns;
+					for (size_t x = 0; x < columns; ++x) {
+						size_t right = x + templ.columns;
+						double sum = sums[bottom + right] - sums[top + right] - sums[bottom + x] + sums[top + x];
+						double square = squares[bottom + right] - squares[top + right] - squares[bottom + x] + squares[top + x];
+						dst[x] = normalise(correlation[x], sum, square, pixels, t.energy);
+					}
+				}
+			}
+
+			void scoreMap(const Plane& image, const Template& t, Result& result) {
+				result.rows = image.rows - t.zeroMean.rows + 1;
+				result.columns = image.columns - t.zeroMean.columns + 1;
+				result.scores.assign(result.rows * result.columns, 0.0f);
+
+				ThreadPool& pool = ThreadPool::instance();
+				size_t bands = std::max(pool.threadCount(), (result.rows + BAND_ROWS - 1) / BAND_ROWS);
+
+				pool.parallelForBands(0, result.rows, bands, [&](size_t rowBegin, size_t rowEnd) {
+					scoreBand(image, t, rowBegin, rowEnd, result.scores.data() + rowBegin * result.columns, result.columns);
+				});
+			}
+
+			// Score of a single position, computed directly.
+			float scoreAt(const Plane& image, const Template& t, size_t row, size_t column) {
+				const Plane& templ = t.zeroMean;
+				double correlation = 0;
+				double sum = 0;
+				double squares = 0;
+
+				for (size_t u = 0; u < templ.rows; ++u) {
+					const float* src = image.row(row + u) + column;
+					const float* taps = templ.row(u);
+					for (size_t v = 0; v < templ.columns; ++v) {
+						correlation += static_cast<double>(taps[v]) * src[v];
+						sum += src[v];
+						squares += static_cast<double>(src[v]) * src[v];
+					}
+				}
+				return normalise(correlation, sum, squares, static_cast<double>(templ.rows * templ.columns), t.energy);
+			}
+
+			// Best first, dropping any location within (rows, columns) of a better one, at most "keep".
+			void suppress(std::vector<Location>& locations, size_t keep, size_t rows, size_t columns) {
+				std::sort(locations.begin(), locations.end(),
+						  [](const Location& a, const Location& b) { return a.score > b.score; });
+
+				std::vector<Location> kept;
+				for (const auto& location : locations) {
+					if (kept.size() == keep) {
+						break;
+					}
+					bool near = std::any_of(kept.begin(), kept.end(), [&](const Location& other) {
+						size_t dr = location.row > other.row ? location.row - other.row : other.row - location.row;
+						size_t dc = location.column > other.column ? location.column - other.column : other.column - location.column;
+						return dr < rows && dc < columns;
+					});
+					if (!near) {
+						kept.push_back(location);
+					}
+				}
+				locations.swap(kept);
+			}
+
+			// Local maxima (3x3) of the score map, at most "keep" per band, best first after suppression.
+			std::vector<Location> peaks(const Result& map, size_t keep, size_t rows, size_t columns) {
+				std::vector<Location> candidates;
+				std::mutex candidatesMutex;
+
+				ThreadPool::instance().parallelFor(0, map.rows, [&](size_t rowBegin, size_t rowEnd) {
+					std::vector<Location> band;
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						for (size_t j = 0; j < map.columns; ++j) {
+							float score = map.scoreAt(i, j);
+							bool peak = true;
+							for (size_t y = (i == 0 ? 0 : i - 1); peak && y <= std::min(i + 1, map.rows - 1); ++y) {
+								for (size_t x = (j == 0 ? 0 : j - 1); x <= std::min(j + 1, map.columns - 1); ++x) {
+									// Ties go to the first position in scan order.
+									float other = map.scoreAt(y, x);
+									if (other > score || (other == score && (y < i || (y == i && x < j)))) {
+										peak = false;
+										break;
+									}
+								}
+							}
+							if (peak) {
+								band.push_back({ i, j, score });
+							}
+						}
+					}
+
+					if (band.size() > keep) {
+						std::nth_element(band.begin(), band.begin() + keep, band.end(),
+										 [](const Location& a, const Location& b) { return a.score > b.score; });
+						band.resize(keep);
+					}
+
+					std::lock_guard<std::mutex> lock(candidatesMutex);
+					candidates.insert(candidates.end(), band.begin(), band.end());
+				});
+
+				suppress(candidates, keep, rows, columns);
+				return candidates;
+			}
+		}
+
+		Result match(const ImageData& image, const ImageData& templ, size_t count) {
+			Result result;
+			size_t templRows = templ.size();
+			size_t templColumns = templ.empty() ? 0 : templ[0].size();
+			size_t imageRows = image.size();
+			size_t imageColumns = image.empty() ? 0 : image[0].size();
+			if (templRows == 0 || templColumns == 0 || templRows > imageRows || templColumns > imageColumns || count == 0) {
+				return result;
+			}
+
+			std::vector<Plane> images{ toPlane(image) };
+			std::vector<Plane> templates{ toPlane(templ) };
+			while ((std::min(templates.back().rows, templates.back().columns) / 2) >= COARSE_SIDE) {
+				images.push_back(halved(images.back()));
+				templates.push_back(halved(templates.back()));
+			}
+
+			size_t levels = images.size() - 1;
+			size_t keep = levels == 0 ? count : std::max(MIN_CANDIDATES, count * CANDIDATES_PER_MATCH);
+
+			Template coarse = prepare(templates.back());
+			scoreMap(images.back(), coarse, result);
+			result.scale = size_t(1) << levels;
+
+			auto halfSize = [](const Plane& t) {
+				return std::make_pair(std::max<size_t>(1, t.rows / 2), std::max<size_t>(1, t.columns / 2));
+			};
+			auto [suppressRows, suppressColumns] = halfSize(templates.back());
+			std::vector<Location> candidates = peaks(result, keep, suppressRows, suppressColumns);
+
+			// Carry the candidates down the pyramid, searching around each at every finer level.
+			for (size_t level = levels; level-- > 0;) {
+				const Plane& levelImage = images[level];
+				Template t = prepare(templates[level]);
+				size_t lastRow = levelImage.rows - t.zeroMean.rows;
+				size_t lastColumn = levelImage.columns - t.zeroMean.columns;
+
+				ThreadPool::instance().parallelFor(0, candidates.size(), [&](size_t begin, size_t end) {
+					for (size_t k = begin; k < end; ++k) {
+						size_t centreRow = std::min(2 * candidates[k].row, lastRow);
+						size_t centreColumn = std::min(2 * candidates[k].column, lastColumn);
+
+						Location best{ centreRow, centreColumn, -2.0f };
+						for (size_t r = centreRow - std::min(centreRow, REFINE_RADIUS); r <= std::min(centreRow + REFINE_RADIUS, lastRow); ++r) {
+							for (size_t c = centreColumn - std::min(centreColumn, REFINE_RADIUS); c <= std::min(centreColumn + REFINE_RADIUS, lastColumn); ++c) {
+								float score = scoreAt(levelImage, t, r, c);
+								if (score > best.score) {
+									best = { r, c, score };
+								}
+							}
+						}
+						candidates[k] = best;
+					}
+				});
+
+				std::tie(suppressRows, suppressColumns) = halfSize(templates[level]);
+				suppress(candidates, level == 0 ? count : keep, suppressRows, suppressColumns);
+			}
+
+			candidates.resize(std::min(candidates.size(), count));
+			result.best = std::move(candidates);
+			return result;
+		}
+	}
+}
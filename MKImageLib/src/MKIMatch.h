@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	namespace Match {
+		// Top-left corner of a match in the image, and its score.
+		struct Location {
+			size_t row = 0;
+			size_t column = 0;
+			float score = 0;
+		};
+
+		struct Result {
+			/*
+				Score of the template at every position where it fits, row-major, from -1 to 1 (0 where
+				the image or template is flat). For pyramid searches the map is that of the coarsest
+				level: entry (r, c) covers full-resolution position (r * scale, c * scale).
+			*/
+			size_t rows = 0;
+			size_t columns = 0;
+			size_t scale = 1;
+			std::vector<float> scores;
+			// Full-resolution matches, best first, at least half a template apart.
+			std::vector<Location> best;
+
+			float scoreAt(size_t row, size_t column) const { return scores[row * columns + column]; }
+		};
+
+		/*
+			Zero-mean normalised cross-correlation of "templ" over "image", keeping the "count" best matches.
+
+			Window sums and sums of squares come from integral images built per row band, so the
+			normalisation costs O(1) per position. The correlation itself runs tap by tap over whole
+			rows (vectorisable sweeps) on the ThreadPool. Templates of at least 24 pixels a side are
+			first matched on a 2x2-averaged pyramid down to about 12 pixels a side, and the best
+			candidates are then refined level by level in a small neighbourhood.
+		*/
+		Result match(const ImageData& image, const ImageData& templ, size_t count);
+	}
+}
@@ -0,0 +1,328 @@
+#include "MKIMetrics.h"
+
+#include "MKIThreadPool.h"
+#include "MKITrace.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace MKImage {
+	namespace Metrics {
+		namespace {
+			constexpr size_t WINDOW = 11;
+			constexpr double SIGMA = 1.5;
+			constexpr double K1 = 0.01;
+			constexpr double K2 = 0.03;
+			constexpr size_t SCALES = 5;
+			constexpr std::array<double, SCALES> SCALE_WEIGHTS = { 0.0448, 0.2856, 0.3001, 0.2363, 0.1333 };
+			// Row bands per thread for SSIM, so bands of uneven cost still balance.
+			constexpr size_t BANDS_PER_THREAD = 4;
+			// Filtered quantities per pixel: x, y, x^2, y^2, xy.
+			constexpr size_t MOMENTS = 5;
+
+			const double NOT_A_NUMBER = std::numeric_limits<double>::quiet_NaN();
+
+			// A gray image as floats scaled to [0, 1].
+			struct Plane {
+				size_t rows = 0;
+				size_t columns = 0;
+				std::vector<float> pixels;
+
+				const float* row(size_t i) const { return pixels.data() + i * columns; }
+				float* row(size_t i) { return pixels.data() + i * columns; }
+			};
+
+			bool sameSize(const Image& a, const Image& b) {
+				return a.rows() == b.rows() && a.columns() == b.columns() && a.rows() > 0 && a.columns() > 0;
+			}
+
+			short range(const Image& a, const Image& b) {
+				return std::max<short>(1, std::max(a.depth(), b.depth()));
+			}
+
+			const std::array<float, WINDOW>& gaussian() {
+				static const auto weights = [] {
+					std::array<float, WINDOW> w{};
+					double sum = 0;
+					for (size_t k = 0; k < WINDOW; ++k) {
+						double x = static_cast<double>(k) - (WINDOW - 1) / 2.0;
+						sum += std::exp(-x * x / (2 * SIGMA * SIGMA));
+					}
+					for (size_t k = 0; k < WINDOW; ++k) {
+						double x = static_cast<double>(k) - (WINDOW - 1) / 2.0;
+						w[k] = static_cast<float>(std::exp(-x * x / (2 * SIGMA * SIGMA)) / sum);
+					}
+					return w;
+				}();
+				return weights;
+			}
+
+			Plane toPlane(const Image& image, short range) {
+				Plane plane{ image.rows(), image.columns(), std::vector<float>(image.rows() * image.columns()) };
+				float scale = 1.0f / range;
+
+				ThreadPool::instance().parallelFor(0, plane.rows, [&](size_t rowBegin, size_t rowEnd) {
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						const short* src = image.data()[i].data();
+						float* dst = plane.row(i);
+						for (size_t j = 0; j < plane.columns; ++j) {
+							dst[j] = src[j] * scale;
+						}
+					}
+				});
+				return plane;
+			}
+
+			// 2x2 average, dropping an odd last row or column.
+			Plane halved(const Plane& in) {
+				Plane out{ in.rows / 2, in.columns / 2, std::vector<float>((in.rows / 2) * (in.columns / 2)) };
+
+				ThreadPool::instance().parallelFor(0, out.rows, [&](size_t rowBegin, size_t rowEnd) {
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						const float* top = in.row(2 * i);
+						const float* bottom = in.row(2 * i + 1);
+						float* dst = out.row(i);
+						for (size_t j = 0; j < out.columns; ++j) {
+							dst[j] = 0.25f * (top[2 * j] + top[2 * j + 1] + bottom[2 * j] + bottom[2 * j + 1]);
+						}
+					}
+				});
+				return out;
+			}
+
+			/*
+				Mean SSIM and mean contrast-structure term of two equally sized planes.
+
+				Each band filters its input rows horizontally into a ring of the last WINDOW rows (one
+				per moment), then filters the ring vertically to get the local means and (co)variances
+				of every output row in the band.
+			*/
+			void ssimPlane(const Plane& x, const Plane& y, double& ssim, double& cs) {
+				const auto& g = gaussian();
+				const float c1 = static_cast<float>(K1 * K1);
+				const float c2 = static_cast<float>(K2 * K2);
+
+				size_t outRows = x.rows - WINDOW + 1;
+				size_t outColumns = x.columns - WINDOW + 1;
+
+				double ssimSum = 0;
+				double csSum = 0;
+				std::mutex sumMutex;
+
+				ThreadPool& pool = ThreadPool::instance();
+				size_t bands = std::min(outRows, pool.threadCount() * BANDS_PER_THREAD);
+
+				pool.parallelForBands(0, outRows, bands, [&](size_t rowBegin, size_t rowEnd) {
+					// ring[(row % WINDOW) * MOMENTS + m] = horizontally filtered moment m of input "row"
+					std::vector<float> ring(WINDOW * MOMENTS * outColumns);
+					std::vector<float> moments(MOMENTS * outColumns);
+					// products[m * columns + j] = moment m of input pixel j in the current row
+					std::vector<float> products(MOMENTS * x.columns);
+					auto ringRow = [&](size_t row, size_t moment) {
+						return ring.data() + ((row % WINDOW) * MOMENTS + moment) * outColumns;
+					};
+
+					double bandSsim = 0;
+					double bandCs = 0;
+
+					for (size_t i = rowBegin; i < rowEnd + WINDOW - 1; ++i) {
+						const float* xr = x.row(i);
+						const float* yr = y.row(i);
+						float* px = products.data();
+						float* py = px + x.columns;
+						float* pxx = py + x.columns;
+						float* pyy = pxx + x.columns;
+						float* pxy = pyy + x.columns;
+						for (size_t j = 0; j < x.columns; ++j) {
+							px[j] = xr[j];
+							py[j] = yr[j];
+							pxx[j] = xr[j] * xr[j];
+							pyy[j] = yr[j] * yr[j];
+							pxy[j] = xr[j] * yr[j];
+						}
+
+						// Tap by tap over whole rows, so the inner loops are plain vectorisable sweeps.
+						for (size_t m = 0; m < MOMENTS; ++m) {
+							const float* src = products.data() + m * x.columns;
+							float* dst = ringRow(i, m);
+							std::fill(dst, dst + outColumns, 0.0f);
+							for (size_t k = 0; k < WINDOW; ++k) {
+								for (size_t j = 0; j < outColumns; ++j) {
+									dst[j] += g[k] * src[j + k];
+								}
+							}
+						}
+
+						if (i < rowBegin + WINDOW - 1) {
+							continue;
+						}
+
+						// The ring now holds input rows [i - WINDOW + 1, i], i.e. output row i - WINDOW + 1.
+						std::fill(moments.begin(), moments.end(), 0.0f);
+						for (size_t k = 0; k < WINDOW; ++k) {
+							size_t source = i + 1 - WINDOW + k;
+							for (size_t m = 0; m < MOMENTS; ++m) {
+								const float* src = ringRow(source, m);
+								float* dst = moments.data() + m * outColumns;
+								for (size_t j = 0; j < outColumns; ++j) {
+									dst[j] += g[k] * src[j];
+								}
+							}
+						}
+
+						const float* mx = moments.data();
+						const float* my = mx + outColumns;
+						const float* exx = my + outColumns;
+						const float* eyy = exx + outColumns;
+						const float* exy = eyy + outColumns;
+
+						double rowSsim = 0;
+						double rowCs = 0;
+						for (size_t j = 0; j < outColumns; ++j) {
+							float mxy = mx[j] * my[j];
+							float mxx = mx[j] * mx[j];
+							float myy = my[j] * my[j];
+							float contrast = (2 * (exy[j] - mxy) + c2) / ((exx[j] - mxx) + (eyy[j] - myy) + c2);
+							rowCs += contrast;
+							rowSsim += (2 * mxy + c1) / (mxx + myy + c1) * contrast;
+						}
+						bandSsim += rowSsim;
+						bandCs += rowCs;
+					}
+
+					std::lock_guard<std::mutex> lock(sumMutex);
+					ssimSum += bandSsim;
+					csSum += bandCs;
+				});
+
+				double count = static_cast<double>(outRows) * outColumns;
+				ssim = ssimSum / count;
+				cs = csSum / count;
+			}
+
+			uint64_t squaredDifferences(const short* a, const short* b, size_t columns) {
+				uint64_t sum = 0;
+				size_t j = 0;
+#ifdef __SSE2__
+				// Pixels are in [0, 32767], so a difference fits 16 bits and a pair of squares 32 bits.
+				__m128i total = _mm_setzero_si128();
+				const __m128i zero = _mm_setzero_si128();
+				for (; j + 8 <= columns; j += 8) {
+					__m128i d = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + j)),
+											  _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j)));
+					__m128i squares = _mm_madd_epi16(d, d);
+					total = _mm_add_epi64(total, _mm_unpacklo_epi32(squares, zero));
+					total = _mm_add_epi64(total, _mm_unpackhi_epi32(squares, zero));
+				}
+				alignas(16) uint64_t lanes[2];
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes), total);
+				sum = lanes[0] + lanes[1];
+#endif
+				for (; j < columns; ++j) {
+					int64_t d = static_cast<int64_t>(a[j]) - b[j];
+					sum += static_cast<uint64_t>(d * d);
+				}
+				return sum;
+			}
+		}
+
+		double mse(const Image& a, const Image& b) {
+			if (!sameSize(a, b)) {
+				return NOT_A_NUMBER;
+			}
+
+			Trace::Scope trace("mse", "metrics");
+			trace.addPixels(a.rows() * a.columns());
+
+			uint64_t total = 0;
+			std::mutex totalMutex;
+
+			ThreadPool::instance().parallelFor(0, a.rows(), [&](size_t rowBegin, size_t rowEnd) {
+				uint64_t band = 0;
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					band += squaredDifferences(a.data()[i].data(), b.data()[i].data(), a.columns());
+				}
+
+				std::lock_guard<std::mutex> lock(totalMutex);
+				total += band;
+			});
+
+			return static_cast<double>(total) / (static_cast<double>(a.rows()) * a.columns());
+		}
+
+		double psnr(const Image& a, const Image& b) {
+			double error = mse(a, b);
+			if (std::isnan(error)) {
+				return error;
+			}
+			if (error == 0) {
+				return std::numeric_limits<double>::infinity();
+			}
+
+			double peak = range(a, b);
+			return 10.0 * std::log10(peak * peak / error);
+		}
+
+		double ssim(const Image& a, const Image& b) {
+			if (!sameSize(a, b) || a.rows() < WINDOW || a.columns() < WINDOW) {
+				return NOT_A_NUMBER;
+			}
+
+			Trace::Scope trace("ssim", "metrics");
+			trace.addPixels(a.rows() * a.columns());
+
+			short peak = range(a, b);
+			double result = 0;
+			double cs = 0;
+			ssimPlane(toPlane(a, peak), toPlane(b, peak), result, cs);
+			return result;
+		}
+
+		double msSsim(const Image& a, const Image& b) {
+			if (!sameSize(a, b) || a.rows() < WINDOW || a.columns() < WINDOW) {
+				return NOT_A_NUMBER;
+			}
+
+			Trace::Scope trace("msSsim", "metrics");
+			trace.addPixels(a.rows() * a.columns());
+
+			size_t scales = 1;
+			for (size_t side = std::min(a.rows(), a.columns()) / 2; scales < SCALES && side >= WINDOW; side /= 2) {
+				++scales;
+			}
+
+			double weightSum = 0;
+			for (size_t s = 0; s < scales; ++s) {
+				weightSum += SCALE_WEIGHTS[s];
+			}
+
+			short peak = range(a, b);
+			Plane x = toPlane(a, peak);
+			Plane y = toPlane(b, peak);
+
+			double result = 1;
+			for (size_t s = 0; s < scales; ++s) {
+				double ssimValue = 0;
+				double cs = 0;
+				ssimPlane(x, y, ssimValue, cs);
+
+				// Negative terms (anti-correlated structure) would make the power undefined.
+				double term = s + 1 == scales ? ssimValue : cs;
+				result *= std::pow(std::max(term, 0.0), SCALE_WEIGHTS[s] / weightSum);
+
+				if (s + 1 < scales) {
+					x = halved(x);
+					y = halved(y);
+				}
+			}
+			return result;
+		}
+	}
+}
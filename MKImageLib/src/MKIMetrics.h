@@ -0,0 +1,32 @@
+#pragma once
+
+#include "MKIImage.h"
+
+namespace MKImage {
+
+	/*
+		Full-reference quality metrics, e.g. to check a fast approximate path against the exact one.
+		Both images must have the same size; otherwise (or when an image is too small for the SSIM
+		window) the result is NaN. The dynamic range is the larger of the two depths.
+	*/
+	namespace Metrics {
+		// Mean squared error, in one pass with SSE2 where available.
+		double mse(const Image& a, const Image& b);
+		// Peak signal-to-noise ratio in dB; infinity for identical images.
+		double psnr(const Image& a, const Image& b);
+
+		/*
+			Mean structural similarity (Wang et al. 2004): 11x11 Gaussian window with sigma 1.5,
+			K1 = 0.01, K2 = 0.03, over the positions where the window fits inside the image.
+			The window is applied separably on row bands in parallel.
+		*/
+		double ssim(const Image& a, const Image& b);
+
+		/*
+			Multi-scale SSIM (Wang et al. 2003): contrast-structure at five scales, halving the images
+			between them, and the full SSIM at the coarsest. Images too small for five scales use as
+			many as fit, with the weights renormalised.
+		*/
+		double msSsim(const Image& a, const Image& b);
+	}
+}
@@ -0,0 +1,478 @@
+#include "MKIMorphology.h"
+
+#include "MKIThreadPool.h"
+#include "MKIBufferPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <cstdint>
+
+namespace MKImage {
+
+	/* #################### StructuringElement #################### */
+
+	StructuringElement::StructuringElement()
+		: m_Element{}, m_Runs{}, m_Rows{ 0 }, m_Columns{ 0 }, m_RowAnchor{ 0 }, m_ColumnAnchor{ 0 },
+		m_Rectangular{ false } {
+	}
+
+	StructuringElement::StructuringElement(std::initializer_list<std::initializer_list<short>> values)
+		: StructuringElement{} {
+
+		for (auto& row : values) {
+			m_Element.emplace_back(row);
+		}
+
+		m_Rows = m_Element.size();
+		m_Columns = m_Element.at(0).size();
+		m_RowAnchor = m_Rows / 2;
+		m_ColumnAnchor = m_Columns / 2;
+
+		findRuns();
+	}
+
+	StructuringElement::StructuringElement(size_t rows, size_t columns)
+		: StructuringElement{} {
+
+		m_Element.assign(rows, std::vector<short>(columns, 1));
+		m_Rows = rows;
+		m_Columns = columns;
+		m_RowAnchor = m_Rows / 2;
+		m_ColumnAnchor = m_Columns / 2;
+
+		findRuns();
+	}
+
+	StructuringElement StructuringElement::reflected() const {
+		StructuringElement out;
+		out.m_Element = m_Element;
+		std::reverse(out.m_Element.begin(), out.m_Element.end());
+		for (auto& row : out.m_Element) {
+			std::reverse(row.begin(), row.end());
+		}
+
+		out.m_Rows = m_Rows;
+		out.m_Columns = m_Columns;
+		out.m_RowAnchor = m_Rows - 1 - m_RowAnchor;
+		out.m_ColumnAnchor = m_Columns - 1 - m_ColumnAnchor;
+
+		out.findRuns();
+		return out;
+	}
+
+	void StructuringElement::findRuns() {
+		m_Runs.clear();
+		m_Rectangular = true;
+
+		for (size_t i = 0; i < m_Rows; ++i) {
+			size_t j = 0;
+			while (j < m_Columns) {
+				if (m_Element.at(i).at(j) == 0) {
+					m_Rectangular = false;
+					++j;
+					continue;
+				}
+
+				size_t start = j;
+				while (j < m_Columns && m_Element.at(i).at(j) != 0) {
+					++j;
+				}
+				m_Runs.push_back({ i, start, j - start });
+			}
+		}
+
+		if (m_Runs.empty()) {
+			m_Rectangular = false;
+		}
+	}
+
+	const StructuringElement StructuringElement::SQUARE_3X3{ 3, 3 };
+
+	const StructuringElement StructuringElement::SQUARE_5X5{ 5, 5 };
+
+	const StructuringElement StructuringElement::CROSS_3X3{ { 0, 1, 0},
+															{ 1, 1, 1},
+															{ 0, 1, 0} };
+
+	const StructuringElement StructuringElement::CROSS_5X5{ { 0, 0, 1, 0, 0},
+															{ 0, 0, 1, 0, 0},
+															{ 1, 1, 1, 1, 1},
+															{ 0, 0, 1, 0, 0},
+															{ 0, 0, 1, 0, 0} };
+
+	const StructuringElement StructuringElement::DISK_5X5{ { 0, 1, 1, 1, 0},
+														   { 1, 1, 1, 1, 1},
+														   { 1, 1, 1, 1, 1},
+														   { 1, 1, 1, 1, 1},
+														   { 0, 1, 1, 1, 0} };
+
+	const StructuringElement StructuringElement::DISK_7X7{ { 0, 0, 1, 1, 1, 0, 0},
+														   { 0, 1, 1, 1, 1, 1, 0},
+														   { 1, 1, 1, 1, 1, 1, 1},
+														   { 1, 1, 1, 1, 1, 1, 1},
+														   { 1, 1, 1, 1, 1, 1, 1},
+														   { 0, 1, 1, 1, 1, 1, 0},
+														   { 0, 0, 1, 1, 1, 0, 0} };
+
+	/* #################### Morphology #################### */
+
+	namespace Morphology {
+		namespace {
+			using Word = uint64_t;
+			using BitRow = std::vector<Word>;
+			constexpr size_t WORD_BITS = 64;
+			// Columns per chunk in the vertical pass, sized so a chunk of g/h rows stays in cache.
+			constexpr size_t COLUMN_CHUNK = 256;
+
+			struct Min {
+				short operator()(short a, short b) const { return std::min(a, b); }
+				Word operator()(Word a, Word b) const { return a & b; }
+			};
+
+			struct Max {
+				short operator()(short a, short b) const { return std::max(a, b); }
+				Word operator()(Word a, Word b) const { return a | b; }
+			};
+
+			/*
+				van Herk/Gil-Werman sliding window over "ext" (length "length").
+				result[k] = op(ext[k], ..., ext[k + window - 1]) for k in [0, length - window].
+			*/
+			template<typename T, typename Op>
+			void slidingWindow(const T* ext, size_t length, size_t window, T* g, T* h, T* result, Op op) {
+				for (size_t k = 0; k < length; ++k) {
+					g[k] = (k % window == 0) ? ext[k] : op(g[k - 1], ext[k]);
+				}
+				for (size_t k = length; k-- > 0;) {
+					h[k] = (k % window == window - 1 || k == length - 1) ? ext[k] : op(h[k + 1], ext[k]);
+				}
+				for (size_t k = 0; k + window <= length; ++k) {
+					result[k] = op(h[k], g[k + window - 1]);
+				}
+			}
+
+			/*
+				Horizontal pass of a rectangular element: every row of "in" is filtered with a window of
+				"window" columns whose anchor is "anchor", writing to the same row of "out".
+			*/
+			template<typename Op>
+			void horizontalPass(const ImageData& in, ImageData& out, size_t window, size_t anchor, short identity, Op op) {
+				size_t columns = in.at(0).size();
+
+				ThreadPool::instance().parallelFor(0, in.size(), [&](size_t rowBegin, size_t rowEnd) {
+					size_t length = columns + window - 1;
+					// Per-thread scratch keeps its capacity between calls.
+					thread_local std::vector<short> ext, g, h;
+					ext.assign(length, identity);
+					g.resize(length);
+					h.resize(length);
+
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						if (window == 1) {
+							out.at(i) = in.at(i);
+							continue;
+						}
+						std::copy(in.at(i).begin(), in.at(i).end(), ext.begin() + anchor);
+						slidingWindow(ext.data(), length, window, g.data(), h.data(), out.at(i).data(), op);
+					}
+				});
+			}
+
+			/*
+				Vertical pass of a rectangular element. Rows are treated as vectors so the van Herk/Gil-Werman
+				recurrences run along contiguous memory; threads take disjoint column chunks.
+			*/
+			template<typename T, typename Op>
+			void verticalPass(const std::vector<std::vector<T>>& in, std::vector<std::vector<T>>& out,
+							  size_t window, size_t anchor, T identity, Op op) {
+				size_t rows = in.size();
+				size_t columns = in.at(0).size();
+
+				if (window == 1) {
+					out = in;
+					return;
+				}
+
+				ThreadPool::instance().parallelFor(0, (columns + COLUMN_CHUNK - 1) / COLUMN_CHUNK,
+												   [&](size_t chunkBegin, size_t chunkEnd) {
+					size_t length = rows + window - 1;
+					thread_local std::vector<T> g, h, identityRow;
+					g.resize(length * COLUMN_CHUNK);
+					h.resize(length * COLUMN_CHUNK);
+					identityRow.assign(COLUMN_CHUNK, identity);
+
+					for (size_t chunk = chunkBegin; chunk < chunkEnd; ++chunk) {
+						size_t c0 = chunk * COLUMN_CHUNK;
+						size_t width = std::min(COLUMN_CHUNK, columns - c0);
+
+						auto extRow = [&](size_t k) -> const T* {
+							if (k < anchor || k - anchor >= rows) {
+								return identityRow.data();
+							}
+							return in[k - anchor].data() + c0;
+						};
+
+						for (size_t k = 0; k < length; ++k) {
+							const T* src = extRow(k);
+							T* dst = &g[k * COLUMN_CHUNK];
+							if (k % window == 0) {
+								std::copy(src, src + width, dst);
+							} else {
+								const T* prev = dst - COLUMN_CHUNK;
+								for (size_t c = 0; c < width; ++c) {
+									dst[c] = op(prev[c], src[c]);
+								}
+							}
+						}
+						for (size_t k = length; k-- > 0;) {
+							const T* src = extRow(k);
+							T* dst = &h[k * COLUMN_CHUNK];
+							if (k % window == window - 1 || k == length - 1) {
+								std::copy(src, src + width, dst);
+							} else {
+								const T* next = dst + COLUMN_CHUNK;
+								for (size_t c = 0; c < width; ++c) {
+									dst[c] = op(next[c], src[c]);
+								}
+							}
+						}
+						for (size_t i = 0; i < rows; ++i) {
+							const T* hRow = &h[i * COLUMN_CHUNK];
+							const T* gRow = &g[(i + window - 1) * COLUMN_CHUNK];
+							T* dst = out[i].data() + c0;
+							for (size_t c = 0; c < width; ++c) {
+								dst[c] = op(hRow[c], gRow[c]);
+							}
+						}
+					}
+				});
+			}
+
+			/*
+				Arbitrary elements: each horizontal run of the element is a 1D van Herk/Gil-Werman window
+				over the matching source row; the output is the op of all shifted run results.
+			*/
+			template<typename Op>
+			void runPass(const ImageData& in, ImageData& out, const StructuringElement& element, short identity, Op op) {
+				const auto& runs = element.runs();
+				long rows = static_cast<long>(in.size());
+				size_t columns = in.at(0).size();
+				size_t pad = element.columns();
+				size_t length = columns + 2 * pad;
+
+				std::vector<size_t> lengths;
+				for (const auto& run : runs) {
+					if (std::find(lengths.begin(), lengths.end(), run.length) == lengths.end()) {
+						lengths.push_back(run.length);
+					}
+				}
+
+				ThreadPool::instance().parallelFor(0, in.size(), [&](size_t rowBegin, size_t rowEnd) {
+					long firstRow = std::max(0L, static_cast<long>(rowBegin) - static_cast<long>(element.rowAnchor()));
+					long lastRow = std::min(rows, static_cast<long>(rowEnd) - static_cast<long>(element.rowAnchor())
+											+ static_cast<long>(element.rows()));
+					size_t cached = static_cast<size_t>(std::max(0L, lastRow - firstRow));
+
+					// windows[l][r] = op over each window of lengths[l] on source row firstRow + r
+					std::vector<std::vector<std::vector<short>>> windows(lengths.size(),
+						std::vector<std::vector<short>>(cached, std::vector<short>(length)));
+					std::vector<short> ext(length, identity), g(length), h(length);
+
+					for (long r = firstRow; r < lastRow; ++r) {
+						std::copy(in.at(r).begin(), in.at(r).end(), ext.begin() + pad);
+						for (size_t l = 0; l < lengths.size(); ++l) {
+							slidingWindow(ext.data(), length, lengths[l], g.data(), h.data(),
+										  windows[l][r - firstRow].data(), op);
+						}
+					}
+
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						std::vector<short>& dst = out.at(i);
+						std::fill(dst.begin(), dst.end(), identity);
+
+						for (const auto& run : runs) {
+							long source = static_cast<long>(i + run.row) - static_cast<long>(element.rowAnchor());
+							if (source < 0 || source >= rows) {
+								continue;
+							}
+
+							size_t l = std::find(lengths.begin(), lengths.end(), run.length) - lengths.begin();
+							const short* src = windows[l][source - firstRow].data() + pad + run.column - element.columnAnchor();
+							for (size_t c = 0; c < columns; ++c) {
+								dst[c] = op(dst[c], src[c]);
+							}
+						}
+					}
+				});
+			}
+
+			template<typename Op>
+			void grayFilter(const ImageData& in, ImageData& out, const StructuringElement& element, short identity, Op op) {
+				if (element.isRectangular()) {
+					ImageData horizontal = BufferPool::instance().acquire(in.size(), in.at(0).size());
+					horizontalPass(in, horizontal, element.columns(), element.columnAnchor(), identity, op);
+					verticalPass(horizontal, out, element.rows(), element.rowAnchor(), identity, op);
+					BufferPool::instance().release(std::move(horizontal));
+				} else {
+					runPass(in, out, element, identity, op);
+				}
+			}
+
+			/* #################### Bit-packed binary path #################### */
+
+			void pack(const std::vector<short>& row, BitRow& bits, Word fill) {
+				std::fill(bits.begin(), bits.end(), 0);
+				for (size_t c = 0; c < row.size(); ++c) {
+					bits[c / WORD_BITS] |= static_cast<Word>(row[c] > 0) << (c % WORD_BITS);
+				}
+				// Bits past the last column behave like the outside of the image.
+				if (fill != 0) {
+					size_t tail = row.size() % WORD_BITS;
+					size_t first = row.size() / WORD_BITS;
+					if (tail != 0) {
+						bits[first++] |= ~Word(0) << tail;
+					}
+					std::fill(bits.begin() + first, bits.end(), fill);
+				}
+			}
+
+			void unpack(const BitRow& bits, std::vector<short>& row, short depth) {
+				for (size_t c = 0; c < row.size(); ++c) {
+					row[c] = ((bits[c / WORD_BITS] >> (c % WORD_BITS)) & 1) ? depth : 0;
+				}
+			}
+
+			// dst bit x = src bit (x + shift); bits shifted in from outside the row are "fill".
+			void shiftBits(const BitRow& src, long shift, Word fill, BitRow& dst) {
+				long words = static_cast<long>(src.size());
+				long wordShift = shift >= 0 ? shift / static_cast<long>(WORD_BITS)
+											: -((-shift + static_cast<long>(WORD_BITS) - 1) / static_cast<long>(WORD_BITS));
+				unsigned bitShift = static_cast<unsigned>(shift - wordShift * static_cast<long>(WORD_BITS));
+
+				auto word = [&](long i) { return (i < 0 || i >= words) ? fill : src[i]; };
+
+				for (long i = 0; i < words; ++i) {
+					Word low = word(i + wordShift);
+					if (bitShift == 0) {
+						dst[i] = low;
+					} else {
+						Word high = word(i + wordShift + 1);
+						dst[i] = (low >> bitShift) | (high << (WORD_BITS - bitShift));
+					}
+				}
+			}
+
+			// dst bit x = op(src bits x .. x + length - 1), built in log2(length) shift steps.
+			template<typename Op>
+			void windowBits(const BitRow& src, size_t length, Word fill, BitRow& dst, BitRow& scratch, Op op) {
+				dst = src;
+				size_t covered = 1;
+				while (covered * 2 <= length) {
+					shiftBits(dst, static_cast<long>(covered), fill, scratch);
+					for (size_t i = 0; i < dst.size(); ++i) {
+						dst[i] = op(dst[i], scratch[i]);
+					}
+					covered *= 2;
+				}
+				if (covered < length) {
+					shiftBits(dst, static_cast<long>(length - covered), fill, scratch);
+					for (size_t i = 0; i < dst.size(); ++i) {
+						dst[i] = op(dst[i], scratch[i]);
+					}
+				}
+			}
+
+			template<typename Op>
+			void binaryFilter(const ImageData& in, ImageData& out, const StructuringElement& element, short depth,
+							  Word identity, Op op) {
+				size_t rows = in.size();
+				// Spare words past the last column so shifting by the anchor never drops image bits.
+				size_t words = (in.at(0).size() + element.columns() + WORD_BITS - 1) / WORD_BITS;
+
+				std::vector<BitRow> packed(rows, BitRow(words));
+				ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						pack(in[i], packed[i], identity);
+					}
+				});
+
+				std::vector<BitRow> result(rows, BitRow(words));
+
+				if (element.isRectangular()) {
+					std::vector<BitRow> horizontal(rows, BitRow(words));
+					ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+						BitRow shifted(words), scratch(words);
+						for (size_t i = rowBegin; i < rowEnd; ++i) {
+							shiftBits(packed[i], -static_cast<long>(element.columnAnchor()), identity, shifted);
+							windowBits(shifted, element.columns(), identity, horizontal[i], scratch, op);
+						}
+					});
+					verticalPass(horizontal, result, element.rows(), element.rowAnchor(), identity, op);
+				} else {
+					const auto& runs = element.runs();
+					ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+						BitRow window(words), scratch(words), shifted(words);
+						for (size_t i = rowBegin; i < rowEnd; ++i) {
+							BitRow& dst = result[i];
+							std::fill(dst.begin(), dst.end(), identity);
+
+							for (const auto& run : runs) {
+								long source = static_cast<long>(i + run.row) - static_cast<long>(element.rowAnchor());
+								if (source < 0 || source >= static_cast<long>(rows)) {
+									continue;
+								}
+
+								shiftBits(packed[source], static_cast<long>(run.column) - static_cast<long>(element.columnAnchor()),
+										  identity, shifted);
+								windowBits(shifted, run.length, identity, window, scratch, op);
+								for (size_t w = 0; w < words; ++w) {
+									dst[w] = op(dst[w], window[w]);
+								}
+							}
+						}
+					});
+				}
+
+				ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						unpack(result[i], out[i], depth);
+					}
+				});
+			}
+		}
+
+		void erode(const ImageData& in, ImageData& out, const StructuringElement& element) {
+			grayFilter(in, out, element, std::numeric_limits<short>::max(), Min{});
+		}
+
+		void dilate(const ImageData& in, ImageData& out, const StructuringElement& element) {
+			grayFilter(in, out, element.reflected(), std::numeric_limits<short>::min(), Max{});
+		}
+
+		void erodeBinary(const ImageData& in, ImageData& out, const StructuringElement& element, short depth) {
+			binaryFilter(in, out, element, depth, ~Word(0), Min{});
+		}
+
+		void dilateBinary(const ImageData& in, ImageData& out, const StructuringElement& element, short depth) {
+			binaryFilter(in, out, element.reflected(), depth, Word(0), Max{});
+		}
+
+		bool isBinary(const ImageData& image, short depth) {
+			std::atomic<bool> binary{ true };
+
+			ThreadPool::instance().parallelFor(0, image.size(), [&](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd && binary.load(std::memory_order_relaxed); ++i) {
+					for (auto j : image[i]) {
+						if (j != 0 && j != depth) {
+							binary.store(false, std::memory_order_relaxed);
+							return;
+						}
+					}
+				}
+			});
+
+			return binary.load();
+		}
+	}
+}
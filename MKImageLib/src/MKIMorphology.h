@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <initializer_list>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	/*
+		A flat structuring element for morphology. Non-zero entries are part of the element.
+		The anchor is the center element, matching how Mask positions its kernels.
+	*/
+	class StructuringElement {
+	public:
+		// A horizontal run of set elements: row inside the element, first column and length.
+		struct Run {
+			size_t row;
+			size_t column;
+			size_t length;
+		};
+
+	private:
+		std::vector<std::vector<short>> m_Element;
+		std::vector<Run> m_Runs;
+		size_t m_Rows;
+		size_t m_Columns;
+		size_t m_RowAnchor;
+		size_t m_ColumnAnchor;
+		bool m_Rectangular;
+
+	public:
+		StructuringElement(std::initializer_list<std::initializer_list<short>> values);
+		StructuringElement(size_t rows, size_t columns);
+
+		static StructuringElement rectangle(size_t rows, size_t columns) { return StructuringElement(rows, columns); }
+
+		size_t rows() const { return m_Rows; }
+		size_t columns() const { return m_Columns; }
+		size_t rowAnchor() const { return m_RowAnchor; }
+		size_t columnAnchor() const { return m_ColumnAnchor; }
+		bool isRectangular() const { return m_Rectangular; }
+		const std::vector<Run>& runs() const { return m_Runs; }
+
+		// The element mirrored through its anchor, used so dilation is the dual of erosion.
+		StructuringElement reflected() const;
+
+	private:
+		StructuringElement();
+		void findRuns();
+
+	public:
+		static const StructuringElement SQUARE_3X3;
+		static const StructuringElement SQUARE_5X5;
+		static const StructuringElement CROSS_3X3;
+		static const StructuringElement CROSS_5X5;
+		static const StructuringElement DISK_5X5;
+		static const StructuringElement DISK_7X7;
+	};
+
+	namespace Morphology {
+		enum class Operations { unknown = 0, erode, dilate, open, close, topHat, blackHat };
+
+		/*
+			Grayscale erosion and dilation. Rectangular elements are applied separably with the
+			van Herk/Gil-Werman algorithm (three comparisons per pixel regardless of size);
+			other elements are split into horizontal runs, each run filtered with van Herk/Gil-Werman.
+			Pixels outside the image never affect the result.
+
+			in = source image, out = destination (same size as in, must not alias in)
+		*/
+		void erode(const ImageData& in, ImageData& out, const StructuringElement& element);
+		void dilate(const ImageData& in, ImageData& out, const StructuringElement& element);
+
+		/*
+			Binary erosion and dilation on a bit-packed copy of the image, 64 pixels per word.
+			Pixels greater than zero are foreground; the output uses 0 and "depth".
+		*/
+		void erodeBinary(const ImageData& in, ImageData& out, const StructuringElement& element, short depth);
+		void dilateBinary(const ImageData& in, ImageData& out, const StructuringElement& element, short depth);
+
+		// True when every pixel is either 0 or depth, e.g. the output of GS::blackAndWhite.
+		bool isBinary(const ImageData& image, short depth);
+	}
+}
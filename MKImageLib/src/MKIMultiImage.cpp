@@ -0,0 +1,223 @@
+#include "MKIMultiImage.h"
+
+#include "MKIImageConstants.h"
+#include "MKIBufferPool.h"
+#include "MKIColour.h"
+#include "MKIThreadPool.h"
+#include "MKIPnm.h"
+#include "MKITrace.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+namespace MKImage {
+	namespace {
+		constexpr size_t RGB = 3;
+	}
+
+	MultiImage::MultiImage()
+		: m_Channels{}, m_File{}, m_FileType{}, m_BadImage{ true } {
+	}
+
+	MultiImage::MultiImage(const std::string& file)
+		: MultiImage{} {
+
+		load(file);
+	}
+
+	MultiImage::MultiImage(std::vector<Image> channels)
+		: MultiImage{} {
+
+		m_Channels = std::move(channels);
+		if (!m_Channels.empty()) {
+			m_File = m_Channels[0].m_File;
+			m_FileType = m_Channels.size() == RGB ? FileType(FileType::P6) : m_Channels[0].fileType();
+			m_BadImage = std::any_of(m_Channels.begin(), m_Channels.end(),
+									 [](const Image& channel) { return channel.isBadImage(); });
+		}
+	}
+
+	void MultiImage::load(const std::string& file) {
+		Trace::Scope trace("load", "io");
+
+		m_Channels.clear();
+		m_File = Pnm::findInput(file);
+
+		std::vector<char> buffer;
+		Pnm::Header header;
+		if (!FS::exists(m_File) || !Pnm::readFile(m_File.string(), buffer) ||
+			!Pnm::parseHeader(buffer.data(), buffer.size(), header)) {
+			std::cout << "Image failed to load";
+			m_BadImage = true;
+			return;
+		}
+
+		m_FileType = header.type;
+
+		if (!Pnm::isColour(header.type)) {
+			Image gray;
+			gray.m_File = m_File;
+			gray.decode(buffer, header);
+			m_BadImage = gray.isBadImage();
+			m_Channels.push_back(std::move(gray));
+
+			trace.addPixels(header.rows * header.columns);
+			trace.addBytes(buffer.size());
+			return;
+		}
+
+		BufferPool& pool = BufferPool::instance();
+		std::vector<ImageData> planes;
+		for (size_t c = 0; c < RGB; ++c) {
+			planes.push_back(pool.acquire(header.rows, header.columns));
+		}
+
+		bool binary = Pnm::isBinary(header.type);
+		short min = 0;
+		short max = 0;
+
+		if (binary) {
+			const unsigned char* payload = reinterpret_cast<const unsigned char*>(buffer.data()) + header.length;
+			m_BadImage = !Pnm::readSamples(payload, buffer.size() - header.length, header.maxValue,
+										   { &planes[0], &planes[1], &planes[2] }, min, max);
+		}
+		else {
+			// Parse the interleaved samples as one wide image, then split it into planes.
+			ImageData interleaved = pool.acquire(header.rows, header.columns * RGB);
+			Pnm::parseText(buffer.data() + header.length, buffer.data() + buffer.size(), interleaved, min, max);
+
+			ThreadPool::instance().parallelFor(0, header.rows, [&](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					const short* src = interleaved[i].data();
+					for (size_t j = 0; j < header.columns; ++j) {
+						for (size_t c = 0; c < RGB; ++c) {
+							planes[c][i][j] = src[j * RGB + c];
+						}
+					}
+				}
+			});
+
+			pool.release(std::move(interleaved));
+			m_BadImage = false;
+		}
+
+		// Each channel is a gray image of the matching binary or plain type.
+		FileType channelType = binary ? FileType::P5 : FileType::P2;
+		for (auto& plane : planes) {
+			m_Channels.emplace_back(std::move(plane), Pnm::depth(header), channelType);
+		}
+		adoptFile();
+
+		trace.addPixels(header.rows * header.columns * RGB);
+		trace.addBytes(buffer.size());
+	}
+
+	void MultiImage::save(const std::string& file, const std::string& comment) {
+		if (m_Channels.size() != RGB) {
+			if (!m_Channels.empty()) {
+				m_Channels[0].save(file, comment);
+			}
+			return;
+		}
+
+		Trace::Scope trace("save", "io");
+
+		Path outFile = Pnm::outputPath(m_File, file);
+
+		Region area{ 0, 0, columns(), rows() };
+		for (const auto& channel : m_Channels) {
+			area = area.clipped(channel.rows(), channel.columns());
+		}
+
+		std::vector<const ImageData*> planes;
+		for (const auto& channel : m_Channels) {
+			planes.push_back(&channel.data());
+		}
+
+		std::ofstream out;
+		if (m_FileType == FileType::P3) {
+			out.open(outFile);
+			if (out.is_open()) {
+				std::string text = Pnm::makeHeader(m_FileType, area.width, area.height, depth(), comment);
+				Pnm::writeText(planes, area, false, depth(), text);
+				out << text;
+			}
+		}
+		else {
+			out.open(outFile, std::ios::binary);
+			if (out.is_open()) {
+				std::vector<unsigned char> payload;
+				Pnm::writeSamples(planes, area, depth(), payload);
+				out << Pnm::makeHeader(FileType::P6, area.width, area.height, depth(), comment);
+				out.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+			}
+		}
+
+		trace.addPixels(area.pixels() * RGB);
+		std::error_code error;
+		uintmax_t written = FS::file_size(outFile, error);
+		if (!error) {
+			trace.addBytes(written);
+		}
+	}
+
+	void MultiImage::setFileType(FileType type) {
+		if (m_Channels.size() == RGB && Pnm::isColour(type)) {
+			m_FileType = type;
+		}
+	}
+
+	void MultiImage::maskProcessing(const Mask& mask) {
+		forEachChannel([&mask](Image& channel, size_t) { channel.maskProcessing(mask); });
+	}
+
+	void MultiImage::guidedProcessing(size_t radius, double epsilon) {
+		if (channels() == 0) {
+			return;
+		}
+
+		Image guide = toLuma();
+		forEachChannel([&guide, radius, epsilon](Image& channel, size_t) { channel.guidedProcessing(guide, radius, epsilon); });
+	}
+
+	void MultiImage::bilateralProcessing(double spatialSigma, double rangeSigma) {
+		forEachChannel([=](Image& channel, size_t) { channel.bilateralProcessing(spatialSigma, rangeSigma); });
+	}
+
+	void MultiImage::scalingProcessing(size_t newWidth, size_t newHeight, Image::ScalingOps operation) {
+		forEachChannel([=](Image& channel, size_t) { channel.scalingProcessing(newWidth, newHeight, operation); });
+	}
+
+	void MultiImage::frameProcessing(MultiImage& other, Image::FrameOps operation) {
+		if (other.channels() == 0) {
+			return;
+		}
+
+		forEachChannel([&other, operation](Image& channel, size_t c) {
+			channel.frameProcessing(other.channel(other.channels() == 1 ? 0 : c), operation);
+		});
+	}
+
+	Image MultiImage::toLuma() const {
+		if (m_Channels.size() != RGB) {
+			return m_Channels.empty() ? Image() : m_Channels[0];
+		}
+
+		Trace::Scope trace("toLuma");
+		trace.addPixels(rows() * columns());
+
+		ImageData luma = BufferPool::instance().acquire(rows(), columns());
+		Colour::rgbToLuma(m_Channels[0].data(), m_Channels[1].data(), m_Channels[2].data(), luma);
+
+		Image gray(std::move(luma), depth(), Pnm::isBinary(m_FileType) ? FileType::P5 : FileType::P2);
+		gray.m_File = m_File;
+		return gray;
+	}
+
+	void MultiImage::adoptFile() {
+		for (auto& channel : m_Channels) {
+			channel.m_File = m_File;
+		}
+	}
+}
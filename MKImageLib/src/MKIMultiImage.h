@@ -0,0 +1,90 @@
+#pragma once
+
+#include "MKIImage.h"
+#include "MKIThreadPool.h"
+
+#include <string>
+#include <vector>
+
+namespace MKImage {
+
+	/*
+		An image with one or more channels, each stored as a separate (planar) Image: one channel for
+		bitmap and gray files, three (red, green, blue) for P3/P6. Channels are full Images, so every
+		Image operation can be applied to channel(i).
+
+		Loads and saves the whole PNM family; colour files are interleaved on disk and split into
+		planes while loading.
+	*/
+	class MultiImage {
+	public:
+		MultiImage();
+		explicit MultiImage(const std::string& file);
+		// Three channels are saved as colour (P6), one channel with the channel's own file type.
+		explicit MultiImage(std::vector<Image> channels);
+
+		size_t channels() const { return m_Channels.size(); }
+		Image& channel(size_t index) { return m_Channels.at(index); }
+		const Image& channel(size_t index) const { return m_Channels.at(index); }
+
+		size_t rows() const { return m_Channels.empty() ? 0 : m_Channels[0].rows(); }
+		size_t columns() const { return m_Channels.empty() ? 0 : m_Channels[0].columns(); }
+		short depth() const { return m_Channels.empty() ? -1 : m_Channels[0].depth(); }
+		FileType fileType() const { return m_FileType; }
+		bool isBadImage() const { return m_BadImage; }
+
+		void load(const std::string& file);
+		// Saves to the output folder next to the source file, like Image::save().
+		void save(const std::string& file, const std::string& comment = "");
+		// Saves as binary (P6) or plain (P3) colour; ignored unless there are three channels.
+		void setFileType(FileType type);
+
+		/*
+			Per-channel processing. The channels are started together and each splits its rows on the
+			shared ThreadPool, so the bands of all channels are queued at once and a colour image keeps
+			every thread busy instead of running one pass per channel.
+		*/
+		template<typename Func, typename ...Args>
+		void pointProcessing(Func f, Args... values);
+		void maskProcessing(const Mask& mask);
+		// Guided filter of every channel, all guided by the luma so the channels keep the same edges.
+		void guidedProcessing(size_t radius, double epsilon);
+		void bilateralProcessing(double spatialSigma, double rangeSigma);
+		void scalingProcessing(size_t newWidth, size_t newHeight, Image::ScalingOps operation);
+		// Combines every channel with the matching channel of "other", or with its only channel if it has one.
+		void frameProcessing(MultiImage& other, Image::FrameOps operation);
+
+		// Rec. 601 luma of a colour image (a copy of the channel otherwise), to feed the gray pipeline.
+		Image toLuma() const;
+
+	private:
+		// Sets the channels' source file so their own save() calls write next to it too.
+		void adoptFile();
+		// Calls f(channel, index) for every channel in parallel.
+		template<typename Func>
+		void forEachChannel(Func f);
+
+	private:
+		std::vector<Image> m_Channels;
+		Path m_File;
+		FileType m_FileType;
+		bool m_BadImage;
+	};
+
+	/* #################### Template method definitions #################### */
+
+	template<typename Func, typename ...Args>
+	void MultiImage::pointProcessing(Func f, Args... values) {
+		forEachChannel([&](Image& channel, size_t) { channel.pointProcessing(f, values...); });
+	}
+
+	template<typename Func>
+	void MultiImage::forEachChannel(Func f) {
+		size_t count = m_Channels.size();
+		ThreadPool::instance().parallelForBands(0, count, count, [&](size_t channelBegin, size_t channelEnd) {
+			for (size_t c = channelBegin; c < channelEnd; ++c) {
+				f(m_Channels[c], c);
+			}
+		});
+	}
+}
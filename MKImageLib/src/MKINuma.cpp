@@ -0,0 +1,124 @@
+#include "MKINuma.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace MKImage {
+	namespace Numa {
+		namespace {
+			// Parses a kernel CPU list such as "0-3,8-11".
+			std::vector<int> parseCpuList(const std::string& text) {
+				std::vector<int> cpus;
+				std::istringstream in(text);
+				std::string range;
+				while (std::getline(in, range, ',')) {
+					size_t dash = range.find('-');
+					try {
+						int first = std::stoi(range.substr(0, dash));
+						int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+						for (int cpu = first; cpu <= last; ++cpu) {
+							cpus.push_back(cpu);
+						}
+					}
+					catch (const std::exception&) {
+						return {};
+					}
+				}
+				return cpus;
+			}
+
+			std::vector<int> allowedCpus() {
+				std::vector<int> cpus;
+#ifdef __linux__
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+					for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+						if (CPU_ISSET(cpu, &set)) {
+							cpus.push_back(cpu);
+						}
+					}
+				}
+#endif
+				if (cpus.empty()) {
+					unsigned count = std::max(1u, std::thread::hardware_concurrency());
+					for (unsigned cpu = 0; cpu < count; ++cpu) {
+						cpus.push_back(static_cast<int>(cpu));
+					}
+				}
+				return cpus;
+			}
+
+			std::vector<std::vector<int>> readNodes() {
+				std::vector<int> allowed = allowedCpus();
+				std::vector<std::vector<int>> nodes;
+
+#ifdef __linux__
+				std::ifstream online("/sys/devices/system/node/online");
+				std::string list;
+				if (online && std::getline(online, list)) {
+					for (int node : parseCpuList(list)) {
+						std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+						std::string cpuList;
+						if (!file || !std::getline(file, cpuList)) {
+							continue;
+						}
+
+						std::vector<int> cpus;
+						for (int cpu : parseCpuList(cpuList)) {
+							if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+								cpus.push_back(cpu);
+							}
+						}
+						if (!cpus.empty()) {
+							nodes.push_back(std::move(cpus));
+						}
+					}
+				}
+#endif
+
+				if (nodes.empty()) {
+					nodes.push_back(allowed);
+				}
+				return nodes;
+			}
+		}
+
+		const std::vector<std::vector<int>>& nodes() {
+			static const std::vector<std::vector<int>> topology = readNodes();
+			return topology;
+		}
+
+		const std::vector<int>& cpuOrder() {
+			static const std::vector<int> order = [] {
+				std::vector<int> cpus;
+				for (const auto& node : nodes()) {
+					cpus.insert(cpus.end(), node.begin(), node.end());
+				}
+				return cpus;
+			}();
+			return order;
+		}
+
+		bool pinCurrentThread(int cpu) {
+#ifdef __linux__
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+			(void)cpu;
+			return false;
+#endif
+		}
+	}
+}
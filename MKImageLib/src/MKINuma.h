@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+
+namespace MKImage {
+
+	/*
+		NUMA topology as far as the ThreadPool needs it: which CPUs belong to which node.
+
+		Read once from /sys/devices/system/node on Linux and restricted to the CPUs the process may
+		run on (so numactl --cpunodebind is honoured). Elsewhere, or where the topology cannot be
+		read, all allowed CPUs form one node.
+	*/
+	namespace Numa {
+		// Allowed CPUs of every node that has any, node by node.
+		const std::vector<std::vector<int>>& nodes();
+
+		/*
+			The allowed CPUs, node after node. Pinning consecutive threads to consecutive entries puts
+			threads that run neighbouring bands on the same node.
+		*/
+		const std::vector<int>& cpuOrder();
+
+		// Pins the calling thread to "cpu". False where that is not supported.
+		bool pinCurrentThread(int cpu);
+	}
+}
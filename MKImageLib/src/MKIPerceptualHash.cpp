@@ -0,0 +1,281 @@
+#include "MKIPerceptualHash.h"
+
+#include "MKIMultiImage.h"
+#include "MKIThreadPool.h"
+#include "MKITrace.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <filesystem>
+
+namespace MKImage {
+	namespace PerceptualHash {
+		namespace {
+			constexpr size_t DCT_SIZE = 32;
+			constexpr size_t DCT_KEPT = 8;
+			// Tasks per thread when hashing files, so slow files do not leave threads idle at the end.
+			constexpr size_t FILE_BANDS_PER_THREAD = 16;
+
+			/*
+				Means of an outRows x outColumns grid of boxes covering "in". Boxes of an image smaller
+				than the grid take one pixel each (rows or columns repeat), so tiny images still hash.
+			*/
+			std::vector<double> reduce(const ImageData& in, size_t outRows, size_t outColumns) {
+				size_t rows = in.size();
+				size_t columns = rows == 0 ? 0 : in[0].size();
+				std::vector<double> out(outRows * outColumns, 0.0);
+				if (rows == 0 || columns == 0) {
+					return out;
+				}
+
+				auto range = [](size_t bin, size_t bins, size_t size) {
+					size_t begin = bin * size / bins;
+					size_t end = std::max(begin + 1, (bin + 1) * size / bins);
+					return std::make_pair(std::min(begin, size - 1), std::min(end, size));
+				};
+
+				std::vector<std::pair<size_t, size_t>> columnRanges(outColumns);
+				for (size_t b = 0; b < outColumns; ++b) {
+					columnRanges[b] = range(b, outColumns, columns);
+				}
+
+				ThreadPool::instance().parallelForBands(0, outRows, outRows, [&](size_t binBegin, size_t binEnd) {
+					for (size_t b = binBegin; b < binEnd; ++b) {
+						auto [rowBegin, rowEnd] = range(b, outRows, rows);
+						std::vector<int64_t> sums(outColumns, 0);
+
+						for (size_t i = rowBegin; i < rowEnd; ++i) {
+							const short* src = in[i].data();
+							for (size_t c = 0; c < outColumns; ++c) {
+								int64_t sum = 0;
+								for (size_t j = columnRanges[c].first; j < columnRanges[c].second; ++j) {
+									sum += src[j];
+								}
+								sums[c] += sum;
+							}
+						}
+
+						for (size_t c = 0; c < outColumns; ++c) {
+							double area = static_cast<double>((rowEnd - rowBegin) * (columnRanges[c].second - columnRanges[c].first));
+							out[b * outColumns + c] = static_cast<double>(sums[c]) / area;
+						}
+					}
+				});
+				return out;
+			}
+
+			// cos((2x + 1) u pi / 64) for the frequencies u = 1..8 that the hash keeps.
+			const std::array<std::array<double, DCT_SIZE>, DCT_KEPT>& cosines() {
+				static const auto table = [] {
+					const double pi = std::acos(-1.0);
+					std::array<std::array<double, DCT_SIZE>, DCT_KEPT> values;
+					for (size_t u = 0; u < DCT_KEPT; ++u) {
+						for (size_t x = 0; x < DCT_SIZE; ++x) {
+							values[u][x] = std::cos((2.0 * x + 1.0) * (u + 1.0) * pi / (2.0 * DCT_SIZE));
+						}
+					}
+					return values;
+				}();
+				return table;
+			}
+
+			// Bit "index" counted from the most significant end, so hashes print in row-major order.
+			Hash bit(size_t index) {
+				return Hash(1) << (63 - index);
+			}
+
+			Fingerprint fingerprint(const std::string& file) {
+				Fingerprint result;
+				result.file = file;
+
+				MultiImage image(file);
+				if (image.isBadImage() || image.channels() == 0) {
+					return result;
+				}
+
+				Image luma = image.toLuma();
+				result.difference = difference(luma);
+				result.dct = dct(luma);
+				result.loaded = true;
+				return result;
+			}
+
+			bool isPnm(const std::filesystem::path& file) {
+				std::string extension = file.extension().string();
+				std::transform(extension.begin(), extension.end(), extension.begin(),
+							   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+				return extension == ".pbm" || extension == ".pgm" || extension == ".ppm" || extension == ".pnm";
+			}
+		}
+
+		Hash difference(const Image& image) {
+			std::vector<double> cells = reduce(image.data(), 8, 9);
+
+			Hash hash = 0;
+			for (size_t i = 0; i < 8; ++i) {
+				for (size_t j = 0; j < 8; ++j) {
+					if (cells[i * 9 + j + 1] > cells[i * 9 + j]) {
+						hash |= bit(i * 8 + j);
+					}
+				}
+			}
+			return hash;
+		}
+
+		Hash dct(const Image& image) {
+			std::vector<double> cells = reduce(image.data(), DCT_SIZE, DCT_SIZE);
+			const auto& cos = cosines();
+
+			// Separable: along the rows for the kept frequencies, then down the columns.
+			std::array<std::array<double, DCT_KEPT>, DCT_SIZE> rowPass;
+			for (size_t y = 0; y < DCT_SIZE; ++y) {
+				for (size_t u = 0; u < DCT_KEPT; ++u) {
+					double sum = 0.0;
+					for (size_t x = 0; x < DCT_SIZE; ++x) {
+						sum += cells[y * DCT_SIZE + x] * cos[u][x];
+					}
+					rowPass[y][u] = sum;
+				}
+			}
+
+			std::array<double, DCT_KEPT * DCT_KEPT> coefficients;
+			for (size_t v = 0; v < DCT_KEPT; ++v) {
+				for (size_t u = 0; u < DCT_KEPT; ++u) {
+					double sum = 0.0;
+					for (size_t y = 0; y < DCT_SIZE; ++y) {
+						sum += rowPass[y][u] * cos[v][y];
+					}
+					coefficients[v * DCT_KEPT + u] = sum;
+				}
+			}
+
+			std::array<double, DCT_KEPT * DCT_KEPT> sorted = coefficients;
+			std::sort(sorted.begin(), sorted.end());
+			double median = (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2.0;
+
+			Hash hash = 0;
+			for (size_t k = 0; k < coefficients.size(); ++k) {
+				if (coefficients[k] > median) {
+					hash |= bit(k);
+				}
+			}
+			return hash;
+		}
+
+		std::vector<Fingerprint> hashFiles(const std::vector<std::string>& files) {
+			Trace::Scope trace("perceptualHashFiles", "io");
+
+			std::vector<Fingerprint> results(files.size());
+			ThreadPool& pool = ThreadPool::instance();
+			pool.parallelForBands(0, files.size(), pool.threadCount() * FILE_BANDS_PER_THREAD, [&](size_t fileBegin, size_t fileEnd) {
+				for (size_t f = fileBegin; f < fileEnd; ++f) {
+					results[f] = fingerprint(files[f]);
+				}
+			});
+			return results;
+		}
+
+		std::vector<Fingerprint> hashDirectory(const std::string& directory, bool recursive) {
+			namespace FS = std::filesystem;
+
+			std::vector<std::string> files;
+			std::error_code error;
+			auto collect = [&files](const FS::directory_entry& entry) {
+				std::error_code ignored;
+				if (entry.is_regular_file(ignored) && isPnm(entry.path())) {
+					files.push_back(entry.path().string());
+				}
+			};
+
+			if (recursive) {
+				for (const auto& entry : FS::recursive_directory_iterator(directory, error)) {
+					collect(entry);
+				}
+			}
+			else {
+				for (const auto& entry : FS::directory_iterator(directory, error)) {
+					collect(entry);
+				}
+			}
+
+			std::sort(files.begin(), files.end());
+			return hashFiles(files);
+		}
+
+		void Index::add(Hash hash, size_t id) {
+			Node node{ hash, static_cast<uint32_t>(id), NONE, NONE, 0 };
+			uint32_t added = static_cast<uint32_t>(m_Nodes.size());
+			if (m_Nodes.empty()) {
+				m_Nodes.push_back(node);
+				return;
+			}
+
+			uint32_t current = 0;
+			for (;;) {
+				unsigned d = distance(hash, m_Nodes[current].hash);
+
+				uint32_t child = m_Nodes[current].firstChild;
+				while (child != NONE && m_Nodes[child].distance != d) {
+					child = m_Nodes[child].nextSibling;
+				}
+
+				if (child == NONE) {
+					node.distance = d;
+					node.nextSibling = m_Nodes[current].firstChild;
+					m_Nodes[current].firstChild = added;
+					m_Nodes.push_back(node);
+					return;
+				}
+				current = child;
+			}
+		}
+
+		std::vector<Index::Match> Index::find(Hash hash, unsigned maxDistance) const {
+			std::vector<Match> matches;
+			if (m_Nodes.empty()) {
+				return matches;
+			}
+
+			std::vector<uint32_t> pending{ 0 };
+			while (!pending.empty()) {
+				const Node& node = m_Nodes[pending.back()];
+				pending.pop_back();
+
+				unsigned d = distance(hash, node.hash);
+				if (d <= maxDistance) {
+					matches.push_back({ node.id, d });
+				}
+
+				for (uint32_t child = node.firstChild; child != NONE; child = m_Nodes[child].nextSibling) {
+					uint32_t childDistance = m_Nodes[child].distance;
+					if (childDistance + maxDistance >= d && childDistance <= d + maxDistance) {
+						pending.push_back(child);
+					}
+				}
+			}
+
+			std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+				return a.distance != b.distance ? a.distance < b.distance : a.id < b.id;
+			});
+			return matches;
+		}
+
+		std::vector<std::pair<size_t, size_t>> nearDuplicates(const std::vector<Hash>& hashes, unsigned maxDistance) {
+			Index index;
+			index.reserve(hashes.size());
+
+			std::vector<std::pair<size_t, size_t>> pairs;
+			for (size_t i = 0; i < hashes.size(); ++i) {
+				for (const auto& match : index.find(hashes[i], maxDistance)) {
+					pairs.emplace_back(match.id, i);
+				}
+				index.add(hashes[i], i);
+			}
+
+			std::sort(pairs.begin(), pairs.end());
+			return pairs;
+		}
+	}
+}
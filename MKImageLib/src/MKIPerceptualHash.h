@@ -0,0 +1,92 @@
+#pragma once
+
+#include "MKIImage.h"
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace MKImage {
+
+	/*
+		64-bit perceptual hashes for near-duplicate detection: visually similar images (rescaled,
+		recompressed, slightly retouched) get hashes a small Hamming distance apart, unrelated images
+		about 32 bits apart. Both hashes work on a box-filtered reduction of the image, so the cost is
+		one pass over the pixels whatever the size, and the result does not depend on the depth.
+	*/
+	namespace PerceptualHash {
+		using Hash = uint64_t;
+
+		// Number of differing bits.
+		inline unsigned distance(Hash a, Hash b) { return static_cast<unsigned>(std::bitset<64>(a ^ b).count()); }
+
+		// dHash: the image reduced to 9x8; bit set where a cell is brighter than its left neighbour.
+		Hash difference(const Image& image);
+		/*
+			pHash: the image reduced to 32x32 and transformed with a DCT-II; bit set where one of the
+			8x8 lowest frequencies (without the DC row and column) is above their median. Slower than
+			difference() by the small DCT only, and more robust to gamma and contrast changes.
+		*/
+		Hash dct(const Image& image);
+
+		struct Fingerprint {
+			std::string file;
+			Hash difference = 0;
+			Hash dct = 0;
+			bool loaded = false;	// false if the file could not be read; the hashes are then 0
+		};
+
+		/*
+			Loads every file and hashes its luma, in parallel on the ThreadPool with one file per task,
+			so decoding dominates and the rate scales with the threads. The results keep the order of
+			"files".
+		*/
+		std::vector<Fingerprint> hashFiles(const std::vector<std::string>& files);
+		// hashFiles() over the PNM files (.pbm, .pgm, .ppm, .pnm) of a directory, sorted by name.
+		std::vector<Fingerprint> hashDirectory(const std::string& directory, bool recursive = false);
+
+		/*
+			A BK-tree over hashes for Hamming-distance queries: each child sits at a given distance
+			from its parent, so a search for radius r only descends into children whose distance is
+			within r of the query's distance to the parent (the triangle inequality). Small radii
+			(up to about 10 bits, the useful range for duplicates) visit a small part of the tree.
+
+			Nodes live in one vector and link their children as a list, so a node costs 24 bytes.
+		*/
+		class Index {
+		public:
+			struct Match {
+				size_t id;
+				unsigned distance;
+			};
+
+		public:
+			// Adds "hash" under a caller-chosen id below 2^32, e.g. the position in a list of Fingerprints.
+			void add(Hash hash, size_t id);
+			// Every entry within "maxDistance" bits of "hash", closest first.
+			std::vector<Match> find(Hash hash, unsigned maxDistance) const;
+
+			size_t size() const { return m_Nodes.size(); }
+			void reserve(size_t count) { m_Nodes.reserve(count); }
+
+		private:
+			static constexpr uint32_t NONE = UINT32_MAX;
+
+			struct Node {
+				Hash hash;
+				uint32_t id;
+				uint32_t firstChild;
+				uint32_t nextSibling;
+				uint32_t distance;		// to the parent
+			};
+
+		private:
+			std::vector<Node> m_Nodes;
+		};
+
+		// All pairs (i, j), i < j, of "hashes" within "maxDistance" bits, found with an Index.
+		std::vector<std::pair<size_t, size_t>> nearDuplicates(const std::vector<Hash>& hashes, unsigned maxDistance);
+	}
+}
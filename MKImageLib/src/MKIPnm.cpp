@@ -0,0 +1,510 @@
+#include "MKIPnm.h"
+
+#include "MKIThreadPool.h"
+#include "MKIImageConstants.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace MKImage {
+	namespace Pnm {
+		namespace {
+			// Chunks smaller than this are not worth a band of their own.
+			constexpr size_t MIN_CHUNK_BYTES = size_t(1) << 16;
+			// Chunks per thread, so uneven chunks (long comments, short values) still balance.
+			constexpr size_t CHUNKS_PER_THREAD = 4;
+
+			inline bool isDigit(char c) {
+				return static_cast<unsigned char>(c - '0') < 10;
+			}
+
+			inline bool isSpace(char c) {
+				return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+			}
+
+			// Skips whitespace and # comments in the header.
+			const char* skipSeparators(const char* p, const char* end) {
+				while (p < end) {
+					if (isSpace(*p)) {
+						++p;
+					}
+					else if (*p == '#') {
+						while (p < end && *p != '\n') {
+							++p;
+						}
+					}
+					else {
+						break;
+					}
+				}
+				return p;
+			}
+
+			bool readNumber(const char*& p, const char* end, size_t& value) {
+				p = skipSeparators(p, end);
+				if (p == end || !isDigit(*p)) {
+					return false;
+				}
+
+				value = 0;
+				while (p < end && isDigit(*p)) {
+					value = value * 10 + static_cast<size_t>(*p - '0');
+					++p;
+				}
+				return true;
+			}
+
+			// Number of digit runs in [begin, end); begin is never inside a run.
+			size_t countValues(const char* begin, const char* end) {
+				size_t count = 0;
+				bool previous = false;
+				for (const char* p = begin; p < end; ++p) {
+					bool digit = isDigit(*p);
+					count += digit & !previous;
+					previous = digit;
+				}
+				return count;
+			}
+
+			size_t countDigits(const char* begin, const char* end) {
+				size_t count = 0;
+				for (const char* p = begin; p < end; ++p) {
+					count += isDigit(*p);
+				}
+				return count;
+			}
+
+			size_t sampleBytes(int maxValue) {
+				return maxValue > 255 ? 2 : 1;
+			}
+
+			// Threshold below which a pixel is written as black in a bitmap.
+			short blackBelow(short depth) {
+				return static_cast<short>((depth + 1) / 2);
+			}
+
+			// unpackTable[byte] = the 8 pixels of a P4 byte, 1 = white
+			const std::array<std::array<short, 8>, 256>& unpackTable() {
+				static const auto table = [] {
+					std::array<std::array<short, 8>, 256> t{};
+					for (size_t b = 0; b < 256; ++b) {
+						for (size_t k = 0; k < 8; ++k) {
+							t[b][k] = (b & (0x80u >> k)) ? 0 : 1;
+						}
+					}
+					return t;
+				}();
+				return table;
+			}
+
+#ifdef __SSE2__
+			// Reverses the order of the eight 16-bit lanes.
+			inline __m128i reverse8(__m128i value) {
+				value = _mm_shufflelo_epi16(value, 0x1B);
+				value = _mm_shufflehi_epi16(value, 0x1B);
+				return _mm_shuffle_epi32(value, 0x4E);
+			}
+#endif
+
+			void packRow(const short* src, size_t columns, short threshold, unsigned char* dst) {
+				size_t j = 0;
+				size_t byte = 0;
+#ifdef __SSE2__
+				const __m128i limit = _mm_set1_epi16(threshold);
+				for (; j + 16 <= columns; j += 16, byte += 2) {
+					// Lanes are reversed so movemask puts the first pixel of each byte in the high bit.
+					__m128i a = reverse8(_mm_cmplt_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + j)), limit));
+					__m128i b = reverse8(_mm_cmplt_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + j + 8)), limit));
+					int mask = _mm_movemask_epi8(_mm_packs_epi16(a, b));
+					dst[byte] = static_cast<unsigned char>(mask & 0xFF);
+					dst[byte + 1] = static_cast<unsigned char>(mask >> 8);
+				}
+#endif
+				for (; j < columns; j += 8, ++byte) {
+					unsigned char bits = 0;
+					for (size_t k = 0; k < 8 && j + k < columns; ++k) {
+						if (src[j + k] < threshold) {
+							bits |= static_cast<unsigned char>(0x80u >> k);
+						}
+					}
+					dst[byte] = bits;
+				}
+			}
+		}
+
+		bool parseHeader(const char* data, size_t size, Header& header) {
+			const char* p = data;
+			const char* end = data + size;
+
+			if (size < 2 || p[0] != 'P' || p[1] < '1' || p[1] > '6') {
+				return false;
+			}
+			header.type = FileType(static_cast<FileType::FType>(p[1] - '0'));
+			p += 2;
+
+			if (!readNumber(p, end, header.columns) || !readNumber(p, end, header.rows)) {
+				return false;
+			}
+
+			bool bitmap = header.type == FileType::P1 || header.type == FileType::P4;
+			if (bitmap) {
+				header.maxValue = 1;
+			}
+			else {
+				size_t maxValue = 0;
+				if (!readNumber(p, end, maxValue) || maxValue == 0 || maxValue > 65535) {
+					return false;
+				}
+				header.maxValue = static_cast<int>(maxValue);
+			}
+
+			// A single whitespace character separates the header from the pixels.
+			if (p < end && isSpace(*p)) {
+				++p;
+			}
+			header.length = static_cast<size_t>(p - data);
+			return true;
+		}
+
+		std::string makeHeader(FileType type, size_t columns, size_t rows, int maxValue, const std::string& comment) {
+			std::string header = type.toString() + '\n';
+			if (!comment.empty()) {
+				header += comment + '\n';
+			}
+			header += std::to_string(columns) + ' ' + std::to_string(rows) + '\n';
+			if (!isBitmap(type)) {
+				header += std::to_string(maxValue) + '\n';
+			}
+			return header;
+		}
+
+		bool isBitmap(FileType type) {
+			return type == FileType::P1 || type == FileType::P4;
+		}
+
+		bool isColour(FileType type) {
+			return type == FileType::P3 || type == FileType::P6;
+		}
+
+		bool isBinary(FileType type) {
+			return type == FileType::P4 || type == FileType::P5 || type == FileType::P6;
+		}
+
+		short depth(const Header& header) {
+			if (isBitmap(header.type)) {
+				return 1;
+			}
+			int maxValue = header.maxValue;
+			if (maxValue > std::numeric_limits<short>::max()) {
+				maxValue >>= 1;
+			}
+			return static_cast<short>(maxValue);
+		}
+
+		std::filesystem::path findInput(const std::string& file) {
+			std::filesystem::path path = std::filesystem::current_path() / file;
+			if (!std::filesystem::exists(path)) {
+				path = std::filesystem::current_path() / Consts::INPUT_FOLDER / file;
+			}
+			return path;
+		}
+
+		std::filesystem::path outputPath(const std::filesystem::path& source, const std::string& file) {
+			std::filesystem::path path(file);
+			if (path.is_absolute()) {
+				return path;
+			}
+
+			std::filesystem::path folder = source.parent_path() / Consts::OUTPUT_FOLDER;
+			if (!std::filesystem::exists(folder)) {
+				std::filesystem::create_directory(folder);
+			}
+			return folder / file;
+		}
+
+		bool readFile(const std::string& file, std::vector<char>& buffer) {
+			std::ifstream in(file, std::ios::binary | std::ios::ate);
+			if (!in.is_open()) {
+				return false;
+			}
+
+			std::streamsize size = in.tellg();
+			in.seekg(0);
+			buffer.resize(static_cast<size_t>(std::max<std::streamsize>(size, 0)));
+			in.read(buffer.data(), size);
+			return static_cast<bool>(in);
+		}
+
+		size_t parseText(const char* begin, const char* end, ImageData& out, short& min, short& max, bool singleDigits) {
+			size_t rows = out.size();
+			size_t columns = rows == 0 ? 0 : out[0].size();
+			size_t total = rows * columns;
+			size_t size = static_cast<size_t>(end - begin);
+
+			ThreadPool& pool = ThreadPool::instance();
+			size_t chunks = std::clamp<size_t>(size / MIN_CHUNK_BYTES, 1, pool.threadCount() * CHUNKS_PER_THREAD);
+
+			// Chunk boundaries, moved forward past any number they would split.
+			std::vector<const char*> bounds(chunks + 1);
+			bounds[0] = begin;
+			bounds[chunks] = end;
+			for (size_t k = 1; k < chunks; ++k) {
+				const char* p = std::max(begin + size * k / chunks, bounds[k - 1]);
+				while (!singleDigits && p < end && isDigit(*p)) {
+					++p;
+				}
+				bounds[k] = p;
+			}
+
+			// firsts[k] = index of the first value in chunk k
+			std::vector<size_t> firsts(chunks + 1, 0);
+			pool.parallelForBands(0, chunks, chunks, [&](size_t chunkBegin, size_t chunkEnd) {
+				for (size_t k = chunkBegin; k < chunkEnd; ++k) {
+					firsts[k + 1] = singleDigits ? countDigits(bounds[k], bounds[k + 1])
+												 : countValues(bounds[k], bounds[k + 1]);
+				}
+			});
+			for (size_t k = 0; k < chunks; ++k) {
+				firsts[k + 1] += firsts[k];
+			}
+
+			std::vector<int> mins(chunks, std::numeric_limits<short>::max());
+			std::vector<int> maxs(chunks, 0);
+
+			pool.parallelForBands(0, chunks, chunks, [&](size_t chunkBegin, size_t chunkEnd) {
+				for (size_t k = chunkBegin; k < chunkEnd; ++k) {
+					size_t index = firsts[k];
+					if (index >= total) {
+						continue;
+					}
+
+					size_t row = index / columns;
+					size_t column = index % columns;
+					short* dest = out[row].data();
+					int lo = mins[k];
+					int hi = maxs[k];
+
+					const char* p = bounds[k];
+					const char* last = bounds[k + 1];
+					while (index < total) {
+						while (p < last && !isDigit(*p)) {
+							++p;
+						}
+						if (p == last) {
+							break;
+						}
+
+						uint64_t digits = static_cast<uint64_t>(*p++ - '0');
+						while (!singleDigits && p < last && isDigit(*p)) {
+							digits = digits * 10 + static_cast<uint64_t>(*p - '0');
+							++p;
+						}
+						int value = static_cast<int>(std::min<uint64_t>(digits, std::numeric_limits<short>::max()));
+
+						dest[column] = static_cast<short>(value);
+						lo = std::min(lo, value);
+						hi = std::max(hi, value);
+
+						++index;
+						if (++column == columns && index < total) {
+							column = 0;
+							dest = out[++row].data();
+						}
+					}
+
+					mins[k] = lo;
+					maxs[k] = hi;
+				}
+			});
+
+			size_t found = firsts[chunks];
+
+			// A short payload leaves the remaining pixels black.
+			for (size_t index = std::min(found, total); index < total; ++index) {
+				out[index / columns][index % columns] = 0;
+			}
+
+			int lo = found < total ? 0 : std::numeric_limits<short>::max();
+			int hi = 0;
+			for (size_t k = 0; k < chunks; ++k) {
+				lo = std::min(lo, mins[k]);
+				hi = std::max(hi, maxs[k]);
+			}
+			min = static_cast<short>(std::min(lo, hi));
+			max = static_cast<short>(hi);
+
+			return found;
+		}
+
+		bool readSamples(const unsigned char* data, size_t size, int maxValue, const std::vector<ImageData*>& planes,
+						 short& min, short& max) {
+			size_t channels = planes.size();
+			size_t rows = planes[0]->size();
+			size_t columns = rows == 0 ? 0 : (*planes[0])[0].size();
+			size_t bytes = sampleBytes(maxValue);
+			size_t stride = columns * channels * bytes;
+
+			if (size < rows * stride) {
+				return false;
+			}
+
+			int shift = maxValue > std::numeric_limits<short>::max() ? 1 : 0;
+			int lo = std::numeric_limits<short>::max();
+			int hi = 0;
+			std::mutex minMaxMutex;
+
+			ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+				int bandLo = std::numeric_limits<short>::max();
+				int bandHi = 0;
+
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					const unsigned char* src = data + i * stride;
+
+					if (channels == 1 && bytes == 1) {
+						short* dst = (*planes[0])[i].data();
+						for (size_t j = 0; j < columns; ++j) {
+							dst[j] = src[j];
+							bandLo = std::min<int>(bandLo, src[j]);
+							bandHi = std::max<int>(bandHi, src[j]);
+						}
+						continue;
+					}
+
+					for (size_t j = 0; j < columns; ++j) {
+						for (size_t c = 0; c < channels; ++c) {
+							int value = bytes == 1 ? src[0] : ((src[0] << 8) | src[1]) >> shift;
+							src += bytes;
+							(*planes[c])[i][j] = static_cast<short>(value);
+							bandLo = std::min(bandLo, value);
+							bandHi = std::max(bandHi, value);
+						}
+					}
+				}
+
+				std::lock_guard<std::mutex> lock(minMaxMutex);
+				lo = std::min(lo, bandLo);
+				hi = std::max(hi, bandHi);
+			});
+
+			min = static_cast<short>(std::min(lo, hi));
+			max = static_cast<short>(hi);
+			return true;
+		}
+
+		void writeSamples(const std::vector<const ImageData*>& planes, const Region& region, int maxValue,
+						  std::vector<unsigned char>& out) {
+			size_t channels = planes.size();
+			size_t bytes = sampleBytes(maxValue);
+			size_t stride = region.width * channels * bytes;
+
+			out.resize(region.height * stride);
+
+			ThreadPool::instance().parallelFor(0, region.height, [&](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					unsigned char* dst = out.data() + i * stride;
+
+					for (size_t j = 0; j < region.width; ++j) {
+						for (size_t c = 0; c < channels; ++c) {
+							int value = std::clamp<int>((*planes[c])[region.row + i][region.column + j], 0, maxValue);
+							if (bytes == 2) {
+								*dst++ = static_cast<unsigned char>(value >> 8);
+							}
+							*dst++ = static_cast<unsigned char>(value & 0xFF);
+						}
+					}
+				}
+			});
+		}
+
+		bool unpackBits(const unsigned char* data, size_t size, ImageData& out) {
+			size_t rows = out.size();
+			size_t columns = rows == 0 ? 0 : out[0].size();
+			size_t stride = (columns + 7) / 8;
+
+			if (size < rows * stride) {
+				return false;
+			}
+
+			const auto& table = unpackTable();
+
+			ThreadPool::instance().parallelFor(0, rows, [&](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					const unsigned char* src = data + i * stride;
+					short* dst = out[i].data();
+
+					size_t whole = columns / 8;
+					for (size_t b = 0; b < whole; ++b) {
+						std::memcpy(dst + 8 * b, table[src[b]].data(), 8 * sizeof(short));
+					}
+					for (size_t j = whole * 8; j < columns; ++j) {
+						dst[j] = table[src[whole]][j - whole * 8];
+					}
+				}
+			});
+			return true;
+		}
+
+		void packBits(const ImageData& in, const Region& region, short depth, std::vector<unsigned char>& out) {
+			size_t stride = (region.width + 7) / 8;
+			short threshold = blackBelow(depth);
+
+			out.resize(region.height * stride);
+
+			ThreadPool::instance().parallelFor(0, region.height, [&](size_t rowBegin, size_t rowEnd) {
+				for (size_t i = rowBegin; i < rowEnd; ++i) {
+					packRow(in[region.row + i].data() + region.column, region.width, threshold, out.data() + i * stride);
+				}
+			});
+		}
+
+		void writeText(const std::vector<const ImageData*>& planes, const Region& region, bool bitmap, short depth,
+					   std::string& out) {
+			size_t channels = planes.size();
+			short threshold = blackBelow(depth);
+
+			// Bands format their rows independently; the text is joined afterwards.
+			size_t bands = std::max<size_t>(1, std::min(region.height, ThreadPool::instance().threadCount()));
+			std::vector<std::string> text(bands);
+
+			ThreadPool::instance().parallelForBands(0, bands, bands, [&](size_t bandBegin, size_t bandEnd) {
+				for (size_t band = bandBegin; band < bandEnd; ++band) {
+					size_t rowBegin = region.height * band / bands;
+					size_t rowEnd = region.height * (band + 1) / bands;
+					std::string& dst = text[band];
+					char number[8];
+
+					for (size_t i = rowBegin; i < rowEnd; ++i) {
+						for (size_t j = 0; j < region.width; ++j) {
+							for (size_t c = 0; c < channels; ++c) {
+								short value = (*planes[c])[region.row + i][region.column + j];
+								if (bitmap) {
+									dst += value < threshold ? '1' : '0';
+								}
+								else {
+									auto result = std::to_chars(number, number + sizeof(number), value);
+									dst.append(number, result.ptr);
+								}
+								dst += ' ';
+							}
+						}
+						dst += '\n';
+					}
+				}
+			});
+
+			for (const auto& band : text) {
+				out += band;
+			}
+		}
+	}
+}
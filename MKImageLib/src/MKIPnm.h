@@ -0,0 +1,87 @@
+#pragma once
+
+#include "MKIFileType.h"
+#include "MKIRegion.h"
+
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <cstddef>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	/*
+		Parsing and encoding helpers for the PNM formats, working on the raw bytes of a whole file.
+
+		P1/P4  bitmap, 1 = black. Loaded as depth 1 images with 1 = white so they behave like gray.
+		P2/P5  gray. Binary samples are one byte, or two big-endian bytes when the max value is over 255.
+		P3/P6  RGB, interleaved in the file and planar (one ImageData per channel) in memory.
+	*/
+	namespace Pnm {
+		struct Header {
+			FileType type;
+			size_t columns = 0;
+			size_t rows = 0;
+			int maxValue = 1;		// 1 for P1/P4, which have no max value field
+			size_t length = 0;		// bytes up to and including the single whitespace before the pixels
+		};
+
+		/*
+			Reads the magic number, width, height and (except for bitmaps) max value, skipping
+			whitespace and # comments between them. Returns false on a malformed header.
+		*/
+		bool parseHeader(const char* data, size_t size, Header& header);
+		// Header text for a file; "comment" is written as given on its own line (it should start with #).
+		std::string makeHeader(FileType type, size_t columns, size_t rows, int maxValue, const std::string& comment);
+
+		bool isBitmap(FileType type);
+		bool isColour(FileType type);
+		bool isBinary(FileType type);
+		// Samples above 32767 do not fit a short, so 16-bit files with a larger max value are halved.
+		short depth(const Header& header);
+
+		// Reads a whole file into "buffer". Returns false if it cannot be opened.
+		bool readFile(const std::string& file, std::vector<char>& buffer);
+		// "file" relative to the working directory, or else to the input folder.
+		std::filesystem::path findInput(const std::string& file);
+		// Where to save "file": as given if absolute, else in the output folder next to "source" (created if missing).
+		std::filesystem::path outputPath(const std::filesystem::path& source, const std::string& file);
+
+		/*
+			Parses whitespace-separated decimal values into "out" (already rows x columns), row by row.
+			singleDigits reads every digit as its own value, as plain bitmaps (P1) allow "0110".
+
+			The payload is split into chunks at whitespace, the values in each chunk are counted in
+			parallel, a prefix sum gives every chunk its first pixel index, and the chunks are then
+			parsed in parallel with a plain digit loop (no locale, no istream). Pixels beyond the
+			values in the payload are set to 0.
+
+			Returns the number of values found; min and max are those of the values stored.
+		*/
+		size_t parseText(const char* begin, const char* end, ImageData& out, short& min, short& max,
+						 bool singleDigits = false);
+
+		/*
+			Binary samples of P5 (one plane) or P6 (three planes), interleaved in the file.
+			Every plane is already rows x columns. Returns false if the payload is too short.
+		*/
+		bool readSamples(const unsigned char* data, size_t size, int maxValue, const std::vector<ImageData*>& planes,
+						 short& min, short& max);
+		void writeSamples(const std::vector<const ImageData*>& planes, const Region& region, int maxValue,
+						  std::vector<unsigned char>& out);
+
+		/*
+			P4 rows: 8 pixels per byte, first pixel in the high bit, each row padded to a whole byte.
+			Unpacking gives 1 for white and 0 for black; packing writes a 1 (black) for pixels below
+			half of "depth". Packing compares and gathers 16 pixels at a time with SSE2 where available,
+			unpacking expands whole bytes through a lookup table.
+		*/
+		bool unpackBits(const unsigned char* data, size_t size, ImageData& out);
+		void packBits(const ImageData& in, const Region& region, short depth, std::vector<unsigned char>& out);
+
+		// Plain (P1/P2/P3) raster text: one image row per line, channels interleaved.
+		void writeText(const std::vector<const ImageData*>& planes, const Region& region, bool bitmap, short depth,
+					   std::string& out);
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+namespace MKImage {
+
+	/* A rectangular region of interest: top-left corner (column, row) plus width and height */
+	struct Region {
+		size_t column = 0;
+		size_t row = 0;
+		size_t width = 0;
+		size_t height = 0;
+
+		bool empty() const { return width == 0 || height == 0; }
+		size_t pixels() const { return width * height; }
+
+		// The part of the region that lies inside an image of the given size.
+		Region clipped(size_t rows, size_t columns) const {
+			Region out;
+			out.column = std::min(column, columns);
+			out.row = std::min(row, rows);
+			out.width = std::min(width, columns - out.column);
+			out.height = std::min(height, rows - out.row);
+			return out;
+		}
+
+		bool covers(size_t rows, size_t columns) const {
+			return column == 0 && row == 0 && width == columns && height == rows;
+		}
+	};
+}
@@ -0,0 +1,295 @@
+#include "MKIResultCache.h"
+
+#include "MKIBufferPool.h"
+#include "MKIImage.h"
+#include "MKIImageConstants.h"
+#include "MKITiles.h"
+#include "MKITrace.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <random>
+
+namespace MKImage {
+	namespace FS = std::filesystem;
+
+	namespace {
+		constexpr char EXTENSION[] = ".mkc";
+		constexpr std::array<char, 4> TRAILER_MAGIC = { 'M', 'K', 'I', 'C' };
+		constexpr size_t TRAILER_BYTES = 8;
+
+		size_t entryBytes(const ImageStorage& pixels) {
+			const ImageData& data = pixels.read();
+			return data.size() * (data.empty() ? 0 : data[0].size()) * sizeof(short);
+		}
+
+		// Distinguishes the temporary files of concurrent writers, in this process or another.
+		std::string temporarySuffix() {
+			static const uint64_t process = std::random_device{}();
+			static std::atomic<uint64_t> counter{ 0 };
+			return ".tmp" + std::to_string(process) + "_" + std::to_string(counter.fetch_add(1));
+		}
+	}
+
+	ResultCache::Key::Key(const char* operation)
+		: m_Value{ Hash::xxh64(operation, std::char_traits<char>::length(operation), VERSION) } {
+	}
+
+	ResultCache::Key& ResultCache::Key::add(const std::vector<short>& values) {
+		add(values.size());
+		m_Value = Hash::xxh64(values.data(), values.size() * sizeof(short), m_Value);
+		return *this;
+	}
+
+	ResultCache::Key& ResultCache::Key::add(const Image& image) {
+		return add(image.rows()).add(image.columns()).add(image.depth())
+			.add(image.minValue()).add(image.maxValue()).add(image.contentHash());
+	}
+
+	ResultCache& ResultCache::instance() {
+		// Never destroyed, like the BufferPool, so images released at exit still find it.
+		static ResultCache* cache = new ResultCache();
+		return *cache;
+	}
+
+	ResultCache::ResultCache()
+		: m_Nodes{}, m_Index{}, m_Mutex{}, m_Directory{}, m_Bytes{ 0 }, m_Capacity{ 0 }, m_Enabled{ false }, m_Stats{} {
+	}
+
+	void ResultCache::setCapacity(size_t bytes) {
+		std::list<Node> dropped;
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Capacity = bytes;
+		evict(m_Capacity, dropped);
+		updateEnabled();
+	}
+
+	size_t ResultCache::capacity() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Capacity;
+	}
+
+	size_t ResultCache::cachedBytes() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Bytes;
+	}
+
+	void ResultCache::setDirectory(const std::string& directory) {
+		FS::path path(directory);
+		std::error_code error;
+		if (!path.empty()) {
+			FS::create_directories(path, error);
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Directory = error ? FS::path() : path;
+		updateEnabled();
+	}
+
+	std::string ResultCache::directory() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Directory.string();
+	}
+
+	bool ResultCache::lookup(const Key& key, Entry& entry) {
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+
+			auto found = m_Index.find(key.value());
+			if (found != m_Index.end()) {
+				m_Nodes.splice(m_Nodes.begin(), m_Nodes, found->second);
+				entry = found->second->entry;
+				m_Stats.memoryHits++;
+				return true;
+			}
+			if (m_Directory.empty()) {
+				m_Stats.misses++;
+				return false;
+			}
+		}
+
+		bool loaded = loadFile(key.value(), entry);
+
+		std::list<Node> dropped;
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!loaded) {
+			m_Stats.misses++;
+			return false;
+		}
+
+		m_Stats.diskHits++;
+		remember(key.value(), entry, dropped);
+		return true;
+	}
+
+	void ResultCache::store(const Key& key, const Entry& entry) {
+		bool toDisk = false;
+		{
+			std::list<Node> dropped;
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			remember(key.value(), entry, dropped);
+			toDisk = !m_Directory.empty();
+		}
+
+		if (toDisk) {
+			saveFile(key.value(), entry);
+		}
+	}
+
+	void ResultCache::clear() {
+		std::list<Node> dropped;
+		FS::path directory;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			dropped.splice(dropped.end(), m_Nodes);
+			m_Index.clear();
+			m_Bytes = 0;
+			directory = m_Directory;
+		}
+
+		if (directory.empty()) {
+			return;
+		}
+
+		std::error_code error;
+		for (const auto& file : FS::directory_iterator(directory, error)) {
+			if (file.path().extension() == EXTENSION) {
+				FS::remove(file.path(), error);
+			}
+		}
+	}
+
+	ResultCache::Stats ResultCache::stats() const {
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Stats;
+	}
+
+	FS::path ResultCache::fileFor(uint64_t key) const {
+		char name[17];
+		std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+		return m_Directory / (std::string(name) + EXTENSION);
+	}
+
+	bool ResultCache::loadFile(uint64_t key, Entry& entry) const {
+		FS::path file;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			file = fileFor(key);
+		}
+
+		std::ifstream in(file, std::ios::binary | std::ios::ate);
+		if (!in.is_open() || static_cast<size_t>(in.tellg()) < TRAILER_BYTES) {
+			return false;
+		}
+
+		Trace::Scope trace("resultCacheLoad", "io");
+
+		std::array<char, TRAILER_BYTES> trailer;
+		in.seekg(-static_cast<std::streamoff>(TRAILER_BYTES), std::ios::end);
+		if (!in.read(trailer.data(), trailer.size()) || !std::equal(TRAILER_MAGIC.begin(), TRAILER_MAGIC.end(), trailer.begin())) {
+			return false;
+		}
+		in.close();
+
+		Tiles::Header header;
+		ImageData pixels;
+		short pixelMin = 0;
+		short pixelMax = 0;
+		Region whole{ 0, 0, std::numeric_limits<size_t>::max(), std::numeric_limits<size_t>::max() };
+		if (!Tiles::decode(file.string(), whole, header, pixels, pixelMin, pixelMax)) {
+			BufferPool::instance().release(std::move(pixels));
+			return false;
+		}
+
+		auto level = [&trailer](size_t at) {
+			return static_cast<short>(static_cast<uint16_t>(static_cast<unsigned char>(trailer[at])
+															| static_cast<unsigned char>(trailer[at + 1]) << 8));
+		};
+
+		trace.addPixels(header.rows * header.columns);
+		entry.pixels = ImageStorage(std::move(pixels));
+		entry.depth = header.depth;
+		entry.min = level(4);
+		entry.max = level(6);
+		return true;
+	}
+
+	void ResultCache::saveFile(uint64_t key, const Entry& entry) const {
+		FS::path file;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			file = fileFor(key);
+		}
+
+		Trace::Scope trace("resultCacheSave", "io");
+
+		const ImageData& pixels = entry.pixels.read();
+		Region whole{ 0, 0, pixels.empty() ? 0 : pixels[0].size(), pixels.size() };
+		std::vector<unsigned char> bytes;
+		Tiles::encode(pixels, whole, entry.depth, Consts::TILE_SIZE, bytes);
+
+		bytes.insert(bytes.end(), TRAILER_MAGIC.begin(), TRAILER_MAGIC.end());
+		for (short level : { entry.min, entry.max }) {
+			bytes.push_back(static_cast<unsigned char>(static_cast<uint16_t>(level) & 0xff));
+			bytes.push_back(static_cast<unsigned char>(static_cast<uint16_t>(level) >> 8));
+		}
+
+		// Written under a temporary name and renamed, so readers never see a partial file.
+		FS::path temporary = file;
+		temporary += temporarySuffix();
+		{
+			std::ofstream out(temporary, std::ios::binary);
+			if (!out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()))) {
+				out.close();
+				std::error_code error;
+				FS::remove(temporary, error);
+				return;
+			}
+		}
+
+		std::error_code error;
+		FS::rename(temporary, file, error);
+		if (error) {
+			FS::remove(temporary, error);
+		}
+
+		trace.addPixels(whole.pixels());
+		trace.addBytes(bytes.size());
+	}
+
+	void ResultCache::remember(uint64_t key, const Entry& entry, std::list<Node>& dropped) {
+		size_t bytes = entryBytes(entry.pixels);
+		if (bytes > m_Capacity) {
+			return;
+		}
+
+		auto found = m_Index.find(key);
+		if (found != m_Index.end()) {
+			m_Bytes -= found->second->bytes;
+			dropped.splice(dropped.end(), m_Nodes, found->second);
+			m_Index.erase(found);
+		}
+
+		m_Nodes.push_front({ key, entry, bytes });
+		m_Index[key] = m_Nodes.begin();
+		m_Bytes += bytes;
+		evict(m_Capacity, dropped);
+	}
+
+	void ResultCache::evict(size_t limit, std::list<Node>& dropped) {
+		while (m_Bytes > limit && !m_Nodes.empty()) {
+			auto last = std::prev(m_Nodes.end());
+			m_Bytes -= last->bytes;
+			m_Index.erase(last->key);
+			dropped.splice(dropped.end(), m_Nodes, last);
+			m_Stats.evicted++;
+		}
+	}
+
+	void ResultCache::updateEnabled() {
+		m_Enabled.store(m_Capacity > 0 || !m_Directory.empty(), std::memory_order_relaxed);
+	}
+}
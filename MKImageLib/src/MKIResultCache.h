@@ -0,0 +1,130 @@
+#pragma once
+
+#include "MKIHash.h"
+#include "MKIImageStorage.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace MKImage {
+	class Image;
+
+	/*
+		A process-wide cache of processing results, keyed by the content of the input and the
+		operation with its parameters.
+
+		Off by default. With a memory capacity, results are kept as shared ImageStorage handles in an
+		LRU list, so a hit costs no copy (the image and the cache share the pixels until one of them
+		writes). With a directory, results are also written there as tiled files (see Tiles) named
+		after the key, followed by an 8-byte trailer ("MKIC", min and max level), and survive the
+		process. Disk hits are promoted to the memory tier. The directory is never trimmed; clear()
+		or the caller's own housekeeping removes old entries.
+
+		Image consults the cache in whole-image pointProcessing/lutProcessing (keyed by the lookup
+		table the function produces, so any pure GS:: function and arguments work), maskProcessing,
+		scalingProcessing and frameProcessing. Keys are 64-bit hashes; a collision would return a
+		wrong image, which at the sizes of a batch service is far less likely than a disk error.
+	*/
+	class ResultCache {
+	public:
+		// Bumped whenever an operation's output changes, so stale disk entries stop matching.
+		static constexpr uint64_t VERSION = 1;
+
+		struct Stats {
+			size_t memoryHits = 0;
+			size_t diskHits = 0;
+			size_t misses = 0;
+			size_t evicted = 0;		// memory entries dropped because of the capacity
+		};
+
+		// A cached result: the pixels and the level range the image had after the operation.
+		struct Entry {
+			ImageStorage pixels;
+			short depth = 0;
+			short min = 0;
+			short max = 0;
+		};
+
+		// Builds a key from an operation name and the values it depends on.
+		class Key {
+		public:
+			explicit Key(const char* operation);
+
+			template <typename T>
+			Key& add(T value) {
+				static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>, "keys take numbers and enums");
+				m_Value = Hash::xxh64(&value, sizeof(T), m_Value);
+				return *this;
+			}
+			Key& add(const std::vector<short>& values);
+			// Size, depth, level range and pixel hash of an image.
+			Key& add(const Image& image);
+
+			uint64_t value() const { return m_Value; }
+
+		private:
+			uint64_t m_Value;
+		};
+
+	public:
+		static ResultCache& instance();
+
+		ResultCache(const ResultCache&) = delete;
+		ResultCache& operator=(const ResultCache&) = delete;
+
+		// Bytes kept in memory; 0 turns the memory tier off. Lowering it evicts straight away.
+		void setCapacity(size_t bytes);
+		size_t capacity() const;
+		size_t cachedBytes() const;
+		// Directory of the disk tier, created if needed; empty turns the disk tier off.
+		void setDirectory(const std::string& directory);
+		std::string directory() const;
+
+		// True if either tier is on. Cheap, so callers can skip building keys otherwise.
+		bool enabled() const { return m_Enabled.load(std::memory_order_relaxed); }
+
+		bool lookup(const Key& key, Entry& entry);
+		void store(const Key& key, const Entry& entry);
+		// Drops the memory tier and the cache files in the directory.
+		void clear();
+
+		Stats stats() const;
+
+	private:
+		struct Node {
+			uint64_t key;
+			Entry entry;
+			size_t bytes;
+		};
+
+		ResultCache();
+
+		std::filesystem::path fileFor(uint64_t key) const;
+		bool loadFile(uint64_t key, Entry& entry) const;
+		void saveFile(uint64_t key, const Entry& entry) const;
+		// Inserts or refreshes a memory entry. Caller holds the lock.
+		void remember(uint64_t key, const Entry& entry, std::list<Node>& dropped);
+		// Moves least recently used entries to "dropped" until m_Bytes <= limit. Caller holds the lock.
+		void evict(size_t limit, std::list<Node>& dropped);
+		void updateEnabled();
+
+	private:
+		// Most recently used first.
+		std::list<Node> m_Nodes;
+		std::unordered_map<uint64_t, std::list<Node>::iterator> m_Index;
+		mutable std::mutex m_Mutex;
+		std::filesystem::path m_Directory;
+		size_t m_Bytes;
+		size_t m_Capacity;
+		std::atomic<bool> m_Enabled;
+		Stats m_Stats;
+	};
+}
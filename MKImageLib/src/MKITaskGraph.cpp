@@ -0,0 +1,145 @@
+#include "MKITaskGraph.h"
+
+#include "MKIThreadPool.h"
+#include "MKITrace.h"
+
+namespace MKImage {
+	namespace {
+		template<typename Func>
+		void launch(const std::vector<TaskGraph::NodeId>& nodes, Func execute) {
+			ThreadPool::instance().parallelForBands(0, nodes.size(), nodes.size(), [&](size_t nodeBegin, size_t nodeEnd) {
+				for (size_t n = nodeBegin; n < nodeEnd; ++n) {
+					execute(nodes[n]);
+				}
+			});
+		}
+	}
+
+	TaskGraph::NodeId TaskGraph::input(const Image& image) {
+		NodeId id = addNode("graphInput", {});
+		m_Nodes[id].source = [image]() { return image; };
+		return id;
+	}
+
+	TaskGraph::NodeId TaskGraph::load(const std::string& file) {
+		NodeId id = addNode("graphLoad", {});
+		m_Nodes[id].source = [file]() { return Image(file); };
+		return id;
+	}
+
+	TaskGraph::NodeId TaskGraph::add(NodeId input, std::function<void(Image&)> operation, const char* name) {
+		NodeId id = addNode(name, { input });
+		m_Nodes[id].unary = std::move(operation);
+		return id;
+	}
+
+	TaskGraph::NodeId TaskGraph::add(NodeId first, NodeId second, std::function<void(Image&, Image&)> operation, const char* name) {
+		NodeId id = addNode(name, { first, second });
+		m_Nodes[id].binary = std::move(operation);
+		return id;
+	}
+
+	TaskGraph::NodeId TaskGraph::mask(NodeId input, const Mask& mask) {
+		return add(input, [mask](Image& image) { image.maskProcessing(mask); }, "maskProcessing");
+	}
+
+	TaskGraph::NodeId TaskGraph::scale(NodeId input, size_t newWidth, size_t newHeight, Image::ScalingOps operation) {
+		return add(input, [=](Image& image) { image.scalingProcessing(newWidth, newHeight, operation); }, "scalingProcessing");
+	}
+
+	TaskGraph::NodeId TaskGraph::frame(NodeId first, NodeId second, Image::FrameOps operation) {
+		return add(first, second, [operation](Image& image, Image& other) { image.frameProcessing(other, operation); }, "frameProcessing");
+	}
+
+	TaskGraph::NodeId TaskGraph::save(NodeId input, const std::string& file, const std::string& comment) {
+		return add(input, [file, comment](Image& image) { image.save(file, comment); }, "graphSave");
+	}
+
+	void TaskGraph::keep(NodeId node) {
+		m_Nodes.at(node).kept = true;
+	}
+
+	const Image& TaskGraph::result(NodeId node) const {
+		return m_Nodes.at(node).result;
+	}
+
+	void TaskGraph::run() {
+		Trace::Scope trace("taskGraph", "graph");
+
+		std::vector<NodeId> sources;
+		for (NodeId id = 0; id < m_Nodes.size(); ++id) {
+			Node& node = m_Nodes[id];
+			node.result = Image();
+			node.consumersLeft = node.consumers.size();
+			node.inputsLeft.store(node.inputs.size(), std::memory_order_relaxed);
+			if (node.inputs.empty()) {
+				sources.push_back(id);
+			}
+		}
+
+		launch(sources, [this](NodeId id) { execute(id); });
+	}
+
+	TaskGraph::NodeId TaskGraph::addNode(const char* name, std::vector<NodeId> inputs) {
+		NodeId id = m_Nodes.size();
+		for (NodeId input : inputs) {
+			m_Nodes.at(input).consumers.push_back(id);
+		}
+
+		m_Nodes.emplace_back();
+		m_Nodes.back().name = name;
+		m_Nodes.back().inputs = std::move(inputs);
+		return id;
+	}
+
+	void TaskGraph::execute(NodeId id) {
+		// A chain of single successors runs in this loop rather than one nested call per node.
+		for (;;) {
+			Node& node = m_Nodes[id];
+
+			{
+				Trace::Scope trace(node.name, "graph");
+
+				Image image = node.source ? node.source() : take(node.inputs[0]);
+				if (node.unary) {
+					node.unary(image);
+				}
+				else if (node.binary) {
+					Image other = take(node.inputs[1]);
+					node.binary(image, other);
+				}
+
+				// Stored before the consumers start; the local handle goes before they do too, so the
+				// stored result is not shared and the last consumer can work in place.
+				if (!node.consumers.empty() || node.kept) {
+					node.result = image;
+				}
+			}
+
+			std::vector<NodeId> ready;
+			for (NodeId consumer : node.consumers) {
+				if (m_Nodes[consumer].inputsLeft.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					ready.push_back(consumer);
+				}
+			}
+
+			if (ready.size() != 1) {
+				launch(ready, [this](NodeId next) { execute(next); });
+				return;
+			}
+			id = ready[0];
+		}
+	}
+
+	Image TaskGraph::take(NodeId id) {
+		Node& node = m_Nodes[id];
+		std::lock_guard<std::mutex> lock(node.mutex);
+
+		if (--node.consumersLeft == 0 && !node.kept) {
+			Image image(std::move(node.result));
+			node.result = Image();
+			return image;
+		}
+		return node.result;
+	}
+}
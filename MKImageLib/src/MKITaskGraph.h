@@ -0,0 +1,110 @@
+#pragma once
+
+#include "MKIImage.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace MKImage {
+
+	/*
+		A processing recipe that branches, as a graph of operations whose edges carry images, e.g.
+
+			TaskGraph graph;
+			auto photo = graph.load("photo.pgm");
+			graph.save(graph.point(photo, GS::gammaTransformation, short(1), 0.8), "preview.pgm");
+			graph.save(graph.mask(photo, Mask::EDGE_LAPLACIAN_3X3), "edges.pgm");
+			for (size_t side : { 64, 128, 256 }) {
+				graph.save(graph.scale(photo, side, side, Image::ScalingOps::bilinear), "thumb" + std::to_string(side) + ".pgm");
+			}
+			graph.run();
+
+		run() starts the sources together and launches every node as soon as its last input is
+		done, as a nested parallelFor() on the shared ThreadPool, so independent branches run at the
+		same time and each operation still splits its rows on the same threads.
+
+		Each consumer gets its input as a copy-on-write Image: consumers that change it copy the
+		pixels on their first write, and the last consumer takes the image itself, so a branch that
+		is the only user of its input works in place. An intermediate image is released to the
+		BufferPool as soon as its last consumer has taken it, unless it was kept with keep().
+
+		Nodes are added once; run() may be called again, e.g. after changing the source images.
+		Operations must not throw.
+	*/
+	class TaskGraph {
+	public:
+		using NodeId = size_t;
+
+	public:
+		TaskGraph() = default;
+		TaskGraph(const TaskGraph&) = delete;
+		TaskGraph& operator=(const TaskGraph&) = delete;
+
+		// A source node holding "image" (shared, not copied).
+		NodeId input(const Image& image);
+		// A source node that loads "file" when the graph runs, alongside the other sources.
+		NodeId load(const std::string& file);
+
+		/*
+			A node applying "operation" to (its copy of) the result of "input".
+			name = stage name for Trace, a string literal
+		*/
+		NodeId add(NodeId input, std::function<void(Image&)> operation, const char* name = "graphNode");
+		// A node combining the results of two nodes into the first, e.g. with frameProcessing().
+		NodeId add(NodeId first, NodeId second, std::function<void(Image&, Image&)> operation, const char* name = "graphNode");
+
+		template<typename Func, typename ...Args>
+		NodeId point(NodeId input, Func f, Args... values);
+		NodeId mask(NodeId input, const Mask& mask);
+		NodeId scale(NodeId input, size_t newWidth, size_t newHeight, Image::ScalingOps operation);
+		NodeId frame(NodeId first, NodeId second, Image::FrameOps operation);
+		// Saves the result of "input" like Image::save(). Has no result of its own.
+		NodeId save(NodeId input, const std::string& file, const std::string& comment = "");
+
+		// Keeps the result of "node" after run(), for result().
+		void keep(NodeId node);
+		// The result of a kept node from the last run().
+		const Image& result(NodeId node) const;
+
+		size_t size() const { return m_Nodes.size(); }
+
+		void run();
+
+	private:
+		struct Node {
+			const char* name = "";
+			std::vector<NodeId> inputs;
+			std::vector<NodeId> consumers;
+			std::function<Image()> source;
+			std::function<void(Image&)> unary;
+			std::function<void(Image&, Image&)> binary;
+			bool kept = false;
+
+			// Run state.
+			Image result;
+			std::mutex mutex;
+			size_t consumersLeft = 0;
+			std::atomic<size_t> inputsLeft{ 0 };
+		};
+
+		NodeId addNode(const char* name, std::vector<NodeId> inputs);
+		void execute(NodeId id);
+		// The result of "id" for one consumer: shared while other consumers remain, taken by the last.
+		Image take(NodeId id);
+
+	private:
+		// A deque, so nodes (which hold a mutex) never move.
+		std::deque<Node> m_Nodes;
+	};
+
+	/* #################### Template method definitions #################### */
+
+	template<typename Func, typename ...Args>
+	TaskGraph::NodeId TaskGraph::point(NodeId input, Func f, Args... values) {
+		return add(input, [=](Image& image) { image.pointProcessing(f, values...); }, "pointProcessing");
+	}
+}
@@ -0,0 +1,246 @@
+#include "MKIThreadPool.h"
+
+#include "MKINuma.h"
+#include "MKITrace.h"
+
+namespace MKImage {
+	namespace {
+		// The calling thread's home slot: its worker number, or 0 for threads outside the pool.
+		thread_local size_t t_Slot = 0;
+	}
+
+#ifdef MKIMAGE_TRACE_ENABLED
+	namespace {
+		// Bands being run by this thread. Only the outermost one is counted as busy time.
+		thread_local size_t t_BandDepth = 0;
+
+		// Accounts time spent blocked waiting for work as idle, unless it happens inside a band.
+		class IdleTimer {
+		public:
+			IdleTimer() : m_Active{ t_BandDepth == 0 && Trace::active() }, m_Start{ m_Active ? Trace::now() : 0 } {}
+			~IdleTimer() {
+				if (m_Active) {
+					Trace::addThreadTime(0, Trace::now() - m_Start);
+				}
+			}
+		private:
+			bool m_Active;
+			uint64_t m_Start;
+		};
+	}
+#endif
+
+	ThreadPool& ThreadPool::instance() {
+		static ThreadPool pool;
+		return pool;
+	}
+
+	ThreadPool::ThreadPool()
+		: m_Workers{}, m_Queues{}, m_Pending{ 0 }, m_Mutex{}, m_WorkReady{}, m_WorkDone{}, m_Stopping{ false },
+		  m_Pinned{ false } {
+		startWorkers(defaultThreadCount() - 1);
+	}
+
+	ThreadPool::~ThreadPool() {
+		stopWorkers();
+	}
+
+	size_t ThreadPool::defaultThreadCount() {
+		size_t numThreads = std::thread::hardware_concurrency();
+
+		if (numThreads == 0) {
+			numThreads = 1;
+		}
+		if (numThreads > 4) {
+			numThreads -= 2;
+		}
+		return numThreads;
+	}
+
+	void ThreadPool::setThreadCount(size_t count) {
+		if (count == 0) {
+			count = defaultThreadCount();
+		}
+		if (count == threadCount()) {
+			return;
+		}
+
+		stopWorkers();
+		startWorkers(count - 1);
+	}
+
+	void ThreadPool::setPinned(bool pinned) {
+		if (pinned == m_Pinned) {
+			return;
+		}
+
+		size_t workers = m_Workers.size();
+		stopWorkers();
+		m_Pinned = pinned;
+		startWorkers(workers);
+	}
+
+	void ThreadPool::startWorkers(size_t count) {
+		m_Stopping = false;
+		m_Queues.resize(count + 1);
+		m_Workers.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			m_Workers.emplace_back(&ThreadPool::workerLoop, this, i + 1);
+		}
+	}
+
+	void ThreadPool::stopWorkers() {
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stopping = true;
+		}
+		m_WorkReady.notify_all();
+
+		for (auto& worker : m_Workers) {
+			worker.join();
+		}
+		m_Workers.clear();
+	}
+
+	void ThreadPool::workerLoop(size_t slot) {
+		t_Slot = slot;
+		if (m_Pinned) {
+			// Consecutive slots, which are home to neighbouring bands, share a node.
+			const std::vector<int>& cpus = Numa::cpuOrder();
+			Numa::pinCurrentThread(cpus[slot % cpus.size()]);
+		}
+
+		std::unique_lock<std::mutex> lock(m_Mutex);
+
+		while (true) {
+			{
+#ifdef MKIMAGE_TRACE_ENABLED
+				IdleTimer idle;
+#endif
+				m_WorkReady.wait(lock, [this] { return m_Stopping || m_Pending != 0; });
+			}
+
+			Task task;
+			if (!takeTask(slot, task)) {
+				return;
+			}
+
+			lock.unlock();
+			run(task);
+			lock.lock();
+		}
+	}
+
+	void ThreadPool::run(const Task& task) {
+#ifdef MKIMAGE_TRACE_ENABLED
+		if (Trace::active()) {
+			Trace::Event event;
+			event.name = "band";
+			event.category = "pool";
+			event.start = Trace::now();
+			event.thread = Trace::threadId();
+
+			++t_BandDepth;
+			callBand(task);
+			--t_BandDepth;
+
+			event.duration = Trace::now() - event.start;
+			Trace::emit(event);
+			if (t_BandDepth == 0) {
+				Trace::addThreadTime(event.duration, 0);
+			}
+		}
+		else {
+			callBand(task);
+		}
+#else
+		callBand(task);
+#endif
+
+		if (task.batch->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			// Take the lock so a waiter cannot miss the notification between its check and its wait.
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_WorkDone.notify_all();
+		}
+	}
+
+	void ThreadPool::callBand(const Task& task) {
+		try {
+			task.invoke(task.context, task.index);
+		}
+		catch (...) {
+			// Stored before the band is counted done, so dispatch() sees it once remaining reaches 0.
+			if (!task.batch->failed.exchange(true)) {
+				task.batch->error = std::current_exception();
+			}
+		}
+	}
+
+	bool ThreadPool::runPending() {
+		Task task;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (!takeTask(t_Slot, task)) {
+				return false;
+			}
+		}
+
+		run(task);
+		return true;
+	}
+
+	bool ThreadPool::takeTask(size_t slot, Task& task) {
+		if (m_Pending == 0) {
+			return false;
+		}
+
+		size_t slots = m_Queues.size();
+		for (size_t k = 0; k < slots; ++k) {
+			std::deque<Task>& queue = m_Queues[(slot + k) % slots];
+			if (!queue.empty()) {
+				task = queue.front();
+				queue.pop_front();
+				--m_Pending;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void ThreadPool::dispatch(void (*invoke)(void*, size_t), void* context, size_t tasks) {
+		Batch batch{ { tasks }, { false }, nullptr };
+		std::atomic<size_t>& remaining = batch.remaining;
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			size_t slots = m_Queues.size();
+			for (size_t i = 1; i < tasks; ++i) {
+				m_Queues[i * slots / tasks].push_back({ invoke, context, i, &batch });
+			}
+			m_Pending += tasks - 1;
+		}
+		m_WorkReady.notify_all();
+		m_WorkDone.notify_all();
+
+		run({ invoke, context, 0, &batch });
+
+		// Help with queued work (ours or a nested caller's) until our own bands are done.
+		while (remaining.load(std::memory_order_acquire) != 0) {
+			if (runPending()) {
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(m_Mutex);
+#ifdef MKIMAGE_TRACE_ENABLED
+			IdleTimer idle;
+#endif
+			m_WorkDone.wait(lock, [this, &remaining] {
+				return remaining.load(std::memory_order_acquire) == 0 || m_Pending != 0;
+			});
+		}
+
+		if (batch.error) {
+			std::rethrow_exception(batch.error);
+		}
+	}
+}
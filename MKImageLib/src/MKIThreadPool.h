@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <cstddef>
+
+namespace MKImage {
+
+	/*
+		A persistent pool of worker threads shared by the whole library.
+
+		Work is split into row (or column) bands with parallelFor(). The calling thread always
+		processes a band itself and, while it waits, runs any other queued band. This keeps nested
+		parallelFor() calls (e.g. one per channel, each splitting its rows) from deadlocking and
+		keeps every core busy when several jobs share the pool.
+
+		Bands have a home thread: band i of n goes to thread i * threadCount() / n (the caller is
+		thread 0), which takes its own bands first and steals others only when it has none left.
+		So the same rows of equally sized images are handled by the same thread from one call to
+		the next: the rows a thread first touched when a buffer was allocated (see BufferPool),
+		decoded or copied are the rows it later filters. With setPinned(), the threads are also
+		bound to CPUs node by node (see Numa), which keeps each band's memory on its node.
+	*/
+	class ThreadPool {
+	public:
+		static ThreadPool& instance();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		~ThreadPool();
+
+		// Number of threads taking part in a parallelFor(), including the caller.
+		size_t threadCount() const { return m_Workers.size() + 1; }
+		// Resizes the pool. Must not be called while work is in flight.
+		void setThreadCount(size_t count);
+		// Pins worker threads to CPUs, filling one NUMA node before the next. Must not be called while work is in flight.
+		void setPinned(bool pinned);
+		bool pinned() const { return m_Pinned; }
+
+		/*
+			Splits [begin, end) into at most threadCount() contiguous bands and calls
+			f(bandBegin, bandEnd) for each band in parallel. Returns once every band is finished.
+			If a band throws, the other bands still run and the first exception is rethrown here.
+
+			size_t begin, end = range to split, usually rows or columns
+			Func f = callable taking (size_t bandBegin, size_t bandEnd)
+		*/
+		template<typename Func>
+		void parallelFor(size_t begin, size_t end, Func f);
+
+		/*
+			Same as parallelFor() but splits into exactly "bands" bands, which lets callers
+			pick a granularity (e.g. one band per tile row) independent of the thread count.
+		*/
+		template<typename Func>
+		void parallelForBands(size_t begin, size_t end, size_t bands, Func f);
+
+		// Default number of threads: all hardware threads, leaving two free on larger machines.
+		static size_t defaultThreadCount();
+
+	private:
+		// The bands of one dispatch(), which outlives them on the dispatching thread's stack.
+		struct Batch {
+			std::atomic<size_t> remaining;
+			std::atomic<bool> failed;
+			std::exception_ptr error;
+		};
+
+		struct Task {
+			void (*invoke)(void* context, size_t index);
+			void* context;
+			size_t index;
+			Batch* batch;
+		};
+
+		ThreadPool();
+
+		void startWorkers(size_t count);
+		void stopWorkers();
+		void workerLoop(size_t slot);
+		void run(const Task& task);
+		// Calls the band, keeping the first exception of its batch for dispatch() to rethrow.
+		static void callBand(const Task& task);
+		bool runPending();
+		// Takes the oldest band of "slot", else the oldest band of the next busy slot. Caller holds the lock.
+		bool takeTask(size_t slot, Task& task);
+		void dispatch(void (*invoke)(void*, size_t), void* context, size_t tasks);
+
+	private:
+		std::vector<std::thread> m_Workers;
+		// Queued bands by home thread, 0 being any thread that is not a worker.
+		std::vector<std::deque<Task>> m_Queues;
+		size_t m_Pending;
+		std::mutex m_Mutex;
+		std::condition_variable m_WorkReady;
+		std::condition_variable m_WorkDone;
+		bool m_Stopping;
+		bool m_Pinned;
+	};
+
+	/* #################### Template method definitions #################### */
+
+	template<typename Func>
+	void ThreadPool::parallelFor(size_t begin, size_t end, Func f) {
+		parallelForBands(begin, end, threadCount(), f);
+	}
+
+	template<typename Func>
+	void ThreadPool::parallelForBands(size_t begin, size_t end, size_t bands, Func f) {
+		if (end <= begin) {
+			return;
+		}
+
+		size_t count = end - begin;
+		if (bands > count) {
+			bands = count;
+		}
+		if (bands <= 1) {
+			f(begin, end);
+			return;
+		}
+
+		struct Context {
+			Func& func;
+			size_t begin;
+			size_t count;
+			size_t bands;
+		} context{ f, begin, count, bands };
+
+		auto invoke = [](void* ctx, size_t index) {
+			Context& c = *static_cast<Context*>(ctx);
+			size_t bandBegin = c.begin + (c.count * index) / c.bands;
+			size_t bandEnd = c.begin + (c.count * (index + 1)) / c.bands;
+			c.func(bandBegin, bandEnd);
+		};
+
+		dispatch(invoke, &context, bands);
+	}
+}
@@ -0,0 +1,434 @@
+#include "MKITiles.h"
+
+#include "MKIThreadPool.h"
+#include "MKIBufferPool.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+
+namespace MKImage {
+	namespace Tiles {
+		namespace {
+			constexpr char MAGIC[4] = { 'M', 'K', 'I', 'T' };
+			constexpr size_t HEADER_BYTES = 20;
+			constexpr size_t ENTRY_BYTES = 12;
+			// Residuals are packed in blocks of this many, all with the bit width of the largest.
+			constexpr size_t BLOCK = 16;
+			// Zigzagged residuals of 16-bit pixels need at most 17 bits.
+			constexpr uint32_t MAX_WIDTH = 17;
+
+			struct Entry {
+				uint64_t offset = 0;
+				uint32_t length = 0;
+			};
+
+			template<typename T>
+			void writeLE(unsigned char* out, T value, size_t bytes) {
+				for (size_t k = 0; k < bytes; ++k) {
+					out[k] = static_cast<unsigned char>(static_cast<uint64_t>(value) >> (8 * k));
+				}
+			}
+
+			uint64_t getLE(const unsigned char* in, size_t bytes) {
+				uint64_t value = 0;
+				for (size_t k = 0; k < bytes; ++k) {
+					value |= static_cast<uint64_t>(in[k]) << (8 * k);
+				}
+				return value;
+			}
+
+			inline uint32_t zigzag(int value) {
+				return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+			}
+
+			inline int unzigzag(uint32_t value) {
+				return static_cast<int>(value >> 1) ^ -static_cast<int>(value & 1);
+			}
+
+			/*
+				Median edge detector: picks left or above at an edge, else the planar estimate.
+				"up" is null on the first row of a tile.
+			*/
+			inline int predict(const short* row, const short* up, size_t j) {
+				if (!up) {
+					return j == 0 ? 0 : row[j - 1];
+				}
+				if (j == 0) {
+					return up[0];
+				}
+
+				int a = row[j - 1];
+				int b = up[j];
+				int c = up[j - 1];
+				if (c >= std::max(a, b)) {
+					return std::min(a, b);
+				}
+				if (c <= std::min(a, b)) {
+					return std::max(a, b);
+				}
+				return a + b - c;
+			}
+
+			uint32_t bitWidth(uint32_t value) {
+				uint32_t width = 0;
+				while (value >> width) {
+					++width;
+				}
+				return width;
+			}
+
+			// Writes one width byte, then the BLOCK values with that many bits each, low bits first.
+			void packBlock(const uint32_t* values, std::vector<unsigned char>& out) {
+				uint32_t largest = 0;
+				for (size_t k = 0; k < BLOCK; ++k) {
+					largest |= values[k];
+				}
+				uint32_t width = bitWidth(largest);
+				out.push_back(static_cast<unsigned char>(width));
+
+				uint64_t bits = 0;
+				uint32_t count = 0;
+				for (size_t k = 0; k < BLOCK; ++k) {
+					bits |= static_cast<uint64_t>(values[k]) << count;
+					count += width;
+					while (count >= 8) {
+						out.push_back(static_cast<unsigned char>(bits));
+						bits >>= 8;
+						count -= 8;
+					}
+				}
+				// BLOCK * width is a whole number of bytes, so nothing is left over.
+			}
+
+			bool unpackBlock(const unsigned char*& p, const unsigned char* end, uint32_t* values) {
+				if (p == end) {
+					return false;
+				}
+				uint32_t width = *p++;
+				if (width > MAX_WIDTH || static_cast<size_t>(end - p) < BLOCK * width / 8) {
+					return false;
+				}
+
+				uint64_t bits = 0;
+				uint32_t count = 0;
+				uint32_t mask = (uint32_t(1) << width) - 1;
+				for (size_t k = 0; k < BLOCK; ++k) {
+					while (count < width) {
+						bits |= static_cast<uint64_t>(*p++) << count;
+						count += 8;
+					}
+					values[k] = static_cast<uint32_t>(bits) & mask;
+					bits >>= width;
+					count -= width;
+				}
+				return true;
+			}
+
+			// How the values of a tile are mapped before packing; stored as the first byte of the tile.
+			enum Mode : unsigned char { predicted = 0, plain = 1 };
+
+			void encodeTile(const ImageData& in, const Region& tile, Mode mode, std::vector<unsigned char>& out) {
+				out.push_back(mode);
+
+				uint32_t block[BLOCK];
+				size_t filled = 0;
+
+				for (size_t i = 0; i < tile.height; ++i) {
+					const short* row = in[tile.row + i].data() + tile.column;
+					const short* up = i == 0 ? nullptr : in[tile.row + i - 1].data() + tile.column;
+
+					for (size_t j = 0; j < tile.width; ++j) {
+						block[filled++] = mode == predicted ? zigzag(row[j] - predict(row, up, j))
+															: static_cast<uint16_t>(row[j]);
+						if (filled == BLOCK) {
+							packBlock(block, out);
+							filled = 0;
+						}
+					}
+				}
+
+				if (filled > 0) {
+					std::fill(block + filled, block + BLOCK, 0);
+					packBlock(block, out);
+				}
+			}
+
+			/*
+				Prediction pays off on smooth images; on noise (e.g. gradient magnitudes) the residuals
+				are wider than the pixels, so such tiles are packed as they are instead.
+			*/
+			void encodeTile(const ImageData& in, const Region& tile, std::vector<unsigned char>& out) {
+				encodeTile(in, tile, predicted, out);
+				if (out.size() <= tile.pixels()) {
+					return;
+				}
+
+				std::vector<unsigned char> plainOut;
+				plainOut.reserve(out.size());
+				encodeTile(in, tile, plain, plainOut);
+				if (plainOut.size() < out.size()) {
+					out.swap(plainOut);
+				}
+			}
+
+			// Decodes a whole tile (width x height, row-major) into "pixels".
+			bool decodeTile(const unsigned char* p, const unsigned char* end, size_t width, size_t height,
+							std::vector<short>& pixels) {
+				pixels.resize(width * height);
+				if (p == end || *p > plain) {
+					return false;
+				}
+				Mode mode = static_cast<Mode>(*p++);
+
+				uint32_t block[BLOCK];
+				size_t used = BLOCK;
+
+				for (size_t i = 0; i < height; ++i) {
+					short* row = pixels.data() + i * width;
+					const short* up = i == 0 ? nullptr : row - width;
+
+					for (size_t j = 0; j < width; ++j) {
+						if (used == BLOCK) {
+							if (!unpackBlock(p, end, block)) {
+								return false;
+							}
+							used = 0;
+						}
+
+						if (mode == plain) {
+							row[j] = static_cast<short>(static_cast<uint16_t>(block[used++]));
+							continue;
+						}
+
+						int value = predict(row, up, j) + unzigzag(block[used++]);
+						if (value < std::numeric_limits<short>::min() || value > std::numeric_limits<short>::max()) {
+							return false;
+						}
+						row[j] = static_cast<short>(value);
+					}
+				}
+				return true;
+			}
+
+			/*
+				Whether a file of "fileSize" bytes can hold the index and tiles "header" describes. Every
+				tile takes at least its mode byte and one width byte per BLOCK pixels, which bounds the
+				index and the pixels before anything is allocated for them.
+			*/
+			bool plausible(const Header& header, uint64_t fileSize) {
+				if (header.tileSize == 0 || fileSize < HEADER_BYTES) {
+					return false;
+				}
+
+				uint64_t budget = fileSize - HEADER_BYTES;
+				uint64_t across = header.tilesAcross();
+				uint64_t down = header.tilesDown();
+				if (across != 0 && down > budget / across) {
+					return false;
+				}
+				uint64_t tiles = across * down;
+				if (tiles > budget / (ENTRY_BYTES + 1)) {
+					return false;
+				}
+
+				uint64_t payload = budget - tiles * (ENTRY_BYTES + 1);
+				return header.rows == 0 || header.columns <= payload * BLOCK / header.rows;
+			}
+
+			bool readIndex(std::ifstream& in, uint64_t fileSize, Header& header, std::vector<Entry>& index) {
+				unsigned char fixed[HEADER_BYTES];
+				if (!in.read(reinterpret_cast<char*>(fixed), HEADER_BYTES) ||
+					std::memcmp(fixed, MAGIC, sizeof(MAGIC)) != 0 || fixed[4] != VERSION) {
+					return false;
+				}
+
+				header.columns = static_cast<size_t>(getLE(fixed + 8, 4));
+				header.rows = static_cast<size_t>(getLE(fixed + 12, 4));
+				header.depth = static_cast<short>(getLE(fixed + 16, 2));
+				header.tileSize = static_cast<size_t>(getLE(fixed + 18, 2));
+				if (!plausible(header, fileSize)) {
+					return false;
+				}
+
+				size_t tiles = header.tilesAcross() * header.tilesDown();
+				std::vector<unsigned char> entries(tiles * ENTRY_BYTES);
+				if (!in.read(reinterpret_cast<char*>(entries.data()), static_cast<std::streamsize>(entries.size()))) {
+					return false;
+				}
+
+				index.resize(tiles);
+				for (size_t t = 0; t < tiles; ++t) {
+					index[t].offset = getLE(entries.data() + t * ENTRY_BYTES, 8);
+					index[t].length = static_cast<uint32_t>(getLE(entries.data() + t * ENTRY_BYTES + 8, 4));
+				}
+				return true;
+			}
+		}
+
+		Region Header::tileRegion(size_t tileRow, size_t tileColumn) const {
+			Region tile{ tileColumn * tileSize, tileRow * tileSize, tileSize, tileSize };
+			return tile.clipped(rows, columns);
+		}
+
+		void encode(const ImageData& in, const Region& region, short depth, size_t tileSize, std::vector<unsigned char>& out) {
+			Header header;
+			header.columns = region.width;
+			header.rows = region.height;
+			header.depth = depth;
+			header.tileSize = std::clamp<size_t>(tileSize, 1, std::numeric_limits<uint16_t>::max());
+
+			size_t across = header.tilesAcross();
+			size_t tiles = across * header.tilesDown();
+			std::vector<std::vector<unsigned char>> payloads(tiles);
+
+			ThreadPool::instance().parallelFor(0, tiles, [&](size_t tileBegin, size_t tileEnd) {
+				for (size_t t = tileBegin; t < tileEnd; ++t) {
+					Region tile = header.tileRegion(t / across, t % across);
+					tile.column += region.column;
+					tile.row += region.row;
+
+					payloads[t].reserve(tile.pixels());
+					encodeTile(in, tile, payloads[t]);
+				}
+			});
+
+			// The fixed header is laid out in place, the same way readIndex() reads it back.
+			std::array<unsigned char, HEADER_BYTES> fixed{};
+			std::memcpy(fixed.data(), MAGIC, sizeof(MAGIC));
+			fixed[4] = VERSION;
+			writeLE(fixed.data() + 8, header.columns, 4);
+			writeLE(fixed.data() + 12, header.rows, 4);
+			writeLE(fixed.data() + 16, static_cast<uint16_t>(header.depth), 2);
+			writeLE(fixed.data() + 18, header.tileSize, 2);
+
+			size_t bytes = HEADER_BYTES + tiles * ENTRY_BYTES;
+			for (const auto& payload : payloads) {
+				bytes += payload.size();
+			}
+
+			out.clear();
+			out.reserve(bytes);
+			out.assign(fixed.begin(), fixed.end());
+
+			size_t indexAt = out.size();
+			out.resize(indexAt + tiles * ENTRY_BYTES);
+
+			for (size_t t = 0; t < tiles; ++t) {
+				writeLE(out.data() + indexAt + t * ENTRY_BYTES, out.size(), 8);
+				writeLE(out.data() + indexAt + t * ENTRY_BYTES + 8, payloads[t].size(), 4);
+				out.insert(out.end(), payloads[t].begin(), payloads[t].end());
+			}
+		}
+
+		bool readHeader(const std::string& file, Header& header) {
+			std::ifstream in(file, std::ios::binary | std::ios::ate);
+			if (!in.is_open()) {
+				return false;
+			}
+			uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+			in.seekg(0);
+
+			std::vector<Entry> index;
+			return readIndex(in, fileSize, header, index);
+		}
+
+		bool decode(const std::string& file, const Region& region, Header& header, ImageData& out, short& min, short& max) {
+			std::ifstream in(file, std::ios::binary | std::ios::ate);
+			if (!in.is_open()) {
+				return false;
+			}
+			uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+			in.seekg(0);
+
+			std::vector<Entry> index;
+			if (!readIndex(in, fileSize, header, index)) {
+				return false;
+			}
+
+			Region area = region.clipped(header.rows, header.columns);
+			BufferPool::instance().release(std::move(out));
+			out = BufferPool::instance().acquire(area.height, area.width);
+			min = 0;
+			max = 0;
+			if (area.empty()) {
+				return true;
+			}
+
+			// Only the tiles that intersect the region are read.
+			size_t across = header.tilesAcross();
+			size_t firstRow = area.row / header.tileSize;
+			size_t lastRow = (area.row + area.height - 1) / header.tileSize;
+			size_t firstColumn = area.column / header.tileSize;
+			size_t lastColumn = (area.column + area.width - 1) / header.tileSize;
+
+			std::vector<size_t> needed;
+			std::vector<std::vector<unsigned char>> payloads;
+			for (size_t tileRow = firstRow; tileRow <= lastRow; ++tileRow) {
+				for (size_t tileColumn = firstColumn; tileColumn <= lastColumn; ++tileColumn) {
+					const Entry& entry = index[tileRow * across + tileColumn];
+					if (entry.offset > fileSize || entry.length > fileSize - entry.offset) {
+						return false;
+					}
+
+					std::vector<unsigned char> payload(entry.length);
+					in.seekg(static_cast<std::streamoff>(entry.offset));
+					if (!in.read(reinterpret_cast<char*>(payload.data()), static_cast<std::streamsize>(payload.size()))) {
+						return false;
+					}
+					needed.push_back(tileRow * across + tileColumn);
+					payloads.push_back(std::move(payload));
+				}
+			}
+
+			bool ok = true;
+			int lo = std::numeric_limits<short>::max();
+			int hi = std::numeric_limits<short>::min();
+			std::mutex resultMutex;
+
+			ThreadPool::instance().parallelFor(0, needed.size(), [&](size_t begin, size_t end) {
+				thread_local std::vector<short> pixels;
+				bool bandOk = true;
+				int bandLo = std::numeric_limits<short>::max();
+				int bandHi = std::numeric_limits<short>::min();
+
+				for (size_t k = begin; k < end && bandOk; ++k) {
+					Region tile = header.tileRegion(needed[k] / across, needed[k] % across);
+					const unsigned char* data = payloads[k].data();
+					if (!decodeTile(data, data + payloads[k].size(), tile.width, tile.height, pixels)) {
+						bandOk = false;
+						break;
+					}
+
+					// Copy the part of the tile inside the region.
+					size_t top = std::max(tile.row, area.row);
+					size_t bottom = std::min(tile.row + tile.height, area.row + area.height);
+					size_t left = std::max(tile.column, area.column);
+					size_t right = std::min(tile.column + tile.width, area.column + area.width);
+
+					for (size_t i = top; i < bottom; ++i) {
+						const short* src = pixels.data() + (i - tile.row) * tile.width + (left - tile.column);
+						short* dst = out[i - area.row].data() + (left - area.column);
+						for (size_t j = 0; j < right - left; ++j) {
+							dst[j] = src[j];
+							bandLo = std::min<int>(bandLo, src[j]);
+							bandHi = std::max<int>(bandHi, src[j]);
+						}
+					}
+				}
+
+				std::lock_guard<std::mutex> lock(resultMutex);
+				ok = ok && bandOk;
+				lo = std::min(lo, bandLo);
+				hi = std::max(hi, bandHi);
+			});
+
+			min = static_cast<short>(lo);
+			max = static_cast<short>(hi);
+			return ok;
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "MKIRegion.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace MKImage {
+	using ImageData = std::vector<std::vector<short>>;
+
+	/*
+		The native tiled container (.mkt): the image split into fixed-size square tiles, each
+		compressed on its own, with an index of tile offsets in the header so any tile can be
+		decoded without reading the others.
+
+		Layout, all integers little-endian:
+			"MKIT", version (u8), 3 reserved bytes
+			columns (u32), rows (u32), depth (u16), tile size (u16)
+			one (offset u64, length u32) entry per tile, row-major
+			tile payloads
+
+		Tile codec: each pixel is predicted from its left, upper and upper-left neighbours inside the
+		tile (the LOCO-I median predictor) and the residual is zigzag mapped to an unsigned value.
+		Residuals are then bit-packed in blocks of 16: one byte with the bit width of the largest,
+		followed by 16 values of that width. Flat areas cost one byte per block. Tiles where this
+		does not beat one byte per pixel (noise) are packed without prediction if that is smaller;
+		a mode byte at the start of each tile says which.
+	*/
+	namespace Tiles {
+		constexpr uint8_t VERSION = 1;
+
+		struct Header {
+			size_t columns = 0;
+			size_t rows = 0;
+			short depth = 0;
+			size_t tileSize = 0;
+
+			size_t tilesAcross() const { return (columns + tileSize - 1) / tileSize; }
+			size_t tilesDown() const { return (rows + tileSize - 1) / tileSize; }
+			// Pixel area of a tile, clipped at the right and bottom edges.
+			Region tileRegion(size_t tileRow, size_t tileColumn) const;
+		};
+
+		// Encodes "region" of "in" into a whole file in "out". Tiles are compressed in parallel.
+		void encode(const ImageData& in, const Region& region, short depth, size_t tileSize, std::vector<unsigned char>& out);
+
+		// Reads only the header and tile index of "file". Returns false if it is not a tiled file.
+		bool readHeader(const std::string& file, Header& header);
+
+		/*
+			Decodes "region" (clipped to the image) of "file" into "out", which is resized to the
+			clipped region. Only the tiles intersecting the region are read from disk; they are
+			decoded in parallel. Returns false if the file is missing, truncated or corrupt.
+		*/
+		bool decode(const std::string& file, const Region& region, Header& header, ImageData& out, short& min, short& max);
+	}
+}
@@ -0,0 +1,272 @@
+#include "MKITrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+namespace MKImage {
+	namespace Trace {
+		namespace {
+			// Beyond this many recorded events new ones are only counted in the totals.
+			constexpr size_t MAX_EVENTS = 1 << 20;
+
+			/*
+				What one thread has traced. Only its own thread writes to it, so its mutex is contended
+				only while a reader is merging the buffers; stages are keyed by the name literal's address.
+			*/
+			struct Buffer {
+				std::mutex mutex;
+				uint32_t thread = 0;
+				std::vector<Event> events;
+				std::unordered_map<const char*, StageStats> stages;
+				ThreadStats time;
+				bool timed = false;
+			};
+
+			struct State {
+				std::mutex mutex;
+				std::shared_ptr<Sink> sink;
+				bool recording = false;
+				// Kept after their threads exit, so the totals of a resized pool are not lost.
+				std::vector<std::shared_ptr<Buffer>> buffers;
+			};
+
+			State& state() {
+				static State s;
+				return s;
+			}
+
+			std::atomic<bool> g_Active{ false };
+			std::atomic<bool> g_Recording{ false };
+			std::atomic<size_t> g_Recorded{ 0 };
+			// Bumped on every setSink(), so threads refresh their copy of the sink only when it changed.
+			std::atomic<uint64_t> g_SinkVersion{ 0 };
+			std::atomic<uint32_t> g_NextThread{ 0 };
+			const auto g_Epoch = std::chrono::steady_clock::now();
+
+			void updateActive(State& s) {
+				g_Recording.store(s.recording, std::memory_order_release);
+				g_Active.store(s.sink != nullptr || s.recording, std::memory_order_release);
+			}
+
+			Buffer& localBuffer() {
+				thread_local std::shared_ptr<Buffer> buffer = [] {
+					auto created = std::make_shared<Buffer>();
+					created->thread = threadId();
+					created->time.thread = created->thread;
+
+					State& s = state();
+					std::lock_guard<std::mutex> lock(s.mutex);
+					s.buffers.push_back(created);
+					return created;
+				}();
+				return *buffer;
+			}
+
+			const std::shared_ptr<Sink>& localSink() {
+				thread_local std::shared_ptr<Sink> sink;
+				thread_local uint64_t version = 0;
+
+				uint64_t current = g_SinkVersion.load(std::memory_order_acquire);
+				if (current != version) {
+					State& s = state();
+					std::lock_guard<std::mutex> lock(s.mutex);
+					sink = s.sink;
+					version = g_SinkVersion.load(std::memory_order_relaxed);
+				}
+				return sink;
+			}
+
+			std::vector<std::shared_ptr<Buffer>> buffers() {
+				State& s = state();
+				std::lock_guard<std::mutex> lock(s.mutex);
+				return s.buffers;
+			}
+
+			void writeEscaped(std::ostream& out, const char* text) {
+				out << '"';
+				for (const char* c = text; *c; ++c) {
+					if (*c == '"' || *c == '\\') {
+						out << '\\';
+					}
+					out << *c;
+				}
+				out << '"';
+			}
+		}
+
+		void setSink(Sink sink) {
+			State& s = state();
+			std::lock_guard<std::mutex> lock(s.mutex);
+			s.sink = sink ? std::make_shared<Sink>(std::move(sink)) : nullptr;
+			g_SinkVersion.fetch_add(1, std::memory_order_release);
+			updateActive(s);
+		}
+
+		void startRecording() {
+			State& s = state();
+			std::lock_guard<std::mutex> lock(s.mutex);
+			s.recording = true;
+			updateActive(s);
+		}
+
+		void stopRecording() {
+			State& s = state();
+			std::lock_guard<std::mutex> lock(s.mutex);
+			s.recording = false;
+			updateActive(s);
+		}
+
+		void clear() {
+			for (const auto& buffer : buffers()) {
+				std::lock_guard<std::mutex> lock(buffer->mutex);
+				buffer->events.clear();
+				buffer->stages.clear();
+				buffer->time = ThreadStats{};
+				buffer->time.thread = buffer->thread;
+				buffer->timed = false;
+			}
+			g_Recorded.store(0, std::memory_order_relaxed);
+		}
+
+		bool active() {
+			return g_Active.load(std::memory_order_acquire);
+		}
+
+		std::vector<Event> events() {
+			std::vector<Event> out;
+			for (const auto& buffer : buffers()) {
+				std::lock_guard<std::mutex> lock(buffer->mutex);
+				out.insert(out.end(), buffer->events.begin(), buffer->events.end());
+			}
+			std::stable_sort(out.begin(), out.end(), [](const Event& a, const Event& b) { return a.start < b.start; });
+			return out;
+		}
+
+		std::vector<StageStats> stageStats() {
+			// Merged by name, as the same literal may have a different address in each translation unit.
+			std::map<std::string, StageStats> merged;
+			for (const auto& buffer : buffers()) {
+				std::lock_guard<std::mutex> lock(buffer->mutex);
+				for (const auto& entry : buffer->stages) {
+					const StageStats& stage = entry.second;
+					StageStats& total = merged[stage.name];
+					total.name = stage.name;
+					total.calls += stage.calls;
+					total.totalTime += stage.totalTime;
+					total.maxTime = std::max(total.maxTime, stage.maxTime);
+					total.pixels += stage.pixels;
+					total.bytes += stage.bytes;
+					total.tiles += stage.tiles;
+				}
+			}
+
+			std::vector<StageStats> out;
+			out.reserve(merged.size());
+			for (auto& stage : merged) {
+				out.push_back(std::move(stage.second));
+			}
+			return out;
+		}
+
+		std::vector<ThreadStats> threadStats() {
+			std::vector<ThreadStats> out;
+			for (const auto& buffer : buffers()) {
+				std::lock_guard<std::mutex> lock(buffer->mutex);
+				if (buffer->timed) {
+					out.push_back(buffer->time);
+				}
+			}
+			std::sort(out.begin(), out.end(), [](const ThreadStats& a, const ThreadStats& b) { return a.thread < b.thread; });
+			return out;
+		}
+
+		std::string chromeTrace() {
+			std::vector<Event> recorded = events();
+
+			std::ostringstream out;
+			out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+			for (size_t i = 0; i < recorded.size(); ++i) {
+				const Event& e = recorded[i];
+				if (i != 0) {
+					out << ',';
+				}
+				// Complete ("X") events; trace-event timestamps are microseconds.
+				out << "\n{\"name\":";
+				writeEscaped(out, e.name);
+				out << ",\"cat\":";
+				writeEscaped(out, e.category);
+				out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+					<< ",\"ts\":" << e.start / 1000.0
+					<< ",\"dur\":" << e.duration / 1000.0
+					<< ",\"args\":{\"pixels\":" << e.pixels
+					<< ",\"bytes\":" << e.bytes
+					<< ",\"tiles\":" << e.tiles << "}}";
+			}
+			out << "\n]}\n";
+			return out.str();
+		}
+
+		bool saveChromeTrace(const std::string& file) {
+			std::ofstream out(file, std::ios::binary);
+			if (!out.is_open()) {
+				return false;
+			}
+			out << chromeTrace();
+			return static_cast<bool>(out);
+		}
+
+		uint64_t now() {
+			auto elapsed = std::chrono::steady_clock::now() - g_Epoch;
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+		}
+
+		uint32_t threadId() {
+			thread_local uint32_t id = g_NextThread.fetch_add(1, std::memory_order_relaxed);
+			return id;
+		}
+
+		void emit(const Event& event) {
+			Buffer& buffer = localBuffer();
+			{
+				std::lock_guard<std::mutex> lock(buffer.mutex);
+
+				StageStats& stage = buffer.stages[event.name];
+				if (stage.calls == 0) {
+					stage.name = event.name;
+				}
+				stage.calls++;
+				stage.totalTime += event.duration;
+				stage.maxTime = std::max(stage.maxTime, event.duration);
+				stage.pixels += event.pixels;
+				stage.bytes += event.bytes;
+				stage.tiles += event.tiles;
+
+				if (g_Recording.load(std::memory_order_acquire) &&
+					g_Recorded.fetch_add(1, std::memory_order_relaxed) < MAX_EVENTS) {
+					buffer.events.push_back(event);
+				}
+			}
+
+			// Called outside the lock so a sink may use the rest of this API.
+			const std::shared_ptr<Sink>& sink = localSink();
+			if (sink) {
+				(*sink)(event);
+			}
+		}
+
+		void addThreadTime(uint64_t busy, uint64_t idle) {
+			Buffer& buffer = localBuffer();
+			std::lock_guard<std::mutex> lock(buffer.mutex);
+			buffer.time.busy += busy;
+			buffer.time.idle += idle;
+			buffer.timed = true;
+		}
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace MKImage {
+
+	/*
+		Hot-path instrumentation.
+
+		Library stages open a Trace::Scope, which times the stage on the calling thread and carries
+		counters (pixels, bytes, tiles). When the scope closes it becomes an Event that is passed to the
+		installed sink and, while recording, kept for export as Chrome trace-event JSON
+		(chrome://tracing or Perfetto). Thread pool bands are reported the same way, together with
+		each thread's busy and idle time. Events and totals are kept per thread and merged when they
+		are read, so tracing does not make the threads wait for each other.
+
+		Nothing is measured while there is no sink and recording is off. Building with
+		MKIMAGE_TRACE=OFF removes the instrumentation altogether: Scope becomes an empty inline class.
+	*/
+	namespace Trace {
+		struct Event {
+			const char* name = "";		// stage name, a string literal
+			const char* category = "";	// "image", "io", "fft" or "pool"
+			uint64_t start = 0;			// nanoseconds since the first traced event
+			uint64_t duration = 0;		// nanoseconds
+			uint32_t thread = 0;		// small id, stable for the life of the thread
+			uint64_t pixels = 0;
+			uint64_t bytes = 0;
+			uint64_t tiles = 0;
+		};
+
+		// Totals for one stage name since the last clear().
+		struct StageStats {
+			std::string name;
+			uint64_t calls = 0;
+			uint64_t totalTime = 0;
+			uint64_t maxTime = 0;
+			uint64_t pixels = 0;
+			uint64_t bytes = 0;
+			uint64_t tiles = 0;
+		};
+
+		// Time a thread spent running pool work (busy) and waiting for it (idle), in nanoseconds.
+		struct ThreadStats {
+			uint32_t thread = 0;
+			uint64_t busy = 0;
+			uint64_t idle = 0;
+		};
+
+		using Sink = std::function<void(const Event&)>;
+
+		// Called for every finished event, from the thread that produced it. An empty sink removes it.
+		void setSink(Sink sink);
+		// Keeps finished events (up to a fixed cap) for events() and chromeTrace().
+		void startRecording();
+		void stopRecording();
+		// Drops recorded events and resets stage and thread totals.
+		void clear();
+
+		// True when events are being consumed, i.e. a sink is set or recording is on.
+		bool active();
+
+		std::vector<Event> events();
+		std::vector<StageStats> stageStats();
+		std::vector<ThreadStats> threadStats();
+
+		// Recorded events as a Chrome trace-event JSON document.
+		std::string chromeTrace();
+		bool saveChromeTrace(const std::string& file);
+
+		/* Used by the instrumented code */
+
+		uint64_t now();
+		uint32_t threadId();
+		void emit(const Event& event);
+		void addThreadTime(uint64_t busy, uint64_t idle);
+
+#ifdef MKIMAGE_TRACE_ENABLED
+		// Times the enclosing block as one stage.
+		class Scope {
+		public:
+			explicit Scope(const char* name, const char* category = "image") : m_Active{ active() } {
+				if (m_Active) {
+					m_Event.name = name;
+					m_Event.category = category;
+					m_Event.start = now();
+				}
+			}
+			~Scope() {
+				if (m_Active) {
+					m_Event.duration = now() - m_Event.start;
+					m_Event.thread = threadId();
+					emit(m_Event);
+				}
+			}
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+			void addPixels(uint64_t count) { m_Event.pixels += count; }
+			void addBytes(uint64_t count) { m_Event.bytes += count; }
+			void addTiles(uint64_t count) { m_Event.tiles += count; }
+
+		private:
+			Event m_Event;
+			bool m_Active;
+		};
+#else
+		class Scope {
+		public:
+			explicit Scope(const char*, const char* = "image") {}
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+			void addPixels(uint64_t) {}
+			void addBytes(uint64_t) {}
+			void addTiles(uint64_t) {}
+		};
+#endif
+	}
+}
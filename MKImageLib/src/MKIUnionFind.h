@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+namespace MKImage {
+
+	/*
+		Disjoint sets over pixel indices, used for connected-component style passes.
+		unite() is not synchronised: callers give each thread a disjoint range of indices
+		(e.g. a row band) and merge band borders afterwards on one thread.
+	*/
+	class UnionFind {
+	public:
+		explicit UnionFind(size_t size) : m_Parent(size) {
+			for (size_t i = 0; i < size; ++i) {
+				m_Parent[i] = static_cast<uint32_t>(i);
+			}
+		}
+
+		// Root of "i" with path halving. Writes to the parent array.
+		uint32_t find(uint32_t i) {
+			while (m_Parent[i] != i) {
+				m_Parent[i] = m_Parent[m_Parent[i]];
+				i = m_Parent[i];
+			}
+			return i;
+		}
+
+		// Root of "i" without modifying the structure, safe to call from many threads at once.
+		uint32_t root(uint32_t i) const {
+			while (m_Parent[i] != i) {
+				i = m_Parent[i];
+			}
+			return i;
+		}
+
+		// Joins the sets of "a" and "b". The root of the merged set is the smaller root index.
+		uint32_t unite(uint32_t a, uint32_t b) {
+			a = find(a);
+			b = find(b);
+			if (a == b) {
+				return a;
+			}
+			if (b < a) {
+				std::swap(a, b);
+			}
+			m_Parent[b] = a;
+			return a;
+		}
+
+		// Points "i" directly at "parent", for forests built elsewhere (e.g. per tile) and copied in.
+		void link(uint32_t i, uint32_t parent) { m_Parent[i] = parent; }
+
+		size_t size() const { return m_Parent.size(); }
+
+	private:
+		std::vector<uint32_t> m_Parent;
+	};
+}
@@ -2,6 +2,7 @@
 #include "MKIHistogram.h"
 #include "MKIImageFuncs.h"
 #include "MKIMask.h"
+#include "MKITrace.h"
 
 #include <thread>
 #include <chrono>
@@ -31,54 +32,24 @@ int main() {
 
 	auto timeStart = std::chrono::high_resolution_clock().now();
 
-	MKImage::Image lena(LENA256);
+	MKImage::Trace::startRecording();
 
-	std::chrono::duration<double> nn(0), bl(0), bc(0);
+	// Performance measurements live in the Bench target.
+	MKImage::Image lena1(LENA256);
+	lena1.scalingProcessing(lena1.columns() * RATIO, lena1.rows() * RATIO, MKImage::Image::ScalingOps::nearestNeighbor);
+	lena1.save(LENA_ZOOM_NN, COMMENT);
 
-	for (size_t i = 0; i < 1'000; ++i) {
-		MKImage::Image lena1(lena);
-		auto ts = std::chrono::high_resolution_clock().now();
-		lena1.scalingProcessing(lena1.columns() * RATIO, lena1.rows() * RATIO, MKImage::Image::ScalingOps::nearestNeighbor);
-		nn += std::chrono::high_resolution_clock().now() - ts;
-	}
-
-	for (size_t i = 0; i < 1'000; ++i) {
-		MKImage::Image lena1(lena);
-		auto ts = std::chrono::high_resolution_clock().now();
-		lena1.scalingProcessing(lena1.columns() * RATIO, lena1.rows() * RATIO, MKImage::Image::ScalingOps::bilinear);
-		bl += std::chrono::high_resolution_clock().now() - ts;
-	}
-
-	for (size_t i = 0; i < 1'000; ++i) {
-		MKImage::Image lena1(lena);
-		auto ts = std::chrono::high_resolution_clock().now();
-		lena1.scalingProcessing(lena1.columns() * RATIO, lena1.rows() * RATIO, MKImage::Image::ScalingOps::bicubic);
-		bc += std::chrono::high_resolution_clock().now() - ts;
-	}
-
-	double nnAvg = nn.count() / 1000.0;
-	double blAvg = bl.count() / 1000.0;
-	double bcAvg = bc.count() / 1000.0;
+	MKImage::Image lena2(LENA256);
+	lena2.scalingProcessing(lena2.columns() * RATIO, lena2.rows() * RATIO, MKImage::Image::ScalingOps::bilinear);
+	lena2.save(LENA_ZOOM_BL, COMMENT);
 
-	std::cout << "\nNearest Neighbor Average: " << nnAvg << '\n';
-	std::cout << "Bilinear Average: " << blAvg << '\n';
-	std::cout << "Bicubic Average: " << bcAvg << '\n';
+	MKImage::Image lena3(LENA256);
+	lena3.scalingProcessing(lena3.columns() * RATIO, lena3.rows() * RATIO, MKImage::Image::ScalingOps::bicubic);
+	lena3.save(LENA_ZOOM_SAVEBC, COMMENT);
 
-	// MKImage::Image lena1(LENA256);
-	// lena1.scalingProcessing(lena1.columns() * RATIO, lena1.rows() * RATIO, MKImage::Image::ScalingOps::nearestNeighbor);
-	// lena1.save(LENA_ZOOM_NN, COMMENT);
-
-	// MKImage::Image lena2(LENA256);
-	// lena2.scalingProcessing(lena2.columns() * RATIO, lena2.rows() * RATIO, MKImage::Image::ScalingOps::bilinear);
-	// lena2.save(LENA_ZOOM_BL, COMMENT);
-
-	// MKImage::Image lena3(LENA256);
-	// lena3.scalingProcessing(lena3.columns() * RATIO, lena3.rows() * RATIO, MKImage::Image::ScalingOps::bicubic);
-	// lena3.save(LENA_ZOOM_SAVEBC, COMMENT);
-
-	// MKImage::Image lena4(LENA256);
-	// lena4.scalingProcessing(lena4.columns() * RATIO, lena4.rows() * RATIO, MKImage::Image::ScalingOps::lanczos2);
-	// lena4.save(LENA_ZOOM_SAVELA, COMMENT);
+	MKImage::Image lena4(LENA256);
+	lena4.scalingProcessing(lena4.columns() * RATIO, lena4.rows() * RATIO, MKImage::Image::ScalingOps::lanczos2);
+	lena4.save(LENA_ZOOM_SAVELA, COMMENT);
 
 	// MKImage::Image shuttle1(SHUTTLE);
 	// shuttle1.scalingProcessing(shuttle1.columns() * RATIO, shuttle1.rows() * RATIO, MKImage::Image::ScalingOps::nearestNeighbor);
@@ -98,6 +69,13 @@ int main() {
 	
 	auto timeStop = std::chrono::high_resolution_clock().now();
 
+	MKImage::Trace::stopRecording();
+	for (const auto& stage : MKImage::Trace::stageStats()) {
+		std::cout << stage.name << ": " << stage.calls << " calls, " << stage.totalTime / 1e9 << " seconds\n";
+	}
+	// Open in chrome://tracing or https://ui.perfetto.dev
+	MKImage::Trace::saveChromeTrace("trace.json");
+
 	std::chrono::duration<double> runTime = timeStop - timeStart;
 	std::cout << "\nProgram runtime(seconds): " << runTime.count() << '\n';
 
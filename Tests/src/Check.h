@@ -0,0 +1,44 @@
+#pragma once
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+	The checks are plain programs run by ctest: each one compares a module with a simple reference
+	implementation, reports the expectations that failed and exits non-zero if there were any.
+*/
+namespace Check {
+	using ImageData = std::vector<std::vector<short>>;
+
+	inline int g_Failures = 0;
+
+	inline void expect(bool ok, const std::string& what) {
+		if (!ok) {
+			std::cerr << "FAILED: " << what << "\n";
+			++g_Failures;
+		}
+	}
+
+	inline int result(const char* name) {
+		std::cout << name << (g_Failures == 0 ? ": ok" : ": failed") << std::endl;
+		return g_Failures == 0 ? 0 : 1;
+	}
+
+	// rows x columns of uniform values from 0 to maxValue.
+	inline ImageData noise(size_t rows, size_t columns, short maxValue, std::mt19937& random) {
+		std::uniform_int_distribution<int> value(0, maxValue);
+		ImageData image(rows, std::vector<short>(columns));
+		for (auto& row : image) {
+			for (auto& pixel : row) {
+				pixel = static_cast<short>(value(random));
+			}
+		}
+		return image;
+	}
+
+	inline std::string size(const ImageData& image) {
+		return std::to_string(image.size()) + "x" + std::to_string(image.empty() ? 0 : image[0].size());
+	}
+}
@@ -0,0 +1,142 @@
+#include "Check.h"
+
+#include "MKIComponents.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+	using namespace MKImage;
+	using Components::Connectivity;
+
+	// Flood fill from every unlabelled foreground pixel in raster order, numbering as label() does.
+	Components::Labels floodFill(const ImageData& in, Connectivity connectivity) {
+		Components::Labels out;
+		out.rows = in.size();
+		out.columns = in.empty() ? 0 : in[0].size();
+		out.labels.assign(out.rows * out.columns, 0);
+
+		std::vector<std::pair<size_t, size_t>> stack;
+		for (size_t i = 0; i < out.rows; ++i) {
+			for (size_t j = 0; j < out.columns; ++j) {
+				if (in[i][j] == 0 || out.labels[i * out.columns + j] != 0) {
+					continue;
+				}
+
+				uint32_t label = static_cast<uint32_t>(out.blobs.size() + 1);
+				Components::Blob blob;
+				size_t top = i, bottom = i, left = j, right = j;
+				double rowSum = 0, columnSum = 0;
+
+				out.labels[i * out.columns + j] = label;
+				stack.push_back({ i, j });
+				while (!stack.empty()) {
+					auto [row, column] = stack.back();
+					stack.pop_back();
+
+					blob.area++;
+					rowSum += row;
+					columnSum += column;
+					top = std::min(top, row);
+					bottom = std::max(bottom, row);
+					left = std::min(left, column);
+					right = std::max(right, column);
+
+					for (int di = -1; di <= 1; ++di) {
+						for (int dj = -1; dj <= 1; ++dj) {
+							if ((di == 0 && dj == 0) || (connectivity == Connectivity::four && di != 0 && dj != 0)) {
+								continue;
+							}
+							long r = static_cast<long>(row) + di;
+							long c = static_cast<long>(column) + dj;
+							if (r < 0 || c < 0 || r >= static_cast<long>(out.rows) || c >= static_cast<long>(out.columns)) {
+								continue;
+							}
+							uint32_t& neighbour = out.labels[r * out.columns + c];
+							if (in[r][c] != 0 && neighbour == 0) {
+								neighbour = label;
+								stack.push_back({ static_cast<size_t>(r), static_cast<size_t>(c) });
+							}
+						}
+					}
+				}
+
+				blob.bounds = Region{ left, top, right - left + 1, bottom - top + 1 };
+				blob.centroidRow = rowSum / blob.area;
+				blob.centroidColumn = columnSum / blob.area;
+				out.blobs.push_back(blob);
+			}
+		}
+		return out;
+	}
+
+	void compare(const ImageData& in, Connectivity connectivity) {
+		std::string name = Check::size(in) + (connectivity == Connectivity::four ? " 4-connected" : " 8-connected");
+		Components::Labels labels = Components::label(in, connectivity);
+		Components::Labels expected = floodFill(in, connectivity);
+
+		Check::expect(labels.rows == expected.rows && labels.columns == expected.columns, name + ": size");
+		Check::expect(labels.labels == expected.labels, name + ": labels differ from the flood fill");
+		Check::expect(labels.count() == expected.count(), name + ": " + std::to_string(labels.count()) + " components, expected "
+					  + std::to_string(expected.count()));
+		if (labels.count() != expected.count()) {
+			return;
+		}
+
+		for (size_t k = 0; k < labels.count(); ++k) {
+			const Components::Blob& blob = labels.blobs[k];
+			const Components::Blob& reference = expected.blobs[k];
+			bool same = blob.area == reference.area && blob.bounds.row == reference.bounds.row
+				&& blob.bounds.column == reference.bounds.column && blob.bounds.width == reference.bounds.width
+				&& blob.bounds.height == reference.bounds.height
+				&& std::abs(blob.centroidRow - reference.centroidRow) < 1e-6
+				&& std::abs(blob.centroidColumn - reference.centroidColumn) < 1e-6;
+			if (!same) {
+				Check::expect(false, name + ": measurements of component " + std::to_string(k + 1));
+				return;
+			}
+		}
+	}
+
+	ImageData randomMask(size_t rows, size_t columns, double density, std::mt19937& random) {
+		std::bernoulli_distribution set(density);
+		ImageData mask(rows, std::vector<short>(columns));
+		for (auto& row : mask) {
+			for (auto& pixel : row) {
+				pixel = set(random) ? 255 : 0;
+			}
+		}
+		return mask;
+	}
+}
+
+int main() {
+	std::mt19937 random(7);
+
+	// Single pixels, lines, and images spanning several tiles with components crossing tile borders.
+	const std::vector<std::pair<size_t, size_t>> sizes{ { 0, 0 }, { 1, 1 }, { 1, 300 }, { 300, 1 }, { 17, 23 }, { 128, 128 },
+														 { 129, 257 }, { 300, 290 } };
+	for (auto size : sizes) {
+		for (double density : { 0.0, 0.3, 0.5, 0.6, 1.0 }) {
+			ImageData mask = randomMask(size.first, size.second, density, random);
+			compare(mask, Connectivity::four);
+			compare(mask, Connectivity::eight);
+		}
+	}
+
+	// Nested open rings, each a long thin component crossing tile borders.
+	ImageData rings(260, std::vector<short>(260));
+	size_t top = 0, left = 0, bottom = 259, right = 259;
+	while (top + 2 <= bottom && left + 2 <= right) {
+		for (size_t j = left; j <= right; ++j) rings[top][j] = 1;
+		for (size_t i = top; i <= bottom; ++i) rings[i][right] = 1;
+		for (size_t j = left; j <= right; ++j) rings[bottom][j] = 1;
+		for (size_t i = top + 2; i <= bottom; ++i) rings[i][left] = 1;
+		top += 2, left += 2, bottom -= 2, right -= 2;
+	}
+	compare(rings, Connectivity::four);
+	compare(rings, Connectivity::eight);
+
+	return Check::result("Components");
+}
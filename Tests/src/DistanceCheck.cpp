@@ -0,0 +1,83 @@
+#include "Check.h"
+
+#include "MKIDistance.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+	using namespace MKImage;
+	using Distance::Target;
+
+	// Squared distance to every target pixel, keeping the smallest.
+	std::vector<uint32_t> bruteForce(const ImageData& in, Target target) {
+		size_t rows = in.size();
+		size_t columns = in.empty() ? 0 : in[0].size();
+		auto isTarget = [&](size_t i, size_t j) { return (in[i][j] != 0) == (target == Target::nonZero); };
+
+		std::vector<uint32_t> out(rows * columns, Distance::NONE_SQUARED);
+		for (size_t i = 0; i < rows; ++i) {
+			for (size_t j = 0; j < columns; ++j) {
+				for (size_t u = 0; u < rows; ++u) {
+					for (size_t v = 0; v < columns; ++v) {
+						if (isTarget(u, v)) {
+							long di = static_cast<long>(i) - static_cast<long>(u);
+							long dj = static_cast<long>(j) - static_cast<long>(v);
+							out[i * columns + j] = std::min(out[i * columns + j], static_cast<uint32_t>(di * di + dj * dj));
+						}
+					}
+				}
+			}
+		}
+		return out;
+	}
+
+	void compare(const ImageData& in, Target target) {
+		std::string name = Check::size(in) + (target == Target::zero ? " to zero" : " to non-zero");
+		std::vector<uint32_t> expected = bruteForce(in, target);
+
+		Distance::Map<uint32_t> squared = Distance::squared(in, target);
+		Check::expect(squared.values == expected, name + ": squared distances differ from brute force");
+
+		Distance::Map<float> euclidean = Distance::euclidean(in, target);
+		bool same = euclidean.values.size() == expected.size();
+		for (size_t k = 0; same && k < expected.size(); ++k) {
+			same = expected[k] == Distance::NONE_SQUARED ? euclidean.values[k] == Distance::NONE
+														 : std::abs(euclidean.values[k] - std::sqrt(static_cast<double>(expected[k]))) < 1e-4;
+		}
+		Check::expect(same, name + ": Euclidean distances differ from brute force");
+	}
+
+	ImageData randomMask(size_t rows, size_t columns, double density, std::mt19937& random) {
+		std::bernoulli_distribution set(density);
+		ImageData mask(rows, std::vector<short>(columns));
+		for (auto& row : mask) {
+			for (auto& pixel : row) {
+				pixel = set(random) ? 255 : 0;
+			}
+		}
+		return mask;
+	}
+}
+
+int main() {
+	std::mt19937 random(3);
+
+	const std::vector<std::pair<size_t, size_t>> sizes{ { 1, 1 }, { 1, 40 }, { 40, 1 }, { 23, 31 }, { 64, 47 } };
+	for (auto size : sizes) {
+		// Empty, single-pixel, sparse, dense and full target sets.
+		for (double density : { 0.0, 0.001, 0.02, 0.3, 0.9, 1.0 }) {
+			ImageData mask = randomMask(size.first, size.second, density, random);
+			compare(mask, Target::zero);
+			compare(mask, Target::nonZero);
+		}
+	}
+
+	// One target pixel in a corner, where the distances are largest.
+	ImageData corner(50, std::vector<short>(70));
+	corner[49][69] = 1;
+	compare(corner, Target::nonZero);
+
+	return Check::result("Distance");
+}
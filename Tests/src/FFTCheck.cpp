@@ -0,0 +1,67 @@
+#include "Check.h"
+
+#include "MKIFFT.h"
+#include "MKIMask.h"
+
+#include <random>
+#include <vector>
+
+namespace {
+	using namespace MKImage;
+
+	// FFT::convolve() must give exactly what Mask::apply() gives at every pixel.
+	void compare(const ImageData& in, const Mask& mask, const std::string& name) {
+		ImageData out(in.size(), std::vector<short>(in[0].size()));
+		FFT::convolve(in, out, mask);
+
+		size_t mismatches = 0;
+		for (size_t i = 0; i < in.size(); ++i) {
+			for (size_t j = 0; j < in[i].size(); ++j) {
+				if (out[i][j] != mask.apply(in, i, j)) {
+					++mismatches;
+				}
+			}
+		}
+		Check::expect(mismatches == 0, name + " on " + Check::size(in) + ": " + std::to_string(mismatches) + " pixels differ");
+	}
+
+	Mask randomMask(size_t rows, size_t columns, std::mt19937& random) {
+		std::uniform_int_distribution<int> tap(-8, 16);
+		std::vector<std::vector<short>> values(rows, std::vector<short>(columns));
+		for (auto& row : values) {
+			for (auto& value : row) {
+				value = static_cast<short>(tap(random));
+			}
+		}
+		return Mask(std::move(values));
+	}
+}
+
+int main() {
+	std::mt19937 random(42);
+
+	const std::vector<std::pair<const Mask*, std::string>> masks{
+		{ &Mask::SMOOTH_3X3, "SMOOTH_3X3" },
+		{ &Mask::SMOOTH_9X9, "SMOOTH_9X9" },
+		{ &Mask::GAUSSIAN_BLUR_5X5, "GAUSSIAN_BLUR_5X5" },
+		{ &Mask::HARD_EDGE_LAPLACIAN_9X9, "HARD_EDGE_LAPLACIAN_9X9" },
+	};
+	for (auto size : { std::make_pair(9, 9), std::make_pair(10, 31), std::make_pair(64, 64), std::make_pair(131, 97) }) {
+		ImageData in = Check::noise(size.first, size.second, 255, random);
+		for (const auto& mask : masks) {
+			compare(in, *mask.first, mask.second);
+		}
+	}
+
+	// Uneven kernels with negative taps, on images just larger than the kernel and on larger ones.
+	for (int n = 0; n < 40; ++n) {
+		std::uniform_int_distribution<size_t> side(1, 12);
+		size_t maskRows = side(random);
+		size_t maskColumns = side(random);
+		std::uniform_int_distribution<size_t> extra(1, n < 20 ? 4 : 90);
+		ImageData in = Check::noise(maskRows + extra(random), maskColumns + extra(random), 255, random);
+		compare(in, randomMask(maskRows, maskColumns, random), "random " + std::to_string(maskRows) + "x" + std::to_string(maskColumns));
+	}
+
+	return Check::result("FFT");
+}
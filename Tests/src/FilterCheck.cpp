@@ -0,0 +1,162 @@
+#include "Check.h"
+
+#include "MKIFilter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+	using namespace MKImage;
+
+	short toPixel(double value, short depth) {
+		return static_cast<short>(std::clamp(std::lround(value), 0L, static_cast<long>(depth)));
+	}
+
+	// The window of "radius" around (i, j), cut at the border.
+	struct Window {
+		size_t top, bottom, left, right;
+
+		Window(const ImageData& image, size_t i, size_t j, size_t radius)
+			: top(i > radius ? i - radius : 0), bottom(std::min(i + radius + 1, image.size())),
+			  left(j > radius ? j - radius : 0), right(std::min(j + radius + 1, image[0].size())) {
+		}
+
+		template<typename Func>
+		void each(Func f) const {
+			for (size_t u = top; u < bottom; ++u) {
+				for (size_t v = left; v < right; ++v) {
+					f(u, v);
+				}
+			}
+		}
+
+		double pixels() const { return static_cast<double>((bottom - top) * (right - left)); }
+	};
+
+	// The guided filter straight from its definition, in double precision.
+	ImageData guided(const ImageData& in, const ImageData& guide, size_t radius, double epsilon, short depth) {
+		size_t rows = in.size();
+		size_t columns = in[0].size();
+		std::vector<double> a(rows * columns), b(rows * columns);
+		for (size_t i = 0; i < rows; ++i) {
+			for (size_t j = 0; j < columns; ++j) {
+				Window window(in, i, j, radius);
+				double meanI = 0, meanII = 0, meanP = 0, meanIP = 0;
+				window.each([&](size_t u, size_t v) {
+					meanI += guide[u][v];
+					meanII += static_cast<double>(guide[u][v]) * guide[u][v];
+					meanP += in[u][v];
+					meanIP += static_cast<double>(guide[u][v]) * in[u][v];
+				});
+				double n = window.pixels();
+				meanI /= n, meanII /= n, meanP /= n, meanIP /= n;
+				double slope = (meanIP - meanI * meanP) / (meanII - meanI * meanI + epsilon * depth * depth);
+				a[i * columns + j] = slope;
+				b[i * columns + j] = meanP - slope * meanI;
+			}
+		}
+
+		ImageData out(rows, std::vector<short>(columns));
+		for (size_t i = 0; i < rows; ++i) {
+			for (size_t j = 0; j < columns; ++j) {
+				Window window(in, i, j, radius);
+				double meanA = 0, meanB = 0;
+				window.each([&](size_t u, size_t v) {
+					meanA += a[u * columns + v];
+					meanB += b[u * columns + v];
+				});
+				out[i][j] = toPixel((meanA * guide[i][j] + meanB) / window.pixels(), depth);
+			}
+		}
+		return out;
+	}
+
+	size_t mirror(long index, size_t size) {
+		if (size == 1) {
+			return 0;
+		}
+		while (index < 0 || index >= static_cast<long>(size)) {
+			index = index < 0 ? -index : 2 * (static_cast<long>(size) - 1) - index;
+		}
+		return static_cast<size_t>(index);
+	}
+
+	// The bilateral filter summed directly over a window of 2 sigma, with mirrored borders.
+	ImageData bilateral(const ImageData& in, double spatialSigma, double rangeSigma, short depth) {
+		size_t rows = in.size();
+		size_t columns = in[0].size();
+		long radius = static_cast<long>(std::ceil(2 * spatialSigma));
+
+		ImageData out(rows, std::vector<short>(columns));
+		for (size_t i = 0; i < rows; ++i) {
+			for (size_t j = 0; j < columns; ++j) {
+				double sum = 0, weights = 0;
+				for (long di = -radius; di <= radius; ++di) {
+					for (long dj = -radius; dj <= radius; ++dj) {
+						short value = in[mirror(static_cast<long>(i) + di, rows)][mirror(static_cast<long>(j) + dj, columns)];
+						double difference = value - in[i][j];
+						double weight = std::exp(-(di * di + dj * dj) / (2 * spatialSigma * spatialSigma)
+												 - difference * difference / (2 * rangeSigma * rangeSigma));
+						sum += weight * value;
+						weights += weight;
+					}
+				}
+				out[i][j] = toPixel(sum / weights, depth);
+			}
+		}
+		return out;
+	}
+
+	// Single-precision sums may round the other way, so pixels may be off by one level.
+	void compare(const ImageData& out, const ImageData& expected, const std::string& name) {
+		int worst = 0;
+		for (size_t i = 0; i < expected.size(); ++i) {
+			for (size_t j = 0; j < expected[i].size(); ++j) {
+				worst = std::max(worst, std::abs(out[i][j] - expected[i][j]));
+			}
+		}
+		Check::expect(worst <= 1, name + " on " + Check::size(expected) + ": off by up to " + std::to_string(worst));
+	}
+
+	// Blocks of flat grey with noise and hard edges between them, which is what these filters are for.
+	ImageData blocks(size_t rows, size_t columns, short depth, std::mt19937& random) {
+		ImageData image = Check::noise(rows, columns, depth / 16, random);
+		for (size_t i = 0; i < rows; ++i) {
+			for (size_t j = 0; j < columns; ++j) {
+				image[i][j] += static_cast<short>(((i / 9 + j / 13) % 3) * (depth / 3));
+			}
+		}
+		return image;
+	}
+}
+
+int main() {
+	std::mt19937 random(5);
+
+	for (auto size : { std::make_pair(1, 1), std::make_pair(5, 40), std::make_pair(37, 29), std::make_pair(64, 80) }) {
+		for (short depth : { 255, 4095 }) {
+			ImageData in = blocks(size.first, size.second, depth, random);
+			ImageData guide = Check::noise(size.first, size.second, depth, random);
+			std::string name = " (depth " + std::to_string(depth) + ")";
+
+			for (size_t radius : { 1, 4, 50 }) {
+				ImageData out = in;
+				Filter::guided(in, in, out, radius, 0.01, depth);
+				compare(out, guided(in, in, radius, 0.01, depth), "guided radius " + std::to_string(radius) + name);
+			}
+			ImageData out = in;
+			Filter::guided(in, guide, out, 3, 0.001, depth);
+			compare(out, guided(in, guide, 3, 0.001, depth), "guided by another image" + name);
+
+			// Below Consts::BILATERAL_GRID_SIGMA, where the window is summed directly.
+			for (double sigma : { 0.5, 1.0, 1.4 }) {
+				Filter::bilateral(in, out, sigma, depth / 10.0, depth);
+				compare(out, bilateral(in, sigma, depth / 10.0, depth), "bilateral sigma " + std::to_string(sigma) + name);
+			}
+		}
+	}
+
+	return Check::result("Filter");
+}
@@ -0,0 +1,84 @@
+#include "Check.h"
+
+#include "MKIPerceptualHash.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace {
+	namespace PerceptualHash = MKImage::PerceptualHash;
+	using PerceptualHash::Hash;
+
+	// Clusters of near-identical hashes among unrelated ones, like duplicates in a photo collection.
+	std::vector<Hash> hashes(size_t count, std::mt19937_64& random) {
+		std::vector<Hash> out;
+		std::uniform_int_distribution<int> bit(0, 63);
+		std::uniform_int_distribution<int> flips(0, 12);
+		while (out.size() < count) {
+			Hash base = random();
+			out.push_back(base);
+			for (int copies = static_cast<int>(random() % 4); copies > 0 && out.size() < count; --copies) {
+				Hash copy = base;
+				for (int n = flips(random); n > 0; --n) {
+					copy ^= Hash(1) << bit(random);
+				}
+				out.push_back(copy);
+			}
+		}
+		std::shuffle(out.begin(), out.end(), random);
+		return out;
+	}
+}
+
+int main() {
+	std::mt19937_64 random(13);
+	std::vector<Hash> all = hashes(3000, random);
+
+	PerceptualHash::Index index;
+	for (size_t i = 0; i < all.size(); ++i) {
+		index.add(all[i], i);
+	}
+	Check::expect(index.size() == all.size(), "index size");
+
+	// Index::find() against a linear scan, closest first and by id among equals.
+	for (unsigned radius : { 0, 1, 4, 10, 20 }) {
+		bool same = true;
+		for (size_t q = 0; q < 200 && same; ++q) {
+			Hash query = q % 2 == 0 ? all[q * 7] : static_cast<Hash>(random());
+			std::vector<PerceptualHash::Index::Match> expected;
+			for (size_t i = 0; i < all.size(); ++i) {
+				unsigned d = PerceptualHash::distance(query, all[i]);
+				if (d <= radius) {
+					expected.push_back({ i, d });
+				}
+			}
+			std::sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) {
+				return a.distance != b.distance ? a.distance < b.distance : a.id < b.id;
+			});
+
+			std::vector<PerceptualHash::Index::Match> found = index.find(query, radius);
+			same = found.size() == expected.size();
+			for (size_t k = 0; same && k < found.size(); ++k) {
+				same = found[k].id == expected[k].id && found[k].distance == expected[k].distance;
+			}
+		}
+		Check::expect(same, "find() within " + std::to_string(radius) + " bits differs from a linear scan");
+	}
+
+	// nearDuplicates() against every pair.
+	for (unsigned radius : { 0, 6, 12 }) {
+		std::vector<std::pair<size_t, size_t>> expected;
+		for (size_t i = 0; i < all.size(); ++i) {
+			for (size_t j = i + 1; j < all.size(); ++j) {
+				if (PerceptualHash::distance(all[i], all[j]) <= radius) {
+					expected.emplace_back(i, j);
+				}
+			}
+		}
+		Check::expect(PerceptualHash::nearDuplicates(all, radius) == expected,
+					  "nearDuplicates() within " + std::to_string(radius) + " bits differs from comparing every pair");
+	}
+
+	return Check::result("PerceptualHash");
+}
@@ -0,0 +1,131 @@
+#include "Check.h"
+
+#include "MKIMatch.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+	using namespace MKImage;
+
+	// Zero-mean normalised cross-correlation of every position, in double precision.
+	std::vector<double> bruteForce(const ImageData& image, const ImageData& templ) {
+		size_t rows = image.size() - templ.size() + 1;
+		size_t columns = image[0].size() - templ[0].size() + 1;
+		double pixels = static_cast<double>(templ.size() * templ[0].size());
+
+		double mean = 0;
+		for (const auto& row : templ) {
+			for (short value : row) {
+				mean += value;
+			}
+		}
+		mean /= pixels;
+		double energy = 0;
+		for (const auto& row : templ) {
+			for (short value : row) {
+				energy += (value - mean) * (value - mean);
+			}
+		}
+
+		std::vector<double> scores(rows * columns, 0.0);
+		for (size_t r = 0; r < rows; ++r) {
+			for (size_t c = 0; c < columns; ++c) {
+				double correlation = 0, sum = 0, squares = 0;
+				for (size_t u = 0; u < templ.size(); ++u) {
+					for (size_t v = 0; v < templ[u].size(); ++v) {
+						double value = image[r + u][c + v];
+						correlation += value * (templ[u][v] - mean);
+						sum += value;
+						squares += value * value;
+					}
+				}
+				double variance = squares - sum * sum / pixels;
+				if (energy == 0 || variance < 1e-6 * (squares + 1)) {
+					continue;
+				}
+				scores[r * columns + c] = correlation / std::sqrt(variance * energy);
+			}
+		}
+		return scores;
+	}
+
+	ImageData crop(const ImageData& image, size_t row, size_t column, size_t rows, size_t columns) {
+		ImageData out(rows);
+		for (size_t i = 0; i < rows; ++i) {
+			out[i].assign(image[row + i].begin() + column, image[row + i].begin() + column + columns);
+		}
+		return out;
+	}
+
+	// The full score map of a template small enough to be matched without the pyramid.
+	void compare(const ImageData& image, const ImageData& templ, const std::string& name) {
+		std::vector<double> expected = bruteForce(image, templ);
+		Match::Result result = Match::match(image, templ, 3);
+
+		Check::expect(result.scale == 1 && result.scores.size() == expected.size(), name + ": score map size");
+		if (result.scores.size() != expected.size()) {
+			return;
+		}
+
+		double worst = 0;
+		for (size_t k = 0; k < expected.size(); ++k) {
+			worst = std::max(worst, std::abs(result.scores[k] - expected[k]));
+		}
+		Check::expect(worst < 1e-3, name + ": scores differ from the double-precision reference by " + std::to_string(worst));
+
+		double best = *std::max_element(expected.begin(), expected.end());
+		Check::expect(!result.best.empty() && std::abs(result.best[0].score - best) < 1e-3, name + ": best score");
+	}
+}
+
+int main() {
+	std::mt19937 random(11);
+
+	ImageData image = Check::noise(60, 70, 255, random);
+	compare(image, crop(image, 20, 31, 9, 13), "template cut from the image");
+	compare(image, Check::noise(7, 5, 255, random), "unrelated template");
+	compare(image, crop(image, 0, 0, 1, 16), "one-row template");
+
+	Match::Result planted = Match::match(image, crop(image, 41, 9, 11, 11), 1);
+	Check::expect(!planted.best.empty() && planted.best[0].row == 41 && planted.best[0].column == 9 && planted.best[0].score > 0.999f,
+				  "template cut from the image is found where it was cut");
+
+	// A flat template correlates with nothing; so does any template over a flat area.
+	compare(image, ImageData(5, std::vector<short>(6, 77)), "flat template");
+	ImageData patchy = image;
+	for (size_t i = 10; i < 40; ++i) {
+		std::fill(patchy[i].begin() + 10, patchy[i].begin() + 50, 200);
+	}
+	compare(patchy, crop(image, 3, 3, 6, 6), "image with a flat area");
+
+	// Templates of 24 pixels a side and more go through the pyramid; a smooth image keeps the
+	// coarse levels informative, and the refined match must land where the template was cut.
+	ImageData smooth(200, std::vector<short>(240));
+	std::uniform_real_distribution<double> unit(0, 1);
+	std::vector<std::array<double, 4>> blobs(40);
+	for (auto& blob : blobs) {
+		blob = { unit(random) * 200, unit(random) * 240, 5 + unit(random) * 12, (unit(random) - 0.5) * 200 };
+	}
+	for (size_t i = 0; i < smooth.size(); ++i) {
+		for (size_t j = 0; j < smooth[i].size(); ++j) {
+			double value = 128 + unit(random) * 4;
+			for (const auto& blob : blobs) {
+				double di = i - blob[0], dj = j - blob[1];
+				value += blob[3] * std::exp(-(di * di + dj * dj) / (2 * blob[2] * blob[2]));
+			}
+			smooth[i][j] = static_cast<short>(std::clamp(value, 0.0, 255.0));
+		}
+	}
+	for (auto corner : { std::make_pair(37, 101), std::make_pair(150, 13), std::make_pair(0, 0) }) {
+		Match::Result result = Match::match(smooth, crop(smooth, corner.first, corner.second, 40, 33), 1);
+		Check::expect(!result.best.empty() && result.best[0].row == static_cast<size_t>(corner.first)
+					  && result.best[0].column == static_cast<size_t>(corner.second) && result.best[0].score > 0.999f,
+					  "pyramid match of the template cut at " + std::to_string(corner.first) + ", " + std::to_string(corner.second));
+	}
+
+	return Check::result("Match");
+}
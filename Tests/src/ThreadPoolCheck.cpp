@@ -0,0 +1,104 @@
+#include "Check.h"
+
+#include "MKIThreadPool.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+	using MKImage::ThreadPool;
+
+	// A band that throws is rethrown on the caller, after the other bands have run.
+	void throwingBand(size_t threads) {
+		ThreadPool& pool = ThreadPool::instance();
+		pool.setThreadCount(threads);
+
+		const size_t bands = 8;
+		std::vector<std::atomic<int>> ran(bands);
+		bool caught = false;
+		try {
+			pool.parallelForBands(0, bands, bands, [&](size_t begin, size_t end) {
+				for (size_t band = begin; band < end; ++band) {
+					if (band == 3) {
+						throw std::runtime_error("band 3");
+					}
+					ran[band]++;
+				}
+			});
+		}
+		catch (const std::runtime_error& e) {
+			caught = std::string(e.what()) == "band 3";
+		}
+
+		std::string where = " with " + std::to_string(threads) + " threads";
+		Check::expect(caught, "the band's exception reaches the caller" + where);
+		for (size_t band = 0; band < bands; ++band) {
+			Check::expect(ran[band] == (band == 3 ? 0 : 1), "band " + std::to_string(band) + " ran once" + where);
+		}
+	}
+
+	// Several failing bands still give exactly one exception.
+	void everyBandThrows() {
+		size_t caught = 0;
+		try {
+			ThreadPool::instance().parallelForBands(0, 16, 16, [](size_t, size_t) { throw std::logic_error("every band"); });
+		}
+		catch (const std::logic_error&) {
+			++caught;
+		}
+		Check::expect(caught == 1, "one exception when every band throws");
+	}
+
+	// A nested parallelFor() that throws fails its band, which fails the outer call.
+	void nested() {
+		bool caught = false;
+		try {
+			ThreadPool::instance().parallelForBands(0, 4, 4, [](size_t begin, size_t) {
+				ThreadPool::instance().parallelForBands(0, 4, 4, [begin](size_t inner, size_t) {
+					if (begin == 2 && inner == 1) {
+						throw std::out_of_range("nested");
+					}
+				});
+			});
+		}
+		catch (const std::out_of_range&) {
+			caught = true;
+		}
+		Check::expect(caught, "a nested band's exception reaches the outer caller");
+	}
+
+	// A range too small to split runs inline and throws as it is.
+	void inlineBand() {
+		bool caught = false;
+		try {
+			ThreadPool::instance().parallelFor(0, 1, [](size_t, size_t) { throw std::runtime_error("inline"); });
+		}
+		catch (const std::runtime_error&) {
+			caught = true;
+		}
+		Check::expect(caught, "the exception of a single band reaches the caller");
+	}
+
+	// The pool keeps working after a failed call.
+	void stillWorks() {
+		std::atomic<size_t> sum{ 0 };
+		ThreadPool::instance().parallelFor(0, 1000, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				sum += i;
+			}
+		});
+		Check::expect(sum == 999 * 1000 / 2, "parallelFor() after failures covers the whole range");
+	}
+}
+
+int main() {
+	for (size_t threads : { 1, 2, 4 }) {
+		throwingBand(threads);
+	}
+	everyBandThrows();
+	nested();
+	inlineBand();
+	stillWorks();
+	return Check::result("ThreadPool");
+}